@@ -0,0 +1,233 @@
+#
+# Copyright 2024 WuXi EsionTech Co., Ltd.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+"""
+Micro-benchmarks of the overhead of the Python <-> C++ bridge
+
+Each benchmark times `number` operations, `repeat` times over, and reports
+the nanoseconds per operation. Calls into Python are timed from C++ loops (see
+`riscv_bench.h`), so that the Python side of a measurement is the callee only.
+
+    python benchmarks/bridge.py [-k FILTER] [--number N] [--repeat R] [--json FILE]
+"""
+import argparse
+import json
+import pathlib
+import platform
+import statistics
+import sys
+import time
+from typing import Callable, Dict, List, Optional
+
+import riscv
+# pylint: disable=import-error,no-name-in-module
+from riscv.cfg import cfg_t, mem_cfg_t
+from riscv.csrs import csr_t, native_csr_t
+from riscv.decode import insn_fetch_all, insn_t
+from riscv.dev import MMIO
+from riscv.disasm import disassembler_t
+from riscv.extension import extension_t
+from riscv.isa_parser import isa_parser_t
+from riscv.processor import insn_desc_t, processor_t
+from riscv.sim import sim_t
+from riscv.test import (
+    _bench_csr_read, _bench_csr_write, _bench_disassemble, _bench_insn_func, _bench_mmio_load,
+    _bench_mmio_store, _bench_mmio_tick, _test_extension_get_instructions
+)
+
+EXAMPLES_DIR = pathlib.Path(__file__).parent.parent / "examples"
+
+# a mix of 32-bit and compressed instructions
+PROGRAM = bytes.fromhex("13868202" "8145" "b3058500" "0505" "efe0dfff" "8280")
+
+# (name, unit, function of `number` returning the elapsed nanoseconds, default number)
+BENCHMARKS: List[tuple] = []
+
+
+def benchmark(name: str, unit: str = "ns/op", number: int = 10000):
+
+    def decorator(func: Callable[[sim_t, int], int]):
+        BENCHMARKS.append((name, unit, func, number))
+        return func
+
+    return decorator
+
+
+class Device(MMIO):
+
+    def __init__(self, sim: sim_t, args: Optional[str] = None):
+        super().__init__(sim, args)
+        self.data = bytes(8)
+
+    # pylint: disable=unused-argument
+    def load(self, addr: int, size: int) -> bytes:
+        return self.data[:size]
+
+    def store(self, addr: int, data: bytes) -> None:
+        self.data = data
+
+    def tick(self, rtc_ticks: int) -> None:
+        pass
+
+
+class CSR(csr_t):
+
+    def __init__(self, proc: processor_t, addr: int):
+        super().__init__(proc, addr)
+        self.v = 0
+
+    # pylint: disable=unused-argument
+    def verify_permissions(self, insn: insn_t, write: bool) -> None:
+        pass
+
+    def read(self) -> int:
+        return self.v
+
+    def unlogged_write(self, val: int) -> None:
+        self.v = val
+
+
+def do_addi(p: processor_t, i: insn_t, pc: int) -> int:
+    p.state.XPR.write(i.rd, p.state.XPR[i.rs1] + i.i_imm)
+    return pc + 4
+
+
+@benchmark("insn_dispatch")
+def bench_insn_dispatch(sim: sim_t, number: int) -> int:
+    desc = insn_desc_t(0x13, 0x707f, *(do_addi, ) * 8)
+    # addi t0, t0, 1
+    return _bench_insn_func(sim.get_core(0), desc, 0x00128293, number)
+
+
+@benchmark("mmio_load")
+def bench_mmio_load(sim: sim_t, number: int) -> int:
+    return _bench_mmio_load(Device(sim), 0, 4, number)
+
+
+@benchmark("mmio_store")
+def bench_mmio_store(sim: sim_t, number: int) -> int:
+    return _bench_mmio_store(Device(sim), 0, 4, number)
+
+
+@benchmark("mmio_tick")
+def bench_mmio_tick(sim: sim_t, number: int) -> int:
+    return _bench_mmio_tick(Device(sim), number)
+
+
+@benchmark("csr_read")
+def bench_csr_read(sim: sim_t, number: int) -> int:
+    return _bench_csr_read(CSR(sim.get_core(0), 0x7c0), number)
+
+
+@benchmark("csr_write")
+def bench_csr_write(sim: sim_t, number: int) -> int:
+    return _bench_csr_write(CSR(sim.get_core(0), 0x7c0), 0x1234, number)
+
+
+@benchmark("native_csr_read")
+def bench_native_csr_read(sim: sim_t, number: int) -> int:
+    return _bench_csr_read(native_csr_t(sim.get_core(0), 0x7c1), number)
+
+
+@benchmark("insn_fetch_all", unit="ns/MB", number=4)
+def bench_insn_fetch_all(sim: sim_t, number: int) -> int:
+    # pylint: disable=unused-argument
+    data = PROGRAM * ((1 << 20) // len(PROGRAM))
+    start = time.perf_counter_ns()
+    for _ in range(number):
+        insn_fetch_all(data)
+    # per MB of instructions
+    return (time.perf_counter_ns() - start) * (1 << 20) // len(data)
+
+
+@benchmark("disassemble", unit="ns/insn", number=1000)
+def bench_disassemble(sim: sim_t, number: int) -> int:
+    # pylint: disable=unused-argument
+    disasm = disassembler_t(isa_parser_t("rv64gc", "msu"))
+    insns = insn_fetch_all(PROGRAM)
+    # per instruction, not per pass
+    return _bench_disassemble(disasm, insns, number) // len(insns)
+
+
+@benchmark("get_instructions", number=20)
+def bench_get_instructions(sim: sim_t, number: int) -> int:
+    # pylint: disable=import-outside-toplevel
+    sys.path.insert(0, EXAMPLES_DIR.as_posix())
+    from xthead import THeadISA
+    proc = sim.get_core(0)
+    elapsed = 0
+    for _ in range(number):
+        # as for the first hart of a sim, which takes the tables of the class
+        # from python, while the other harts share them
+        extension_t.clear_tables()
+        ext = THeadISA()
+        start = time.perf_counter_ns()
+        _test_extension_get_instructions(ext, proc)
+        elapsed += time.perf_counter_ns() - start
+    return elapsed
+
+
+def run(names: Optional[str], number: Optional[int], repeat: int) -> List[Dict]:
+    sim = sim_t(
+        cfg=cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+        halted=True,
+        plugin_device_factories=[],
+        args=["pk"])
+    results = []
+    for name, unit, func, default_number in BENCHMARKS:
+        if names and names not in name:
+            continue
+        n = number or default_number
+        # one warm-up round, not reported
+        func(sim, n)
+        samples = [func(sim, n) / n for _ in range(repeat)]
+        results.append({
+            "name": name,
+            "unit": unit,
+            "number": n,
+            "repeat": repeat,
+            "min": min(samples),
+            "median": statistics.median(samples),
+            "mean": statistics.mean(samples),
+            "stdev": statistics.stdev(samples) if repeat > 1 else 0.0,
+        })
+        print(f"{name:<20} {results[-1]['median']:>14.1f} {unit}", file=sys.stderr)
+    return results
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("-k", dest="names", help="run benchmarks whose names contain NAMES")
+    parser.add_argument("--number", type=int, help="operations per sample")
+    parser.add_argument("--repeat", type=int, default=5, help="samples per benchmark")
+    parser.add_argument("--json", dest="output", help="write results to OUTPUT, '-' for stdout")
+    args = parser.parse_args(argv)
+    report = {
+        "version": getattr(riscv, "__version__", None),
+        "python": platform.python_version(),
+        "machine": platform.machine(),
+        "timestamp": time.time(),
+        "benchmarks": run(args.names, args.number, args.repeat),
+    }
+    if args.output == "-":
+        json.dump(report, sys.stdout, indent=2)
+    elif args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            json.dump(report, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,501 @@
+#
+# Copyright 2024 WuXi EsionTech Co., Ltd.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+"""
+End-to-end throughput of the simulator, with native and Python models
+
+Each workload is a generated bare-metal RV64 program that loops over a small
+body of instructions, then exits through `tohost`. Workloads that exercise a
+model (CSRs, MMIO devices, custom instructions) come in a native and a Python
+flavor of the same program.
+
+Every workload runs in a forked process of its own, and reports:
+
+- `mips`: instructions retired by `sim_t.run()`, per microsecond of wall time
+- `wall_s`: wall time of `sim_t.run()`
+- `python_fraction`: share of the wall time spent in the Python model, taken
+  from a second run with the model's methods wrapped in timers (which inflates
+  that run, so it is not used for `mips`)
+- `peak_rss_kb`: peak resident set size of the process
+
+    python benchmarks/throughput.py [-k FILTER] [--scale S] [--json FILE] [--keep DIR]
+"""
+import argparse
+import json
+import os
+import pathlib
+import platform
+import resource
+import struct
+import sys
+import tempfile
+import time
+from typing import Callable, Dict, List, Optional, Tuple
+
+import riscv
+# pylint: disable=import-error,no-name-in-module
+from riscv.cfg import cfg_t, mem_cfg_t
+from riscv.csrs import csr_t, native_csr_t
+from riscv.sim import sim_t
+
+EXAMPLES_DIR = pathlib.Path(__file__).parent.parent / "examples"
+
+MEM_BASE = 0x8000_0000
+MEM_SIZE = 0x200_0000
+UART_BASE = 0x2000_0000
+# buffers of the memory streaming workload
+SRC_BASE = 0x8010_0000
+DST_BASE = 0x8090_0000
+STREAM_BYTES = 0x8_0000
+
+CSR_MSCRATCH = 0x340
+CSR_CUSTOM = 0x7c0
+CSR_MINSTRET = 0xb02
+
+# integer registers
+ZERO, T0, T1, S1, A0, A1, A2, A3, A4, A5, A6 = 0, 5, 6, 9, 10, 11, 12, 13, 14, 15, 16
+
+
+class Assembler:
+    """
+    Just enough of an RV64 assembler for the workloads
+    """
+
+    def __init__(self, base: int):
+        self.base = base
+        self.words: List[int] = []
+        self.labels: Dict[str, int] = {}
+        self.fixups: List[Tuple[int, str, Callable[[int], int]]] = []
+
+    @property
+    def pc(self) -> int:
+        return self.base + 4 * len(self.words)
+
+    def label(self, name: str) -> None:
+        self.labels[name] = self.pc
+
+    def emit(self, word: int) -> None:
+        self.words.append(word & 0xffff_ffff)
+
+    def r(self, funct7: int, rs2: int, rs1: int, funct3: int, rd: int, opcode: int) -> None:
+        self.emit(funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode)
+
+    def i(self, imm: int, rs1: int, funct3: int, rd: int, opcode: int) -> None:
+        self.emit((imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode)
+
+    def s(self, imm: int, rs2: int, rs1: int, funct3: int, opcode: int = 0x23) -> None:
+        imm &= 0xfff
+        self.emit((imm >> 5) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (imm & 0x1f) << 7 | opcode)
+
+    def u(self, imm20: int, rd: int, opcode: int) -> None:
+        self.emit((imm20 & 0xfffff) << 12 | rd << 7 | opcode)
+
+    @staticmethod
+    def _b(offset: int) -> int:
+        offset &= 0x1fff
+        return ((offset >> 12) & 1) << 31 | ((offset >> 5) & 0x3f) << 25 | \
+            ((offset >> 1) & 0xf) << 8 | ((offset >> 11) & 1) << 7
+
+    @staticmethod
+    def _j(offset: int) -> int:
+        offset &= 0x1fffff
+        return ((offset >> 20) & 1) << 31 | ((offset >> 1) & 0x3ff) << 21 | \
+            ((offset >> 11) & 1) << 20 | ((offset >> 12) & 0xff) << 12
+
+    # instructions
+
+    def addi(self, rd: int, rs1: int, imm: int) -> None:
+        self.i(imm, rs1, 0, rd, 0x13)
+
+    def add(self, rd: int, rs1: int, rs2: int) -> None:
+        self.r(0, rs2, rs1, 0, rd, 0x33)
+
+    def xor(self, rd: int, rs1: int, rs2: int) -> None:
+        self.r(0, rs2, rs1, 4, rd, 0x33)
+
+    def sh1add(self, rd: int, rs1: int, rs2: int) -> None:
+        self.r(0x10, rs2, rs1, 2, rd, 0x33)
+
+    def th_addsl(self, rd: int, rs1: int, rs2: int, imm2: int) -> None:
+        self.r(imm2, rs2, rs1, 1, rd, 0x0b)
+
+    def lui(self, rd: int, imm20: int) -> None:
+        self.u(imm20, rd, 0x37)
+
+    def li(self, rd: int, value: int) -> None:
+        assert 0 <= value < (1 << 31)
+        lo = value & 0xfff
+        if lo >= 0x800:
+            lo -= 0x1000
+        self.lui(rd, (value - lo) >> 12)
+        self.addi(rd, rd, lo)
+
+    def la(self, rd: int, name: str) -> None:
+        pc = self.pc
+        self.emit(0)
+        self.emit(0)
+
+        def fixup(addr: int) -> int:
+            offset = addr - pc
+            lo = offset & 0xfff
+            if lo >= 0x800:
+                lo -= 0x1000
+            hi = ((offset - lo) >> 12) & 0xfffff
+            # auipc rd, hi; addi rd, rd, lo
+            self.words[(pc - self.base) // 4 + 1] = (lo & 0xfff) << 20 | rd << 15 | rd << 7 | 0x13
+            return hi << 12 | rd << 7 | 0x17
+
+        self.fixups.append((pc, name, fixup))
+
+    def ld(self, rd: int, rs1: int, imm: int) -> None:
+        self.i(imm, rs1, 3, rd, 0x03)
+
+    def lw(self, rd: int, rs1: int, imm: int) -> None:
+        self.i(imm, rs1, 2, rd, 0x03)
+
+    def sd(self, rs2: int, rs1: int, imm: int) -> None:
+        self.s(imm, rs2, rs1, 3)
+
+    def sw(self, rs2: int, rs1: int, imm: int) -> None:
+        self.s(imm, rs2, rs1, 2)
+
+    def csrw(self, csr: int, rs1: int) -> None:
+        self.i(csr, rs1, 1, ZERO, 0x73)
+
+    def csrr(self, rd: int, csr: int) -> None:
+        self.i(csr, ZERO, 2, rd, 0x73)
+
+    def bnez(self, rs1: int, name: str) -> None:
+        pc = self.pc
+        self.emit(0)
+        self.fixups.append((pc, name, lambda addr: self._b(addr - pc) | rs1 << 15 | 1 << 12 | 0x63))
+
+    def j(self, name: str) -> None:
+        pc = self.pc
+        self.emit(0)
+        self.fixups.append((pc, name, lambda addr: self._j(addr - pc) | 0x6f))
+
+    def assemble(self, symbols: Dict[str, int]) -> bytes:
+        labels = {**self.labels, **symbols}
+        for pc, name, fixup in self.fixups:
+            self.words[(pc - self.base) // 4] = fixup(labels[name])
+        return struct.pack(f"<{len(self.words)}I", *self.words)
+
+
+def loop(body: Callable[[Assembler], None], count: int, setup: Optional[Callable[[Assembler], None]] = None,
+         outer: int = 1) -> Callable[[Assembler], None]:
+    """
+    `count` iterations of `body` (in `outer` rounds, each after `setup`), using T0 and S1
+    """
+
+    def program(asm: Assembler) -> None:
+        asm.li(S1, outer)
+        asm.label("outer")
+        if setup is not None:
+            setup(asm)
+        asm.li(T0, count // outer)
+        asm.label("inner")
+        body(asm)
+        asm.addi(T0, T0, -1)
+        asm.bnez(T0, "inner")
+        asm.addi(S1, S1, -1)
+        asm.bnez(S1, "outer")
+
+    return program
+
+
+def build_elf(program: Callable[[Assembler], None]) -> bytes:
+    """
+    A static RV64 executable of `program`, which then writes 1 to `tohost`
+    """
+    asm = Assembler(MEM_BASE)
+    program(asm)
+    asm.li(A0, 1)
+    asm.la(T1, "tohost")
+    asm.sd(A0, T1, 0)
+    asm.label("halt")
+    asm.j("halt")
+    text_size = 4 * len(asm.words)
+    tohost = MEM_BASE + ((text_size + 63) & ~63)
+    text = asm.assemble({"tohost": tohost, "src": SRC_BASE, "dst": DST_BASE})
+    image = text.ljust(tohost - MEM_BASE, b"\0") + bytes(16)
+    # .symtab and .strtab
+    strtab = b"\0tohost\0fromhost\0"
+    symtab = bytes(24) + \
+        struct.pack("<IBBHQQ", 1, 0x11, 0, 2, tohost, 8) + \
+        struct.pack("<IBBHQQ", 8, 0x11, 0, 2, tohost + 8, 8)
+    shstrtab = b"\0.text\0.tohost\0.symtab\0.strtab\0.shstrtab\0"
+    # file layout: header, program header, image at 0x1000, tables, section headers
+    image_off = 0x1000
+    symtab_off = image_off + len(image)
+    strtab_off = symtab_off + len(symtab)
+    shstrtab_off = strtab_off + len(strtab)
+    shoff = (shstrtab_off + len(shstrtab) + 7) & ~7
+    sections = [
+        struct.pack("<IIQQQQIIQQ", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0),
+        struct.pack("<IIQQQQIIQQ", 1, 1, 0x6, MEM_BASE, image_off, text_size, 0, 0, 4, 0),
+        struct.pack("<IIQQQQIIQQ", 7, 1, 0x3, tohost, image_off + tohost - MEM_BASE, 16, 0, 0, 8, 0),
+        struct.pack("<IIQQQQIIQQ", 15, 2, 0, 0, symtab_off, len(symtab), 4, 1, 8, 24),
+        struct.pack("<IIQQQQIIQQ", 23, 3, 0, 0, strtab_off, len(strtab), 0, 0, 1, 0),
+        struct.pack("<IIQQQQIIQQ", 31, 3, 0, 0, shstrtab_off, len(shstrtab), 0, 0, 1, 0),
+    ]
+    ident = b"\x7fELF" + bytes([2, 1, 1]) + bytes(9)
+    header = struct.pack("<16sHHIQQQIHHHHHH", ident, 2, 243, 1, MEM_BASE, 64, shoff, 0, 64, 56, 1, 64,
+                         len(sections), len(sections) - 1)
+    phdr = struct.pack("<IIQQQQQQ", 1, 7, image_off, MEM_BASE, MEM_BASE, len(image), len(image), 0x1000)
+    elf = (header + phdr).ljust(image_off, b"\0") + image + symtab + strtab + shstrtab
+    return elf.ljust(shoff, b"\0") + b"".join(sections)
+
+
+class Workload:
+    """
+    A program, and the sim it runs on
+    """
+
+    def __init__(self, name: str, program: Callable[[Assembler], None], isa: str = "rv64gc",
+                 devices: Optional[List[Tuple[str, Tuple[str, ...]]]] = None,
+                 setup: Optional[Callable] = None, hooks: Optional[Callable[[], List[Tuple[type, str]]]] = None):
+        self.name = name
+        self.program = program
+        self.isa = isa
+        self.devices = devices or []
+        # called with the sim, before it runs
+        self.setup = setup
+        # the methods of the python model, timed for `python_fraction`
+        self.hooks = hooks
+
+
+class CustomCSR(csr_t):
+    """
+    Python model of a plain read/write CSR
+    """
+
+    def __init__(self, proc, addr: int):
+        super().__init__(proc, addr)
+        self.v = 0
+
+    # pylint: disable=unused-argument
+    def verify_permissions(self, insn, write: bool) -> None:
+        pass
+
+    def read(self) -> int:
+        return self.v
+
+    def unlogged_write(self, val: int) -> None:
+        self.v = val
+
+
+def python_csr(sim: sim_t) -> None:
+    proc = sim.get_core(0)
+    proc.state.add_csr(CSR_CUSTOM, CustomCSR(proc, CSR_CUSTOM))
+
+
+def native_csr(sim: sim_t) -> None:
+    proc = sim.get_core(0)
+    proc.state.add_csr(CSR_CUSTOM, native_csr_t(proc, CSR_CUSTOM))
+
+
+def csr_hooks() -> List[Tuple[type, str]]:
+    return [(CustomCSR, "read"), (CustomCSR, "unlogged_write")]
+
+
+def uart_hooks() -> List[Tuple[type, str]]:
+    # pylint: disable=import-outside-toplevel,import-error
+    from amba.uart_lite import UARTLiteMMIO
+    from amba.uart_lite_impl import UARTLite
+    return [(UARTLiteMMIO, "load"), (UARTLiteMMIO, "store"), (UARTLite, "tick")]
+
+
+def thead_hooks() -> List[Tuple[type, str]]:
+    # pylint: disable=import-outside-toplevel,import-error
+    from xthead.theadba import TheadBa
+    return [(TheadBa, "_do_th_addsl")]
+
+
+def int_body(asm: Assembler) -> None:
+    asm.add(A1, A1, T0)
+    asm.xor(A2, A2, A1)
+    asm.addi(A3, A3, 3)
+
+
+def stream_setup(asm: Assembler) -> None:
+    asm.la(A4, "src")
+    asm.la(A6, "dst")
+
+
+def stream_body(asm: Assembler) -> None:
+    asm.ld(A5, A4, 0)
+    asm.sd(A5, A6, 0)
+    asm.addi(A4, A4, 8)
+    asm.addi(A6, A6, 8)
+
+
+def csr_body(csr: int) -> Callable[[Assembler], None]:
+
+    def body(asm: Assembler) -> None:
+        asm.csrw(csr, T0)
+        asm.csrr(A1, csr)
+
+    return body
+
+
+def mmio_setup(asm: Assembler) -> None:
+    asm.lui(A4, UART_BASE >> 12)
+
+
+def mmio_body(asm: Assembler) -> None:
+    # STAT_REG, then CTRL_REG
+    asm.lw(A1, A4, 0x8)
+    asm.sw(ZERO, A4, 0xc)
+
+
+def workloads(scale: float) -> List[Workload]:
+    n = int(1_000_000 * scale) or 1
+    # python models are some orders of magnitude slower
+    p = int(50_000 * scale) or 1
+    rounds = max(1, n * 8 // STREAM_BYTES)
+    return [
+        Workload("int_loop", loop(int_body, n * 4)),
+        Workload("mem_stream", loop(stream_body, rounds * (STREAM_BYTES // 8), stream_setup, rounds)),
+        Workload("csr:native", loop(csr_body(CSR_MSCRATCH), n)),
+        Workload("csr:native_csr_t", loop(csr_body(CSR_CUSTOM), n), setup=native_csr),
+        Workload("csr:python", loop(csr_body(CSR_CUSTOM), p), setup=python_csr, hooks=csr_hooks),
+        Workload("mmio:native", loop(mmio_body, n, mmio_setup),
+                 devices=[("amba_uartlite:native", (hex(UART_BASE), "irq=0", "in=/dev/null"))]),
+        Workload("mmio:python", loop(mmio_body, p, mmio_setup), devices=[("amba_uartlite", (hex(UART_BASE), ))],
+                 hooks=uart_hooks),
+        Workload("custom_insn:native", loop(lambda asm: asm.sh1add(A1, A2, A1), n), isa="rv64gc_zba"),
+        Workload("custom_insn:python", loop(lambda asm: asm.th_addsl(A1, A1, A2, 1), p), isa="rv64gc_xthead",
+                 hooks=thead_hooks),
+    ]
+
+
+def run_once(workload: Workload, elf: str, timed: bool) -> Dict:
+    python_ns = [0]
+    if timed and workload.hooks is not None:
+        for cls, name in workload.hooks():
+            setattr(cls, name, timer(getattr(cls, name), python_ns))
+    sim = sim_t(
+        cfg=cfg_t(isa=workload.isa, priv="m", mem_layout=[mem_cfg_t(MEM_BASE, MEM_SIZE)]),
+        halted=False,
+        plugin_device_factories=workload.devices,
+        args=[elf])
+    if workload.setup is not None:
+        workload.setup(sim)
+    start = time.perf_counter_ns()
+    exit_code = sim.run()
+    wall_ns = time.perf_counter_ns() - start
+    return {
+        "exit_code": exit_code,
+        "instret": sim.get_core(0).get_csr(CSR_MINSTRET),
+        "wall_ns": wall_ns,
+        "python_ns": python_ns[0],
+        "peak_rss_kb": resource.getrusage(resource.RUSAGE_SELF).ru_maxrss,
+    }
+
+
+def timer(func: Callable, total: List[int]) -> Callable:
+
+    def timed(*args, **kwargs):
+        start = time.perf_counter_ns()
+        try:
+            return func(*args, **kwargs)
+        finally:
+            total[0] += time.perf_counter_ns() - start
+
+    return timed
+
+
+def in_child(func: Callable[[], Dict]) -> Dict:
+    """
+    Result of `func` run in a forked process
+    """
+    rfd, wfd = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.close(rfd)
+        try:
+            # the python uart polls stdin
+            devnull = os.open(os.devnull, os.O_RDONLY)
+            os.dup2(devnull, 0)
+            result = func()
+        except BaseException as exc:  # pylint: disable=broad-except
+            result = {"error": repr(exc)}
+        with os.fdopen(wfd, "w") as f:
+            json.dump(result, f)
+        os._exit(0)  # pylint: disable=protected-access
+    os.close(wfd)
+    with os.fdopen(rfd) as f:
+        data = f.read()
+    os.waitpid(pid, 0)
+    return json.loads(data) if data else {"error": "no result"}
+
+
+def run(names: Optional[str], scale: float, keep: Optional[str]) -> List[Dict]:
+    sys.path.insert(0, EXAMPLES_DIR.as_posix())
+    # pylint: disable=import-outside-toplevel,import-error,unused-import
+    import amba
+    import xthead
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        out_dir = pathlib.Path(keep or tmp)
+        out_dir.mkdir(parents=True, exist_ok=True)
+        for workload in workloads(scale):
+            if names and names not in workload.name:
+                continue
+            elf = out_dir / (workload.name.replace(":", "-") + ".elf")
+            elf.write_bytes(build_elf(workload.program))
+            result = in_child(lambda w=workload, e=elf.as_posix(): run_once(w, e, False))
+            if "error" not in result and workload.hooks is not None:
+                profiled = in_child(lambda w=workload, e=elf.as_posix(): run_once(w, e, True))
+                result["python_fraction"] = profiled.get("python_ns", 0) / max(profiled.get("wall_ns", 1), 1)
+            elif "error" not in result:
+                result["python_fraction"] = 0.0
+            if "error" not in result:
+                result["mips"] = result["instret"] / max(result["wall_ns"], 1) * 1e3
+                result["wall_s"] = result["wall_ns"] / 1e9
+                print(f"{workload.name:<20} {result['mips']:>10.2f} MIPS {result['wall_s']:>8.3f} s "
+                      f"{result['python_fraction']:>6.1%} py {result['peak_rss_kb']:>8} KB", file=sys.stderr)
+            else:
+                print(f"{workload.name:<20} {result['error']}", file=sys.stderr)
+            results.append({"name": workload.name, "isa": workload.isa, **result})
+    return results
+
+
+def main(argv: Optional[List[str]] = None) -> int:
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("-k", dest="names", help="run workloads whose names contain NAMES")
+    parser.add_argument("--scale", type=float, default=1.0, help="scale the instruction counts by SCALE")
+    parser.add_argument("--json", dest="output", help="write results to OUTPUT, '-' for stdout")
+    parser.add_argument("--keep", help="keep the generated programs in KEEP")
+    args = parser.parse_args(argv)
+    results = run(args.names, args.scale, args.keep)
+    report = {
+        "version": getattr(riscv, "__version__", None),
+        "python": platform.python_version(),
+        "machine": platform.machine(),
+        "timestamp": time.time(),
+        "workloads": results,
+    }
+    if args.output == "-":
+        json.dump(report, sys.stdout, indent=2)
+    elif args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            json.dump(report, f, indent=2)
+    return 1 if any("error" in r for r in results) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
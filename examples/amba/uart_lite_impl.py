@@ -19,6 +19,9 @@ from riscv.fesvr import term  # pylint: disable=import-error,no-name-in-module
 
 from .uart_lite import UARTLiteMMIO
 
+# stdin / stdout, with whole-buffer reads and writes (flushed on every tick)
+console = term.buffered_terminal_t(flush_interval=0)
+
 
 @dev.register("amba_uartlite")
 class UARTLite(UARTLiteMMIO):
@@ -34,10 +37,10 @@ class UARTLite(UARTLiteMMIO):
         super().tick(rtc_ticks)
         # flush TX_FIFO to stdout
         if self.tx_fifo:
-            term.write(bytes(self.tx_fifo))
+            console.write(bytes(self.tx_fifo))
             self.tx_fifo.clear()
         # load RX_FIFO from stdin
-        self.rx_fifo.extend(term.read())
+        self.rx_fifo.extend(console.read())
 
 
 @dev.register('amba_uartlite:plic')
@@ -48,16 +51,12 @@ class UARTLitePLIC(UARTLite):
 
     def __init__(self, sim, args: Optional[str] = None):
         super().__init__(sim, args)
-        self.intr_ttl: int = 0
+        self.irq = self.interrupt_line(1)
 
     def tick(self, rtc_ticks: int) -> None:
         old_len = len(self.rx_fifo)
         super().tick(rtc_ticks)
         new_len = len(self.rx_fifo)
         if new_len > old_len:
-            self.sim.plic.set_interrupt_level(1, 1)
-            self.intr_ttl = 1
-        elif self.intr_ttl > 0:
-            self.intr_ttl -= 1
-        else:
-            self.sim.plic.set_interrupt_level(1, 0)
+            # deasserted after 2 ticks
+            self.irq.pulse(2)
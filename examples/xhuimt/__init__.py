@@ -30,6 +30,9 @@ class HuiMtISA(isa.ISA):
     Functional Mockup of HuiMt-E Extensions to RISC-V ISA
     """
 
+    # the LR/SC instructions are bound to the reservations of this hart
+    hart_specific = True
+
     def __init__(self):
         super().__init__()
         self.lrsc = MyLRSC()
@@ -46,6 +46,8 @@ def _config_bridge() -> Pybind11Extension:
         ],
         define_macros=[
             ("ENV_PYSPIKE_LIBS", f"\"{ package.ENV_PYSPIKE_LIBS }\""),
+            ("ENV_PYSPIKE_CACHE", f"\"{ package.ENV_PYSPIKE_CACHE }\""),
+            ("PYSPIKE_VERSION", f"\"{ _full_version() }\""),
             ("PYBIND11_DETAILED_ERROR_MESSAGES", "1"),
         ],
         extra_link_args=[
@@ -77,14 +79,20 @@ def _local_scheme(version: ScmVersion) -> str:
     return "+pyspike.unknown.spike.unknown"
 
 
+def _full_version() -> str:
+    # names the pyspike and spike commits, see `_local_scheme`
+    full_version = getattr(package, "__version__", None)
+    if full_version is None or "+" not in full_version:
+        full_version = get_version(local_scheme=_local_scheme)
+    return full_version
+
+
 @contextlib.contextmanager
 def _dynamic_version(source_dir: pathlib.Path):
     with source_dir.joinpath("VERSION").open("r+") as f_ver:
         default_version = f_ver.read()
         try:
-            full_version = getattr(package, "__version__", None)
-            if full_version is None or "+" not in full_version:
-                full_version = get_version(local_scheme=_local_scheme)
+            full_version = _full_version()
             f_ver.seek(0)
             f_ver.write(f"#define SPIKE_VERSION \"{full_version}\"\n")
             f_ver.truncate()
@@ -13,12 +13,22 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <limits.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <string_view>
+
 #include <fesvr/term.h>
 
 #include <pybind11/embed.h>
 #include <pybind11/stl.h>
 
 #include "fesvr_term.h"
+#include "riscv_trace.h"
 
 namespace py = pybind11;
 
@@ -31,13 +41,17 @@ py_canonical_terminal_t::~py_canonical_terminal_t() {
 }
 
 py::bytes py_canonical_terminal_t::read() {
-  std::vector<char> data;
+  if (auto replayed = mmio_trace_t::replay_console()) {
+    return py::bytes(replayed.value());
+  }
+  std::string data;
   int ch = canonical_terminal_t::read();
   while (ch != -1) {
     data.push_back(static_cast<char>(ch));
     ch = canonical_terminal_t::read();
   }
-  return py::bytes(data.data(), data.size());
+  mmio_trace_t::record_console(data);
+  return py::bytes(data);
 }
 
 void py_canonical_terminal_t::write(const py::bytes &data) {
@@ -46,3 +60,138 @@ void py_canonical_terminal_t::write(const py::bytes &data) {
     canonical_terminal_t::write(c);
   }
 }
+
+py_buffered_terminal_t::py_buffered_terminal_t(int in_fd,
+                                               std::optional<int> out_fd,
+                                               size_t flush_bytes,
+                                               double flush_interval,
+                                               size_t read_size,
+                                               size_t max_pending)
+    : in_fd(in_fd), out_fd(out_fd), flush_bytes(flush_bytes),
+      flush_interval(std::chrono::duration_cast<
+                     std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(flush_interval))),
+      max_pending(max_pending), out_regular(false),
+      rbuf(read_size > 0 ? read_size : 1), pending(), pending_since(), sink(),
+      syscalls(0), dropped(0) {
+  struct stat st;
+  if (out_fd.has_value() && fstat(out_fd.value(), &st) == 0) {
+    out_regular = S_ISREG(st.st_mode);
+  }
+}
+
+py_buffered_terminal_t::~py_buffered_terminal_t() {
+  flush();
+}
+
+py::bytes py_buffered_terminal_t::read() {
+  maybe_flush();
+  if (auto replayed = mmio_trace_t::replay_console()) {
+    return py::bytes(replayed.value());
+  }
+  if (in_fd < 0) {
+    return py::bytes();
+  }
+  struct pollfd pfd = {in_fd, POLLIN, 0};
+  syscalls++;
+  if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) {
+    return py::bytes();
+  }
+  syscalls++;
+  ssize_t n = ::read(in_fd, rbuf.data(), rbuf.size());
+  if (n <= 0) {
+    return py::bytes();
+  }
+  mmio_trace_t::record_console(std::string(rbuf.data(), n));
+  return py::bytes(rbuf.data(), n);
+}
+
+void py_buffered_terminal_t::write(const py::bytes &data) {
+  std::string_view str(data);
+  if (!out_fd.has_value()) {
+    sink.append(str);
+    return;
+  }
+  if (pending.empty()) {
+    pending_since = std::chrono::steady_clock::now();
+  }
+  // a stalled reader must not stall the sim, nor grow the queue unbounded
+  size_t room = max_pending - std::min(max_pending, pending.size());
+  if (str.size() > room) {
+    dropped += str.size() - room;
+    str = str.substr(0, room);
+  }
+  pending.append(str);
+  maybe_flush();
+}
+
+void py_buffered_terminal_t::flush() {
+  if (out_fd.has_value() && !pending.empty()) {
+    pending.erase(0, write_out(pending.data(), pending.size()));
+    pending_since = std::chrono::steady_clock::now();
+  }
+}
+
+py::bytes py_buffered_terminal_t::getvalue() const {
+  return py::bytes(sink);
+}
+
+void py_buffered_terminal_t::clear() {
+  sink.clear();
+}
+
+size_t py_buffered_terminal_t::get_pending() const {
+  return pending.size();
+}
+
+size_t py_buffered_terminal_t::get_syscalls() const {
+  return syscalls;
+}
+
+size_t py_buffered_terminal_t::get_dropped() const {
+  return dropped;
+}
+
+void py_buffered_terminal_t::maybe_flush() {
+  if (!pending.empty() &&
+      (pending.size() >= flush_bytes ||
+       std::chrono::steady_clock::now() - pending_since >= flush_interval)) {
+    flush();
+  }
+}
+
+size_t py_buffered_terminal_t::write_out(const char *data, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    // only write what the fd takes right away: `POLLOUT` on a pipe or a tty
+    // guarantees room for `PIPE_BUF` bytes, even if the fd is blocking
+    struct pollfd pfd = {out_fd.value(), POLLOUT, 0};
+    syscalls++;
+    if (poll(&pfd, 1, 0) <= 0) {
+      break;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      // the reader is gone, drop the output like a closed terminal would
+      dropped += len - done;
+      return len;
+    }
+    size_t chunk = len - done;
+    if (!out_regular) {
+      chunk = std::min<size_t>(chunk, PIPE_BUF);
+    }
+    syscalls++;
+    ssize_t n = ::write(out_fd.value(), data + done, chunk);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (n <= 0) {
+      dropped += len - done;
+      return len;
+    }
+    done += n;
+  }
+  return done;
+}
@@ -16,6 +16,11 @@
 #ifndef _FESVR_TERM_H_
 #define _FESVR_TERM_H_
 
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include <pybind11/embed.h>
 #include <pybind11/stl.h>
 
@@ -35,4 +40,56 @@ public:
   static void write(const pybind11::bytes &data);
 };
 
+// buffered, non-blocking counterpart of `py_canonical_terminal_t`
+//
+// `read` returns everything available on `in_fd` with a single `read(2)`
+// into a reusable buffer. `write` queues data, which is written out once
+// `flush_bytes` are pending, or once the oldest pending byte is
+// `flush_interval` seconds old (checked on every `read` and `write`). without
+// `out_fd`, output goes to an in-memory sink.
+//
+// neither ever blocks: output is only written as far as `out_fd` takes it
+// right away, the rest stays queued, and data beyond `max_pending` queued
+// bytes is dropped (and counted) while the reader stalls.
+class py_buffered_terminal_t {
+public:
+  py_buffered_terminal_t(int in_fd, std::optional<int> out_fd,
+                         size_t flush_bytes, double flush_interval,
+                         size_t read_size, size_t max_pending);
+  ~py_buffered_terminal_t();
+
+public:
+  pybind11::bytes read();
+  void write(const pybind11::bytes &data);
+  void flush();
+
+  // contents of the in-memory sink
+  pybind11::bytes getvalue() const;
+  void clear();
+
+public:
+  size_t get_pending() const;
+  size_t get_syscalls() const;
+  size_t get_dropped() const;
+
+private:
+  void maybe_flush();
+  // returns the number of bytes written (or dropped, if the reader is gone)
+  size_t write_out(const char *data, size_t len);
+
+private:
+  int in_fd;
+  std::optional<int> out_fd;
+  size_t flush_bytes;
+  std::chrono::steady_clock::duration flush_interval;
+  size_t max_pending;
+  bool out_regular;
+  std::vector<char> rbuf;
+  std::string pending;
+  std::chrono::steady_clock::time_point pending_since;
+  std::string sink;
+  size_t syscalls;
+  size_t dropped;
+};
+
 #endif // _FESVR_TERM_H_
@@ -17,10 +17,14 @@
 #include <pybind11/stl.h>
 
 #include "py_bridge.h"
+#include "riscv_stats.h"
 
 namespace py = pybind11;
 
-PythonBridge::PythonBridge() : standalone(!Py_IsInitialized()), references() {
+thread_local uint64_t PythonBridge::current = PythonBridge::GLOBAL;
+
+PythonBridge::PythonBridge()
+    : standalone(!Py_IsInitialized()), references(), next_scope(GLOBAL + 1) {
   if (standalone) {
     py::initialize_interpreter();
   }
@@ -54,27 +58,121 @@ void PythonBridge::bootstrap() {
 }
 
 PythonBridge::~PythonBridge() {
+  if (!Py_IsInitialized()) {
+    // the interpreter is gone already, the references with it
+    for (auto &scope : references) {
+      for (auto &ref : scope.second) {
+        ref.second.release();
+      }
+    }
+  }
   references.clear();
   if (standalone) {
     py::finalize_interpreter();
   }
 }
 
+void PythonBridge::retain(uint64_t key, py::handle py_obj) {
+  std::lock_guard<std::mutex> guard(lock);
+  // a python object is retained once per scope
+  references[current].try_emplace(key,
+                                  py::reinterpret_borrow<py::object>(py_obj));
+}
+
+void PythonBridge::release(uint64_t scope) {
+  std::map<uint64_t, py::object> released;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = references.find(scope);
+    if (it == references.end()) {
+      return;
+    }
+    released.swap(it->second);
+    references.erase(it);
+  }
+  if (!Py_IsInitialized()) {
+    for (auto &ref : released) {
+      ref.second.release();
+    }
+    return;
+  }
+  // finalizers may track objects in turn, so drop the lock first
+  py::gil_scoped_acquire gil;
+  released.clear();
+}
+
+size_t PythonBridge::live() const {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t count = 0;
+  for (const auto &scope : references) {
+    count += scope.second.size();
+  }
+  return count;
+}
+
+size_t PythonBridge::live(uint64_t scope) const {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = references.find(scope);
+  return it == references.end() ? 0 : it->second.size();
+}
+
+PythonBridge::scope_t::scope_t() : prev(current), entered(true) {
+  auto &bridge = PythonBridge::getInstance();
+  {
+    std::lock_guard<std::mutex> guard(bridge.lock);
+    id = bridge.next_scope++;
+  }
+  current = id;
+}
+
+PythonBridge::scope_t::~scope_t() {
+  leave();
+  PythonBridge::getInstance().release(id);
+}
+
+void PythonBridge::scope_t::leave() {
+  if (entered) {
+    current = prev;
+    entered = false;
+  }
+}
+
+uint64_t PythonBridge::scope_t::get_id() const {
+  return id;
+}
+
+PythonBridge::scope_guard_t::scope_guard_t(uint64_t scope) : prev(current) {
+  current = scope;
+}
+
+PythonBridge::scope_guard_t::~scope_guard_t() {
+  current = prev;
+}
+
 template <>
 insn_func_t PythonBridge::track<insn_func_t>(py::handle py_obj) {
-  py_obj.inc_ref();
   // cast python callable to ctypes function
   py::function py2ct =
       py::module_::import("riscv._riscv.processor").attr("insn_func_py2ct");
   auto py_ct = py2ct(py_obj);
-  py_ct.inc_ref();
-  references.emplace(reinterpret_cast<uint64_t>(py_ct.ptr()), py_ct);
+  retain(reinterpret_cast<uint64_t>(py_ct.ptr()), py_ct);
   // cast ctypes function to void pointer then to insn_func_t
   py::function cast = py::module_::import("ctypes").attr("cast");
   py::function c_void_p = py::module_::import("ctypes").attr("c_void_p");
   auto obj = py::cast<uint64_t>(cast(py_ct, c_void_p).attr("value"));
-  references.emplace(obj, py_obj);
-  return reinterpret_cast<insn_func_t>(obj);
+  retain(obj, py_obj);
+  // called through a stand-in, counted in `riscv.stats` under its name
+  py::object py_name = py::getattr(py_obj, "__qualname__", py::none());
+  if (py_name.is_none()) {
+    py_name = py::type::handle_of(py_obj).attr("__qualname__");
+  }
+  py::object py_thunk;
+  insn_func_t func = callback_stats_t::wrap_insn(
+      reinterpret_cast<insn_func_t>(obj), py::str(py_name), py_thunk);
+  if (py_thunk) {
+    retain(reinterpret_cast<uint64_t>(func), py_thunk);
+  }
+  return func;
 }
 
 std::string format_ptr(const void *ptr, size_t width) {
@@ -16,7 +16,9 @@
 #ifndef _PYTHON_BRIDGE_H_
 #define _PYTHON_BRIDGE_H_
 
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <mutex>
 
 #include <riscv/abstract_device.h>
@@ -49,7 +51,8 @@ public:
   static void bootstrap();
 
 public:
-  // keep the python object alive on the C++ side
+  // keep the python object alive on the C++ side, until the current scope of
+  // this thread is released
   template <typename T> T track(pybind11::handle py_obj) {
     static_assert(
         std::is_pointer<T>::value &&
@@ -57,8 +60,6 @@ public:
                              typename std::remove_pointer<T>::type>::value ||
              std::is_base_of<const device_factory_t,
                              typename std::remove_pointer<T>::type>::value ||
-             std::is_base_of<processor_t,
-                             typename std::remove_pointer<T>::type>::value ||
              std::is_base_of<arg_t,
                              typename std::remove_pointer<T>::type>::value ||
              std::is_base_of<csr_t,
@@ -71,20 +72,70 @@ public:
                              typename std::remove_pointer<T>::type>::value ||
              std::is_base_of<insn_desc_t,
                              typename std::remove_pointer<T>::type>::value),
-        "T must be abstract_device_t, device_factory_t, processor_t, arg_t, "
-        "csr_t, rocc_t, extension_t, disasm_insn_t, or insn_desc_t");
-    py_obj.inc_ref();
+        "T must be abstract_device_t, device_factory_t, arg_t, csr_t, rocc_t, "
+        "extension_t, disasm_insn_t, or insn_desc_t");
     T obj = pybind11::cast<T>(py_obj);
-    references.emplace(reinterpret_cast<uint64_t>(obj), py_obj);
+    retain(reinterpret_cast<uint64_t>(obj), py_obj);
     return obj;
   };
 
+  // number of python objects kept alive, in all scopes or in `scope`
+  size_t live() const;
+  size_t live(uint64_t scope) const;
+
+public:
+  // the scope that is never released, e.g. for objects shared by all sims
+  static const uint64_t GLOBAL = 0;
+
+  // ownership scope of tracked objects, e.g. of a sim
+  //
+  // the scope is entered on construction, and released on destruction, along
+  // with all objects tracked in it.
+  class scope_t {
+  public:
+    scope_t();
+    ~scope_t();
+
+  private:
+    scope_t(const scope_t &) = delete;
+    scope_t &operator=(const scope_t &) = delete;
+
+  public:
+    // restores the scope that was current on construction
+    void leave();
+    uint64_t get_id() const;
+
+  private:
+    uint64_t id;
+    uint64_t prev;
+    bool entered;
+  };
+
+  // makes `scope` current on this thread, for the lifetime of the guard
+  class scope_guard_t {
+  public:
+    scope_guard_t(uint64_t scope);
+    ~scope_guard_t();
+
+  private:
+    uint64_t prev;
+  };
+
+private:
+  void retain(uint64_t key, pybind11::handle py_obj);
+  void release(uint64_t scope);
+
 private:
   // do we need to initialize the python interpreter?
   bool standalone;
 
-  // references to python objects that need to be kept alive
-  std::map<uint64_t, pybind11::handle> references;
+  // references to python objects that need to be kept alive, by scope
+  mutable std::mutex lock;
+  std::map<uint64_t, std::map<uint64_t, pybind11::object>> references;
+  uint64_t next_scope;
+
+private:
+  static thread_local uint64_t current;
 
 private:
   static PythonBridge singleton;
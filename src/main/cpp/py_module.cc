@@ -15,7 +15,10 @@
  */
 #include <dlfcn.h>
 
+#include <cstring>
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -34,17 +37,81 @@
 
 #include "fesvr_term.h"
 #include "py_bridge.h"
+#include "riscv_bench.h"
+#include "riscv_buffer.h"
+#include "riscv_cache.h"
 #include "riscv_cfg.h"
+#include "riscv_channel.h"
 #include "riscv_csrs.h"
 #include "riscv_decode.h"
 #include "riscv_devices.h"
+#include "riscv_dma.h"
 #include "riscv_disasm.h"
 #include "riscv_extension.h"
+#include "riscv_irq.h"
+#include "riscv_mem.h"
+#include "riscv_metrics.h"
 #include "riscv_processor.h"
 #include "riscv_sim.h"
+#include "riscv_stats.h"
+#include "riscv_trace.h"
+#include "riscv_uart.h"
+#include "riscv_virtio.h"
 
 namespace py = pybind11;
 
+// holds an export of `data` for as long as the result lives
+static std::shared_ptr<py::buffer_info> buffer_export(const py::buffer &data,
+                                                      bool writable) {
+  std::shared_ptr<py::buffer_info> info(
+      new py::buffer_info(data.request(writable)), [](py::buffer_info *info) {
+        py::gil_scoped_acquire gil;
+        delete info;
+      });
+  if (!PyBuffer_IsContiguous(info->view(), 'C')) {
+    throw py::value_error("buffer must be C-contiguous");
+  }
+  return info;
+}
+
+// a `rom_image_t`, from an image, a buffer, or the path of a file
+static std::shared_ptr<rom_image_t> rom_image_from(const py::object &source) {
+  if (py::isinstance<rom_image_t>(source)) {
+    return source.cast<std::shared_ptr<rom_image_t>>();
+  }
+  if (PyObject_CheckBuffer(source.ptr())) {
+    auto info = buffer_export(source, false);
+    return std::make_shared<rom_image_t>(
+        static_cast<const uint8_t *>(info->ptr), info->size * info->itemsize,
+        info);
+  }
+  py::object path = py::module_::import("os").attr("fspath")(source);
+  return rom_image_t::open(path.cast<std::string>());
+}
+
+// guest memory exported in place, along with the object that keeps it mapped
+struct guest_view_t {
+  char *data;
+  size_t len;
+  py::object owner;
+  bool readonly;
+};
+
+// zero-copy views of the segments of a virtio request, which keep the sim
+// alive
+static py::list virtio_views(const virtio_request_t &req,
+                             const std::vector<virtio_segment_t> &segs,
+                             bool readonly) {
+  py::object owner = py::cast(const_cast<sim_t *>(req.get_sim()),
+                              py::return_value_policy::reference);
+  py::list views;
+  for (const auto &seg : segs) {
+    views.append(py::memoryview(
+        py::cast(guest_view_t{seg.host, seg.len, owner, readonly})));
+  }
+  return views;
+}
+
 PYBIND11_MODULE(_riscv, m) {
 
   m.doc() = "Python Bindings of Spike RISC-V ISA Simulator";
@@ -53,11 +120,27 @@ PYBIND11_MODULE(_riscv, m) {
   {
     auto mod_cfg = m.def_submodule("cfg");
 
-    py::class_<mem_cfg_t>(mod_cfg, "mem_cfg_t")
-        .def(py::init<reg_t, reg_t>())
-        .def_property_readonly("base", &mem_cfg_t::get_base)
-        .def_property_readonly("size", &mem_cfg_t::get_size)
-        .def_property_readonly("inclusive_end", &mem_cfg_t::get_inclusive_end);
+    py::class_<managed_mem_cfg_t>(mod_cfg, "mem_cfg_t")
+        .def(py::init(&managed_mem_cfg_t::create), py::arg("base"),
+             py::arg("size"), py::kw_only(), py::arg("backing") = "anonymous",
+             py::arg("path") = py::none(), py::arg("shared") = false,
+             py::arg("region") = py::none())
+        .def_property_readonly("base", &managed_mem_cfg_t::get_base)
+        .def_property_readonly("size", &managed_mem_cfg_t::get_size)
+        .def_property_readonly("inclusive_end",
+                               &managed_mem_cfg_t::get_inclusive_end)
+        .def_property_readonly("backing", [](const managed_mem_cfg_t &self) {
+          return self.backing.kind;
+        })
+        .def_property_readonly("path", [](const managed_mem_cfg_t &self) {
+          return self.backing.path;
+        })
+        .def_property_readonly("shared", [](const managed_mem_cfg_t &self) {
+          return self.backing.shared;
+        })
+        .def_property_readonly("region", [](const managed_mem_cfg_t &self) {
+          return self.backing.region;
+        });
 
     py::class_<managed_cfg_t>(mod_cfg, "cfg_t")
         .def(py::init())
@@ -101,15 +184,80 @@ PYBIND11_MODULE(_riscv, m) {
     py::class_<proxy_csr_t, csr_t, py::smart_holder>(mod_csrs, "proxy_csr_t")
         .def(py::init([](processor_t *const proc, const reg_t addr,
                          py::object py_csr) {
-               auto raw_csr =
-                   PythonBridge::getInstance().track<py_csr_t *>(py_csr);
-               return new proxy_csr_t(proc, addr, raw_csr->shared_from_this());
+               return new proxy_csr_t(proc, addr, py_csr_cast(py_csr));
              }),
              py::arg("proc"), py::arg("addr"), py::arg("delegate"));
 
     py::class_<const_csr_t, csr_t, py::smart_holder>(mod_csrs, "const_csr_t")
         .def(py::init<processor_t *const, const reg_t, reg_t>(),
              py::arg("proc"), py::arg("addr"), py::arg("val"));
+
+    py::class_<native_csr_t, csr_t, py::smart_holder>(mod_csrs, "native_csr_t")
+        .def(py::init<processor_t *const, const reg_t, const reg_t,
+                      const reg_t, const std::map<reg_t, std::vector<reg_t>> &,
+                      native_csr_t::callback_t>(),
+             py::arg("proc"), py::arg("addr"), py::arg("reset_value") = 0,
+             py::kw_only(), py::arg("write_mask") = ~reg_t(0),
+             py::arg("warl") = std::map<reg_t, std::vector<reg_t>>(),
+             py::arg("on_write") = native_csr_t::callback_t())
+        .def_property("value", &native_csr_t::read, &native_csr_t::set)
+        .def_property_readonly("reset_value", &native_csr_t::get_reset_value)
+        .def_property_readonly("write_mask", &native_csr_t::get_write_mask)
+        .def("legalize", &native_csr_t::legalize, py::arg("val"))
+        .def("reset", &native_csr_t::reset);
+
+    py::class_<cached_csr_t, csr_t, py::smart_holder>(mod_csrs, "cached_csr_t")
+        .def(py::init<processor_t *const, const reg_t, cached_csr_t::compute_t,
+                      cached_csr_t::write_t, std::optional<uint64_t>>(),
+             py::arg("proc"), py::arg("addr"), py::arg("compute"),
+             py::kw_only(), py::arg("on_write") = cached_csr_t::write_t(),
+             py::arg("ttl") = std::nullopt)
+        .def("invalidate", &cached_csr_t::invalidate)
+        .def("depend_on",
+             py::overload_cast<reg_t>(&cached_csr_t::depend_on),
+             py::arg("addr"))
+        .def(
+            "depend_on",
+            [](cached_csr_t &self, py::object py_csr) {
+              self.depend_on(py_csr_cast(py_csr));
+            },
+            py::arg("csr"))
+        .def_property_readonly("valid", &cached_csr_t::is_valid)
+        .def_property_readonly("ttl", &cached_csr_t::get_ttl)
+        .def_property_readonly("refreshes", &cached_csr_t::get_refreshes)
+        .def_property_readonly("hits", &cached_csr_t::get_hits);
+
+    // buffer of shape `(len, 2)`, one `(addr, value)` row per CSR
+    py::class_<csr_snapshot_t, py::smart_holder>(mod_csrs, "csr_snapshot_t",
+                                                 py::buffer_protocol())
+        .def_buffer([](csr_snapshot_t &self) {
+          const auto &entries = self.get_entries();
+          return py::buffer_info(
+              const_cast<csr_snapshot_t::entry_t *>(entries.data()),
+              sizeof(reg_t), py::format_descriptor<reg_t>::format(), 2,
+              {entries.size(), size_t(2)},
+              {sizeof(csr_snapshot_t::entry_t), sizeof(reg_t)}, true);
+        })
+        .def("__len__",
+             [](const csr_snapshot_t &self) {
+               return self.get_entries().size();
+             })
+        .def("__getitem__",
+             [](const csr_snapshot_t &self, size_t i) {
+               const auto &entries = self.get_entries();
+               if (i >= entries.size()) {
+                 throw py::index_error();
+               }
+               return std::make_tuple(entries[i].addr, entries[i].value);
+             })
+        .def("get", &csr_snapshot_t::get, py::arg("addr"))
+        .def("as_dict", [](const csr_snapshot_t &self) {
+          std::map<reg_t, reg_t> dict;
+          for (const auto &entry : self.get_entries()) {
+            dict[entry.addr] = entry.value;
+          }
+          return dict;
+        });
   }
 
   // riscv.debug_module
@@ -147,6 +295,30 @@ PYBIND11_MODULE(_riscv, m) {
         .def("store", &py_mmio_store)
         .def("size", &py_mmio_size)
         .def("tick", &abstract_device_t::tick)
+        .def_property(
+            "tick_divisor",
+            [](const abstract_device_t &self) -> unsigned {
+              auto *py_self = dynamic_cast<const py_abstract_device_t *>(&self);
+              return py_self != nullptr ? py_self->get_tick_divisor() : 1;
+            },
+            [](abstract_device_t &self, unsigned divisor) {
+              auto *py_self = dynamic_cast<py_abstract_device_t *>(&self);
+              if (py_self == nullptr) {
+                throw py::type_error("native devices tick on every tick");
+              }
+              py_self->set_tick_divisor(divisor);
+            })
+        .def(
+            "attach_line",
+            [](abstract_device_t &self,
+               std::shared_ptr<interrupt_line_t> line) {
+              auto *py_self = dynamic_cast<py_abstract_device_t *>(&self);
+              if (py_self == nullptr) {
+                throw py::type_error("native devices drive their own lines");
+              }
+              py_self->attach_line(line);
+            },
+            py::arg("line"))
         .def("__repr__", [](const abstract_device_t &self) {
           return "<riscv._riscv.devices.abstract_device_t object at " +
                  format_ptr(&self) + ">";
@@ -165,14 +337,59 @@ PYBIND11_MODULE(_riscv, m) {
     py::class_<abstract_interrupt_controller_t, py::smart_holder>(
         mod_devices, "abstract_interrupt_controller_t")
         .def("set_interrupt_level",
-             &abstract_interrupt_controller_t::set_interrupt_level);
+             [](abstract_interrupt_controller_t &self, uint32_t id,
+                int level) {
+               self.set_interrupt_level(id, level);
+               mmio_trace_t::record_irq(id, level != 0);
+             },
+             py::arg("id"), py::arg("level"));
+
+    py::class_<interrupt_line_t, py::smart_holder>(mod_devices,
+                                                   "interrupt_line_t")
+        .def(py::init([](sim_t *sim, unsigned irq) {
+               return new interrupt_line_t(sim, irq);
+             }),
+             py::arg("sim"), py::arg("irq"), py::keep_alive<1, 2>())
+        .def_property("level", &interrupt_line_t::get_level,
+                      &interrupt_line_t::set_level)
+        .def("set_level", &interrupt_line_t::set_level, py::arg("level"))
+        .def("pulse", &interrupt_line_t::pulse, py::arg("ticks") = 1)
+        .def("tick", &interrupt_line_t::tick, py::arg("rtc_ticks") = 1)
+        .def_property_readonly("irq", &interrupt_line_t::get_irq)
+        .def_property_readonly("assertions", &interrupt_line_t::get_assertions)
+        .def_property_readonly("updates", &interrupt_line_t::get_updates)
+        .def_property_readonly("redundant", &interrupt_line_t::get_redundant)
+        .def_property_readonly("coalesced", &interrupt_line_t::get_coalesced)
+        .def_property_readonly("histogram", &interrupt_line_t::get_histogram)
+        .def("reset_stats", &interrupt_line_t::reset_stats);
 
     py::class_<bus_t, abstract_device_t, py::smart_holder>(mod_devices, "bus_t")
         .def("find_device", &bus_t::find_device);
 
+    py::class_<rom_image_t, py::smart_holder>(mod_devices, "rom_image_t",
+                                              py::buffer_protocol())
+        .def(py::init(&rom_image_from), py::arg("source"))
+        .def_buffer([](rom_image_t &self) {
+          return py::buffer_info(const_cast<uint8_t *>(self.data()),
+                                 self.size(), true);
+        })
+        .def("__len__", &rom_image_t::size)
+        .def_property_readonly("mapped", &rom_image_t::is_mapped);
+
+    // `data` is a `rom_image_t`, a buffer (referenced, not copied), or the
+    // path of a file to map. ROMs built by spike have no image.
     py::class_<rom_device_t, abstract_device_t, py::smart_holder>(
         mod_devices, "rom_device_t")
-        .def(py::init<std::vector<char>>(), py::arg("data"));
+        .def(py::init([](const py::object &data) -> rom_device_t * {
+               return new shared_rom_t(rom_image_from(data));
+             }),
+             py::arg("data"))
+        .def_property_readonly(
+            "image",
+            [](rom_device_t &self) -> std::shared_ptr<rom_image_t> {
+              auto *rom = dynamic_cast<shared_rom_t *>(&self);
+              return rom != nullptr ? rom->get_image() : nullptr;
+            });
 
     py::class_<abstract_mem_t, abstract_device_t, py::smart_holder>(
         mod_devices, "abstract_mem_t");
@@ -180,6 +397,283 @@ PYBIND11_MODULE(_riscv, m) {
     py::class_<mem_t, abstract_mem_t, py::smart_holder>(mod_devices, "mem_t")
         .def(py::init<reg_t>(), py::arg("size"));
 
+    py::class_<shared_mem_t, py::smart_holder>(mod_devices, "shared_mem_t")
+        .def(py::init([](reg_t size, const std::string &backing,
+                         std::optional<std::string> path, bool sync) {
+               mem_backing_t b;
+               b.kind = backing;
+               b.path = path.value_or("");
+               b.shared = backing == "file" || backing == "shm";
+               return new shared_mem_t(size, b, sync);
+             }),
+             py::arg("size"), py::kw_only(), py::arg("backing") = "anonymous",
+             py::arg("path") = py::none(), py::arg("sync") = true)
+        .def_property_readonly("size", &shared_mem_t::size)
+        .def_property_readonly("sync", &shared_mem_t::is_sync)
+        .def("read",
+             [](shared_mem_t &self, reg_t addr, size_t len) {
+               if (addr + len < addr || addr + len > self.size()) {
+                 throw py::index_error("out of range");
+               }
+               return py::bytes(self.contents(addr), len);
+             },
+             py::arg("addr"), py::arg("len"))
+        .def("write",
+             [](shared_mem_t &self, reg_t addr, const py::bytes &data) {
+               std::string str(data);
+               if (addr + str.size() < addr || addr + str.size() > self.size()) {
+                 throw py::index_error("out of range");
+               }
+               std::memcpy(self.contents(addr), str.data(), str.size());
+             },
+             py::arg("addr"), py::arg("data"));
+
+    py::class_<channel_t, py::smart_holder>(mod_devices, "channel_t")
+        .def(py::init([](const std::string &name, uint32_t slots, uint32_t mtu,
+                         bool shm) {
+               auto channel = std::make_shared<channel_t>(name, slots, mtu, shm);
+               channel_t::attach(channel);
+               return channel;
+             }),
+             py::arg("name"), py::kw_only(), py::arg("slots") = 64,
+             py::arg("mtu") = 2048, py::arg("shm") = false)
+        .def_property_readonly("name", &channel_t::get_name)
+        .def_property_readonly("slots", &channel_t::get_slots)
+        .def_property_readonly("mtu", &channel_t::get_mtu)
+        .def_property_readonly("shm", &channel_t::is_shm)
+        .def("send",
+             [](channel_t &self, unsigned endpoint, const py::bytes &data) {
+               return self.send(endpoint, data);
+             },
+             py::arg("endpoint"), py::arg("data"))
+        .def("recv",
+             [](channel_t &self, unsigned endpoint) -> std::optional<py::bytes> {
+               auto packet = self.recv(endpoint);
+               if (!packet.has_value()) {
+                 return std::nullopt;
+               }
+               return py::bytes(packet.value());
+             },
+             py::arg("endpoint"))
+        .def("pending",
+             [](channel_t &self, unsigned endpoint) {
+               return self.rx(endpoint)->size();
+             },
+             py::arg("endpoint"))
+        .def("close", [](channel_t &self) { channel_t::detach(self.get_name()); });
+
+    py::class_<mailbox_t, abstract_device_t, py::smart_holder>(mod_devices,
+                                                               "mailbox_t")
+        .def_property_readonly("tx_packets", &mailbox_t::get_tx_packets)
+        .def_property_readonly("rx_packets", &mailbox_t::get_rx_packets)
+        .def_property_readonly("tx_drops", &mailbox_t::get_tx_drops)
+        .def_property_readonly("irq", &mailbox_t::get_irq,
+                               py::return_value_policy::reference_internal);
+
+    py::class_<byte_fifo_t, py::smart_holder>(mod_devices, "byte_fifo_t",
+                                              py::buffer_protocol())
+        .def_buffer([](byte_fifo_t &self) {
+          return py::buffer_info(self.linearize(), self.size(), true);
+        })
+        .def_property_readonly("capacity", &byte_fifo_t::capacity)
+        .def("__len__", &byte_fifo_t::size)
+        .def("push",
+             [](byte_fifo_t &self, const py::bytes &data) {
+               std::string str(data);
+               return self.push(reinterpret_cast<const uint8_t *>(str.data()),
+                                str.size());
+             },
+             py::arg("data"))
+        .def("pop",
+             [](byte_fifo_t &self, size_t len) {
+               std::string str(std::min(len, self.size()), '\0');
+               self.pop(reinterpret_cast<uint8_t *>(str.data()), str.size());
+               return py::bytes(str);
+             },
+             py::arg("len"))
+        .def("clear", &byte_fifo_t::clear);
+
+    py::class_<uartlite_t, abstract_device_t, py::smart_holder>(mod_devices,
+                                                                "uartlite_t")
+        .def_property_readonly("rx_fifo", &uartlite_t::get_rx_fifo,
+                               py::return_value_policy::reference_internal)
+        .def_property_readonly("tx_fifo", &uartlite_t::get_tx_fifo,
+                               py::return_value_policy::reference_internal)
+        .def_property_readonly("irq", &uartlite_t::get_irq,
+                               py::return_value_policy::reference_internal);
+
+    py::class_<buffer_device_t, abstract_device_t, py::smart_holder>(
+        mod_devices, "buffer_device_t")
+        .def(py::init([](const py::buffer &buffer,
+                         std::optional<reg_t> doorbell, uint64_t threshold,
+                         buffer_device_t::callback_t callback) {
+               // the export keeps the buffer alive (and a bytearray unresized)
+               auto info = buffer_export(buffer, true);
+               return new buffer_device_t(
+                   static_cast<uint8_t *>(info->ptr),
+                   info->size * info->itemsize, info, doorbell, threshold,
+                   callback);
+             }),
+             py::arg("buffer"), py::kw_only(),
+             py::arg("doorbell") = py::none(), py::arg("threshold") = 0,
+             py::arg("callback") = py::none())
+        .def_property_readonly("writes", &buffer_device_t::get_writes)
+        .def_property_readonly("notifications",
+                               &buffer_device_t::get_notifications);
+
+    py::class_<buffer_factory_t, device_factory_t, py::smart_holder>(
+        mod_devices, "buffer_factory_t")
+        .def(py::init([](const py::buffer &buffer,
+                         std::optional<reg_t> doorbell, uint64_t threshold,
+                         buffer_device_t::callback_t callback) {
+               auto info = buffer_export(buffer, true);
+               return new buffer_factory_t(
+                   static_cast<uint8_t *>(info->ptr),
+                   info->size * info->itemsize, info, doorbell, threshold,
+                   callback);
+             }),
+             py::arg("buffer"), py::kw_only(),
+             py::arg("doorbell") = py::none(), py::arg("threshold") = 0,
+             py::arg("callback") = py::none());
+
+    py::class_<guest_view_t>(mod_devices, "_guest_view_t",
+                             py::buffer_protocol())
+        .def_buffer([](guest_view_t &self) {
+          return py::buffer_info(reinterpret_cast<uint8_t *>(self.data),
+                                 self.len, self.readonly);
+        });
+
+    py::class_<dma_port_t, py::smart_holder>(mod_devices, "dma_port_t")
+        .def(py::init([](sim_t *sim) { return new dma_port_t(sim); }),
+             py::arg("sim"), py::keep_alive<1, 2>())
+        .def("read",
+             [](py::object py_self, reg_t addr,
+                size_t len) -> py::memoryview {
+               // zero-copy view of guest memory, which keeps the port and
+               // thus the sim alive
+               dma_port_t &self = py_self.cast<dma_port_t &>();
+               if (char *host = self.contents(addr, len)) {
+                 return py::memoryview(
+                     py::cast(guest_view_t{host, len, py_self, false}));
+               }
+               std::string str(len, '\0');
+               if (!self.read(addr, len,
+                              reinterpret_cast<uint8_t *>(str.data()))) {
+                 throw py::index_error("dma read fault");
+               }
+               return py::memoryview(py::bytes(str));
+             },
+             py::arg("addr"), py::arg("len"))
+        .def("write",
+             [](dma_port_t &self, reg_t addr, const py::buffer &data) {
+               py::buffer_info info = data.request();
+               size_t len = info.size * info.itemsize;
+               if (!self.write(addr, len,
+                               static_cast<const uint8_t *>(info.ptr))) {
+                 throw py::index_error("dma write fault");
+               }
+             },
+             py::arg("addr"), py::arg("data"))
+        .def("copy",
+             [](dma_port_t &self, reg_t dst, reg_t src, size_t len) {
+               if (!self.copy(dst, src, len)) {
+                 throw py::index_error("dma copy fault");
+               }
+             },
+             py::arg("dst"), py::arg("src"), py::arg("len"))
+        .def("gather",
+             [](dma_port_t &self, const std::vector<dma_segment_t> &segments) {
+               size_t len = 0;
+               for (const auto &segment : segments) {
+                 len += segment.second;
+               }
+               std::string str(len, '\0');
+               if (!self.gather(segments,
+                                reinterpret_cast<uint8_t *>(str.data()))) {
+                 throw py::index_error("dma gather fault");
+               }
+               return py::memoryview(py::bytes(str));
+             },
+             py::arg("segments"))
+        .def("scatter",
+             [](dma_port_t &self, const std::vector<dma_segment_t> &segments,
+                const py::buffer &data) {
+               py::buffer_info info = data.request();
+               size_t len = 0;
+               for (const auto &segment : segments) {
+                 len += segment.second;
+               }
+               if (len > size_t(info.size * info.itemsize)) {
+                 throw py::value_error("segments exceed data");
+               }
+               if (!self.scatter(segments,
+                                 static_cast<const uint8_t *>(info.ptr))) {
+                 throw py::index_error("dma scatter fault");
+               }
+             },
+             py::arg("segments"), py::arg("data"));
+
+    py::class_<dma_engine_t, abstract_device_t, py::smart_holder>(
+        mod_devices, "dma_engine_t")
+        .def("submit", &dma_engine_t::submit, py::arg("src"), py::arg("dst"),
+             py::arg("len"))
+        .def_property_readonly("pending", &dma_engine_t::get_pending)
+        .def_property_readonly("transfers", &dma_engine_t::get_transfers)
+        .def_property_readonly("bytes", &dma_engine_t::get_bytes)
+        .def_property_readonly("irq", &dma_engine_t::get_irq,
+                               py::return_value_policy::reference_internal);
+
+    py::class_<virtio_request_t, py::smart_holder>(mod_devices,
+                                                   "virtio_request_t")
+        .def_property_readonly("queue", &virtio_request_t::get_queue)
+        .def_property_readonly("head", &virtio_request_t::get_head)
+        .def_property_readonly("completed", &virtio_request_t::is_completed)
+        .def_property_readonly("readable",
+                               [](virtio_request_t &self) {
+                                 return virtio_views(self, self.readable, true);
+                               })
+        .def_property_readonly("writable",
+                               [](virtio_request_t &self) {
+                                 return virtio_views(self, self.writable,
+                                                     false);
+                               })
+        .def("complete", &virtio_request_t::complete, py::arg("written") = 0);
+
+    py::class_<virtio_backend_t, py_virtio_backend_t, py::smart_holder>(
+        mod_devices, "virtio_backend_t")
+        .def(py::init<>())
+        .def("device_id", &virtio_backend_t::device_id)
+        .def("device_features", &virtio_backend_t::device_features)
+        .def("num_queues", &virtio_backend_t::num_queues)
+        .def("config",
+             [](virtio_backend_t &self) { return py::bytes(self.config()); })
+        .def("reset", &virtio_backend_t::reset)
+        .def("handle", &virtio_backend_t::handle, py::arg("queue"),
+             py::arg("requests"))
+        .def("attach",
+             [](std::shared_ptr<virtio_backend_t> self, const std::string &name) {
+               virtio_backend_t::attach(name, self);
+             },
+             py::arg("name"))
+        .def_static("detach", &virtio_backend_t::detach, py::arg("name"))
+        .def_static("names", &virtio_backend_t::names);
+
+    py::class_<virtio_mmio_t, abstract_device_t, py::smart_holder>(
+        mod_devices, "virtio_mmio_t")
+        .def_property(
+            "config",
+            [](virtio_mmio_t &self) { return py::bytes(self.get_config()); },
+            [](virtio_mmio_t &self, const py::bytes &data) {
+              self.set_config(data);
+            })
+        .def_property_readonly("status", &virtio_mmio_t::get_status)
+        .def_property_readonly("driver_features",
+                               &virtio_mmio_t::get_driver_features)
+        .def_property_readonly("requests", &virtio_mmio_t::get_requests)
+        .def_property_readonly("batches", &virtio_mmio_t::get_batches)
+        .def_property_readonly("irq", &virtio_mmio_t::get_irq,
+                               py::return_value_policy::reference_internal);
+
     py::class_<clint_t, abstract_device_t, py::smart_holder>(mod_devices,
                                                              "clint_t");
 
@@ -232,6 +726,7 @@ PYBIND11_MODULE(_riscv, m) {
     py::class_<insn_t, py::smart_holder>(mod_decode, "insn_t")
         .def(py::init<>())
         .def(py::init<insn_bits_t>(), py::arg("bits"))
+        .def(py::init<const insn_t &>(), py::arg("insn"))
         .def(py::init([](py::bytes bits) {
                return new insn_t(insn_fetch_one(bits));
              }),
@@ -323,6 +818,14 @@ PYBIND11_MODULE(_riscv, m) {
         .def_property_readonly("zcmp_regmask", &insn_t::zcmp_regmask)
 
         .def("__len__", &insn_t::length)
+        // updates the insn in place (see `insn_func_py2ct`)
+        .def(
+            "_assign",
+            [](insn_t &self, insn_bits_t bits) { self = insn_t(bits); },
+            py::arg("bits"))
+        // a new insn, for handlers to keep beyond a call
+        .def("copy", [](const insn_t &self) { return insn_t(self.bits()); })
+        .def("__copy__", [](const insn_t &self) { return insn_t(self.bits()); })
         .def("__eq__",
              [](insn_t &self, insn_t &other) {
                return self.bits() == other.bits();
@@ -357,11 +860,11 @@ PYBIND11_MODULE(_riscv, m) {
         .def(py::init<const isa_parser_t *>(), py::arg("isa"), py::keep_alive<0, 2>())
         .def(
             "add_insn",
-            [](disassembler_t &self, py::object py_insn) {
-              self.add_insn(
-                  PythonBridge::getInstance().track<disasm_insn_t *>(py_insn));
+            [](disassembler_t &self, const disasm_insn_t &insn) {
+              // the disassembler deletes its entries
+              self.add_insn(new disasm_insn_t(insn));
             },
-            py::arg("insn"), py::keep_alive<1, 2>())
+            py::arg("insn"))
         .def("disassemble", &disassembler_t::disassemble)
         .def("lookup", &disassembler_t::lookup, py::return_value_policy::copy);
 
@@ -423,7 +926,9 @@ PYBIND11_MODULE(_riscv, m) {
         .def("raise_interrupt", &py_extension_t::raise_interrupt,
              py::arg("proc"))
         .def("clear_interrupt", &py_extension_t::clear_interrupt,
-             py::arg("proc"));
+             py::arg("proc"))
+        // tables shared by the instances of each class
+        .def_static("clear_tables", &py_extension_t::clear_tables);
 
     py::class_<rocc_t, py_rocc_t, extension_t, py::smart_holder>(mod_extension,
                                                                  "rocc_t")
@@ -648,10 +1153,28 @@ PYBIND11_MODULE(_riscv, m) {
         .def(py::init())
         // state_t members
         .def_readwrite("pc", &state_t::pc)
-        .def_readonly("XPR", &state_t::XPR,
-                      py::return_value_policy::reference_internal)
-        .def_readonly("FPR", &state_t::FPR,
-                      py::return_value_policy::reference_internal)
+        .def_property_readonly(
+            "XPR",
+            [](py::object py_self) -> py::object {
+              auto &self = py_self.cast<state_t &>();
+              if (auto *pin = py_hart_pin_t::lookup(&self)) {
+                return pin->XPR;
+              }
+              return py::cast(&self.XPR,
+                              py::return_value_policy::reference_internal,
+                              py_self);
+            })
+        .def_property_readonly(
+            "FPR",
+            [](py::object py_self) -> py::object {
+              auto &self = py_self.cast<state_t &>();
+              if (auto *pin = py_hart_pin_t::lookup(&self)) {
+                return pin->FPR;
+              }
+              return py::cast(&self.FPR,
+                              py::return_value_policy::reference_internal,
+                              py_self);
+            })
         .def_readonly("prv", &state_t::prv)
         .def_readonly("prev_prv", &state_t::prev_prv)
         .def_readonly("prv_changed", &state_t::prv_changed)
@@ -664,29 +1187,36 @@ PYBIND11_MODULE(_riscv, m) {
         // commit logs
         .def_property_readonly(
             "log_reg_write",
-            [](state_t &self) {
-              return new py_commit_log_reg_t(self.log_reg_write);
-            },
-            py::return_value_policy::reference_internal)
+            [](py::object py_self) -> py::object {
+              auto &self = py_self.cast<state_t &>();
+              if (auto *pin = py_hart_pin_t::lookup(&self)) {
+                return pin->log_reg_write;
+              }
+              return py::cast(py_commit_log_reg_t(self.log_reg_write, py_self));
+            })
         .def_property_readonly(
             "log_mem_read",
-            [](state_t &self) {
-              return new py_commit_log_mem_t(self.log_mem_read);
-            },
-            py::return_value_policy::reference_internal)
+            [](py::object py_self) -> py::object {
+              auto &self = py_self.cast<state_t &>();
+              if (auto *pin = py_hart_pin_t::lookup(&self)) {
+                return pin->log_mem_read;
+              }
+              return py::cast(py_commit_log_mem_t(self.log_mem_read, py_self));
+            })
         .def_property_readonly(
             "log_mem_write",
-            [](state_t &self) {
-              return new py_commit_log_mem_t(self.log_mem_write);
-            },
-            py::return_value_policy::reference_internal)
+            [](py::object py_self) -> py::object {
+              auto &self = py_self.cast<state_t &>();
+              if (auto *pin = py_hart_pin_t::lookup(&self)) {
+                return pin->log_mem_write;
+              }
+              return py::cast(py_commit_log_mem_t(self.log_mem_write, py_self));
+            })
         // state_t methods
         .def(
             "add_csr",
             [](state_t &self, reg_t addr, py::object py_csr) {
-              auto raw_csr =
-                  PythonBridge::getInstance().track<py_csr_t *>(py_csr);
-              self.add_csr(addr, raw_csr->shared_from_this());
+              self.add_csr(addr, py_csr_cast(py_csr));
             },
             py::arg("addr"), py::arg("csr"))
         .def("reset", &state_t::reset, py::arg("proc"), py::arg("max_isa"));
@@ -701,12 +1231,30 @@ PYBIND11_MODULE(_riscv, m) {
         .def("get_csr", py::overload_cast<int>(&processor_t::get_csr),
              py::arg("which"))
         .def("put_csr", &processor_t::put_csr, py::arg("which"), py::arg("val"))
+        .def("csr_snapshot", &csr_snapshot_t::take, py::kw_only(),
+             py::arg("priv") = std::nullopt, py::arg("custom") = std::nullopt,
+             py::arg("side_effects") = false)
+        .def("csr_restore",
+             [](processor_t &self, const csr_snapshot_t &snapshot) {
+               return snapshot.restore(self);
+             },
+             py::arg("snapshot"))
         // mmu
         .def_property_readonly("mmu", &processor_t::get_mmu,
                                py::return_value_policy::reference_internal)
         // state
-        .def_property_readonly("state", &processor_t::get_state,
-                               py::return_value_policy::reference_internal)
+        .def_property_readonly(
+            "state",
+            [](py::object py_self) -> py::object {
+              auto &self = py_self.cast<processor_t &>();
+              // pinned, no keep alive is added (and allocated) on each access
+              if (auto *pin = py_hart_pin_t::lookup(self.get_state())) {
+                return pin->state;
+              }
+              return py::cast(self.get_state(),
+                              py::return_value_policy::reference_internal,
+                              py_self);
+            })
         // instruction
         .def("register_base_insn", &processor_t::register_base_insn,
              py::arg("insn"), py::keep_alive<1, 2>())
@@ -722,7 +1270,13 @@ PYBIND11_MODULE(_riscv, m) {
         // reset
         .def("reset", &processor_t::reset)
         // step
-        .def("step", &processor_t::step, py::arg("n"))
+        .def(
+            "step",
+            [](processor_t &self, size_t n) {
+              py_hart_pin_t pin(&self);
+              self.step(n);
+            },
+            py::arg("n"))
         // get address of processor_t *
         .def_static("addressof",
                     [](py::object proc) -> uint64_t {
@@ -761,9 +1315,22 @@ PYBIND11_MODULE(_riscv, m) {
       insn_func_ctype = CFUNCTYPE(c_uint64, c_void_p, c_uint64, c_uint64)
 
       def insn_func_py2ct(f: Callable[[processor_t, insn_t, int], int]) -> insn_func_ctype:
+          # the insn_t is reused across calls, a handler keeping it keeps
+          # `insn.copy()` instead
+          slot = insn_t()
+          busy = False
           @insn_func_ctype
           def py2ct(p: int, insn: c_uint64, pc: int) -> int:
-              return f(processor_t.from_address(p), insn_t(insn), pc)
+              nonlocal busy
+              if busy:
+                  # re-entered, e.g. from another thread or a nested step
+                  return f(processor_t.from_address(p), insn_t(insn), pc)
+              busy = True
+              try:
+                  slot._assign(insn)
+                  return f(processor_t.from_address(p), slot, pc)
+              finally:
+                  busy = False
           return py2ct
 
       def insn_func_ct2py(f: insn_func_ctype) -> Callable[[processor_t, insn_t, int], int]:
@@ -930,7 +1497,10 @@ PYBIND11_MODULE(_riscv, m) {
              py::arg("dm_config") = debug_module_config_t(), py::arg("log_path") = std::nullopt,
              py::arg("dtb_discovery") = false, py::arg("dtb_enabled") = true,
              py::arg("dtb_file") = std::nullopt, py::arg("socket_enabled") = false,
-             py::arg("cmd_file") = std::nullopt, py::arg("instruction_limit") = std::nullopt)
+             py::arg("cmd_file") = std::nullopt, py::arg("instruction_limit") = std::nullopt,
+             py::arg("dtb_cache") = false, py::arg("image_cache") = false,
+             py::arg("idle_skip") = false, py::arg("record") = std::nullopt,
+             py::arg("replay") = std::nullopt, py::arg("metrics") = false)
         .def_property_readonly("cfg", &sim_t::get_cfg)
         .def_property_readonly("plic", &sim_t::get_intctrl)
         .def_property_readonly("nprocs", &sim_t::nprocs)
@@ -940,9 +1510,214 @@ PYBIND11_MODULE(_riscv, m) {
         .def("set_debug", &sim_t::set_debug, py::arg("value"))
         .def("configure_log", &sim_t::configure_log, py::arg("enable_log"),
              py::arg("enable_commitlog"))
-        .def("run", &sim_t::run)
+        .def("run",
+             [](sim_t &self) {
+               // every sim_t created from python is a py_sim_t
+               return static_cast<py_sim_t &>(self).run();
+             })
         .def("stop", &sim_t::stop)
-        .def("proc_reset", &sim_t::proc_reset, py::arg("id"));
+        .def("proc_reset", &sim_t::proc_reset, py::arg("id"))
+        .def_property_readonly(
+            "scheduler",
+            [](sim_t &self) -> scheduler_t & {
+              return static_cast<py_sim_t &>(self).get_scheduler();
+            },
+            py::return_value_policy::reference_internal)
+        .def_property_readonly("trace", [](sim_t &self) {
+          return static_cast<py_sim_t &>(self).get_trace();
+        })
+        .def_property_readonly("metrics", [](sim_t &self) {
+          return static_cast<py_sim_t &>(self).get_metrics();
+        })
+        .def_property_readonly("tracked_objects", [](sim_t &self) {
+          return static_cast<py_sim_t &>(self).get_tracked_objects();
+        });
+
+    // number of python objects kept alive on the C++ side, by all sims and
+    // globally (e.g. registered device factories and shared extension tables)
+    mod_sim.def("tracked_objects",
+                []() { return PythonBridge::getInstance().live(); });
+
+    py::class_<mmio_trace_t, py::smart_holder>(mod_sim, "mmio_trace_t")
+        .def_property_readonly("path", &mmio_trace_t::get_path)
+        .def_property_readonly("recording",
+                               [](const mmio_trace_t &self) {
+                                 return self.get_mode() == mmio_trace_t::RECORD;
+                               })
+        .def_property_readonly("records", &mmio_trace_t::get_records)
+        // the plugin devices, as recorded or replayed
+        .def_property_readonly("devices", &mmio_trace_t::get_devices,
+                               py::return_value_policy::reference_internal)
+        // why the replay stopped, if it did
+        .def_property_readonly("divergence", &mmio_trace_t::get_divergence)
+        .def("flush", &mmio_trace_t::flush);
+
+    py::class_<sim_metrics_t, py::smart_holder>(mod_sim, "sim_metrics_t")
+        .def_property("interval", &sim_metrics_t::get_interval,
+                      &sim_metrics_t::set_interval)
+        .def_property_readonly("publications",
+                               &sim_metrics_t::get_publications)
+        .def_property_readonly("socket",
+                               [](const sim_metrics_t &self)
+                                   -> std::optional<std::string> {
+                                 if (self.get_socket().empty()) {
+                                   return std::nullopt;
+                                 }
+                                 return self.get_socket();
+                               })
+        // the plugin devices, as counted
+        .def_property_readonly("devices", &sim_metrics_t::get_devices,
+                               py::return_value_policy::reference_internal)
+        // to be called on the sim's thread, or while it does not run
+        .def("publish", &sim_metrics_t::publish)
+        // read on any thread, without holding the GIL
+        .def("snapshot",
+             [](const sim_metrics_t &self) {
+               py::gil_scoped_release release;
+               auto samples = self.snapshot();
+               return std::map<std::string, uint64_t>(samples.begin(),
+                                                      samples.end());
+             })
+        .def("prometheus",
+             [](const sim_metrics_t &self) {
+               py::gil_scoped_release release;
+               return self.prometheus();
+             })
+        .def("write", &sim_metrics_t::write, py::arg("path"))
+        .def("serve", &sim_metrics_t::serve, py::arg("path"))
+        .def("close", &sim_metrics_t::close);
+
+    py::class_<scheduler_t, abstract_device_t, py::smart_holder>(
+        mod_sim, "scheduler_t")
+        .def_property("idle_skip", &scheduler_t::get_idle_skip,
+                      &scheduler_t::set_idle_skip)
+        .def_property_readonly("mtime", &scheduler_t::get_mtime)
+        .def_property_readonly("pending", &scheduler_t::pending)
+        .def_property_readonly("skips", &scheduler_t::get_skips)
+        .def_property_readonly("skipped", &scheduler_t::get_skipped)
+        .def("schedule",
+             [](scheduler_t &self, reg_t delay,
+                scheduler_t::callback_t callback) {
+               return self.schedule(self.get_mtime().value_or(0) + delay,
+                                    callback);
+             },
+             py::arg("delay"), py::arg("callback"))
+        .def("schedule_at", &scheduler_t::schedule, py::arg("when"),
+             py::arg("callback"))
+        .def("cancel", &scheduler_t::cancel, py::arg("id"));
+
+    py::class_<dtb_cache_t, std::unique_ptr<dtb_cache_t, py::nodelete>>(
+        mod_sim, "dtb_cache_t")
+        .def_property("directory", &dtb_cache_t::get_directory,
+                      &dtb_cache_t::set_directory)
+        .def_property_readonly("hits", &dtb_cache_t::get_hits)
+        .def_property_readonly("misses", &dtb_cache_t::get_misses)
+        .def("clear", &dtb_cache_t::clear)
+        .def("__len__", &dtb_cache_t::len);
+
+    mod_sim.attr("dtb_cache") = py::cast(&dtb_cache_t::getInstance(),
+                                         py::return_value_policy::reference);
+
+    py::class_<elf_image_cache_t,
+               std::unique_ptr<elf_image_cache_t, py::nodelete>>(
+        mod_sim, "elf_image_cache_t")
+        .def_property("directory", &elf_image_cache_t::get_directory,
+                      &elf_image_cache_t::set_directory)
+        .def_property_readonly("hits", &elf_image_cache_t::get_hits)
+        .def_property_readonly("misses", &elf_image_cache_t::get_misses)
+        .def("clear", &elf_image_cache_t::clear)
+        .def("__len__", &elf_image_cache_t::len);
+
+    mod_sim.attr("image_cache") = py::cast(&elf_image_cache_t::getInstance(),
+                                           py::return_value_policy::reference);
+  }
+
+  // riscv.stats
+  {
+    auto mod_stats = m.def_submodule("stats");
+
+    py::class_<callback_site_t, std::unique_ptr<callback_site_t, py::nodelete>>(
+        mod_stats, "callback_site_t")
+        .def_property_readonly("kind", &callback_site_t::get_kind)
+        .def_property_readonly("name", &callback_site_t::get_name)
+        .def_property_readonly("calls", &callback_site_t::get_calls)
+        .def_property_readonly("cycles", &callback_site_t::get_cycles)
+        .def_property_readonly("max_cycles", &callback_site_t::get_max)
+        .def_property_readonly("histogram", &callback_site_t::get_histogram)
+        .def_property_readonly("ns",
+                               [](const callback_site_t &self) {
+                                 return self.get_cycles() /
+                                        callback_stats_t::cycles_per_ns();
+                               })
+        .def_property_readonly("max_ns",
+                               [](const callback_site_t &self) {
+                                 return self.get_max() /
+                                        callback_stats_t::cycles_per_ns();
+                               })
+        .def("quantile_ns",
+             [](const callback_site_t &self, double q) {
+               return self.get_quantile(q) / callback_stats_t::cycles_per_ns();
+             },
+             py::arg("q"))
+        .def("reset", &callback_site_t::reset);
+
+    mod_stats.def("enable", []() { callback_stats_t::set_enabled(true); });
+    mod_stats.def("disable", []() { callback_stats_t::set_enabled(false); });
+    mod_stats.def("is_enabled", &callback_stats_t::is_enabled);
+    mod_stats.def("reset", &callback_stats_t::reset);
+    mod_stats.def("cycles_per_ns", &callback_stats_t::cycles_per_ns);
+    mod_stats.def("sites", &callback_stats_t::sites,
+                  py::return_value_policy::reference);
+
+    auto report = [](const std::string &format) -> std::string {
+      if (format == "text") {
+        return callback_stats_t::report();
+      }
+      if (format != "json") {
+        throw py::value_error("unknown report format: " + format);
+      }
+      py::list entries;
+      for (const auto *site : callback_stats_t::sites()) {
+        if (site->get_calls() == 0) {
+          continue;
+        }
+        double scale = 1.0 / callback_stats_t::cycles_per_ns();
+        py::dict entry;
+        entry["kind"] = site->get_kind();
+        entry["name"] = site->get_name();
+        entry["calls"] = site->get_calls();
+        entry["total_ns"] = site->get_cycles() * scale;
+        entry["mean_ns"] = site->get_cycles() * scale / site->get_calls();
+        entry["p50_ns"] = site->get_quantile(0.5) * scale;
+        entry["p99_ns"] = site->get_quantile(0.99) * scale;
+        entry["max_ns"] = site->get_max() * scale;
+        entry["histogram"] = site->get_histogram();
+        entries.append(entry);
+      }
+      return py::str(py::module_::import("json").attr("dumps")(
+          entries, py::arg("indent") = 2));
+    };
+    mod_stats.def("report", report, py::arg("format") = "text");
+    // prints the report to stderr, or writes it to `path`, at interpreter exit
+    mod_stats.def(
+        "report_at_exit",
+        [report](const std::string &format, std::optional<std::string> path) {
+          if (format != "text" && format != "json") {
+            throw py::value_error("unknown report format: " + format);
+          }
+          py::cpp_function at_exit([report, format, path]() {
+            auto text = report(format);
+            if (path) {
+              py::module_::import("pathlib")
+                  .attr("Path")(*path)
+                  .attr("write_text")(text);
+            } else {
+              py::module_::import("sys").attr("stderr").attr("write")(text);
+            }
+          });
+          py::module_::import("atexit").attr("register")(at_exit);
+        },
+        py::arg("format") = "text", py::arg("path") = py::none());
   }
 
   // riscv.test
@@ -962,6 +1737,75 @@ PYBIND11_MODULE(_riscv, m) {
                  py::return_value_policy::reference);
     mod_test.def("_test_mmio_generate_dts", &py_mmio_generate_dts,
                  py::arg("factory"), py::arg("sim"));
+    mod_test.def(
+        "_test_extension_get_instructions",
+        [](extension_t &ext, const processor_t &proc) {
+          return ext.get_instructions(proc).size();
+        },
+        py::arg("ext"), py::arg("proc"));
+    mod_test.def(
+        "_test_extension_get_disasms",
+        [](extension_t &ext, const processor_t *proc) {
+          // the caller owns the entries, as spike's disassembler does
+          std::vector<disasm_insn_t *> disasms = ext.get_disasms(proc);
+          for (disasm_insn_t *disasm : disasms) {
+            delete disasm;
+          }
+          return disasms.size();
+        },
+        py::arg("ext"), py::arg("proc"));
+    mod_test.def(
+        "_test_insn_func",
+        [](processor_t &proc, const insn_desc_t &desc, insn_bits_t bits,
+           reg_t pc, size_t n) {
+          // calls the handler as a pinned hart does
+          py_hart_pin_t pin(&proc);
+          for (size_t i = 0; i < n; i++) {
+            pc = desc.fast_rv32i(&proc, insn_t(bits), pc);
+          }
+          return pc;
+        },
+        py::arg("proc"), py::arg("desc"), py::arg("bits"), py::arg("pc"),
+        py::arg("n"));
+    mod_test.def(
+        "_test_rocc_custom",
+        [](rocc_t &rocc, processor_t *proc, insn_bits_t bits, reg_t xs1,
+           reg_t xs2) {
+          // calls the custom op of `bits` as the rocc instructions do
+          rocc_insn_union_t u;
+          u.i = insn_t(bits);
+          switch (bits & ROCC_OPCODE_MASK) {
+          case ROCC_OPCODE0:
+            return rocc.custom0(proc, u.r, xs1, xs2);
+          case ROCC_OPCODE1:
+            return rocc.custom1(proc, u.r, xs1, xs2);
+          case ROCC_OPCODE2:
+            return rocc.custom2(proc, u.r, xs1, xs2);
+          case ROCC_OPCODE3:
+            return rocc.custom3(proc, u.r, xs1, xs2);
+          default:
+            throw std::runtime_error("not a rocc instruction");
+          }
+        },
+        py::arg("rocc"), py::arg("proc"), py::arg("bits"), py::arg("xs1"),
+        py::arg("xs2"));
+
+    // timing loops of benchmarks/, in nanoseconds
+    mod_test.def("_bench_insn_func", &bench_insn_func, py::arg("proc"),
+                 py::arg("desc"), py::arg("bits"), py::arg("n"));
+    mod_test.def("_bench_mmio_load", &bench_mmio_load, py::arg("device"),
+                 py::arg("addr"), py::arg("len"), py::arg("n"));
+    mod_test.def("_bench_mmio_store", &bench_mmio_store, py::arg("device"),
+                 py::arg("addr"), py::arg("len"), py::arg("n"));
+    mod_test.def("_bench_mmio_tick", &bench_mmio_tick, py::arg("device"),
+                 py::arg("n"));
+    mod_test.def("_bench_csr_read", &bench_csr_read, py::arg("csr"),
+                 py::arg("n"));
+    mod_test.def("_bench_csr_write", &bench_csr_write, py::arg("csr"),
+                 py::arg("value"), py::arg("n"));
+    mod_test.def("_bench_disassemble", &bench_disassemble, py::arg("disasm"),
+                 py::arg("insns"), py::arg("n"));
+    mod_test.def("_bench_allocations", &bench_allocations);
   }
 
   // fesvr.term
@@ -972,6 +1816,23 @@ PYBIND11_MODULE(_riscv, m) {
 
     mod_term.def("read", &py_canonical_terminal_t::read);
     mod_term.def("write", &py_canonical_terminal_t::write);
+
+    py::class_<py_buffered_terminal_t>(mod_term, "buffered_terminal_t")
+        .def(py::init<int, std::optional<int>, size_t, double, size_t,
+                      size_t>(),
+             py::kw_only(), py::arg("in_fd") = 0, py::arg("out_fd") = 1,
+             py::arg("flush_bytes") = 4096, py::arg("flush_interval") = 0.01,
+             py::arg("read_size") = 4096, py::arg("max_pending") = 1 << 20)
+        .def("read", &py_buffered_terminal_t::read)
+        .def("write", &py_buffered_terminal_t::write, py::arg("data"))
+        .def("flush", &py_buffered_terminal_t::flush)
+        .def("getvalue", &py_buffered_terminal_t::getvalue)
+        .def("clear", &py_buffered_terminal_t::clear)
+        .def_property_readonly("pending", &py_buffered_terminal_t::get_pending)
+        .def_property_readonly("syscalls",
+                               &py_buffered_terminal_t::get_syscalls)
+        .def_property_readonly("dropped",
+                               &py_buffered_terminal_t::get_dropped);
   }
 
   // bootstrap PYSPIKE_LIBS modules
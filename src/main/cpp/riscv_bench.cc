@@ -0,0 +1,156 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#include "riscv_bench.h"
+#include "riscv_processor.h"
+
+namespace {
+
+class stopwatch_t {
+public:
+  stopwatch_t() : start(std::chrono::steady_clock::now()) {}
+
+public:
+  uint64_t elapsed() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point start;
+};
+
+// keeps results observable, so that loops are not optimized away
+volatile reg_t sink;
+
+std::atomic<uint64_t> allocations{0};
+
+void *allocate(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+} // namespace
+
+// counting replacements of the global allocation functions
+
+void *operator new(std::size_t size) {
+  if (void *p = allocate(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+uint64_t bench_allocations() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t bench_insn_func(processor_t &proc, const insn_desc_t &desc,
+                         insn_bits_t bits, size_t n) {
+  py_hart_pin_t pin(&proc);
+  reg_t pc = proc.get_state()->pc;
+  stopwatch_t watch;
+  for (size_t i = 0; i < n; i++) {
+    sink = desc.fast_rv32i(&proc, insn_t(bits), pc);
+  }
+  return watch.elapsed();
+}
+
+uint64_t bench_mmio_load(abstract_device_t &device, reg_t addr, size_t len,
+                         size_t n) {
+  uint8_t bytes[8] = {};
+  if (len > sizeof(bytes)) {
+    throw std::runtime_error("mmio accesses are up to 8 bytes");
+  }
+  stopwatch_t watch;
+  for (size_t i = 0; i < n; i++) {
+    sink = device.load(addr, len, bytes);
+  }
+  return watch.elapsed();
+}
+
+uint64_t bench_mmio_store(abstract_device_t &device, reg_t addr, size_t len,
+                          size_t n) {
+  uint8_t bytes[8] = {};
+  if (len > sizeof(bytes)) {
+    throw std::runtime_error("mmio accesses are up to 8 bytes");
+  }
+  stopwatch_t watch;
+  for (size_t i = 0; i < n; i++) {
+    sink = device.store(addr, len, bytes);
+  }
+  return watch.elapsed();
+}
+
+uint64_t bench_mmio_tick(abstract_device_t &device, size_t n) {
+  stopwatch_t watch;
+  for (size_t i = 0; i < n; i++) {
+    device.tick(1);
+  }
+  return watch.elapsed();
+}
+
+uint64_t bench_csr_read(const csr_t &csr, size_t n) {
+  stopwatch_t watch;
+  for (size_t i = 0; i < n; i++) {
+    sink = csr.read();
+  }
+  return watch.elapsed();
+}
+
+uint64_t bench_csr_write(csr_t &csr, reg_t value, size_t n) {
+  stopwatch_t watch;
+  for (size_t i = 0; i < n; i++) {
+    csr.write(value);
+  }
+  return watch.elapsed();
+}
+
+uint64_t bench_disassemble(const disassembler_t &disasm,
+                           const std::vector<insn_bits_t> &insns, size_t n) {
+  stopwatch_t watch;
+  for (size_t i = 0; i < n; i++) {
+    for (auto bits : insns) {
+      sink = disasm.disassemble(insn_t(bits)).size();
+    }
+  }
+  return watch.elapsed();
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_BENCH_H_
+#define _RISCV_BENCH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/csrs.h>
+#include <riscv/disasm.h>
+#include <riscv/processor.h>
+
+// timing loops of the bridge micro-benchmarks (see benchmarks/)
+//
+// each loop calls into the bridge `n` times from C++, the way spike does, so
+// that the python side of a measurement is the callee only. all return the
+// elapsed wall time in nanoseconds.
+
+// a python instruction handler, called as `fast_rv32i` of a pinned hart
+uint64_t bench_insn_func(processor_t &proc, const insn_desc_t &desc,
+                         insn_bits_t bits, size_t n);
+
+// loads, stores and ticks of a device, with accesses of up to 8 bytes
+uint64_t bench_mmio_load(abstract_device_t &device, reg_t addr, size_t len,
+                         size_t n);
+uint64_t bench_mmio_store(abstract_device_t &device, reg_t addr, size_t len,
+                          size_t n);
+uint64_t bench_mmio_tick(abstract_device_t &device, size_t n);
+
+// reads and writes of a CSR
+uint64_t bench_csr_read(const csr_t &csr, size_t n);
+uint64_t bench_csr_write(csr_t &csr, reg_t value, size_t n);
+
+// disassembly of `insns`, `n` times over
+uint64_t bench_disassemble(const disassembler_t &disasm,
+                           const std::vector<insn_bits_t> &insns, size_t n);
+
+// the number of C++ allocations (`operator new`) of the module so far, for
+// tests to assert that a steady-state path allocates nothing
+uint64_t bench_allocations();
+
+#endif // _RISCV_BENCH_H_
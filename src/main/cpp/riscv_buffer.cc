@@ -0,0 +1,120 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "riscv_buffer.h"
+
+buffer_device_t::buffer_device_t(uint8_t *data, size_t len,
+                                 std::shared_ptr<void> owner,
+                                 std::optional<reg_t> doorbell,
+                                 uint64_t threshold, callback_t callback)
+    : data(data), len(len), owner(owner), doorbell(doorbell),
+      threshold(threshold), callback(callback), writes(0), pending(0),
+      notifications(0) {
+  // NOP
+}
+
+bool buffer_device_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > this->len) {
+    return false;
+  }
+  std::memcpy(bytes, data + addr, len);
+  return true;
+}
+
+bool buffer_device_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (addr + len < addr || addr + len > this->len) {
+    return false;
+  }
+  std::memcpy(data + addr, bytes, len);
+  writes++;
+  pending++;
+  if (doorbell.has_value() && addr <= doorbell.value() &&
+      doorbell.value() < addr + len) {
+    notify(doorbell.value());
+  } else if (threshold != 0 && pending >= threshold) {
+    notify(addr);
+  }
+  return true;
+}
+
+reg_t buffer_device_t::size() {
+  return len;
+}
+
+uint64_t buffer_device_t::get_writes() const {
+  return writes;
+}
+
+uint64_t buffer_device_t::get_notifications() const {
+  return notifications;
+}
+
+void buffer_device_t::notify(reg_t offset) {
+  uint64_t count = pending;
+  pending = 0;
+  notifications++;
+  if (!callback) {
+    return;
+  }
+  try {
+    callback(offset, count);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+buffer_factory_t::buffer_factory_t(uint8_t *data, size_t len,
+                                   std::shared_ptr<void> owner,
+                                   std::optional<reg_t> doorbell,
+                                   uint64_t threshold,
+                                   buffer_device_t::callback_t callback)
+    : data(data), len(len), owner(owner), doorbell(doorbell),
+      threshold(threshold), callback(callback) {
+  // NOP
+}
+
+abstract_device_t *buffer_factory_t::parse_from_fdt(
+    const void *fdt, const sim_t *sim, reg_t *base,
+    const std::vector<std::string> &sargs) const {
+  if (sargs.empty()) {
+    throw std::runtime_error("buffer device requires (base,)");
+  }
+  if (base != nullptr) {
+    *base = std::stoull(sargs[0], nullptr, 16);
+  }
+  return new buffer_device_t(data, len, owner, doorbell, threshold, callback);
+}
+
+std::string
+buffer_factory_t::generate_dts(const sim_t *sim,
+                               const std::vector<std::string> &sargs) const {
+  if (sargs.empty()) {
+    return "";
+  }
+  reg_t base = std::stoull(sargs[0], nullptr, 16);
+  std::ostringstream s;
+  s << std::hex << "    buffer@" << base << " {\n"
+    << "      compatible = \"pyspike,buffer\";\n"
+    << "      reg = <0x" << (base >> 32) << " 0x" << (base & 0xffffffff)
+    << " 0x" << (len >> 32) << " 0x" << (len & 0xffffffff) << ">;\n"
+    << "    };\n";
+  return s.str();
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_BUFFER_H_
+#define _RISCV_BUFFER_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+
+// MMIO window onto host memory that the device does not own
+//
+// guest loads and stores are served from `data` in C++. `owner` keeps the
+// memory alive (e.g. a python buffer export), and is released with the
+// device. notifications are coarse: `callback(offset, writes)` is called on
+// every store to the `doorbell` offset, and after every `threshold` stores
+// (0 for never), with the number of stores since the last notification.
+class buffer_device_t : public abstract_device_t {
+public:
+  typedef std::function<void(reg_t offset, uint64_t writes)> callback_t;
+
+public:
+  buffer_device_t(uint8_t *data, size_t len, std::shared_ptr<void> owner,
+                  std::optional<reg_t> doorbell, uint64_t threshold,
+                  callback_t callback);
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual reg_t size() override;
+
+public:
+  uint64_t get_writes() const;
+  uint64_t get_notifications() const;
+
+private:
+  void notify(reg_t offset);
+
+private:
+  uint8_t *data;
+  size_t len;
+  std::shared_ptr<void> owner;
+  std::optional<reg_t> doorbell;
+  uint64_t threshold;
+  callback_t callback;
+  uint64_t writes;
+  uint64_t pending;
+  uint64_t notifications;
+};
+
+// device factory of `buffer_device_t`s onto one buffer, with sargs `(base,)`
+//
+// registered in `mmio_device_map` under any name, so that sims map the buffer
+// like any plugin device. all devices created share the buffer, its owner and
+// the notification settings.
+class buffer_factory_t : public device_factory_t {
+public:
+  buffer_factory_t(uint8_t *data, size_t len, std::shared_ptr<void> owner,
+                   std::optional<reg_t> doorbell, uint64_t threshold,
+                   buffer_device_t::callback_t callback);
+
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override;
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override;
+
+private:
+  uint8_t *data;
+  size_t len;
+  std::shared_ptr<void> owner;
+  std::optional<reg_t> doorbell;
+  uint64_t threshold;
+  buffer_device_t::callback_t callback;
+};
+
+#endif // _RISCV_BUFFER_H_
@@ -0,0 +1,455 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fesvr/elfloader.h>
+#include <riscv/devices.h>
+#include <riscv/mmu.h>
+
+#include "riscv_cache.h"
+#include "riscv_devices.h"
+
+// the full version, naming both the pyspike and the spike commits (setup.py)
+#ifndef PYSPIKE_VERSION
+#define PYSPIKE_VERSION "unknown"
+#endif
+
+namespace fs = std::filesystem;
+
+content_hash_t::content_hash_t() : state(0xcbf29ce484222325ULL) {
+  // NOP
+}
+
+content_hash_t &content_hash_t::update(const void *data, size_t len) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < len; i++) {
+    state ^= bytes[i];
+    state *= 0x100000001b3ULL;
+  }
+  return *this;
+}
+
+content_hash_t &content_hash_t::update(const std::string &str) {
+  // length-prefixed, so that ("ab", "c") and ("a", "bc") hash differently
+  update(static_cast<uint64_t>(str.size()));
+  return update(str.data(), str.size());
+}
+
+content_hash_t &content_hash_t::update(uint64_t value) {
+  uint8_t bytes[sizeof(value)];
+  for (size_t i = 0; i < sizeof(value); i++) {
+    bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+  }
+  return update(bytes, sizeof(bytes));
+}
+
+std::string content_hash_t::hexdigest() const {
+  std::string result;
+  result.reserve(16);
+  for (size_t i = 0; i < 16; i++) {
+    result.push_back("0123456789abcdef"[(state >> (60 - i * 4)) & 0xf]);
+  }
+  return result;
+}
+
+std::string cache_directory(const std::string &subdir) {
+  auto getenv = [](const char *name) -> std::string {
+    const char *value = std::getenv(name);
+    return value ? value : "";
+  };
+  fs::path root;
+  if (!getenv(ENV_PYSPIKE_CACHE).empty()) {
+    root = getenv(ENV_PYSPIKE_CACHE);
+  } else if (!getenv("XDG_CACHE_HOME").empty()) {
+    root = fs::path(getenv("XDG_CACHE_HOME")) / "pyspike";
+  } else if (!getenv("HOME").empty()) {
+    root = fs::path(getenv("HOME")) / ".cache" / "pyspike";
+  } else {
+    root = fs::temp_directory_path() / "pyspike";
+  }
+  fs::path dir = root / subdir;
+  fs::create_directories(dir);
+  return dir.string();
+}
+
+void cache_write_file(const std::string &path, const std::string &data) {
+  std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream fout(tmp_path, std::ios::binary | std::ios::trunc);
+    fout.write(data.data(), data.size());
+    if (!fout) {
+      throw std::runtime_error("failed to write cache file " + tmp_path);
+    }
+  }
+  fs::rename(tmp_path, path);
+}
+
+dtb_cache_t::dtb_cache_t()
+    : lock(), directory(), entries(), hits(0), misses(0) {
+  // NOP
+}
+
+dtb_cache_t::~dtb_cache_t() {
+  // NOP
+}
+
+dtb_cache_t &dtb_cache_t::getInstance() {
+  return dtb_cache_t::singleton;
+}
+
+std::optional<std::string> dtb_cache_t::key(
+    const cfg_t &cfg,
+    const std::vector<std::pair<std::string, std::vector<std::string>>>
+        &plugin_device_factories) const {
+  content_hash_t hash;
+  // invalidate all entries whenever pyspike or the bundled spike changes, as
+  // make_dts() may change its output between spike versions
+  hash.update(std::string("dtb:" PYSPIKE_VERSION));
+  // cfg_t properties that end up in the dts
+  hash.update(std::string(cfg.isa ?: ""));
+  hash.update(std::string(cfg.priv ?: ""));
+  hash.update(std::string(cfg.bootargs ?: ""));
+  hash.update(static_cast<uint64_t>(cfg.pmpregions));
+  hash.update(static_cast<uint64_t>(cfg.pmpgranularity));
+  hash.update(static_cast<uint64_t>(cfg.initrd_bounds.first));
+  hash.update(static_cast<uint64_t>(cfg.initrd_bounds.second));
+  hash.update(static_cast<uint64_t>(cfg.mem_layout.size()));
+  for (const auto &mem_cfg : cfg.mem_layout) {
+    hash.update(static_cast<uint64_t>(mem_cfg.get_base()));
+    hash.update(static_cast<uint64_t>(mem_cfg.get_size()));
+  }
+  hash.update(static_cast<uint64_t>(cfg.nprocs()));
+  for (const auto &hartid : cfg.hartids) {
+    hash.update(static_cast<uint64_t>(hartid));
+  }
+  // plugin device factories, their arguments and versions
+  const mmio_device_map_t &registry = mmio_device_map();
+  hash.update(static_cast<uint64_t>(plugin_device_factories.size()));
+  for (const auto &[name, sargs] : plugin_device_factories) {
+    const device_factory_t *factory = registry.at(name);
+    auto py_factory = dynamic_cast<const py_device_factory_t *>(factory);
+    if (py_factory != nullptr) {
+      if (!py_factory->dts_deterministic()) {
+        return std::nullopt;
+      }
+      hash.update(py_factory->dts_version());
+    }
+    hash.update(name);
+    hash.update(static_cast<uint64_t>(sargs.size()));
+    for (const auto &sarg : sargs) {
+      hash.update(sarg);
+    }
+  }
+  return hash.hexdigest();
+}
+
+std::optional<std::string> dtb_cache_t::lookup(const std::string &key) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = entries.find(key);
+  if (it != entries.end() && fs::exists(it->second)) {
+    hits++;
+    return it->second;
+  }
+  std::string path = path_of(key);
+  if (fs::exists(path)) {
+    entries[key] = path;
+    hits++;
+    return path;
+  }
+  misses++;
+  return std::nullopt;
+}
+
+void dtb_cache_t::store(const std::string &key, const std::string &dtb) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::string path = path_of(key);
+  cache_write_file(path, dtb);
+  entries[key] = path;
+}
+
+void dtb_cache_t::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  for (const auto &[key, path] : entries) {
+    fs::remove(path);
+  }
+  if (!directory.empty() && fs::is_directory(directory)) {
+    for (const auto &entry : fs::directory_iterator(directory)) {
+      if (entry.path().extension() == ".dtb") {
+        fs::remove(entry.path());
+      }
+    }
+  }
+  entries.clear();
+  hits = 0;
+  misses = 0;
+}
+
+std::string dtb_cache_t::get_directory() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (directory.empty()) {
+    directory = cache_directory("dtb");
+  }
+  return directory;
+}
+
+void dtb_cache_t::set_directory(const std::string &directory) {
+  std::lock_guard<std::mutex> guard(lock);
+  fs::create_directories(directory);
+  this->directory = directory;
+  entries.clear();
+}
+
+size_t dtb_cache_t::len() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return entries.size();
+}
+
+size_t dtb_cache_t::get_hits() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return hits;
+}
+
+size_t dtb_cache_t::get_misses() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return misses;
+}
+
+std::string dtb_cache_t::path_of(const std::string &key) {
+  // caller holds the lock
+  if (directory.empty()) {
+    directory = cache_directory("dtb");
+  }
+  return (fs::path(directory) / (key + ".dtb")).string();
+}
+
+dtb_cache_t dtb_cache_t::singleton;
+
+// memif_t that records the pages written by `load_elf()`, instead of writing
+// them to the target
+class recording_memif_t : public memif_t {
+public:
+  recording_memif_t(chunked_memif_t *cmemif) : memif_t(cmemif), pages() {
+    // NOP
+  }
+
+public:
+  virtual void write(addr_t addr, size_t len, const void *bytes) override {
+    const char *src = reinterpret_cast<const char *>(bytes);
+    while (len > 0) {
+      reg_t pgoff = addr % PGSIZE;
+      size_t chunk = std::min<size_t>(len, PGSIZE - pgoff);
+      std::string &page = pages[addr / PGSIZE];
+      if (page.empty()) {
+        page.resize(PGSIZE, '\0');
+      }
+      std::memcpy(page.data() + pgoff, src, chunk);
+      addr += chunk;
+      src += chunk;
+      len -= chunk;
+    }
+  }
+
+public:
+  // written pages, indexed by page number
+  std::map<reg_t, std::string> pages;
+};
+
+elf_image_cache_t::elf_image_cache_t()
+    : lock(), directory(), entries(), digests(), hits(0), misses(0) {
+  // NOP
+}
+
+elf_image_cache_t::~elf_image_cache_t() {
+  // NOP
+}
+
+elf_image_cache_t &elf_image_cache_t::getInstance() {
+  return elf_image_cache_t::singleton;
+}
+
+std::optional<elf_image_t>
+elf_image_cache_t::get(const std::string &elf_path,
+                       const std::vector<mem_cfg_t> &mem_layout,
+                       reg_t load_offset, chunked_memif_t *cmemif) {
+  std::lock_guard<std::mutex> guard(lock);
+  content_hash_t hash;
+  hash.update(std::string("elf:" __DATE__ " " __TIME__));
+  try {
+    hash.update(file_digest(elf_path));
+  } catch (std::exception &e) {
+    return std::nullopt;
+  }
+  hash.update(static_cast<uint64_t>(load_offset));
+  hash.update(static_cast<uint64_t>(mem_layout.size()));
+  for (const auto &mem_cfg : mem_layout) {
+    hash.update(static_cast<uint64_t>(mem_cfg.get_base()));
+    hash.update(static_cast<uint64_t>(mem_cfg.get_size()));
+  }
+  std::string key = hash.hexdigest();
+  // lookup in memory
+  if (auto it = entries.find(key);
+      it != entries.end() && fs::exists(it->second.path)) {
+    hits++;
+    return it->second;
+  }
+  // lookup on disk
+  elf_image_t image = {path_of(key + ".img"), {}};
+  std::string index_path = path_of(key + ".idx");
+  if (std::ifstream fidx(index_path); fidx && fs::exists(image.path)) {
+    elf_extent_t extent;
+    while (fidx >> std::hex >> extent.paddr >> extent.offset >> extent.size) {
+      image.extents.push_back(extent);
+    }
+    entries[key] = image;
+    hits++;
+    return image;
+  }
+  misses++;
+  // parse the ELF, and lay out its pages in runs of consecutive pages
+  recording_memif_t memif(cmemif);
+  try {
+    reg_t entry;
+    load_elf(elf_path.c_str(), &memif, &entry, load_offset);
+  } catch (std::exception &e) {
+    return std::nullopt;
+  }
+  std::string blob;
+  for (const auto &[ppn, page] : memif.pages) {
+    reg_t paddr = ppn * PGSIZE;
+    if (image.extents.empty() ||
+        image.extents.back().paddr + image.extents.back().size != paddr) {
+      image.extents.push_back({paddr, blob.size(), 0});
+    }
+    image.extents.back().size += PGSIZE;
+    blob.append(page);
+  }
+  std::ostringstream index;
+  for (const auto &extent : image.extents) {
+    index << std::hex << extent.paddr << " " << extent.offset << " "
+          << extent.size << "\n";
+  }
+  // the index is written last, it marks the entry as complete
+  cache_write_file(image.path, blob);
+  cache_write_file(index_path, index.str());
+  entries[key] = image;
+  return image;
+}
+
+void elf_image_cache_t::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (!directory.empty() && fs::is_directory(directory)) {
+    for (const auto &entry : fs::directory_iterator(directory)) {
+      auto ext = entry.path().extension();
+      if (ext == ".img" || ext == ".idx" || ext == ".sum") {
+        fs::remove(entry.path());
+      }
+    }
+  }
+  entries.clear();
+  digests.clear();
+  hits = 0;
+  misses = 0;
+}
+
+std::string elf_image_cache_t::get_directory() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (directory.empty()) {
+    directory = cache_directory("elf");
+  }
+  return directory;
+}
+
+void elf_image_cache_t::set_directory(const std::string &directory) {
+  std::lock_guard<std::mutex> guard(lock);
+  fs::create_directories(directory);
+  this->directory = directory;
+  entries.clear();
+}
+
+size_t elf_image_cache_t::len() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return entries.size();
+}
+
+size_t elf_image_cache_t::get_hits() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return hits;
+}
+
+size_t elf_image_cache_t::get_misses() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return misses;
+}
+
+std::string elf_image_cache_t::file_digest(const std::string &path) {
+  // caller holds the lock
+  //
+  // hashing a multi-hundred-MB image is not free, so the content digest is
+  // memoized by the file's stat signature, both in memory and on disk.
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    throw std::runtime_error("cannot stat " + path);
+  }
+  content_hash_t signature;
+  signature.update(fs::absolute(path).string());
+  signature.update(static_cast<uint64_t>(st.st_dev));
+  signature.update(static_cast<uint64_t>(st.st_ino));
+  signature.update(static_cast<uint64_t>(st.st_size));
+  signature.update(static_cast<uint64_t>(st.st_mtim.tv_sec));
+  signature.update(static_cast<uint64_t>(st.st_mtim.tv_nsec));
+  std::string sig = signature.hexdigest();
+  if (auto it = digests.find(sig); it != digests.end()) {
+    return it->second;
+  }
+  std::string sum_path = path_of(sig + ".sum");
+  std::string digest;
+  if (std::ifstream fsum(sum_path); fsum && (fsum >> digest)) {
+    digests[sig] = digest;
+    return digest;
+  }
+  std::ifstream fin(path, std::ios::binary);
+  if (!fin) {
+    throw std::runtime_error("cannot read " + path);
+  }
+  content_hash_t content;
+  std::vector<char> buffer(1 << 20);
+  while (fin.read(buffer.data(), buffer.size()) || fin.gcount() > 0) {
+    content.update(buffer.data(), fin.gcount());
+  }
+  digest = content.hexdigest();
+  cache_write_file(sum_path, digest);
+  digests[sig] = digest;
+  return digest;
+}
+
+std::string elf_image_cache_t::path_of(const std::string &name) {
+  // caller holds the lock
+  if (directory.empty()) {
+    directory = cache_directory("elf");
+  }
+  return (fs::path(directory) / name).string();
+}
+
+elf_image_cache_t elf_image_cache_t::singleton;
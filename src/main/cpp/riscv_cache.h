@@ -0,0 +1,188 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_CACHE_H_
+#define _RISCV_CACHE_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fesvr/memif.h>
+#include <riscv/cfg.h>
+
+// incremental FNV-1a (64-bit) digest for content-addressed cache keys
+//
+// unlike `std::hash`, the digest is stable across processes and builds, so the
+// same input always maps to the same on-disk cache entry.
+class content_hash_t {
+public:
+  content_hash_t();
+
+public:
+  content_hash_t &update(const void *data, size_t len);
+  content_hash_t &update(const std::string &str);
+  content_hash_t &update(uint64_t value);
+  std::string hexdigest() const;
+
+private:
+  uint64_t state;
+};
+
+// returns (and creates on demand) the cache directory `<root>/<subdir>`, where
+// `<root>` is `$PYSPIKE_CACHE`, `$XDG_CACHE_HOME/pyspike` or
+// `$HOME/.cache/pyspike`, whichever is found first
+std::string cache_directory(const std::string &subdir);
+
+// write `data` to `path` through a temporary file and an atomic rename, so
+// concurrent processes never observe a partially written cache entry
+void cache_write_file(const std::string &path, const std::string &data);
+
+// content-addressed cache of compiled device tree blobs (DTB)
+//
+// the key covers everything that `make_dts()` and the plugin device factories
+// depend on. entries live in memory for the lifetime of the process, and are
+// persisted under `cache_directory("dtb")` to be shared across runs and
+// processes. a configuration involving any python device factory that does not
+// declare `dts_deterministic = True` is never cached.
+class dtb_cache_t {
+private:
+  dtb_cache_t();
+
+private:
+  dtb_cache_t(const dtb_cache_t &) = delete;
+  dtb_cache_t(const dtb_cache_t &&) = delete;
+  dtb_cache_t &operator=(const dtb_cache_t &) = delete;
+  dtb_cache_t &operator=(const dtb_cache_t &&) = delete;
+
+public:
+  ~dtb_cache_t();
+
+  // returns singleton instance of dtb cache
+  static dtb_cache_t &getInstance();
+
+public:
+  // returns the cache key of a configuration, or `std::nullopt` if any of the
+  // plugin device factories opts out of caching
+  std::optional<std::string>
+  key(const cfg_t &cfg,
+      const std::vector<std::pair<std::string, std::vector<std::string>>>
+          &plugin_device_factories) const;
+
+  // returns the path to the cached dtb file of `key`, if there is one
+  std::optional<std::string> lookup(const std::string &key);
+
+  // stores `dtb`, as compiled by the sim, under `key`
+  void store(const std::string &key, const std::string &dtb);
+
+  // forgets all entries, both in memory and on disk
+  void clear();
+
+public:
+  std::string get_directory();
+  void set_directory(const std::string &directory);
+  size_t len() const;
+  size_t get_hits() const;
+  size_t get_misses() const;
+
+private:
+  std::string path_of(const std::string &key);
+
+private:
+  mutable std::mutex lock;
+  std::string directory;
+  std::map<std::string, std::string> entries;
+  size_t hits;
+  size_t misses;
+
+private:
+  static dtb_cache_t singleton;
+};
+
+// one page-aligned run of loadable pages of a program image
+struct elf_extent_t {
+  reg_t paddr;     // guest physical address
+  uint64_t offset; // offset in the image file
+  uint64_t size;   // length in bytes
+};
+
+// program image laid out by `elf_image_cache_t`
+struct elf_image_t {
+  std::string path;                  // page-aligned image file
+  std::vector<elf_extent_t> extents; // sorted by paddr
+};
+
+// content-addressed cache of program images
+//
+// an ELF is parsed once with `load_elf()`, and the pages it writes are laid
+// out in an image file such that every guest address shares its page offset
+// with its file offset. the image can thus be mapped copy-on-write straight
+// into `mapped_mem_t` regions, which makes loading O(pages touched) instead of
+// a full copy. entries are keyed by the content hash of the ELF, the memory
+// layout and the load offset, and persisted under `cache_directory("elf")`.
+class elf_image_cache_t {
+private:
+  elf_image_cache_t();
+
+private:
+  elf_image_cache_t(const elf_image_cache_t &) = delete;
+  elf_image_cache_t(const elf_image_cache_t &&) = delete;
+  elf_image_cache_t &operator=(const elf_image_cache_t &) = delete;
+  elf_image_cache_t &operator=(const elf_image_cache_t &&) = delete;
+
+public:
+  ~elf_image_cache_t();
+
+  // returns singleton instance of program image cache
+  static elf_image_cache_t &getInstance();
+
+public:
+  // returns the image of `elf_path`, laying it out on miss. `cmemif` only
+  // provides the target endianness to `load_elf()`. returns `std::nullopt` if
+  // the ELF cannot be parsed, leaving the error to the regular loader.
+  std::optional<elf_image_t> get(const std::string &elf_path,
+                                 const std::vector<mem_cfg_t> &mem_layout,
+                                 reg_t load_offset, chunked_memif_t *cmemif);
+
+  // forgets all entries, both in memory and on disk
+  void clear();
+
+public:
+  std::string get_directory();
+  void set_directory(const std::string &directory);
+  size_t len() const;
+  size_t get_hits() const;
+  size_t get_misses() const;
+
+private:
+  std::string file_digest(const std::string &path);
+  std::string path_of(const std::string &name);
+
+private:
+  mutable std::mutex lock;
+  std::string directory;
+  std::map<std::string, elf_image_t> entries;
+  std::map<std::string, std::string> digests;
+  size_t hits;
+  size_t misses;
+
+private:
+  static elf_image_cache_t singleton;
+};
+
+#endif // _RISCV_CACHE_H_
@@ -13,7 +13,49 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <stdexcept>
+
 #include "riscv_cfg.h"
+#include "riscv_mem.h"
+
+managed_mem_cfg_t::managed_mem_cfg_t(reg_t base, reg_t size,
+                                     const mem_backing_t &backing)
+    : mem_cfg_t(base, size), backing(backing) {
+  // NOP
+}
+
+managed_mem_cfg_t *
+managed_mem_cfg_t::create(reg_t base, reg_t size, const std::string &backing,
+                          std::optional<std::string> path, bool shared,
+                          std::shared_ptr<shared_mem_t> region) {
+  mem_backing_t b;
+  b.kind = region ? "shared" : backing;
+  b.path = path.value_or("");
+  b.shared = shared || b.kind == "shm" || b.kind == "shared";
+  b.region = region;
+  if (region && backing != "anonymous") {
+    throw std::runtime_error("memory backing of a region is set on the region");
+  }
+  if (region && size > region->size()) {
+    throw std::runtime_error("memory size exceeds the shared region");
+  }
+  if (b.kind != "anonymous" && b.kind != "hugepage" && b.kind != "hugetlb" &&
+      b.kind != "file" && b.kind != "shm" && b.kind != "shared") {
+    throw std::runtime_error("unknown memory backing: " + b.kind);
+  }
+  if ((b.kind == "file" || b.kind == "shm") && b.path.empty()) {
+    throw std::runtime_error("memory backing '" + b.kind + "' requires a path");
+  }
+  if (b.kind == "shared" && !b.region) {
+    throw std::runtime_error("memory backing 'shared' requires a region");
+  }
+  if ((b.kind != "file" && b.kind != "shm" && b.kind != "shared") &&
+      b.shared) {
+    throw std::runtime_error("memory backing '" + b.kind +
+                             "' cannot be shared");
+  }
+  return new managed_mem_cfg_t(base, size, b);
+}
 
 managed_cfg_t::managed_cfg_t() : cfg_t() {
   get_bootargs();
@@ -63,10 +105,17 @@ void managed_cfg_t::set_priv(const std::string &priv) {
   this->priv = _priv.c_str();
 }
 
+mem_backing_t managed_cfg_t::get_mem_backing(size_t i) const {
+  if (i < _mem_backings.size()) {
+    return _mem_backings[i];
+  }
+  return mem_backing_t();
+}
+
 managed_cfg_t *
 managed_cfg_t::create(std::optional<std::string> isa,
                       std::optional<std::string> priv,
-                      std::optional<std::vector<mem_cfg_t>> mem_layout,
+                      std::optional<std::vector<managed_mem_cfg_t>> mem_layout,
                       std::optional<reg_t> start_pc) {
   managed_cfg_t *cfg = new managed_cfg_t();
   if (isa.has_value()) {
@@ -76,7 +125,11 @@ managed_cfg_t::create(std::optional<std::string> isa,
     cfg->set_priv(priv.value());
   }
   if (mem_layout.has_value()) {
-    cfg->mem_layout = mem_layout.value();
+    cfg->mem_layout.clear();
+    for (const auto &mem_cfg : mem_layout.value()) {
+      cfg->mem_layout.push_back(mem_cfg);
+      cfg->_mem_backings.push_back(mem_cfg.backing);
+    }
   }
   if (start_pc.has_value()) {
     cfg->start_pc = start_pc.value();
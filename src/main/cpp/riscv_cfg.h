@@ -16,11 +16,50 @@
 #ifndef _RISCV_CFG_H_
 #define _RISCV_CFG_H_
 
+#include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <riscv/cfg.h>
 
+class shared_mem_t;
+
+// host backing of a guest memory region
+//
+// - "anonymous": private zero pages, populated on first touch
+// - "hugepage": as "anonymous", with transparent huge pages requested
+// - "hugetlb": explicit huge pages (the size must be a multiple of 2 MiB)
+// - "file": the file at `path`, mapped shared or private (copy-on-write)
+// - "shm": the POSIX shared memory object `path` (e.g. "/guest"), always shared
+// - "shared": a window onto `region`, which may be attached to several sims
+struct mem_backing_t {
+  std::string kind = "anonymous";
+  std::string path;
+  bool shared = false;
+  std::shared_ptr<shared_mem_t> region;
+};
+
+// helper class for extending `mem_cfg_t` with a backing
+//
+// `cfg_t::mem_layout` holds `mem_cfg_t` by value, so the backing does not
+// survive in there. `managed_cfg_t` keeps the backings of its layout aside.
+class managed_mem_cfg_t : public mem_cfg_t {
+public:
+  managed_mem_cfg_t(reg_t base, reg_t size,
+                    const mem_backing_t &backing = mem_backing_t());
+
+public:
+  static managed_mem_cfg_t *create(reg_t base, reg_t size,
+                                   const std::string &backing,
+                                   std::optional<std::string> path,
+                                   bool shared,
+                                   std::shared_ptr<shared_mem_t> region);
+
+public:
+  mem_backing_t backing;
+};
+
 // helper class for extending `cfg_t`
 //
 // `cfg_t` contains `const char *` properties pointing to externally allocated
@@ -48,16 +87,20 @@ public:
   void set_isa(const std::string &isa);
   void set_priv(const std::string &priv);
 
+  // backing of `mem_layout[i]` (anonymous unless given at creation)
+  mem_backing_t get_mem_backing(size_t i) const;
+
 public:
-  static managed_cfg_t *create(std::optional<std::string> isa,
-                               std::optional<std::string> priv,
-                               std::optional<std::vector<mem_cfg_t>> mem_layout,
-                               std::optional<reg_t> start_pc);
+  static managed_cfg_t *
+  create(std::optional<std::string> isa, std::optional<std::string> priv,
+         std::optional<std::vector<managed_mem_cfg_t>> mem_layout,
+         std::optional<reg_t> start_pc);
 
 private:
   std::string _bootargs;
   std::string _isa;
   std::string _priv;
+  std::vector<mem_backing_t> _mem_backings;
 };
 
 #endif // _RISCV_CFG_H_
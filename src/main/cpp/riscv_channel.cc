@@ -0,0 +1,456 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <riscv/devices.h>
+
+#include "riscv_channel.h"
+
+static const uint32_t CHANNEL_MAGIC = 0x4d424f58; // "MBOX"
+
+static size_t align_up(size_t value, size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+size_t spsc_ring_t::footprint(uint32_t slots, uint32_t mtu) {
+  return align_up(sizeof(spsc_ring_t), 64) +
+         static_cast<size_t>(slots) * align_up(sizeof(uint32_t) + mtu, 64);
+}
+
+spsc_ring_t *spsc_ring_t::create(void *mem, uint32_t slots, uint32_t mtu) {
+  spsc_ring_t *ring = new (mem) spsc_ring_t();
+  ring->head.store(0, std::memory_order_relaxed);
+  ring->tail.store(0, std::memory_order_relaxed);
+  ring->slots = slots;
+  ring->mtu = mtu;
+  ring->slot_size = align_up(sizeof(uint32_t) + mtu, 64);
+  return ring;
+}
+
+bool spsc_ring_t::push(const void *data, uint32_t len) {
+  uint64_t t = tail.load(std::memory_order_relaxed);
+  if (len > mtu || t - head.load(std::memory_order_acquire) >= slots) {
+    return false;
+  }
+  uint8_t *s = slot(t);
+  std::memcpy(s, &len, sizeof(len));
+  std::memcpy(s + sizeof(len), data, len);
+  tail.store(t + 1, std::memory_order_release);
+  return true;
+}
+
+bool spsc_ring_t::full() const {
+  return tail.load(std::memory_order_relaxed) -
+             head.load(std::memory_order_acquire) >=
+         slots;
+}
+
+const uint8_t *spsc_ring_t::front(uint32_t *len) const {
+  uint64_t h = head.load(std::memory_order_relaxed);
+  if (h == tail.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  const uint8_t *s = slot(h);
+  std::memcpy(len, s, sizeof(*len));
+  return s + sizeof(*len);
+}
+
+void spsc_ring_t::pop() {
+  uint64_t h = head.load(std::memory_order_relaxed);
+  if (h != tail.load(std::memory_order_acquire)) {
+    head.store(h + 1, std::memory_order_release);
+  }
+}
+
+uint32_t spsc_ring_t::size() const {
+  return tail.load(std::memory_order_acquire) -
+         head.load(std::memory_order_relaxed);
+}
+
+uint32_t spsc_ring_t::get_slots() const {
+  return slots;
+}
+
+uint32_t spsc_ring_t::get_mtu() const {
+  return mtu;
+}
+
+uint8_t *spsc_ring_t::slot(uint64_t index) {
+  return reinterpret_cast<uint8_t *>(this) +
+         align_up(sizeof(spsc_ring_t), 64) + (index % slots) * slot_size;
+}
+
+const uint8_t *spsc_ring_t::slot(uint64_t index) const {
+  return reinterpret_cast<const uint8_t *>(this) +
+         align_up(sizeof(spsc_ring_t), 64) + (index % slots) * slot_size;
+}
+
+channel_t::channel_t(const std::string &name, uint32_t slots, uint32_t mtu,
+                     bool shm)
+    : name(name), shm(shm), owner(true), length(0), mem(nullptr),
+      rings{nullptr, nullptr} {
+  if (slots == 0 || mtu == 0 || mtu > mailbox_t::MAX_MTU) {
+    throw std::runtime_error("channel needs 1+ slots and an mtu of 1-4096");
+  }
+  size_t header_size = align_up(sizeof(header_t), 64);
+  length = header_size + 2 * spsc_ring_t::footprint(slots, mtu);
+  if (shm) {
+    map_shm();
+  } else {
+    mem = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      throw std::runtime_error("failed to allocate channel " + name);
+    }
+  }
+  header_t *header = static_cast<header_t *>(mem);
+  uint8_t *base = static_cast<uint8_t *>(mem) + header_size;
+  if (owner) {
+    header->slots = slots;
+    header->mtu = mtu;
+    rings[0] = spsc_ring_t::create(base, slots, mtu);
+    rings[1] = spsc_ring_t::create(base + spsc_ring_t::footprint(slots, mtu),
+                                   slots, mtu);
+    header->magic.store(CHANNEL_MAGIC, std::memory_order_release);
+    return;
+  }
+  // attached to an existing object, which dictates slots and mtu
+  for (int i = 0; i < 1000; i++) {
+    if (header->magic.load(std::memory_order_acquire) == CHANNEL_MAGIC) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (header->magic.load(std::memory_order_acquire) != CHANNEL_MAGIC ||
+      length < header_size + 2 * spsc_ring_t::footprint(header->slots,
+                                                        header->mtu)) {
+    munmap(mem, length);
+    throw std::runtime_error("shared memory of channel " + name +
+                             " is not initialized");
+  }
+  rings[0] = reinterpret_cast<spsc_ring_t *>(base);
+  rings[1] = reinterpret_cast<spsc_ring_t *>(
+      base + spsc_ring_t::footprint(header->slots, header->mtu));
+}
+
+channel_t::~channel_t() {
+  munmap(mem, length);
+  if (shm && owner) {
+    shm_unlink(("/pyspike-" + name).c_str());
+  }
+}
+
+void channel_t::map_shm() {
+  // the first process creates and formats the object, the others attach
+  std::string path = "/pyspike-" + name;
+  int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    owner = false;
+    fd = shm_open(path.c_str(), O_RDWR, 0600);
+  }
+  if (fd < 0) {
+    throw std::runtime_error("failed to open shared memory " + path + ": " +
+                             strerror(errno));
+  }
+  if (owner && ftruncate(fd, length) != 0) {
+    close(fd);
+    shm_unlink(path.c_str());
+    throw std::runtime_error("failed to resize shared memory " + path);
+  }
+  if (!owner) {
+    // wait for the owner to size the object
+    struct stat st = {};
+    for (int i = 0; i < 1000; i++) {
+      if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(header_t)) {
+      close(fd);
+      throw std::runtime_error("shared memory " + path + " is not sized");
+    }
+    length = st.st_size;
+  }
+  mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    if (owner) {
+      shm_unlink(path.c_str());
+    }
+    throw std::runtime_error("failed to map shared memory " + path);
+  }
+}
+
+spsc_ring_t *channel_t::tx(unsigned endpoint) {
+  return rings[endpoint & 1];
+}
+
+spsc_ring_t *channel_t::rx(unsigned endpoint) {
+  return rings[(endpoint & 1) ^ 1];
+}
+
+bool channel_t::send(unsigned endpoint, const std::string &data) {
+  return tx(endpoint)->push(data.data(), data.size());
+}
+
+std::optional<std::string> channel_t::recv(unsigned endpoint) {
+  uint32_t len;
+  const uint8_t *data = rx(endpoint)->front(&len);
+  if (data == nullptr) {
+    return std::nullopt;
+  }
+  std::string packet(reinterpret_cast<const char *>(data), len);
+  rx(endpoint)->pop();
+  return packet;
+}
+
+const std::string &channel_t::get_name() const {
+  return name;
+}
+
+uint32_t channel_t::get_slots() const {
+  return rings[0]->get_slots();
+}
+
+uint32_t channel_t::get_mtu() const {
+  return rings[0]->get_mtu();
+}
+
+bool channel_t::is_shm() const {
+  return shm;
+}
+
+void channel_t::attach(std::shared_ptr<channel_t> channel) {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  registry[channel->get_name()] = channel;
+}
+
+void channel_t::detach(const std::string &name) {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  registry.erase(name);
+}
+
+std::shared_ptr<channel_t> channel_t::lookup(const std::string &name) {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  auto it = registry.find(name);
+  if (it == registry.end()) {
+    throw std::runtime_error("unknown channel: " + name);
+  }
+  return it->second;
+}
+
+std::vector<std::string> channel_t::names() {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  std::vector<std::string> result;
+  for (const auto &[name, channel] : registry) {
+    result.push_back(name);
+  }
+  return result;
+}
+
+std::mutex channel_t::registry_lock;
+std::map<std::string, std::shared_ptr<channel_t>> channel_t::registry;
+
+mailbox_t::mailbox_t(const sim_t *sim, std::shared_ptr<channel_t> channel,
+                     unsigned endpoint, unsigned irq)
+    : sim(sim), channel(channel), tx(channel->tx(endpoint)),
+      rx(channel->rx(endpoint)), irq(sim, irq), ctrl(0),
+      tx_buf(MAX_MTU, 0), tx_packets(0), rx_packets(0), tx_drops(0) {
+  // NOP
+}
+
+bool mailbox_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > SIZE) {
+    return false;
+  }
+  if (addr >= RX_BUF) {
+    // zero-copy read of the packet at the head of the ring
+    uint32_t pkt_len = 0;
+    const uint8_t *pkt = rx->front(&pkt_len);
+    reg_t offset = addr - RX_BUF;
+    std::memset(bytes, 0, len);
+    if (pkt != nullptr && offset < pkt_len) {
+      std::memcpy(bytes, pkt + offset, std::min<reg_t>(len, pkt_len - offset));
+    }
+    return true;
+  }
+  if (addr >= TX_BUF) {
+    // the buffers are separate, accesses may not straddle them
+    if (addr + len > RX_BUF) {
+      return false;
+    }
+    std::memcpy(bytes, tx_buf.data() + (addr - TX_BUF), len);
+    return true;
+  }
+  if (len != 4 || addr % 4 != 0) {
+    return false;
+  }
+  uint32_t value = read_reg(addr);
+  std::memcpy(bytes, &value, sizeof(value));
+  return true;
+}
+
+bool mailbox_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (addr + len < addr || addr + len > SIZE || addr >= RX_BUF) {
+    return false;
+  }
+  if (addr >= TX_BUF) {
+    if (addr + len > RX_BUF) {
+      return false;
+    }
+    std::memcpy(tx_buf.data() + (addr - TX_BUF), bytes, len);
+    return true;
+  }
+  if (len != 4 || addr % 4 != 0) {
+    return false;
+  }
+  uint32_t value;
+  std::memcpy(&value, bytes, sizeof(value));
+  write_reg(addr, value);
+  return true;
+}
+
+reg_t mailbox_t::size() {
+  return SIZE;
+}
+
+void mailbox_t::tick(reg_t rtc_ticks) {
+  irq.tick(rtc_ticks);
+  update_interrupt();
+}
+
+uint64_t mailbox_t::get_tx_packets() const {
+  return tx_packets;
+}
+
+uint64_t mailbox_t::get_rx_packets() const {
+  return rx_packets;
+}
+
+uint64_t mailbox_t::get_tx_drops() const {
+  return tx_drops;
+}
+
+uint32_t mailbox_t::read_reg(reg_t addr) {
+  uint32_t len = 0;
+  switch (addr) {
+  case STATUS:
+    return (rx->front(&len) != nullptr ? 1 : 0) | (tx->full() ? 2 : 0);
+  case CTRL:
+    return ctrl;
+  case RX_LEN:
+    rx->front(&len);
+    return len;
+  case MTU:
+    return tx->get_mtu();
+  case TX_DROPS:
+    return static_cast<uint32_t>(tx_drops);
+  default:
+    return 0;
+  }
+}
+
+void mailbox_t::write_reg(reg_t addr, uint32_t value) {
+  switch (addr) {
+  case CTRL:
+    ctrl = value & 1;
+    update_interrupt();
+    break;
+  case TX_LEN:
+    if (tx->push(tx_buf.data(), value)) {
+      tx_packets++;
+    } else {
+      tx_drops++;
+    }
+    break;
+  case RX_POP:
+    if (rx->size() > 0) {
+      rx->pop();
+      rx_packets++;
+    }
+    update_interrupt();
+    break;
+  default:
+    break;
+  }
+}
+
+interrupt_line_t &mailbox_t::get_irq() {
+  return irq;
+}
+
+void mailbox_t::update_interrupt() {
+  bool level = (ctrl & 1) && rx->size() > 0;
+  irq.set_level(level);
+}
+
+// sargs: `(base, channel, endpoint = 0, irq = 0)`
+class mailbox_factory_t : public device_factory_t {
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override {
+    if (sargs.size() < 2) {
+      throw std::runtime_error(
+          "mailbox requires (base, channel[, endpoint[, irq]])");
+    }
+    if (base != nullptr) {
+      *base = std::stoull(sargs[0], nullptr, 16);
+    }
+    unsigned endpoint = sargs.size() > 2 ? std::stoul(sargs[2], nullptr, 0) : 0;
+    unsigned irq = sargs.size() > 3 ? std::stoul(sargs[3], nullptr, 0) : 0;
+    return new mailbox_t(sim, channel_t::lookup(sargs[1]), endpoint, irq);
+  }
+
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override {
+    if (sargs.empty()) {
+      return "";
+    }
+    reg_t base = std::stoull(sargs[0], nullptr, 16);
+    unsigned irq = sargs.size() > 3 ? std::stoul(sargs[3], nullptr, 0) : 0;
+    std::ostringstream s;
+    s << std::hex << "    mailbox@" << base << " {\n"
+      << "      compatible = \"pyspike,mailbox\";\n";
+    if (irq != 0) {
+      s << "      interrupt-parent = <&PLIC>;\n"
+        << "      interrupts = <" << std::dec << irq << std::hex << ">;\n";
+    }
+    s << "      reg = <0x" << (base >> 32) << " 0x" << (base & 0xffffffff)
+      << " 0x0 0x" << mailbox_t::SIZE << ">;\n"
+      << "    };\n";
+    return s.str();
+  }
+};
+
+static bool mailbox_registered = [] {
+  mmio_device_map()["mailbox"] = new mailbox_factory_t();
+  return true;
+}();
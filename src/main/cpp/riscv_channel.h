@@ -0,0 +1,207 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_CHANNEL_H_
+#define _RISCV_CHANNEL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/sim.h>
+
+#include "riscv_irq.h"
+
+// lock-free single-producer single-consumer ring of packets
+//
+// the ring lives in memory that it does not own (a heap or shared memory
+// mapping), and holds nothing but plain data and address-free atomics, so
+// producer and consumer may be in different processes.
+class spsc_ring_t {
+public:
+  // bytes needed for a ring of `slots` packets of up to `mtu` bytes
+  static size_t footprint(uint32_t slots, uint32_t mtu);
+
+  // formats a ring in `mem` (by the creator only)
+  static spsc_ring_t *create(void *mem, uint32_t slots, uint32_t mtu);
+
+public:
+  // producer side: enqueue a packet, false if the ring is full
+  bool push(const void *data, uint32_t len);
+  // producer side: whether a push would fail
+  bool full() const;
+
+  // consumer side: the packet at the head, `nullptr` if the ring is empty
+  const uint8_t *front(uint32_t *len) const;
+  // consumer side: drop the packet at the head
+  void pop();
+  // consumer side: number of queued packets
+  uint32_t size() const;
+
+public:
+  uint32_t get_slots() const;
+  uint32_t get_mtu() const;
+
+private:
+  uint8_t *slot(uint64_t index);
+  const uint8_t *slot(uint64_t index) const;
+
+private:
+  // head and tail on separate cache lines, to avoid false sharing
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) uint32_t slots;
+  uint32_t mtu;
+  uint32_t slot_size;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "spsc_ring_t requires lock-free 64-bit atomics");
+
+// bidirectional point-to-point channel with endpoints 0 and 1
+//
+// every endpoint sends to its own ring and receives from the peer's one. a
+// channel is in-process (anonymous memory), or backed by the POSIX shared
+// memory object `/pyspike-<name>`, which connects sims of different processes.
+// channels are looked up by name when mailbox devices are instantiated.
+class channel_t {
+public:
+  channel_t(const std::string &name, uint32_t slots, uint32_t mtu, bool shm);
+  ~channel_t();
+
+private:
+  channel_t(const channel_t &) = delete;
+  channel_t &operator=(const channel_t &) = delete;
+
+public:
+  // the ring that `endpoint` sends to
+  spsc_ring_t *tx(unsigned endpoint);
+  // the ring that `endpoint` receives from
+  spsc_ring_t *rx(unsigned endpoint);
+
+public:
+  // send / receive on behalf of `endpoint`. the sim owning `endpoint`, if any,
+  // must not be running, as each ring admits a single producer and consumer.
+  bool send(unsigned endpoint, const std::string &data);
+  std::optional<std::string> recv(unsigned endpoint);
+
+public:
+  const std::string &get_name() const;
+  uint32_t get_slots() const;
+  uint32_t get_mtu() const;
+  bool is_shm() const;
+
+public:
+  // registry of channels by name
+  static void attach(std::shared_ptr<channel_t> channel);
+  static void detach(const std::string &name);
+  static std::shared_ptr<channel_t> lookup(const std::string &name);
+  static std::vector<std::string> names();
+
+private:
+  struct header_t {
+    std::atomic<uint32_t> magic;
+    uint32_t slots;
+    uint32_t mtu;
+  };
+
+private:
+  void map_shm();
+
+private:
+  std::string name;
+  bool shm;
+  bool owner; // formats the rings, and unlinks the shm object
+  size_t length;
+  void *mem;
+  spsc_ring_t *rings[2];
+
+private:
+  static std::mutex registry_lock;
+  static std::map<std::string, std::shared_ptr<channel_t>> registry;
+};
+
+// mailbox device, one endpoint of a `channel_t`
+//
+// registered as "mailbox" in `mmio_device_map`, with sargs
+// `(base, channel, endpoint, irq)`. all registers are 32-bit:
+//
+// - 0x00 STATUS: bit 0 RX_AVAIL, bit 1 TX_FULL (read-only)
+// - 0x04 CTRL: bit 0 enables the RX_AVAIL interrupt
+// - 0x08 TX_LEN: writing N sends the first N bytes of TX_BUF
+// - 0x0c RX_LEN: length of the received packet at RX_BUF, 0 if none
+// - 0x10 RX_POP: writing anything drops the received packet
+// - 0x14 MTU (read-only)
+// - 0x18 TX_DROPS: packets dropped on TX_LEN because the ring was full
+// - 0x1000 TX_BUF, 0x2000 RX_BUF (read-only, zero-copy view of the ring)
+//
+// the interrupt level is updated on every tick and on RX_POP.
+class mailbox_t : public abstract_device_t {
+public:
+  mailbox_t(const sim_t *sim, std::shared_ptr<channel_t> channel,
+            unsigned endpoint, unsigned irq);
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual reg_t size() override;
+  virtual void tick(reg_t rtc_ticks) override;
+
+public:
+  uint64_t get_tx_packets() const;
+  uint64_t get_rx_packets() const;
+  uint64_t get_tx_drops() const;
+
+public:
+  interrupt_line_t &get_irq();
+
+public:
+  static const reg_t STATUS = 0x00;
+  static const reg_t CTRL = 0x04;
+  static const reg_t TX_LEN = 0x08;
+  static const reg_t RX_LEN = 0x0c;
+  static const reg_t RX_POP = 0x10;
+  static const reg_t MTU = 0x14;
+  static const reg_t TX_DROPS = 0x18;
+  static const reg_t TX_BUF = 0x1000;
+  static const reg_t RX_BUF = 0x2000;
+  static const reg_t SIZE = 0x3000;
+  static const uint32_t MAX_MTU = 0x1000;
+
+private:
+  uint32_t read_reg(reg_t addr);
+  void write_reg(reg_t addr, uint32_t value);
+  void update_interrupt();
+
+private:
+  const sim_t *sim;
+  std::shared_ptr<channel_t> channel;
+  spsc_ring_t *tx;
+  spsc_ring_t *rx;
+  interrupt_line_t irq;
+  uint32_t ctrl;
+  std::vector<uint8_t> tx_buf;
+  uint64_t tx_packets;
+  uint64_t rx_packets;
+  uint64_t tx_drops;
+};
+
+#endif // _RISCV_CHANNEL_H_
@@ -13,13 +13,18 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 
 #include <pybind11/embed.h>
 
+#include <riscv/encoding.h>
 #include <riscv/processor.h>
 #include <riscv/trap.h>
 
+#include "py_bridge.h"
 #include "riscv_csrs.h"
 
 namespace py = pybind11;
@@ -34,13 +39,341 @@ void py_csr_t::verify_permissions(insn_t insn, bool write) const {
 }
 
 reg_t py_csr_t::read() const noexcept {
+  callback_probe_t probe(read_site, [this] { return site("read"); });
   PYBIND11_OVERRIDE_PURE(reg_t, csr_t, read);
 }
 
 bool py_csr_t::unlogged_write(const reg_t val) noexcept {
+  callback_probe_t probe(write_site,
+                         [this] { return site("unlogged_write"); });
   PYBIND11_OVERRIDE_PURE(bool, csr_t, unlogged_write, val);
 }
 
 reg_t py_csr_t::written_value() const noexcept {
   PYBIND11_OVERRIDE(reg_t, csr_t, written_value);
 }
+
+callback_site_t *py_csr_t::site(const char *method) const {
+  std::ostringstream oss;
+  oss << callback_stats_t::type_name<csr_t>(this) << "@0x" << std::hex
+      << address << "." << method;
+  return callback_stats_t::site("csr", oss.str());
+}
+
+native_csr_t::native_csr_t(processor_t *const proc, const reg_t addr,
+                           const reg_t reset_value, const reg_t write_mask,
+                           const std::map<reg_t, std::vector<reg_t>> &warl,
+                           callback_t on_write)
+    : csr_t(proc, addr), val(reset_value), reset_value(reset_value),
+      write_mask(write_mask), warl(warl), on_write(on_write) {
+  // NOP
+}
+
+reg_t native_csr_t::read() const noexcept {
+  return val;
+}
+
+reg_t native_csr_t::legalize(reg_t val) const {
+  reg_t legal = (this->val & ~write_mask) | (val & write_mask);
+  for (const auto &[mask, values] : warl) {
+    reg_t field = legal & mask;
+    if (std::find(values.begin(), values.end(), field) == values.end()) {
+      legal = (legal & ~mask) | (this->val & mask);
+    }
+  }
+  return legal;
+}
+
+void native_csr_t::set(reg_t val) {
+  if (this->val != val) {
+    this->val = val;
+    changed();
+  }
+}
+
+void native_csr_t::reset() {
+  set(reset_value);
+}
+
+reg_t native_csr_t::get_reset_value() const {
+  return reset_value;
+}
+
+reg_t native_csr_t::get_write_mask() const {
+  return write_mask;
+}
+
+void native_csr_t::watch(std::function<void()> watcher) {
+  watchers.push_back(watcher);
+}
+
+bool native_csr_t::unlogged_write(const reg_t val) noexcept {
+  reg_t old = this->val;
+  this->val = legalize(val);
+  if (this->val == old) {
+    return true;
+  }
+  changed();
+  if (on_write) {
+    try {
+      on_write(old, this->val);
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+  return true;
+}
+
+void native_csr_t::changed() {
+  for (const auto &watcher : watchers) {
+    watcher();
+  }
+}
+
+watched_csr_t::watched_csr_t(processor_t *const proc, csr_t_p delegate)
+    : csr_t(proc, delegate->address), delegate(delegate), watchers() {
+  // NOP
+}
+
+void watched_csr_t::verify_permissions(insn_t insn, bool write) const {
+  delegate->verify_permissions(insn, write);
+}
+
+reg_t watched_csr_t::read() const noexcept {
+  return delegate->read();
+}
+
+csr_t_p watched_csr_t::get_delegate() const {
+  return delegate;
+}
+
+void watched_csr_t::watch(std::function<void()> watcher) {
+  watchers.push_back(watcher);
+}
+
+bool watched_csr_t::unlogged_write(const reg_t val) noexcept {
+  // the delegate logs its own write
+  delegate->write(val);
+  for (const auto &watcher : watchers) {
+    watcher();
+  }
+  return false;
+}
+
+cached_csr_t::cached_csr_t(processor_t *const proc, const reg_t addr,
+                           compute_t compute, write_t on_write,
+                           std::optional<uint64_t> ttl)
+    : csr_t(proc, addr), compute(compute), on_write(on_write), ttl(ttl),
+      val(0), valid(false), refreshed_at(0), refreshes(0), hits(0) {
+  // NOP
+}
+
+reg_t cached_csr_t::read() const noexcept {
+  if (valid && ttl.has_value() && instret() - refreshed_at >= ttl.value()) {
+    valid = false;
+  }
+  if (valid) {
+    hits++;
+    return val;
+  }
+  try {
+    val = compute();
+  } catch (std::exception &e) {
+    // keep serving the stale value
+    std::cerr << e.what() << std::endl;
+  }
+  valid = true;
+  refreshed_at = instret();
+  refreshes++;
+  return val;
+}
+
+void cached_csr_t::invalidate() {
+  valid = false;
+}
+
+void cached_csr_t::depend_on(csr_t_p csr) {
+  std::weak_ptr<cached_csr_t> self = weak_from_this();
+  auto watcher = [self] {
+    if (auto csr = self.lock()) {
+      csr->invalidate();
+    }
+  };
+  if (auto native = std::dynamic_pointer_cast<native_csr_t>(csr)) {
+    native->watch(watcher);
+    return;
+  }
+  auto it = state->csrmap.find(csr->address);
+  auto watched = it != state->csrmap.end()
+                     ? std::dynamic_pointer_cast<watched_csr_t>(it->second)
+                     : nullptr;
+  if (watched == nullptr && it != state->csrmap.end() && it->second == csr) {
+    watched = std::make_shared<watched_csr_t>(proc, csr);
+    it->second = watched;
+  } else if (watched == nullptr ||
+             (watched != csr && watched->get_delegate() != csr)) {
+    std::ostringstream oss;
+    oss << "CSR 0x" << std::hex << csr->address << " is not on the hart";
+    throw std::runtime_error(oss.str());
+  }
+  watched->watch(watcher);
+}
+
+void cached_csr_t::depend_on(reg_t addr) {
+  auto it = state->csrmap.find(addr);
+  if (it == state->csrmap.end()) {
+    std::ostringstream oss;
+    oss << "CSR 0x" << std::hex << addr << " is not on the hart";
+    throw std::runtime_error(oss.str());
+  }
+  depend_on(it->second);
+}
+
+std::optional<reg_t> cached_csr_t::peek() const {
+  if (!valid || (ttl.has_value() && instret() - refreshed_at >= ttl.value())) {
+    return std::nullopt;
+  }
+  return val;
+}
+
+bool cached_csr_t::is_valid() const {
+  return valid;
+}
+
+std::optional<uint64_t> cached_csr_t::get_ttl() const {
+  return ttl;
+}
+
+uint64_t cached_csr_t::get_refreshes() const {
+  return refreshes;
+}
+
+uint64_t cached_csr_t::get_hits() const {
+  return hits;
+}
+
+bool cached_csr_t::unlogged_write(const reg_t val) noexcept {
+  if (on_write) {
+    try {
+      on_write(val);
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+  invalidate();
+  return true;
+}
+
+uint64_t cached_csr_t::instret() const {
+  return state->minstret->read();
+}
+
+// the value of `csr`, unless reading it has side effects not asked for
+static std::optional<reg_t> peek_csr(const csr_t_p &csr, bool side_effects) {
+  if (auto watched = std::dynamic_pointer_cast<watched_csr_t>(csr)) {
+    return peek_csr(watched->get_delegate(), side_effects);
+  }
+  if (auto cached = std::dynamic_pointer_cast<cached_csr_t>(csr)) {
+    if (auto value = cached->peek()) {
+      return value;
+    }
+    if (!side_effects) {
+      return std::nullopt;
+    }
+  }
+  return csr->read();
+}
+
+csr_snapshot_t csr_snapshot_t::take(processor_t &proc,
+                                    std::optional<unsigned> priv,
+                                    std::optional<bool> custom,
+                                    bool side_effects) {
+  csr_snapshot_t snapshot;
+  const auto &csrmap = proc.get_state()->csrmap;
+  snapshot.entries.reserve(csrmap.size());
+  for (const auto &[addr, csr] : csrmap) {
+    if (priv.has_value() && get_field(addr, 0x300) > priv.value()) {
+      continue;
+    }
+    if (custom.has_value() && is_custom(addr) != custom.value()) {
+      continue;
+    }
+    if (auto value = peek_csr(csr, side_effects)) {
+      snapshot.entries.push_back({addr, value.value()});
+    }
+  }
+  std::sort(snapshot.entries.begin(), snapshot.entries.end(),
+            [](const entry_t &a, const entry_t &b) { return a.addr < b.addr; });
+  return snapshot;
+}
+
+size_t csr_snapshot_t::restore(processor_t &proc) const {
+  const auto &csrmap = proc.get_state()->csrmap;
+  size_t written = 0;
+  auto write = [&](const entry_t &entry) {
+    auto it = csrmap.find(entry.addr);
+    if (it == csrmap.end() || get_field(entry.addr, 0xc00) == 3 ||
+        is_alias(entry.addr)) {
+      return;
+    }
+    it->second->write(entry.value);
+    written++;
+  };
+  // the extensions enabled by misa decide on the legal values of others
+  if (auto misa = get(CSR_MISA)) {
+    write({CSR_MISA, misa.value()});
+  }
+  for (const auto &entry : entries) {
+    if (entry.addr != CSR_MISA) {
+      write(entry);
+    }
+  }
+  return written;
+}
+
+const std::vector<csr_snapshot_t::entry_t> &
+csr_snapshot_t::get_entries() const {
+  return entries;
+}
+
+std::optional<reg_t> csr_snapshot_t::get(reg_t addr) const {
+  auto it = std::lower_bound(
+      entries.begin(), entries.end(), addr,
+      [](const entry_t &entry, reg_t addr) { return entry.addr < addr; });
+  if (it == entries.end() || it->addr != addr) {
+    return std::nullopt;
+  }
+  return it->value;
+}
+
+bool csr_snapshot_t::is_custom(reg_t addr) {
+  // 0x800-0x8ff, and 0x_c0-0x_ff of the 0x5__-0xf__ blocks but 0x8__
+  unsigned block = (addr >> 8) & 0xf;
+  return block == 0x8 || (block >= 0x5 && (addr & 0xc0) == 0xc0);
+}
+
+bool csr_snapshot_t::is_alias(reg_t addr) {
+  switch (addr) {
+  case CSR_FCSR:    // fflags, frm
+  case CSR_VCSR:    // vxsat, vxrm
+  case CSR_SSTATUS: // mstatus
+  case CSR_SIE:     // mie
+  case CSR_SIP:     // mip
+  case CSR_HIE:     // mie
+  case CSR_HIP:     // mip
+  case CSR_VSIE:    // mie
+  case CSR_VSIP:    // mip
+    return true;
+  default:
+    return false;
+  }
+}
+
+csr_t_p py_csr_cast(py::handle py_csr) {
+  if (dynamic_cast<py_csr_t *>(py::cast<csr_t *>(py_csr)) != nullptr) {
+    return PythonBridge::getInstance()
+        .track<py_csr_t *>(py_csr)
+        ->shared_from_this();
+  }
+  return py::cast<csr_t_p>(py_csr);
+}
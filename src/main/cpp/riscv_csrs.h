@@ -16,10 +16,18 @@
 #ifndef _RISCV_CSRS_H_
 #define _RISCV_CSRS_H_
 
+#include <functional>
+#include <map>
 #include <memory>
+#include <optional>
+#include <vector>
 
 #include <riscv/csrs.h>
 
+#include <pybind11/pybind11.h>
+
+#include "riscv_stats.h"
+
 class py_csr_t : public csr_t,
                  public std::enable_shared_from_this<csr_t>,
                  public pybind11::trampoline_self_life_support {
@@ -37,9 +45,187 @@ public:
   using csr_t::proc;
   using csr_t::state;
 
+private:
+  // `riscv.stats` site of a python method
+  callback_site_t *site(const char *method) const;
+
 private:
   // keep myself alive till after the python object is garbage-collected
   csr_t_p keepalive;
+  mutable callback_site_t *read_site = nullptr;
+  mutable callback_site_t *write_site = nullptr;
+};
+
+// CSR whose value lives in C++
+//
+// a write keeps the bits outside of `write_mask`, and each WARL field (a mask
+// of `warl`) keeps its old value if written one that is not listed as legal.
+// `on_write(old, new)` is called on writes that change the value, if at all,
+// so that reads never leave C++.
+class native_csr_t : public csr_t {
+public:
+  typedef std::function<void(reg_t, reg_t)> callback_t;
+
+public:
+  native_csr_t(processor_t *const proc, const reg_t addr,
+               const reg_t reset_value, const reg_t write_mask,
+               const std::map<reg_t, std::vector<reg_t>> &warl,
+               callback_t on_write);
+
+public:
+  virtual reg_t read() const noexcept override;
+
+public:
+  // the value `val` would be written as
+  reg_t legalize(reg_t val) const;
+  // sets the value as is, without calling `on_write`
+  void set(reg_t val);
+  void reset();
+
+public:
+  reg_t get_reset_value() const;
+  reg_t get_write_mask() const;
+
+public:
+  // `watcher` is called whenever the value changes
+  void watch(std::function<void()> watcher);
+
+protected:
+  virtual bool unlogged_write(const reg_t val) noexcept override;
+
+private:
+  void changed();
+
+private:
+  reg_t val;
+  reg_t reset_value;
+  reg_t write_mask;
+  std::map<reg_t, std::vector<reg_t>> warl;
+  callback_t on_write;
+  std::vector<std::function<void()>> watchers;
+};
+
+// stand-in for another CSR in the csrmap of its hart, calling watchers after
+// every write to it through the csrmap (CSR instructions, `put_csr`)
+//
+// writes made by the hart itself (e.g. of mstatus on traps) bypass it.
+class watched_csr_t : public csr_t {
+public:
+  watched_csr_t(processor_t *const proc, csr_t_p delegate);
+
+public:
+  virtual void verify_permissions(insn_t insn, bool write) const override;
+  virtual reg_t read() const noexcept override;
+
+public:
+  csr_t_p get_delegate() const;
+  void watch(std::function<void()> watcher);
+
+protected:
+  virtual bool unlogged_write(const reg_t val) noexcept override;
+
+private:
+  csr_t_p delegate;
+  std::vector<std::function<void()>> watchers;
 };
 
+// CSR of derived state, computed on demand and cached in C++
+//
+// reads are served from the cached value, and `compute()` is only called on
+// the first read after the cache has been invalidated: explicitly (e.g. by a
+// device), by a dependency (see `depend_on`), by a write to the CSR itself
+// (passed to `on_write`, if any), or once `ttl` instructions have been
+// retired since the last refresh.
+class cached_csr_t : public csr_t,
+                     public std::enable_shared_from_this<cached_csr_t> {
+public:
+  typedef std::function<reg_t()> compute_t;
+  typedef std::function<void(reg_t)> write_t;
+
+public:
+  cached_csr_t(processor_t *const proc, const reg_t addr, compute_t compute,
+               write_t on_write, std::optional<uint64_t> ttl);
+
+public:
+  virtual reg_t read() const noexcept override;
+
+public:
+  void invalidate();
+  // invalidate on every change of a native CSR, or else on every write to
+  // `csr`, which must be in the csrmap of the hart, and is replaced there by a
+  // `watched_csr_t` (once)
+  void depend_on(csr_t_p csr);
+  // ... on the CSR at `addr` in the csrmap of the hart
+  void depend_on(reg_t addr);
+
+public:
+  // the cached value if still valid, without refreshing it or counting a hit
+  std::optional<reg_t> peek() const;
+
+public:
+  bool is_valid() const;
+  std::optional<uint64_t> get_ttl() const;
+  uint64_t get_refreshes() const;
+  uint64_t get_hits() const;
+
+protected:
+  virtual bool unlogged_write(const reg_t val) noexcept override;
+
+private:
+  uint64_t instret() const;
+
+private:
+  compute_t compute;
+  write_t on_write;
+  std::optional<uint64_t> ttl;
+  mutable reg_t val;
+  mutable bool valid;
+  mutable uint64_t refreshed_at;
+  mutable uint64_t refreshes;
+  mutable uint64_t hits;
+};
+
+// values of all CSRs of a hart, sorted by address
+//
+// snapshots read each CSR once, without permission checks (like `get_csr`
+// with `peek`), optionally keeping only the CSRs accessible at privilege
+// level `priv` (0 U, 1 S, 2 H, 3 M) and below, or only the custom (`custom`)
+// or standard (`not custom`) ones. python CSRs are read through their `read`.
+// cached CSRs whose value is not valid are left out, unless `side_effects`
+// allows refreshing them.
+class csr_snapshot_t {
+public:
+  struct entry_t {
+    reg_t addr;
+    reg_t value;
+  };
+
+public:
+  static csr_snapshot_t take(processor_t &proc, std::optional<unsigned> priv,
+                             std::optional<bool> custom, bool side_effects);
+
+  // writes the values back, skipping read-only and missing CSRs, and the
+  // views of others (see `is_alias`), and misa first. returns the number of
+  // CSRs written.
+  size_t restore(processor_t &proc) const;
+
+public:
+  const std::vector<entry_t> &get_entries() const;
+  std::optional<reg_t> get(reg_t addr) const;
+
+public:
+  // in the address ranges reserved for custom CSRs
+  static bool is_custom(reg_t addr);
+  // a view of CSRs at other addresses (e.g. sstatus of mstatus, fcsr of
+  // fflags and frm), whose state a snapshot holds twice
+  static bool is_alias(reg_t addr);
+
+private:
+  std::vector<entry_t> entries;
+};
+
+// shared_ptr to the CSR of a python object, either a `py_csr_t` subclass
+// (kept alive by the bridge) or a native CSR
+csr_t_p py_csr_cast(pybind11::handle py_csr);
+
 #endif // _RISCV_CSRS_H_
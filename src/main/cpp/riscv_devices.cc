@@ -13,7 +13,10 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <sstream>
 
 #include "riscv_devices.h"
 
@@ -22,7 +25,10 @@
 namespace py = pybind11;
 
 bool py_abstract_device_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  // the sim may run without the GIL (see `py_sim_t::run`)
+  py::gil_scoped_acquire gil;
   try {
+    callback_probe_t probe(sites[LOAD], [this] { return site("load"); });
     py::function py_method = py::get_override(this, "load");
     py::bytes py_result = py_method(addr, len);
     py::buffer_info buf = py::cast<py::buffer>(py_result).request();
@@ -38,7 +44,9 @@ bool py_abstract_device_t::load(reg_t addr, size_t len, uint8_t *bytes) {
 }
 
 bool py_abstract_device_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  py::gil_scoped_acquire gil;
   try {
+    callback_probe_t probe(sites[STORE], [this] { return site("store"); });
     py::function py_method = py::get_override(this, "store");
     py_method(addr, py::bytes(reinterpret_cast<const char *>(bytes), len));
     return true;
@@ -53,7 +61,55 @@ reg_t py_abstract_device_t::size() {
 }
 
 void py_abstract_device_t::tick(reg_t rtc_ticks) {
-  PYBIND11_OVERRIDE_PURE(void, abstract_device_t, tick, rtc_ticks);
+  for (auto &line : lines) {
+    line->tick(rtc_ticks);
+  }
+  if (tick_divisor == 0) {
+    return;
+  }
+  tick_pending += rtc_ticks;
+  if (++tick_count < tick_divisor) {
+    return;
+  }
+  reg_t ticks = tick_pending;
+  tick_count = 0;
+  tick_pending = 0;
+  callback_probe_t probe(sites[TICK], [this] { return site("tick"); });
+  PYBIND11_OVERRIDE_PURE(void, abstract_device_t, tick, ticks);
+}
+
+callback_site_t *py_abstract_device_t::site(const char *method) {
+  std::ostringstream oss;
+  oss << callback_stats_t::type_name<abstract_device_t>(this);
+  if (base) {
+    oss << "@0x" << std::hex << *base;
+  }
+  oss << "." << method;
+  return callback_stats_t::site("device", oss.str());
+}
+
+void py_abstract_device_t::set_base(reg_t base) {
+  this->base = base;
+  // sites are looked up again, under the new name
+  std::fill(std::begin(sites), std::end(sites), nullptr);
+}
+
+void py_abstract_device_t::attach_line(
+    std::shared_ptr<interrupt_line_t> line) {
+  lines.push_back(line);
+}
+
+unsigned py_abstract_device_t::get_tick_divisor() const {
+  return tick_divisor;
+}
+
+void py_abstract_device_t::set_tick_divisor(unsigned divisor) {
+  tick_divisor = divisor;
+  if (divisor == 0) {
+    // unsubscribed devices do not catch up when subscribed again
+    tick_count = 0;
+    tick_pending = 0;
+  }
 }
 
 py_device_factory_t::py_device_factory_t() {
@@ -68,18 +124,36 @@ abstract_device_t *py_device_factory_t::parse_from_fdt(
     py::args py_sargs = py::cast(sargs);
     py::object py_result = py_method(fdt, sim, *py_sargs);
     py::handle py_dev;
+    std::optional<reg_t> py_base;
     if (py::isinstance<py::tuple>(py_result)) {
       // if py_method returns a tuple, assume it's `(abstract_device_t, int)`
       py::tuple py_tuple_result = py_result.cast<py::tuple>();
-      if ((base != nullptr) && (py_tuple_result.size() > 1)) {
-        *base = py_tuple_result[1].cast<reg_t>();
+      if ((py_tuple_result.size() > 1) && !py_tuple_result[1].is_none()) {
+        py_base = py_tuple_result[1].cast<reg_t>();
+      }
+      if ((base != nullptr) && py_base) {
+        *base = *py_base;
       }
       py_dev = py_tuple_result[0];
     } else {
       // otherwise, assume it's just `abstract_device_t`
       py_dev = py_result;
     }
-    return PythonBridge::getInstance().track<abstract_device_t *>(py_dev);
+    // counted for the sim, though owned (and deleted) by it: python hands
+    // the device over, and a python subclass stays alive as long as it
+    PythonBridge::getInstance().track<abstract_device_t *>(py_dev);
+    abstract_device_t *dev =
+        py_dev.cast<std::unique_ptr<abstract_device_t>>().release();
+    auto *py_abstract_dev = dynamic_cast<py_abstract_device_t *>(dev);
+    if (py_abstract_dev != nullptr) {
+      if (auto divisor = tick_divisor()) {
+        py_abstract_dev->set_tick_divisor(*divisor);
+      }
+      if (py_base) {
+        py_abstract_dev->set_base(*py_base);
+      }
+    }
+    return dev;
   } catch (py::error_already_set &e) {
     std::cerr << e.what() << std::endl;
   }
@@ -100,6 +174,27 @@ py_device_factory_t::generate_dts(const sim_t *sim,
   return "";
 }
 
+bool py_device_factory_t::dts_deterministic() const {
+  py::object py_self = py::cast(static_cast<const device_factory_t *>(this));
+  return py::getattr(py_self, "dts_deterministic", py::bool_(false))
+      .cast<bool>();
+}
+
+std::string py_device_factory_t::dts_version() const {
+  py::object py_self = py::cast(static_cast<const device_factory_t *>(this));
+  return py::str(py::getattr(py_self, "dts_version", py::str("")))
+      .cast<std::string>();
+}
+
+std::optional<unsigned> py_device_factory_t::tick_divisor() const {
+  py::object py_self = py::cast(static_cast<const device_factory_t *>(this));
+  py::object py_divisor = py::getattr(py_self, "tick_divisor", py::none());
+  if (py_divisor.is_none()) {
+    return std::nullopt;
+  }
+  return py_divisor.cast<unsigned>();
+}
+
 py_mmio_factory_map_t::py_mmio_factory_map_t() {
   // NOP
 }
@@ -119,6 +214,8 @@ py_mmio_factory_map_t::getitem(const std::string &name) const {
 
 void py_mmio_factory_map_t::setitem(const std::string &name,
                                     pybind11::handle py_mmio_fact) {
+  // the registry outlives any sim
+  PythonBridge::scope_guard_t scope(PythonBridge::GLOBAL);
   mmio_device_map()[name] =
       PythonBridge::getInstance().track<const device_factory_t *>(py_mmio_fact);
 }
@@ -180,15 +277,11 @@ reg_t py_mmio_size(abstract_device_t &device) {
   if (py_method) {
     return py::cast<reg_t>(py_method());
   }
-  throw std::runtime_error("size failed");
+  return device.size();
 }
 
 void py_mmio_tick(abstract_device_t &device, reg_t rtc_ticks) {
-  py::function py_method = py::get_override(&device, "tick");
-  if (py_method) {
-    py_method(rtc_ticks);
-    return;
-  }
+  // through the trampoline, as spike does, so the tick divisor applies
   device.tick(rtc_ticks);
 }
 
@@ -16,6 +16,10 @@
 #ifndef _RISCV_DEVICE_H_
 #define _RISCV_DEVICE_H_
 
+#include <memory>
+#include <optional>
+#include <vector>
+
 #include <riscv/abstract_device.h>
 #include <riscv/sim.h>
 
@@ -23,6 +27,8 @@
 #include <pybind11/stl.h>
 
 #include "py_bridge.h"
+#include "riscv_irq.h"
+#include "riscv_stats.h"
 
 // trampoline helper class for extending abstract_device_t
 class py_abstract_device_t : public abstract_device_t,
@@ -39,6 +45,33 @@ public:
   virtual reg_t size() override;
   // py signature: `(rtc_ticks: int) -> None`
   virtual void tick(reg_t rtc_ticks) override;
+
+public:
+  // python `tick` is called once every `divisor` spike ticks (with the sum of
+  // their `rtc_ticks`), or never if 0. skipped ticks do not enter python.
+  unsigned get_tick_divisor() const;
+  void set_tick_divisor(unsigned divisor);
+
+  // interrupt lines ticked natively on every spike tick, before (and
+  // regardless of) the python `tick`, so that pulses last their rtc ticks
+  void attach_line(std::shared_ptr<interrupt_line_t> line);
+
+  // the address a factory placed the device at, which tells apart the
+  // `riscv.stats` sites of devices of the same class
+  void set_base(reg_t base);
+
+private:
+  // `riscv.stats` site of a python method, `Class@0x<base>.method` once placed
+  callback_site_t *site(const char *method);
+
+private:
+  unsigned tick_divisor = 1;
+  unsigned tick_count = 0;
+  reg_t tick_pending = 0;
+  std::vector<std::shared_ptr<interrupt_line_t>> lines;
+  std::optional<reg_t> base;
+  enum { LOAD, STORE, TICK };
+  callback_site_t *sites[3] = {};
 };
 
 // trampoline helper class for extending device_factory_t
@@ -57,6 +90,16 @@ public:
   virtual std::string
   generate_dts(const sim_t *sim,
                const std::vector<std::string> &sargs) const override;
+
+public:
+  // py attribute: `dts_deterministic: bool = False`, whether `generate_dts`
+  // depends on nothing but `sargs`, so its dts may be cached
+  bool dts_deterministic() const;
+  // py attribute: `dts_version: str = ""`, bumped to invalidate cached dts
+  std::string dts_version() const;
+  // py attribute: `tick_divisor: int | None = None`, applied to the devices
+  // created by `parse_from_fdt` unless None
+  std::optional<unsigned> tick_divisor() const;
 };
 
 // helper class for accessing mmio_device_map
@@ -23,6 +23,10 @@
 namespace py = pybind11;
 
 std::string py_arg_t::to_string(insn_t insn) const {
+  callback_probe_t probe(to_string_site, [this] {
+    return callback_stats_t::site("disasm_arg",
+                                  callback_stats_t::type_name<arg_t>(this));
+  });
   PYBIND11_OVERLOAD_PURE(std::string, arg_t, to_string, insn);
 }
 
@@ -22,9 +22,15 @@
 
 #include <pybind11/pybind11.h>
 
+#include "riscv_stats.h"
+
 class py_arg_t : public arg_t, public pybind11::trampoline_self_life_support {
 public:
   virtual std::string to_string(insn_t val) const override;
+
+private:
+  // `riscv.stats` site of `to_string`
+  mutable callback_site_t *to_string_site = nullptr;
 };
 
 // py signature: disasm_insn_t(name: str, match: int, mask: int, *args: arg_t)
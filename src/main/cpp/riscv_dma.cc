@@ -0,0 +1,249 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <riscv/devices.h>
+#include <riscv/mmu.h>
+
+#include "riscv_dma.h"
+
+dma_port_t::dma_port_t(simif_t *sim) : sim(sim) {
+  // NOP
+}
+
+char *dma_port_t::contents(reg_t addr, size_t len) {
+  if (len == 0 || addr + len < addr) {
+    return nullptr;
+  }
+  char *host = sim->addr_to_mem(addr);
+  if (host == nullptr) {
+    return nullptr;
+  }
+  // every page of the range must follow on from the first one
+  for (reg_t page = (addr / PGSIZE + 1) * PGSIZE; page < addr + len;
+       page += PGSIZE) {
+    if (sim->addr_to_mem(page) != host + (page - addr)) {
+      return nullptr;
+    }
+  }
+  return host;
+}
+
+bool dma_port_t::read(reg_t addr, size_t len, uint8_t *bytes) {
+  if (char *host = contents(addr, len)) {
+    std::memcpy(bytes, host, len);
+    return true;
+  }
+  for (size_t done = 0; done < len;) {
+    size_t chunk = std::min<size_t>(len - done, 8 - (addr + done) % 8);
+    if (!sim->mmio_load(addr + done, chunk, bytes + done)) {
+      return false;
+    }
+    done += chunk;
+  }
+  return true;
+}
+
+bool dma_port_t::write(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (char *host = contents(addr, len)) {
+    std::memcpy(host, bytes, len);
+    return true;
+  }
+  for (size_t done = 0; done < len;) {
+    size_t chunk = std::min<size_t>(len - done, 8 - (addr + done) % 8);
+    if (!sim->mmio_store(addr + done, chunk, bytes + done)) {
+      return false;
+    }
+    done += chunk;
+  }
+  return true;
+}
+
+bool dma_port_t::copy(reg_t dst, reg_t src, size_t len) {
+  char *host_dst = contents(dst, len);
+  char *host_src = contents(src, len);
+  if (host_dst != nullptr && host_src != nullptr) {
+    std::memmove(host_dst, host_src, len);
+    return true;
+  }
+  std::vector<uint8_t> bounce(len);
+  return read(src, len, bounce.data()) && write(dst, len, bounce.data());
+}
+
+bool dma_port_t::gather(const std::vector<dma_segment_t> &segments,
+                        uint8_t *bytes) {
+  for (const auto &[addr, len] : segments) {
+    if (!read(addr, len, bytes)) {
+      return false;
+    }
+    bytes += len;
+  }
+  return true;
+}
+
+bool dma_port_t::scatter(const std::vector<dma_segment_t> &segments,
+                         const uint8_t *bytes) {
+  for (const auto &[addr, len] : segments) {
+    if (!write(addr, len, bytes)) {
+      return false;
+    }
+    bytes += len;
+  }
+  return true;
+}
+
+dma_engine_t::dma_engine_t(const sim_t *sim, unsigned irq, size_t burst)
+    : sim(sim), port(const_cast<sim_t *>(sim)), irq(sim, irq), burst(burst),
+      regs{}, queue(), transfers(0), bytes(0) {
+  // NOP
+}
+
+bool dma_engine_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > SIZE) {
+    return false;
+  }
+  regs[STATUS / 8] = (regs[STATUS / 8] & ~STATUS_BUSY) |
+                     (queue.empty() ? 0 : STATUS_BUSY);
+  std::memcpy(bytes, reinterpret_cast<const uint8_t *>(regs) + addr, len);
+  return true;
+}
+
+bool dma_engine_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (addr + len < addr || addr + len > SIZE) {
+    return false;
+  }
+  // registers have side effects, each store goes to one of them
+  if (len == 0 || addr / 8 != (addr + len - 1) / 8) {
+    return false;
+  }
+  if (addr / 8 == STATUS / 8) {
+    uint64_t value = 0;
+    std::memcpy(reinterpret_cast<uint8_t *>(&value) + addr % 8, bytes, len);
+    // write 1 to clear
+    regs[STATUS / 8] &= ~(value & (STATUS_DONE | STATUS_ERROR));
+    update_interrupt();
+    return true;
+  }
+  std::memcpy(reinterpret_cast<uint8_t *>(regs) + addr, bytes, len);
+  if (addr / 8 == CTRL / 8 && (regs[CTRL / 8] & CTRL_START)) {
+    regs[CTRL / 8] &= ~CTRL_START;
+    submit(regs[SRC / 8], regs[DST / 8], regs[LEN / 8]);
+  }
+  update_interrupt();
+  return true;
+}
+
+reg_t dma_engine_t::size() {
+  return SIZE;
+}
+
+void dma_engine_t::tick(reg_t rtc_ticks) {
+  irq.tick(rtc_ticks);
+  size_t budget = burst > 0 ? burst : SIZE_MAX;
+  while (!queue.empty() && budget > 0) {
+    transfer_t &t = queue.front();
+    size_t chunk = std::min(t.len, budget);
+    if (!port.copy(t.dst, t.src, chunk)) {
+      regs[STATUS / 8] |= STATUS_ERROR;
+      queue.pop_front();
+      continue;
+    }
+    t.src += chunk;
+    t.dst += chunk;
+    t.len -= chunk;
+    bytes += chunk;
+    budget -= chunk;
+    if (t.len == 0) {
+      transfers++;
+      queue.pop_front();
+      regs[STATUS / 8] |= STATUS_DONE;
+    }
+  }
+  update_interrupt();
+}
+
+void dma_engine_t::submit(reg_t src, reg_t dst, size_t len) {
+  queue.push_back({src, dst, len});
+}
+
+size_t dma_engine_t::get_pending() const {
+  return queue.size();
+}
+
+uint64_t dma_engine_t::get_transfers() const {
+  return transfers;
+}
+
+uint64_t dma_engine_t::get_bytes() const {
+  return bytes;
+}
+
+interrupt_line_t &dma_engine_t::get_irq() {
+  return irq;
+}
+
+void dma_engine_t::update_interrupt() {
+  bool level = (regs[CTRL / 8] & CTRL_IRQ_EN) &&
+               (regs[STATUS / 8] & (STATUS_DONE | STATUS_ERROR));
+  irq.set_level(level);
+}
+
+// sargs: `(base, irq = 0, burst = 0)`
+class dma_engine_factory_t : public device_factory_t {
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override {
+    if (sargs.empty()) {
+      throw std::runtime_error("dma_engine requires (base[, irq[, burst]])");
+    }
+    if (base != nullptr) {
+      *base = std::stoull(sargs[0], nullptr, 16);
+    }
+    unsigned irq = sargs.size() > 1 ? std::stoul(sargs[1], nullptr, 0) : 0;
+    size_t burst = sargs.size() > 2 ? std::stoull(sargs[2], nullptr, 0) : 0;
+    return new dma_engine_t(sim, irq, burst);
+  }
+
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override {
+    if (sargs.empty()) {
+      return "";
+    }
+    reg_t base = std::stoull(sargs[0], nullptr, 16);
+    unsigned irq = sargs.size() > 1 ? std::stoul(sargs[1], nullptr, 0) : 0;
+    std::ostringstream s;
+    s << std::hex << "    dma@" << base << " {\n"
+      << "      compatible = \"pyspike,dma-engine\";\n";
+    if (irq != 0) {
+      s << "      interrupt-parent = <&PLIC>;\n"
+        << "      interrupts = <" << std::dec << irq << std::hex << ">;\n";
+    }
+    s << "      reg = <0x" << (base >> 32) << " 0x" << (base & 0xffffffff)
+      << " 0x0 0x" << dma_engine_t::SIZE << ">;\n"
+      << "    };\n";
+    return s.str();
+  }
+};
+
+static bool dma_engine_registered = [] {
+  mmio_device_map()["dma_engine"] = new dma_engine_factory_t();
+  return true;
+}();
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_DMA_H_
+#define _RISCV_DMA_H_
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/sim.h>
+
+#include "riscv_irq.h"
+
+// one scatter/gather segment, `(addr, len)`
+typedef std::pair<reg_t, size_t> dma_segment_t;
+
+// bus master access to guest physical memory
+//
+// ranges that lie within one memory region are accessed in place (a single
+// `memcpy`, or no copy at all for `contents`). other ranges, e.g. MMIO, go
+// through `simif_t::mmio_load` / `mmio_store` in chunks of up to 8 bytes.
+class dma_port_t {
+public:
+  dma_port_t(simif_t *sim);
+
+public:
+  // host pointer to [addr, addr + len) if it is contiguous guest memory
+  char *contents(reg_t addr, size_t len);
+
+  bool read(reg_t addr, size_t len, uint8_t *bytes);
+  bool write(reg_t addr, size_t len, const uint8_t *bytes);
+  // guest to guest, the ranges may overlap
+  bool copy(reg_t dst, reg_t src, size_t len);
+
+  // segments are concatenated into / split from `bytes`
+  bool gather(const std::vector<dma_segment_t> &segments, uint8_t *bytes);
+  bool scatter(const std::vector<dma_segment_t> &segments,
+               const uint8_t *bytes);
+
+private:
+  simif_t *sim;
+};
+
+// native DMA engine
+//
+// registered as "dma_engine" in `mmio_device_map`, with sargs
+// `(base, irq = 0, burst = 0)`. all registers are 64-bit, and stores spanning
+// two of them are rejected:
+//
+// - 0x00 SRC, 0x08 DST, 0x10 LEN: the next transfer
+// - 0x18 CTRL: writing bit 0 queues the transfer, bit 1 enables the interrupt
+// - 0x20 STATUS: bit 0 BUSY, bit 1 DONE, bit 2 ERROR. writing 1 clears DONE
+//   and ERROR (and thus the interrupt)
+//
+// queued transfers (also submitted from python) are executed on ticks, up to
+// `burst` bytes per tick (0 for unlimited). the interrupt is raised while
+// DONE or ERROR is set.
+class dma_engine_t : public abstract_device_t {
+public:
+  dma_engine_t(const sim_t *sim, unsigned irq, size_t burst);
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual reg_t size() override;
+  virtual void tick(reg_t rtc_ticks) override;
+
+public:
+  void submit(reg_t src, reg_t dst, size_t len);
+  size_t get_pending() const;
+  uint64_t get_transfers() const;
+  uint64_t get_bytes() const;
+
+public:
+  interrupt_line_t &get_irq();
+
+public:
+  static const reg_t SRC = 0x00;
+  static const reg_t DST = 0x08;
+  static const reg_t LEN = 0x10;
+  static const reg_t CTRL = 0x18;
+  static const reg_t STATUS = 0x20;
+  static const reg_t SIZE = 0x28;
+
+  static const uint64_t CTRL_START = 0x1;
+  static const uint64_t CTRL_IRQ_EN = 0x2;
+  static const uint64_t STATUS_BUSY = 0x1;
+  static const uint64_t STATUS_DONE = 0x2;
+  static const uint64_t STATUS_ERROR = 0x4;
+
+private:
+  struct transfer_t {
+    reg_t src;
+    reg_t dst;
+    size_t len;
+  };
+
+private:
+  void update_interrupt();
+
+private:
+  const sim_t *sim;
+  dma_port_t port;
+  interrupt_line_t irq;
+  size_t burst;
+  uint64_t regs[SIZE / 8];
+  std::deque<transfer_t> queue;
+  uint64_t transfers;
+  uint64_t bytes;
+};
+
+#endif // _RISCV_DMA_H_
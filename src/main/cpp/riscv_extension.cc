@@ -19,17 +19,32 @@
 
 namespace py = pybind11;
 
+std::map<PyObject *, py_extension_t::tables_t> py_extension_t::tables;
+
 std::vector<insn_desc_t>
 py_extension_t::get_instructions(const processor_t &proc) {
+  // also called by `processor_t::reset`, possibly without the GIL
+  py::gil_scoped_acquire gil;
   std::vector<insn_desc_t> instructions;
   auto &bridge = PythonBridge::getInstance();
   try {
+    tables_t *shared = shared_tables();
+    if (shared != nullptr && shared->instructions.has_value()) {
+      return shared->instructions.value();
+    }
+    // shared tables outlive the sim
+    std::optional<PythonBridge::scope_guard_t> scope;
+    if (shared != nullptr) {
+      scope.emplace(shared->scope->get_id());
+    }
     py::function py_method = py::get_override(this, "get_instructions");
-    py::object py_proc = py::cast(&proc);
-    py::sequence py_seq = py_method(*bridge.track<processor_t *>(py_proc));
+    py::sequence py_seq = py_method(py::cast(&proc));
     for (const auto &py_obj : py_seq) {
       instructions.push_back(*bridge.track<insn_desc_t *>(py_obj));
     }
+    if (shared != nullptr) {
+      shared->instructions = instructions;
+    }
   } catch (py::error_already_set &e) {
     std::cerr << e.what() << std::endl;
   }
@@ -38,14 +53,31 @@ py_extension_t::get_instructions(const processor_t &proc) {
 
 std::vector<disasm_insn_t *>
 py_extension_t::get_disasms(const processor_t *proc) {
+  py::gil_scoped_acquire gil;
   std::vector<disasm_insn_t *> disasms;
   auto &bridge = PythonBridge::getInstance();
   try {
-    py::function py_method = py::get_override(this, "get_disasms");
-    py::object py_proc = py::cast(proc);
-    py::sequence py_seq = py_method(*bridge.track<processor_t *>(py_proc));
-    for (const auto &py_obj : py_seq) {
-      disasms.push_back(bridge.track<disasm_insn_t *>(py_obj));
+    tables_t *shared = shared_tables();
+    std::vector<disasm_insn_t *> py_disasms;
+    if (shared != nullptr && shared->disasms.has_value()) {
+      py_disasms = shared->disasms.value();
+    } else {
+      std::optional<PythonBridge::scope_guard_t> scope;
+      if (shared != nullptr) {
+        scope.emplace(shared->scope->get_id());
+      }
+      py::function py_method = py::get_override(this, "get_disasms");
+      py::sequence py_seq = py_method(py::cast(proc));
+      for (const auto &py_obj : py_seq) {
+        py_disasms.push_back(bridge.track<disasm_insn_t *>(py_obj));
+      }
+      if (shared != nullptr) {
+        shared->disasms = py_disasms;
+      }
+    }
+    // owned and deleted by the disassembler of the hart
+    for (disasm_insn_t *py_disasm : py_disasms) {
+      disasms.push_back(new disasm_insn_t(*py_disasm));
     }
   } catch (py::error_already_set &e) {
     std::cerr << e.what() << std::endl;
@@ -54,14 +86,13 @@ py_extension_t::get_disasms(const processor_t *proc) {
 }
 
 std::vector<csr_t_p> py_extension_t::get_csrs(processor_t &proc) const {
+  py::gil_scoped_acquire gil;
   std::vector<csr_t_p> csrs;
-  auto &bridge = PythonBridge::getInstance();
   try {
     py::function py_method = py::get_override(this, "get_csrs");
-    py::object py_proc = py::cast(&proc);
-    py::sequence py_seq = py_method(*bridge.track<processor_t *>(py_proc));
+    py::sequence py_seq = py_method(py::cast(&proc));
     for (const auto &py_obj : py_seq) {
-      csrs.push_back(bridge.track<py_csr_t *>(py_obj)->shared_from_this());
+      csrs.push_back(py_csr_cast(py_obj));
     }
   } catch (py::error_already_set &e) {
     std::cerr << e.what() << std::endl;
@@ -69,41 +100,65 @@ std::vector<csr_t_p> py_extension_t::get_csrs(processor_t &proc) const {
   return csrs;
 }
 
+void py_extension_t::clear_tables() {
+  // releases the scopes of the tables
+  tables.clear();
+}
+
+py_extension_t::tables_t *py_extension_t::shared_tables() {
+  py::object py_self = py::cast(static_cast<extension_t *>(this));
+  if (py::getattr(py_self, "hart_specific", py::bool_(false)).cast<bool>()) {
+    return nullptr;
+  }
+  py::handle py_type = py::type::handle_of(py_self);
+  tables_t &shared = tables[py_type.ptr()];
+  if (!shared.py_type) {
+    shared.py_type = py::reinterpret_borrow<py::object>(py_type);
+    // entered only while the tables are taken from python
+    shared.scope = std::make_unique<PythonBridge::scope_t>();
+    shared.scope->leave();
+  }
+  return &shared;
+}
+
 const char *py_extension_t::name() const {
   PYBIND11_OVERRIDE_PURE_NAME(const char *, extension_t, "_name", name);
 }
 
 void py_extension_t::reset(processor_t &proc) {
-  auto &bridge = PythonBridge::getInstance();
+  // processors are owned by the sim, and not retained
+  py::gil_scoped_acquire gil;
   auto py_proc = py::cast(&proc);
-  PYBIND11_OVERRIDE(void, extension_t, reset,
-                    *bridge.track<processor_t *>(py_proc));
+  PYBIND11_OVERRIDE(void, extension_t, reset, py_proc);
 }
 
 void py_extension_t::set_debug(bool value, const processor_t &proc) {
-  auto &bridge = PythonBridge::getInstance();
+  py::gil_scoped_acquire gil;
   auto py_proc = py::cast(&proc);
-  PYBIND11_OVERRIDE(void, extension_t, set_debug, value,
-                    *bridge.track<processor_t *>(py_proc));
+  PYBIND11_OVERRIDE(void, extension_t, set_debug, value, py_proc);
 }
 
 reg_t py_rocc_t::custom0(processor_t *proc, rocc_insn_t insn, reg_t xs1,
                          reg_t xs2) {
+  callback_probe_t probe(sites[0], [this] { return site("custom0"); });
   PYBIND11_OVERRIDE(reg_t, rocc_t, custom0, proc, insn, xs1, xs2);
 }
 
 reg_t py_rocc_t::custom1(processor_t *proc, rocc_insn_t insn, reg_t xs1,
                          reg_t xs2) {
+  callback_probe_t probe(sites[1], [this] { return site("custom1"); });
   PYBIND11_OVERRIDE(reg_t, rocc_t, custom1, proc, insn, xs1, xs2);
 }
 
 reg_t py_rocc_t::custom2(processor_t *proc, rocc_insn_t insn, reg_t xs1,
                          reg_t xs2) {
+  callback_probe_t probe(sites[2], [this] { return site("custom2"); });
   PYBIND11_OVERRIDE(reg_t, rocc_t, custom2, proc, insn, xs1, xs2);
 }
 
 reg_t py_rocc_t::custom3(processor_t *proc, rocc_insn_t insn, reg_t xs1,
                          reg_t xs2) {
+  callback_probe_t probe(sites[3], [this] { return site("custom3"); });
   PYBIND11_OVERRIDE(reg_t, rocc_t, custom3, proc, insn, xs1, xs2);
 }
 
@@ -111,6 +166,11 @@ const char *py_rocc_t::name() const {
   PYBIND11_OVERRIDE_PURE_NAME(const char *, rocc_t, "_name", name);
 }
 
+callback_site_t *py_rocc_t::site(const char *method) {
+  return callback_stats_t::site(
+      "rocc", callback_stats_t::type_name<rocc_t>(this) + "." + method);
+}
+
 void py_register_extension(const std::string &name, py::function py_ctor) {
   register_extension(name.c_str(), [py_ctor]() -> extension_t * {
     auto py_ext = py_ctor();
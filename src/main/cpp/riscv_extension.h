@@ -17,6 +17,9 @@
 #define _RISCV_EXTENSION_H_
 
 #include <functional>
+#include <map>
+#include <memory>
+#include <optional>
 #include <vector>
 
 #include <riscv/extension.h>
@@ -27,7 +30,17 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include "py_bridge.h"
+#include "riscv_stats.h"
+
 // trampoline helper class for extending extension_t
+//
+// spike instantiates extensions once per hart. the instruction and disasm
+// tables are thus taken from python once per extension class, and shared by
+// all of its instances until `clear_tables`, unless the class sets
+// `hart_specific = True` (e.g. if its instructions are bound to per-hart
+// state). the disassembler of a hart deletes its entries, so it is handed
+// copies of the python disasm entries either way. CSRs are always per hart.
 class py_extension_t : public extension_t,
                        public pybind11::trampoline_self_life_support {
 public:
@@ -50,6 +63,27 @@ public:
   using extension_t::clear_interrupt;
   using extension_t::illegal_instruction;
   using extension_t::raise_interrupt;
+
+public:
+  // drops the shared tables of all classes, and releases the python objects
+  // they keep alive. sims built with them must be gone by then.
+  static void clear_tables();
+
+private:
+  struct tables_t {
+    pybind11::object py_type; // keeps the key alive
+    // of the python objects of the tables, released with them
+    std::unique_ptr<PythonBridge::scope_t> scope;
+    std::optional<std::vector<insn_desc_t>> instructions;
+    std::optional<std::vector<disasm_insn_t *>> disasms;
+  };
+
+private:
+  // the tables shared with other instances, null if hart-specific
+  tables_t *shared_tables();
+
+private:
+  static std::map<PyObject *, tables_t> tables;
 };
 
 // trampoline helper class for extending rocc_t
@@ -69,6 +103,13 @@ public:
 
 public:
   virtual const char *name() const override;
+
+private:
+  // `riscv.stats` site of a python method
+  callback_site_t *site(const char *method);
+
+private:
+  callback_site_t *sites[4] = {};
 };
 
 // helper for Python -> C++ -> Python calls to `register_extension`
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+
+#include <riscv/devices.h>
+
+#include "riscv_irq.h"
+#include "riscv_trace.h"
+
+// offset of the pending bits in spike's PLIC
+static const reg_t PLIC_PENDING = 0x1000;
+
+interrupt_line_t::interrupt_line_t(const sim_t *sim, unsigned irq)
+    : sim(const_cast<sim_t *>(sim)), irq(irq), level(), now(0),
+      asserted_at(0), awaiting(false), was_pending(false), deadline(),
+      assertions(0), updates(0), redundant(0), coalesced(0),
+      histogram(BUCKETS, 0) {
+  // NOP
+}
+
+void interrupt_line_t::set_level(bool level) {
+  if (irq == 0) {
+    return;
+  }
+  // a level set explicitly overrides any pending pulse
+  deadline.reset();
+  if (!level && awaiting) {
+    record(now - asserted_at);
+  }
+  drive(level);
+}
+
+void interrupt_line_t::pulse(uint64_t ticks) {
+  if (irq == 0) {
+    return;
+  }
+  if (level.value_or(false)) {
+    coalesced++;
+    if (deadline.has_value()) {
+      deadline = std::max(deadline.value(), now + ticks);
+    }
+    return;
+  }
+  set_level(true);
+  deadline = now + ticks;
+}
+
+void interrupt_line_t::tick(reg_t rtc_ticks) {
+  now += rtc_ticks;
+  if (awaiting) {
+    // a claim clears the pending bit
+    bool pending = is_pending();
+    if (was_pending && !pending) {
+      record(now - asserted_at);
+    }
+    was_pending = pending;
+  }
+  if (deadline.has_value() && now >= deadline.value()) {
+    deadline.reset();
+    awaiting = false;
+    drive(false);
+  }
+}
+
+unsigned interrupt_line_t::get_irq() const {
+  return irq;
+}
+
+bool interrupt_line_t::get_level() const {
+  return level.value_or(false);
+}
+
+uint64_t interrupt_line_t::get_assertions() const {
+  return assertions;
+}
+
+uint64_t interrupt_line_t::get_updates() const {
+  return updates;
+}
+
+uint64_t interrupt_line_t::get_redundant() const {
+  return redundant;
+}
+
+uint64_t interrupt_line_t::get_coalesced() const {
+  return coalesced;
+}
+
+const std::vector<uint64_t> &interrupt_line_t::get_histogram() const {
+  return histogram;
+}
+
+void interrupt_line_t::drive(bool level) {
+  if (this->level == level) {
+    redundant++;
+    return;
+  }
+  this->level = level;
+  updates++;
+  sim->get_intctrl()->set_interrupt_level(irq, level ? 1 : 0);
+  mmio_trace_t::record_irq(irq, level);
+  if (level) {
+    assertions++;
+    asserted_at = now;
+    awaiting = true;
+    was_pending = is_pending();
+  }
+}
+
+bool interrupt_line_t::is_pending() const {
+  auto *plic = dynamic_cast<abstract_device_t *>(sim->get_intctrl());
+  uint32_t bits = 0;
+  if (plic == nullptr ||
+      !plic->load(PLIC_PENDING + irq / 32 * 4, sizeof(bits),
+                  reinterpret_cast<uint8_t *>(&bits))) {
+    return false;
+  }
+  return bits & (uint32_t(1) << irq % 32);
+}
+
+void interrupt_line_t::record(uint64_t latency) {
+  awaiting = false;
+  size_t bucket = latency == 0 ? 0 : 64 - __builtin_clzll(latency);
+  histogram[std::min(bucket, BUCKETS - 1)]++;
+}
+
+void interrupt_line_t::reset_stats() {
+  assertions = updates = redundant = coalesced = 0;
+  std::fill(histogram.begin(), histogram.end(), 0);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_IRQ_H_
+#define _RISCV_IRQ_H_
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <riscv/sim.h>
+
+// one interrupt source of the sim's interrupt controller, as driven by one
+// device
+//
+// the line caches its level, and forwards nothing but changes to the
+// controller. irq 0 is no line at all, and all updates are dropped.
+//
+// the line has its own clock in rtc ticks, advanced by `tick`, which the
+// owning device calls on every tick before doing its own work. a pulse asserts
+// the line, and deasserts it after the given number of rtc ticks; a pulse on
+// an asserted line is coalesced into it, extending the deadline if need be.
+//
+// the service latency of every assertion, from the assertion until the guest
+// claims the interrupt at the PLIC or the device deasserts the line (whichever
+// comes first), is recorded in a histogram of power-of-two buckets: bucket 0
+// counts 0 ticks, bucket i counts [2^(i-1), 2^i) ticks. pulses expiring
+// unclaimed are not serviced, and not recorded.
+class interrupt_line_t {
+public:
+  interrupt_line_t(const sim_t *sim, unsigned irq);
+
+public:
+  void set_level(bool level);
+  void pulse(uint64_t ticks);
+  void tick(reg_t rtc_ticks);
+
+public:
+  unsigned get_irq() const;
+  bool get_level() const;
+  uint64_t get_assertions() const;
+  uint64_t get_updates() const;
+  uint64_t get_redundant() const;
+  uint64_t get_coalesced() const;
+  const std::vector<uint64_t> &get_histogram() const;
+  void reset_stats();
+
+public:
+  static const size_t BUCKETS = 32;
+
+private:
+  void drive(bool level);
+  // whether the controller has the source pending
+  bool is_pending() const;
+  void record(uint64_t latency);
+
+private:
+  sim_t *sim;
+  unsigned irq;
+  std::optional<bool> level;
+  uint64_t now;
+  uint64_t asserted_at;
+  bool awaiting;     // the current assertion is not serviced yet
+  bool was_pending;  // ... and the controller had it pending
+  std::optional<uint64_t> deadline; // of the current pulse
+  uint64_t assertions;
+  uint64_t updates;
+  uint64_t redundant;
+  uint64_t coalesced;
+  std::vector<uint64_t> histogram;
+};
+
+#endif // _RISCV_IRQ_H_
@@ -0,0 +1,567 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "riscv_mem.h"
+
+// size of explicit huge pages, the default on x86-64, aarch64 and riscv64
+static const size_t HUGETLB_PAGE_SIZE = 2 << 20;
+
+static std::runtime_error mem_error(const std::string &what) {
+  return std::runtime_error(what + ": " + std::string(strerror(errno)));
+}
+
+mapped_mem_t::mapped_mem_t(reg_t size, const mem_backing_t &backing)
+    : base(nullptr), sz(size), reserved(size), shared(false), written(),
+      pages(size / PGSIZE) {
+  if (size == 0 || size % PGSIZE != 0) {
+    throw std::runtime_error(
+        "memory size must be a positive multiple of 4 KiB");
+  }
+  written.reset(new std::atomic<uint8_t>[pages]);
+  for (size_t page = 0; page < pages; page++) {
+    written[page].store(0, std::memory_order_relaxed);
+  }
+  if (backing.kind == "file") {
+    int flags = backing.shared ? (O_RDWR | O_CREAT) : O_RDONLY;
+    int fd = open(backing.path.c_str(), flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw mem_error("failed to open " + backing.path);
+    }
+    map_fd(backing, fd);
+  } else if (backing.kind == "shm") {
+    int fd = shm_open(backing.path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+      throw mem_error("failed to open shared memory " + backing.path);
+    }
+    map_fd(backing, fd);
+  } else {
+    map_anonymous(backing);
+  }
+}
+
+mapped_mem_t::~mapped_mem_t() {
+  munmap(base, reserved);
+}
+
+void mapped_mem_t::map_anonymous(const mem_backing_t &backing) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  if (backing.kind == "hugetlb") {
+    if (sz % HUGETLB_PAGE_SIZE != 0) {
+      throw std::runtime_error(
+          "hugetlb memory size must be a multiple of 2 MiB");
+    }
+    flags |= MAP_HUGETLB;
+  } else if (backing.kind == "hugepage") {
+    // over-reserve, so that the region can start at a huge page boundary
+    reserved = sz + HUGETLB_PAGE_SIZE;
+  }
+  void *ptr = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (ptr == MAP_FAILED) {
+    throw mem_error("failed to reserve guest memory");
+  }
+  base = static_cast<char *>(ptr);
+  if (backing.kind == "hugepage") {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(base);
+    uintptr_t aligned = (addr + HUGETLB_PAGE_SIZE - 1) / HUGETLB_PAGE_SIZE *
+                        HUGETLB_PAGE_SIZE;
+    // give back the slack on both ends
+    if (aligned > addr) {
+      munmap(base, aligned - addr);
+    }
+    munmap(reinterpret_cast<char *>(aligned) + sz,
+           addr + reserved - (aligned + sz));
+    base = reinterpret_cast<char *>(aligned);
+    reserved = sz;
+    // advisory only, the kernel may not have THP enabled
+    madvise(base, sz, MADV_HUGEPAGE);
+  }
+}
+
+void mapped_mem_t::map_fd(const mem_backing_t &backing, int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw mem_error("failed to stat " + backing.path);
+  }
+  reg_t file_size = static_cast<reg_t>(st.st_size);
+  if (backing.shared) {
+    // a shared backing covers the whole region, grow it as needed
+    if (file_size < sz && ftruncate(fd, sz) != 0) {
+      close(fd);
+      throw mem_error("failed to resize " + backing.path);
+    }
+    void *ptr = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+      throw mem_error("failed to map " + backing.path);
+    }
+    base = static_cast<char *>(ptr);
+    shared = true;
+    // the contents are whatever other processes left there
+    mark(0, sz);
+    return;
+  }
+  // a private backing is mapped over zero pages, as pages past the end of
+  // the file would raise SIGBUS instead of reading as zero
+  map_anonymous(mem_backing_t());
+  size_t len = std::min<reg_t>((file_size + PGSIZE - 1) / PGSIZE * PGSIZE, sz);
+  bool ok = len == 0 || map_private(0, fd, 0, len);
+  if (!ok) {
+    // e.g. host pages larger than guest pages, read the file in instead
+    size_t done = 0;
+    size_t todo = std::min<reg_t>(file_size, sz);
+    while (done < todo) {
+      ssize_t n = pread(fd, base + done, todo - done, done);
+      if (n <= 0) {
+        break;
+      }
+      done += n;
+    }
+    ok = done == todo;
+    mark(0, todo);
+  }
+  close(fd);
+  if (!ok) {
+    munmap(base, reserved);
+    throw mem_error("failed to map " + backing.path);
+  }
+}
+
+bool mapped_mem_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > sz) {
+    return false;
+  }
+  std::memcpy(bytes, base + addr, len);
+  return true;
+}
+
+bool mapped_mem_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (addr + len < addr || addr + len > sz) {
+    return false;
+  }
+  std::memcpy(base + addr, bytes, len);
+  mark(addr, len);
+  return true;
+}
+
+char *mapped_mem_t::contents(reg_t addr) {
+  // the page may be written through the pointer
+  mark(addr, 1);
+  return base + addr;
+}
+
+reg_t mapped_mem_t::size() {
+  return sz;
+}
+
+void mapped_mem_t::dump(std::ostream &o) {
+  for (reg_t i = 0; i < sz; i += PGSIZE) {
+    o.write(base + i, PGSIZE);
+  }
+}
+
+bool mapped_mem_t::map_private(reg_t offset, int fd, off_t file_offset,
+                               size_t len) {
+  static const long host_page_size = sysconf(_SC_PAGESIZE);
+  if (shared || host_page_size != static_cast<long>(PGSIZE) ||
+      offset % PGSIZE != 0 || file_offset % PGSIZE != 0 ||
+      len % PGSIZE != 0 || offset + len > sz) {
+    return false;
+  }
+  void *ptr = mmap(base + offset, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_FIXED, fd, file_offset);
+  if (ptr == MAP_FAILED) {
+    // a failed MAP_FIXED may leave a hole, put fresh zero pages back there
+    mmap(base + offset, len, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    return false;
+  }
+  mark(offset, len);
+  return true;
+}
+
+bool mapped_mem_t::touched(reg_t offset, size_t len) const {
+  if (len == 0) {
+    return false;
+  }
+  reg_t first = offset / PGSIZE;
+  reg_t last = std::min<reg_t>((offset + len - 1) / PGSIZE, pages - 1);
+  for (reg_t page = first; page <= last; page++) {
+    if (written[page].load(std::memory_order_relaxed) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void mapped_mem_t::mark(reg_t offset, size_t len) {
+  if (len == 0 || offset >= sz) {
+    return;
+  }
+  reg_t last = std::min<reg_t>((offset + len - 1) / PGSIZE, pages - 1);
+  for (reg_t page = offset / PGSIZE; page <= last; page++) {
+    // tested first, so that pages marked already stay shared in host caches
+    if (written[page].load(std::memory_order_relaxed) == 0) {
+      written[page].store(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+size_t mapped_mem_t::resident_pages() const {
+  // in chunks, so as not to allocate one byte per page of a large region
+  const reg_t chunk = PGSIZE * 4096;
+  std::vector<unsigned char> residency(chunk / PGSIZE);
+  size_t pages = 0;
+  for (reg_t offset = 0; offset < sz; offset += chunk) {
+    reg_t len = std::min(chunk, sz - offset);
+    if (mincore(base + offset, len, residency.data()) != 0) {
+      continue;
+    }
+    for (size_t i = 0; i < len / PGSIZE; i++) {
+      pages += residency[i] & 1;
+    }
+  }
+  return pages;
+}
+
+bool mapped_mem_t::is_shared() const {
+  return shared;
+}
+
+shared_mem_t::shared_mem_t(reg_t size, const mem_backing_t &backing, bool sync)
+    : mem(size, backing), sync(sync) {
+  // NOP
+}
+
+reg_t shared_mem_t::size() {
+  return mem.size();
+}
+
+char *shared_mem_t::contents(reg_t addr) {
+  return mem.contents(addr);
+}
+
+bool shared_mem_t::is_sync() const {
+  return sync;
+}
+
+void shared_mem_t::acquire_turn() {
+  std::unique_lock<std::mutex> guard(turn_lock);
+  if (turn_holder == std::this_thread::get_id()) {
+    return;
+  }
+  uint64_t ticket = next_ticket++;
+  turn_cond.wait(guard, [this, ticket] { return now_serving == ticket; });
+  turn_holder = std::this_thread::get_id();
+}
+
+void shared_mem_t::release_turn() {
+  {
+    std::lock_guard<std::mutex> guard(turn_lock);
+    if (turn_holder != std::this_thread::get_id()) {
+      return;
+    }
+    now_serving++;
+    turn_holder = std::thread::id();
+  }
+  turn_cond.notify_all();
+}
+
+bool shared_mem_t::holds_turn() {
+  std::lock_guard<std::mutex> guard(turn_lock);
+  return turn_holder == std::this_thread::get_id();
+}
+
+void shared_mem_turns_t::add(std::shared_ptr<shared_mem_t> region) {
+  if (!region->is_sync()) {
+    return;
+  }
+  auto it = std::lower_bound(regions.begin(), regions.end(), region);
+  if (it == regions.end() || *it != region) {
+    regions.insert(it, region);
+  }
+}
+
+bool shared_mem_turns_t::empty() const {
+  return regions.empty();
+}
+
+void shared_mem_turns_t::acquire() {
+  for (auto &region : regions) {
+    region->acquire_turn();
+  }
+}
+
+void shared_mem_turns_t::release() {
+  for (auto it = regions.rbegin(); it != regions.rend(); ++it) {
+    (*it)->release_turn();
+  }
+}
+
+bool shared_mem_turns_t::held() {
+  return !regions.empty() && regions.front()->holds_turn();
+}
+
+void shared_mem_turns_t::start(bool parked) {
+  running = true;
+  if (!parked) {
+    acquire();
+  }
+}
+
+void shared_mem_turns_t::stop() {
+  running = false;
+  release();
+}
+
+bool shared_mem_turns_t::yield(const void *caller) {
+  if (leader == nullptr) {
+    leader = caller;
+  }
+  if (caller != leader || !running) {
+    return false;
+  }
+  if (parked && parked()) {
+    release();
+    return false;
+  }
+  // no-op when resuming, the turns were handed over already
+  release();
+  acquire();
+  return true;
+}
+
+// naturally aligned accesses are single (untorn) host accesses
+template <typename T>
+static inline void atomic_load_to(const char *ptr, uint8_t *bytes) {
+  T value = __atomic_load_n(reinterpret_cast<const T *>(ptr), __ATOMIC_ACQUIRE);
+  std::memcpy(bytes, &value, sizeof(T));
+}
+
+template <typename T>
+static inline void atomic_store_from(char *ptr, const uint8_t *bytes) {
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  __atomic_store_n(reinterpret_cast<T *>(ptr), value, __ATOMIC_RELEASE);
+}
+
+shared_mem_view_t::shared_mem_view_t(std::shared_ptr<shared_mem_t> region,
+                                     reg_t size, sim_t *sim,
+                                     std::shared_ptr<shared_mem_turns_t> turns)
+    : region(region), sz(size), sim(sim), turns(turns) {
+  // NOP
+}
+
+bool shared_mem_view_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > sz) {
+    return false;
+  }
+  const char *ptr = region->contents(addr);
+  switch (len != 0 && addr % len == 0 ? len : 0) {
+  case 1: atomic_load_to<uint8_t>(ptr, bytes); break;
+  case 2: atomic_load_to<uint16_t>(ptr, bytes); break;
+  case 4: atomic_load_to<uint32_t>(ptr, bytes); break;
+  case 8: atomic_load_to<uint64_t>(ptr, bytes); break;
+  default: std::memcpy(bytes, ptr, len); break;
+  }
+  return true;
+}
+
+bool shared_mem_view_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (addr + len < addr || addr + len > sz) {
+    return false;
+  }
+  char *ptr = region->contents(addr);
+  switch (len != 0 && addr % len == 0 ? len : 0) {
+  case 1: atomic_store_from<uint8_t>(ptr, bytes); break;
+  case 2: atomic_store_from<uint16_t>(ptr, bytes); break;
+  case 4: atomic_store_from<uint32_t>(ptr, bytes); break;
+  case 8: atomic_store_from<uint64_t>(ptr, bytes); break;
+  default: std::memcpy(ptr, bytes, len); break;
+  }
+  return true;
+}
+
+char *shared_mem_view_t::contents(reg_t addr) {
+  return region->contents(addr);
+}
+
+reg_t shared_mem_view_t::size() {
+  return sz;
+}
+
+void shared_mem_view_t::dump(std::ostream &o) {
+  o.write(region->contents(0), sz);
+}
+
+void shared_mem_view_t::tick(reg_t rtc_ticks) {
+  // only the ticked instance knows its sim, and only a sim started with its
+  // turns (see `py_sim_t::run`) takes turns
+  if (sim == nullptr || !turns || !turns->yield(this)) {
+    return;
+  }
+  // other sims may have stored to reserved addresses in the meantime
+  for (size_t i = 0; i < sim->nprocs(); i++) {
+    sim->get_core(i)->get_mmu()->yield_load_reservation();
+  }
+}
+
+shared_mem_factory_t::shared_mem_factory_t(
+    std::shared_ptr<shared_mem_t> region, reg_t size,
+    std::shared_ptr<shared_mem_turns_t> turns)
+    : region(region), size(size), turns(turns) {
+  // NOP
+}
+
+abstract_device_t *shared_mem_factory_t::parse_from_fdt(
+    const void *fdt, const sim_t *sim, reg_t *base,
+    const std::vector<std::string> &sargs) const {
+  if (base != nullptr) {
+    *base = std::stoull(sargs.at(0), nullptr, 0);
+  }
+  return new shared_mem_view_t(region, size, const_cast<sim_t *>(sim), turns);
+}
+
+std::string
+shared_mem_factory_t::generate_dts(const sim_t *sim,
+                                   const std::vector<std::string> &sargs) const {
+  // the memory node comes from the instance in `mems`
+  return "";
+}
+
+rom_image_t::rom_image_t(const uint8_t *data, size_t len,
+                         std::shared_ptr<void> owner)
+    : base(data), len(len), owner(owner), mapped(false) {
+  // NOP
+}
+
+rom_image_t::~rom_image_t() {
+  if (mapped && len > 0) {
+    munmap(const_cast<uint8_t *>(base), len);
+  }
+}
+
+std::shared_ptr<rom_image_t> rom_image_t::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw mem_error("cannot open " + path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw mem_error("cannot stat " + path);
+  }
+  // a rewritten file is a different image
+  std::string key = path + ":" + std::to_string(st.st_dev) + ":" +
+                    std::to_string(st.st_ino) + ":" +
+                    std::to_string(st.st_size) + ":" +
+                    std::to_string(st.st_mtim.tv_sec) + "." +
+                    std::to_string(st.st_mtim.tv_nsec);
+  std::lock_guard<std::mutex> guard(cache_lock);
+  auto it = cache.find(key);
+  if (it != cache.end()) {
+    if (auto image = it->second.lock()) {
+      close(fd);
+      return image;
+    }
+  }
+  size_t len = st.st_size;
+  std::shared_ptr<rom_image_t> image;
+  if (len <= COPY_MAX) {
+    // a copy does not fault once the file is truncated
+    auto copy = std::make_shared<std::vector<uint8_t>>(len);
+    size_t done = 0;
+    while (done < len) {
+      ssize_t n = pread(fd, copy->data() + done, len - done, done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        close(fd);
+        throw mem_error("cannot read " + path);
+      }
+      done += n;
+    }
+    close(fd);
+    image = std::make_shared<rom_image_t>(copy->data(), len, copy);
+  } else {
+    void *data = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      throw mem_error("cannot map " + path);
+    }
+    image = std::make_shared<rom_image_t>(static_cast<uint8_t *>(data), len,
+                                          nullptr);
+    image->mapped = true;
+  }
+  // drop the entries of images that are gone
+  for (auto it = cache.begin(); it != cache.end();) {
+    it = it->second.expired() ? cache.erase(it) : std::next(it);
+  }
+  cache[key] = image;
+  return image;
+}
+
+const uint8_t *rom_image_t::data() const {
+  return base;
+}
+
+size_t rom_image_t::size() const {
+  return len;
+}
+
+bool rom_image_t::is_mapped() const {
+  return mapped;
+}
+
+std::mutex rom_image_t::cache_lock;
+std::map<std::string, std::weak_ptr<rom_image_t>> rom_image_t::cache;
+
+shared_rom_t::shared_rom_t(std::shared_ptr<rom_image_t> image)
+    : rom_device_t(std::vector<char>()), image(image) {
+  // NOP
+}
+
+bool shared_rom_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > image->size()) {
+    return false;
+  }
+  std::memcpy(bytes, image->data() + addr, len);
+  return true;
+}
+
+bool shared_rom_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  return false;
+}
+
+reg_t shared_rom_t::size() {
+  return image->size();
+}
+
+std::shared_ptr<rom_image_t> shared_rom_t::get_image() const {
+  return image;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_MEM_H_
+#define _RISCV_MEM_H_
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/devices.h>
+#include <riscv/mmu.h>
+#include <riscv/sim.h>
+
+#include "riscv_cfg.h"
+
+// guest memory region backed by one contiguous host mapping
+//
+// spike's `mem_t` allocates guest pages one by one on first touch, which makes
+// it impossible to map anything into a region. `mapped_mem_t` reserves the
+// whole region up front with `MAP_NORESERVE`, so the host kernel still
+// populates (zero-fills) pages lazily, while `contents()` is plain pointer
+// arithmetic and page ranges can be replaced by file mappings. the mapping
+// itself may come from any `mem_backing_t`.
+class mapped_mem_t : public abstract_mem_t {
+public:
+  mapped_mem_t(reg_t size, const mem_backing_t &backing = mem_backing_t());
+  ~mapped_mem_t();
+
+private:
+  mapped_mem_t(const mapped_mem_t &) = delete;
+  mapped_mem_t &operator=(const mapped_mem_t &) = delete;
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual char *contents(reg_t addr) override;
+  virtual reg_t size() override;
+  virtual void dump(std::ostream &o) override;
+
+public:
+  // replace pages [offset, offset + len) by a private (copy-on-write) mapping
+  // of `fd` at `file_offset`. all of `offset`, `file_offset` and `len` must be
+  // page-aligned. returns false (leaving the region as is) on failure, or if
+  // the region is shared with other processes.
+  bool map_private(reg_t offset, int fd, off_t file_offset, size_t len);
+
+  // whether any page in [offset, offset + len) may hold data: stored to,
+  // handed out by `contents()` (and possibly written through), or mapped
+  // from a file. page residency says nothing of that, as file-backed pages
+  // may be resident untouched, and written pages swapped out.
+  bool touched(reg_t offset, size_t len) const;
+  // number of pages resident in host memory
+  size_t resident_pages() const;
+
+  // whether stores are visible to other mappings of the backing
+  bool is_shared() const;
+
+private:
+  void map_anonymous(const mem_backing_t &backing);
+  void map_fd(const mem_backing_t &backing, int fd);
+  void mark(reg_t offset, size_t len);
+
+private:
+  char *base;
+  reg_t sz;
+  size_t reserved; // length of the host mapping, may exceed `sz`
+  bool shared;
+  // pages that may hold data, see `touched()`. atomic, as sims sharing the
+  // region hand out `contents()` on their own threads.
+  std::unique_ptr<std::atomic<uint8_t>[]> written;
+  size_t pages;
+};
+
+// one host allocation attachable to several sims as guest memory
+//
+// every attachment is a `shared_mem_view_t` at its own base address, and
+// guest accesses on the TLB fast path go straight to the host memory. aligned
+// accesses of up to 8 bytes are thus single host loads and stores, and the
+// slow path performs them with `__atomic` builtins, so sims running on
+// different threads never observe torn values.
+//
+// LR/SC and AMOs are only atomic within one sim. with `sync` set, the sims
+// attaching the region run in turns of one quantum (the `INTERLEAVE` steps
+// between device ticks), and yield the load reservations of their harts at
+// every turn, as spike does among the harts of one sim. sims sharing no
+// synchronized region never wait for each other.
+// without `sync`, sims run freely, and an SC may succeed after a store from
+// another sim to the reserved address.
+class shared_mem_t {
+public:
+  shared_mem_t(reg_t size, const mem_backing_t &backing, bool sync);
+
+private:
+  shared_mem_t(const shared_mem_t &) = delete;
+  shared_mem_t &operator=(const shared_mem_t &) = delete;
+
+public:
+  reg_t size();
+  char *contents(reg_t addr);
+  bool is_sync() const;
+
+public:
+  // take and hand back the region's turn among the sims attaching it (FIFO
+  // order). both are no-ops on a thread that already / does not hold it.
+  void acquire_turn();
+  void release_turn();
+  bool holds_turn();
+
+private:
+  mapped_mem_t mem;
+  bool sync;
+
+private:
+  std::mutex turn_lock;
+  std::condition_variable turn_cond;
+  uint64_t next_ticket = 0;
+  uint64_t now_serving = 0;
+  std::thread::id turn_holder;
+};
+
+// the synchronized regions attached to one sim, whose turns it takes together
+//
+// turns are taken in address order of the regions and handed back in
+// reverse, so that sims attaching overlapping sets of regions never deadlock.
+class shared_mem_turns_t {
+public:
+  // ignores unsynchronized regions, and regions already added
+  void add(std::shared_ptr<shared_mem_t> region);
+  bool empty() const;
+
+  void acquire();
+  void release();
+  bool held();
+
+  // the sim runs (see `py_sim_t::run`) and takes its turns at every quantum.
+  // a sim starting `parked` takes them at its first quantum instead.
+  void start(bool parked);
+  void stop();
+
+  // hand the turns over to the waiting sims and take them back. only the
+  // first ticked view (`caller`) does so, once per quantum; returns whether
+  // the turns were handed over. a parked sim hands them over until it
+  // resumes, and returns false.
+  bool yield(const void *caller);
+
+public:
+  // whether the sim stopped running guest code: all of its harts halted, or
+  // (about to be) at its interactive prompt, where it does not tick. a sim
+  // resuming from there runs up to one quantum before it takes its turns
+  // back.
+  std::function<bool()> parked;
+
+private:
+  std::vector<std::shared_ptr<shared_mem_t>> regions;
+  const void *leader = nullptr;
+  bool running = false;
+};
+
+// attachment of a `shared_mem_t` to a sim
+//
+// each attachment is instantiated twice: once in the sim's `mems` (for the
+// dts memory node and address translation), and once as a plugin device
+// created by `shared_mem_factory_t` (to be ticked at every quantum).
+class shared_mem_view_t : public abstract_mem_t {
+public:
+  shared_mem_view_t(std::shared_ptr<shared_mem_t> region, reg_t size,
+                    sim_t *sim = nullptr,
+                    std::shared_ptr<shared_mem_turns_t> turns = nullptr);
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual char *contents(reg_t addr) override;
+  virtual reg_t size() override;
+  virtual void dump(std::ostream &o) override;
+  virtual void tick(reg_t rtc_ticks) override;
+
+private:
+  std::shared_ptr<shared_mem_t> region;
+  reg_t sz;
+  sim_t *sim;
+  std::shared_ptr<shared_mem_turns_t> turns;
+};
+
+// device factory of the ticked `shared_mem_view_t`, with sargs `(base,)`
+class shared_mem_factory_t : public device_factory_t {
+public:
+  shared_mem_factory_t(std::shared_ptr<shared_mem_t> region, reg_t size,
+                       std::shared_ptr<shared_mem_turns_t> turns);
+
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override;
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override;
+
+private:
+  std::shared_ptr<shared_mem_t> region;
+  reg_t size;
+  std::shared_ptr<shared_mem_turns_t> turns;
+};
+
+// read-only ROM contents that the devices do not own
+//
+// an image is memory owned by someone else (`owner`, e.g. a python buffer
+// export), or the contents of a file. files of up to `COPY_MAX` bytes are
+// read into memory, larger ones are mapped read-only, and must then not be
+// truncated while mapped (reading past the end of a mapped file faults).
+// images of files are shared by path while the file is unchanged, so sims
+// booting the same ROM read or map it once.
+class rom_image_t {
+public:
+  rom_image_t(const uint8_t *data, size_t len, std::shared_ptr<void> owner);
+  ~rom_image_t();
+
+private:
+  rom_image_t(const rom_image_t &) = delete;
+  rom_image_t &operator=(const rom_image_t &) = delete;
+
+public:
+  static std::shared_ptr<rom_image_t> open(const std::string &path);
+
+public:
+  const uint8_t *data() const;
+  size_t size() const;
+  bool is_mapped() const;
+
+public:
+  static const size_t COPY_MAX = 64 << 10;
+
+private:
+  const uint8_t *base;
+  size_t len;
+  std::shared_ptr<void> owner;
+  bool mapped;
+
+private:
+  static std::mutex cache_lock;
+  static std::map<std::string, std::weak_ptr<rom_image_t>> cache;
+};
+
+// ROM device on a (shared) `rom_image_t`, stores fail
+//
+// a spike `rom_device_t` (with empty contents of its own), so that it remains
+// the one ROM device type for python.
+class shared_rom_t : public rom_device_t {
+public:
+  shared_rom_t(std::shared_ptr<rom_image_t> image);
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual reg_t size() override;
+
+public:
+  std::shared_ptr<rom_image_t> get_image() const;
+
+private:
+  std::shared_ptr<rom_image_t> image;
+};
+
+#endif // _RISCV_MEM_H_
@@ -0,0 +1,631 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <riscv/csrs.h>
+#include <riscv/encoding.h>
+
+#include "riscv_metrics.h"
+#include "riscv_stats.h"
+
+namespace {
+
+// `riscv.stats` kinds of python callbacks
+const char *const CALLBACK_KINDS[] = {"insn", "device", "csr", "rocc",
+                                      "disasm_arg"};
+
+uint64_t steady_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string hex(reg_t value) {
+  std::ostringstream oss;
+  oss << "0x" << std::hex << value;
+  return oss.str();
+}
+
+// plugin device of a sim with metrics
+class counting_device_t : public abstract_device_t {
+public:
+  counting_device_t(std::shared_ptr<sim_metrics_t> metrics,
+                    abstract_device_t *dev, uint64_t *loads, uint64_t *stores)
+      : metrics(metrics), dev(dev), loads(loads), stores(stores) {
+    // NOP
+  }
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override {
+    (*loads)++;
+    return dev->load(addr, len, bytes);
+  }
+
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override {
+    (*stores)++;
+    return dev->store(addr, len, bytes);
+  }
+
+  virtual reg_t size() override {
+    return dev->size();
+  }
+
+  virtual void tick(reg_t rtc_ticks) override {
+    dev->tick(rtc_ticks);
+  }
+
+private:
+  std::shared_ptr<sim_metrics_t> metrics;
+  std::unique_ptr<abstract_device_t> dev;
+  uint64_t *loads;
+  uint64_t *stores;
+};
+
+class counting_factory_t : public device_factory_t {
+public:
+  counting_factory_t(sim_metrics_t *metrics, const std::string &name,
+                     const device_factory_t *inner)
+      : metrics(metrics), name(name), inner(inner) {
+    // NOP
+  }
+
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override {
+    abstract_device_t *dev = inner->parse_from_fdt(fdt, sim, base, sargs);
+    if (dev == nullptr) {
+      return nullptr;
+    }
+    return metrics->add_device(name, base != nullptr ? *base : 0, dev);
+  }
+
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override {
+    return inner->generate_dts(sim, sargs);
+  }
+
+private:
+  sim_metrics_t *metrics;
+  std::string name;
+  const device_factory_t *inner;
+};
+
+// device ticking the metrics, without registers
+class ticking_device_t : public abstract_device_t {
+public:
+  ticking_device_t(std::shared_ptr<sim_metrics_t> metrics)
+      : metrics(metrics) {
+    // NOP
+  }
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override {
+    return false;
+  }
+
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override {
+    return false;
+  }
+
+  virtual reg_t size() override {
+    return 0;
+  }
+
+  virtual void tick(reg_t rtc_ticks) override {
+    metrics->tick();
+  }
+
+private:
+  std::shared_ptr<sim_metrics_t> metrics;
+};
+
+class ticking_factory_t : public device_factory_t {
+public:
+  ticking_factory_t(sim_metrics_t *metrics) : metrics(metrics) {
+    // NOP
+  }
+
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override {
+    if (base != nullptr) {
+      *base = sim_metrics_t::BASE;
+    }
+    return new ticking_device_t(metrics->shared_from_this());
+  }
+
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override {
+    return "";
+  }
+
+private:
+  sim_metrics_t *metrics;
+};
+
+// stands in for a CSR of a hart, counting the writes to it
+//
+// with `traps` set, the written values are counted as trap causes. the
+// wrapper never logs, as writes are logged by the wrapped CSR.
+class counting_csr_t : public csr_t {
+public:
+  counting_csr_t(processor_t *const proc, csr_t_p inner,
+                 sim_metrics_t::traps_t *traps, uint64_t *writes)
+      : csr_t(proc, inner->address), inner(inner), traps(traps),
+        writes(writes) {
+    // NOP
+  }
+
+public:
+  virtual void verify_permissions(insn_t insn, bool write) const override {
+    inner->verify_permissions(insn, write);
+  }
+
+  virtual reg_t read() const noexcept override {
+    return inner->read();
+  }
+
+protected:
+  virtual bool unlogged_write(const reg_t val) noexcept override {
+    if (traps != nullptr) {
+      // `take_trap` sets the interrupt bit at bit 63, or at MXLEN - 1 for
+      // causes adjusted for VS-mode
+      reg_t msb = reg_t(1) << (proc->get_isa().get_max_xlen() - 1);
+      bool interrupt = (val >> 63) != 0 || (val & msb) != 0;
+      reg_t code = val & ~(reg_t(1) << 63) & ~msb;
+      if (code < sim_metrics_t::CAUSES) {
+        (*traps)[(interrupt ? sim_metrics_t::CAUSES : 0) + code]++;
+      }
+    } else {
+      (*writes)++;
+    }
+    inner->write(val);
+    return false;
+  }
+
+private:
+  csr_t_p inner;
+  sim_metrics_t::traps_t *traps;
+  uint64_t *writes;
+};
+
+// wraps `csr` unless it is wrapped already
+void wrap_csr(processor_t *proc, csr_t_p &csr, sim_metrics_t::traps_t *traps,
+              uint64_t *writes) {
+  if (csr && !std::dynamic_pointer_cast<counting_csr_t>(csr)) {
+    csr = std::make_shared<counting_csr_t>(proc, csr, traps, writes);
+  }
+}
+
+} // namespace
+
+sim_metrics_t::sim_metrics_t(uint64_t interval)
+    : sim(nullptr), interval(interval), ticks(0), factories(), counters(),
+      devices(), harts(), mems(), last_publication_ns(0), series(), scratch(),
+      sequence(0), values(), wanted(false), socket_path(), listen_fd(-1),
+      wake_fd{-1, -1}, server() {
+  // NOP
+}
+
+sim_metrics_t::~sim_metrics_t() {
+  close();
+}
+
+const device_factory_t *sim_metrics_t::wrap(const std::string &name,
+                                            const device_factory_t *inner) {
+  factories.push_back(std::make_unique<counting_factory_t>(this, name, inner));
+  return factories.back().get();
+}
+
+const device_factory_t *sim_metrics_t::ticker() {
+  factories.push_back(std::make_unique<ticking_factory_t>(this));
+  return factories.back().get();
+}
+
+abstract_device_t *sim_metrics_t::add_device(const std::string &name,
+                                             reg_t base,
+                                             abstract_device_t *dev) {
+  counters.push_back(std::make_unique<device_t>(device_t{name, base, 0, 0}));
+  devices.push_back(new counting_device_t(shared_from_this(), dev,
+                                          &counters.back()->loads,
+                                          &counters.back()->stores));
+  return devices.back();
+}
+
+void sim_metrics_t::bind(
+    sim_t *sim, const std::vector<std::pair<reg_t, mapped_mem_t *>> &mems) {
+  this->sim = sim;
+  this->mems = mems;
+  harts.resize(sim->nprocs());
+  for (size_t i = 0; i < harts.size(); i++) {
+    harts[i] = hart_t{sim->get_core(i), {}, 0, 0};
+    attach(harts[i].proc);
+  }
+  // the series of a metric are contiguous, as the exposition format requires
+  for (const auto &hart : harts) {
+    add("pyspike_instret_total",
+        "hart=\"" + std::to_string(hart.proc->get_id()) + "\"", COUNTER,
+        "Instructions retired.");
+  }
+  for (const auto &hart : harts) {
+    add("pyspike_instructions_per_second",
+        "hart=\"" + std::to_string(hart.proc->get_id()) + "\"", GAUGE,
+        "Instructions retired per second, between the last two publications.");
+  }
+  for (const auto &hart : harts) {
+    for (size_t i = 0; i < 2 * CAUSES; i++) {
+      add("pyspike_traps_total",
+          "hart=\"" + std::to_string(hart.proc->get_id()) + "\",cause=\"" +
+              std::to_string(i % CAUSES) + "\",interrupt=\"" +
+              (i < CAUSES ? "0" : "1") + "\"",
+          COUNTER, "Traps taken, by cause.", true);
+    }
+  }
+  for (const auto &hart : harts) {
+    add("pyspike_satp_writes_total",
+        "hart=\"" + std::to_string(hart.proc->get_id()) + "\"", COUNTER,
+        "Writes to satp, each of which flushes the TLB.");
+  }
+  for (const auto &device : counters) {
+    add("pyspike_mmio_loads_total",
+        "device=\"" + device->name + "\",base=\"" + hex(device->base) + "\"",
+        COUNTER, "MMIO loads from a plugin device.");
+  }
+  for (const auto &device : counters) {
+    add("pyspike_mmio_stores_total",
+        "device=\"" + device->name + "\",base=\"" + hex(device->base) + "\"",
+        COUNTER, "MMIO stores to a plugin device.");
+  }
+  for (const auto &[base, mem] : mems) {
+    add("pyspike_memory_resident_pages", "base=\"" + hex(base) + "\"", GAUGE,
+        "Pages of a guest memory region resident in host memory.");
+  }
+  for (const auto &[base, mem] : mems) {
+    add("pyspike_memory_pages", "base=\"" + hex(base) + "\"", GAUGE,
+        "Pages of a guest memory region.");
+  }
+  for (const char *kind : CALLBACK_KINDS) {
+    add("pyspike_python_callbacks_total",
+        "kind=\"" + std::string(kind) + "\"", COUNTER,
+        "Python callbacks of the process, counted while riscv.stats is "
+        "enabled.");
+  }
+  values.reset(new std::atomic<uint64_t>[series.size()]);
+  for (size_t i = 0; i < series.size(); i++) {
+    values[i].store(0, std::memory_order_relaxed);
+  }
+  scratch.reserve(series.size());
+  last_publication_ns = steady_ns();
+}
+
+void sim_metrics_t::unbind() {
+  // the harts keep their counters, which the CSR wrappers still point to
+  sim = nullptr;
+  mems.clear();
+  // deleted by the sim
+  devices.clear();
+}
+
+void sim_metrics_t::attach(processor_t *proc) {
+  for (auto &hart : harts) {
+    if (hart.proc != proc) {
+      continue;
+    }
+    state_t *state = proc->get_state();
+    // `take_trap` writes these objects directly, while CSR instructions
+    // access scause through the virtualized CSR, which is left as is
+    wrap_csr(proc, state->mcause, &hart.traps, nullptr);
+    wrap_csr(proc, state->nonvirtual_scause, &hart.traps, nullptr);
+    wrap_csr(proc, state->vscause, &hart.traps, nullptr);
+    auto it = state->csrmap.find(CSR_SATP);
+    if (it != state->csrmap.end()) {
+      wrap_csr(proc, it->second, nullptr, &hart.satp_writes);
+    }
+  }
+}
+
+void sim_metrics_t::tick() {
+  uint64_t every = interval.load(std::memory_order_relaxed);
+  if ((every != 0 && ++ticks >= every) ||
+      wanted.load(std::memory_order_relaxed)) {
+    publish();
+  }
+}
+
+void sim_metrics_t::publish() {
+  if (sim == nullptr) {
+    return;
+  }
+  ticks = 0;
+  wanted.store(false, std::memory_order_relaxed);
+  uint64_t now = steady_ns();
+  uint64_t elapsed = now - last_publication_ns;
+  last_publication_ns = now;
+  scratch.clear();
+  std::vector<uint64_t> instret;
+  for (auto &hart : harts) {
+    instret.push_back(hart.proc->get_state()->minstret->read());
+    scratch.push_back(instret.back());
+  }
+  for (size_t i = 0; i < harts.size(); i++) {
+    uint64_t retired = instret[i] - harts[i].last_instret;
+    harts[i].last_instret = instret[i];
+    scratch.push_back(
+        elapsed != 0 ? static_cast<uint64_t>(retired * 1e9 / elapsed) : 0);
+  }
+  for (const auto &hart : harts) {
+    scratch.insert(scratch.end(), hart.traps.begin(), hart.traps.end());
+  }
+  for (const auto &hart : harts) {
+    scratch.push_back(hart.satp_writes);
+  }
+  for (const auto &device : counters) {
+    scratch.push_back(device->loads);
+  }
+  for (const auto &device : counters) {
+    scratch.push_back(device->stores);
+  }
+  for (const auto &[base, mem] : mems) {
+    scratch.push_back(mem->resident_pages());
+  }
+  for (const auto &[base, mem] : mems) {
+    scratch.push_back(mem->size() / PGSIZE);
+  }
+  size_t kinds = sizeof(CALLBACK_KINDS) / sizeof(CALLBACK_KINDS[0]);
+  size_t first = scratch.size();
+  scratch.resize(first + kinds, 0);
+  for (const auto *site : callback_stats_t::sites()) {
+    for (size_t i = 0; i < kinds; i++) {
+      if (site->get_kind() == CALLBACK_KINDS[i]) {
+        scratch[first + i] += site->get_calls();
+      }
+    }
+  }
+  // seqlock write, the sim's thread being the only writer
+  uint64_t seq = sequence.load(std::memory_order_relaxed);
+  sequence.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < series.size(); i++) {
+    values[i].store(scratch[i], std::memory_order_relaxed);
+  }
+  sequence.store(seq + 2, std::memory_order_release);
+}
+
+std::vector<uint64_t> sim_metrics_t::read() const {
+  wanted.store(true, std::memory_order_relaxed);
+  std::vector<uint64_t> result(series.size());
+  while (true) {
+    uint64_t seq = sequence.load(std::memory_order_acquire);
+    if (seq & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (size_t i = 0; i < series.size(); i++) {
+      result[i] = values[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) == seq) {
+      return result;
+    }
+  }
+}
+
+std::vector<sim_metrics_t::sample_t> sim_metrics_t::snapshot() const {
+  auto values = read();
+  std::vector<sample_t> samples;
+  samples.reserve(series.size());
+  for (size_t i = 0; i < series.size(); i++) {
+    samples.push_back(std::make_pair(
+        series[i].name + "{" + series[i].labels + "}", values[i]));
+  }
+  return samples;
+}
+
+std::string sim_metrics_t::prometheus() const {
+  auto values = read();
+  std::ostringstream oss;
+  const std::string *name = nullptr;
+  for (size_t i = 0; i < series.size(); i++) {
+    const series_t &s = series[i];
+    if (name == nullptr || *name != s.name) {
+      name = &s.name;
+      oss << "# HELP " << s.name << " " << s.help << "\n";
+      oss << "# TYPE " << s.name << " "
+          << (s.type == COUNTER ? "counter" : "gauge") << "\n";
+    }
+    if (s.sparse && values[i] == 0) {
+      continue;
+    }
+    oss << s.name << "{" << s.labels << "} " << values[i] << "\n";
+  }
+  return oss.str();
+}
+
+void sim_metrics_t::write(const std::string &path) const {
+  // scrapers never see a partial file
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out << prometheus();
+    if (!out) {
+      throw std::runtime_error("cannot write metrics to " + tmp);
+    }
+  }
+  if (rename(tmp.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("cannot write metrics to " + path + ": " +
+                             strerror(errno));
+  }
+}
+
+void sim_metrics_t::serve(const std::string &path) {
+  if (server.joinable()) {
+    throw std::runtime_error("metrics already served on " + socket_path);
+  }
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error("socket path too long: " + path);
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw std::runtime_error(std::string("cannot create socket: ") +
+                             strerror(errno));
+  }
+  // a socket left over by an earlier process is replaced
+  unlink(path.c_str());
+  if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, 16) != 0 || pipe2(wake_fd, O_CLOEXEC) != 0) {
+    int err = errno;
+    ::close(fd);
+    throw std::runtime_error("cannot serve metrics on " + path + ": " +
+                             strerror(err));
+  }
+  listen_fd = fd;
+  socket_path = path;
+  server = std::thread([this]() { accept(); });
+}
+
+void sim_metrics_t::close() {
+  if (!server.joinable()) {
+    return;
+  }
+  char byte = 0;
+  ssize_t n = ::write(wake_fd[1], &byte, 1);
+  (void)n;
+  server.join();
+  ::close(listen_fd);
+  ::close(wake_fd[0]);
+  ::close(wake_fd[1]);
+  unlink(socket_path.c_str());
+  listen_fd = -1;
+  wake_fd[0] = wake_fd[1] = -1;
+  socket_path.clear();
+}
+
+void sim_metrics_t::accept() {
+  while (true) {
+    pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake_fd[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if (fds[1].revents != 0) {
+      return;
+    }
+    int fd =
+        accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) {
+      continue;
+    }
+    // the request, if any, is read up to its blank line and ignored
+    uint64_t deadline = steady_ns() + TIMEOUT_MS * uint64_t(1000000);
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           request.size() < 8192 && wait(fd, POLLIN, deadline)) {
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      request.append(buf, n);
+    }
+    std::string body = prometheus();
+    std::string text = "HTTP/1.0 200 OK\r\n"
+                       "Content-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: " +
+                       std::to_string(body.size()) + "\r\n\r\n" + body;
+    // a reader that stops reading is dropped, rather than blocking `close()`
+    deadline = steady_ns() + TIMEOUT_MS * uint64_t(1000000);
+    size_t sent = 0;
+    while (sent < text.size() && wait(fd, POLLOUT, deadline)) {
+      ssize_t n = send(fd, text.data() + sent, text.size() - sent,
+                       MSG_NOSIGNAL);
+      if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      sent += n;
+    }
+    ::close(fd);
+  }
+}
+
+bool sim_metrics_t::wait(int fd, short events, uint64_t deadline_ns) const {
+  while (true) {
+    uint64_t now = steady_ns();
+    if (now >= deadline_ns) {
+      return false;
+    }
+    int timeout = static_cast<int>((deadline_ns - now + 999999) / 1000000);
+    pollfd fds[2] = {{fd, events, 0}, {wake_fd[0], POLLIN, 0}};
+    int n = poll(fds, 2, timeout);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    // the wake byte is left unread, for `accept` to return
+    return n > 0 && fds[1].revents == 0 && fds[0].revents != 0;
+  }
+}
+
+uint64_t sim_metrics_t::get_interval() const {
+  return interval.load(std::memory_order_relaxed);
+}
+
+void sim_metrics_t::set_interval(uint64_t interval) {
+  // taken by the next tick, on the sim's thread
+  this->interval.store(interval, std::memory_order_relaxed);
+}
+
+uint64_t sim_metrics_t::get_publications() const {
+  return sequence.load(std::memory_order_acquire) / 2;
+}
+
+const std::string &sim_metrics_t::get_socket() const {
+  return socket_path;
+}
+
+const std::vector<abstract_device_t *> &sim_metrics_t::get_devices() const {
+  return devices;
+}
+
+void sim_metrics_t::add(const std::string &name, const std::string &labels,
+                        type_t type, const std::string &help, bool sparse) {
+  series.push_back(series_t{name, labels, type, help, sparse});
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_METRICS_H_
+#define _RISCV_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/processor.h>
+#include <riscv/sim.h>
+
+#include "riscv_mem.h"
+
+// live telemetry of one sim (`sim_t(metrics=True)`)
+//
+// counters are only written by the thread running the sim, and published to
+// readers on any thread through a seqlock: a publication makes the sequence
+// odd, stores every value and makes it even again, and readers retry their
+// copy until they saw the same even sequence before and after it. values are
+// published on the first device tick after a reader asked for a snapshot,
+// every `interval` ticks if set (none by default), and when `run` returns. a
+// polled snapshot is thus at most one quantum (`INTERLEAVE` steps) old, and a
+// sim that nobody reads, without an interval, spends two relaxed loads per
+// tick, and an increment per MMIO access of its plugin devices.
+//
+// the metrics are:
+//
+// - per hart: instructions retired, and retired per second between the last
+//   two publications
+// - per hart: traps taken, by cause. spike has no hook for traps, so they are
+//   counted as the writes of `take_trap` to mcause, scause and vscause (whose
+//   objects are replaced with counting wrappers). traps taken in debug mode
+//   write no cause, and are not counted.
+// - per hart: writes to satp, each of which flushes the TLB. the flushes of
+//   sfence.vma and hfence are not observable, and are not counted.
+// - per plugin device: MMIO loads and stores
+// - per memory region: resident pages (`mincore`, at every publication, in
+//   time linear in the size of the region). shared regions are left out.
+// - process-wide: python callbacks by kind, as counted by `riscv.stats` while
+//   it is enabled
+class sim_metrics_t : public std::enable_shared_from_this<sim_metrics_t> {
+public:
+  typedef std::pair<std::string, uint64_t> sample_t;
+
+public:
+  sim_metrics_t(uint64_t interval);
+  ~sim_metrics_t();
+
+private:
+  sim_metrics_t(const sim_metrics_t &) = delete;
+  sim_metrics_t &operator=(const sim_metrics_t &) = delete;
+
+public:
+  // the factory standing in for plugin device factory `inner` (registered as
+  // `name`), and the one of the device ticking the metrics. owned by the
+  // metrics.
+  const device_factory_t *wrap(const std::string &name,
+                               const device_factory_t *inner);
+  const device_factory_t *ticker();
+  // lays out the metrics of the sim, once its devices are created
+  void bind(sim_t *sim,
+            const std::vector<std::pair<reg_t, mapped_mem_t *>> &mems);
+  // stops publishing, as the sim is destroyed (along with the plugin devices).
+  // snapshots keep the last values.
+  void unbind();
+  // (re)installs the trap and satp counters of a hart, after a reset
+  void attach(processor_t *proc);
+
+public:
+  // called on the sim's thread
+  void tick();
+  void publish();
+
+public:
+  // called on any thread
+  std::vector<sample_t> snapshot() const;
+  // in the prometheus text exposition format
+  std::string prometheus() const;
+  // writes `prometheus()` to `path`, atomically (through a rename)
+  void write(const std::string &path) const;
+  // serves `prometheus()` over HTTP/1.0 to every connection to unix socket
+  // `path`, from a thread of its own. connections are served one at a time,
+  // each given `TIMEOUT_MS` to send the request, and as long to take the
+  // response.
+  void serve(const std::string &path);
+  void close();
+
+public:
+  uint64_t get_interval() const;
+  void set_interval(uint64_t interval);
+  uint64_t get_publications() const;
+  const std::string &get_socket() const;
+
+public:
+  // called by the counting factories
+  abstract_device_t *add_device(const std::string &name, reg_t base,
+                                abstract_device_t *dev);
+
+public:
+  // the plugin devices, as counted
+  const std::vector<abstract_device_t *> &get_devices() const;
+
+public:
+  // traps by cause, exceptions first, then interrupts
+  static const size_t CAUSES = 64;
+  typedef std::array<uint64_t, 2 * CAUSES> traps_t;
+
+  // default publication interval, in ticks: none, as publications scan the
+  // pages of every memory region
+  static const uint64_t INTERVAL = 0;
+
+  // time a connection to the socket is given to send or receive, in ms
+  static const int TIMEOUT_MS = 1000;
+
+  // address of the (empty) ticking device on the bus, below the scheduler's
+  static const reg_t BASE = ~reg_t(0) << 13;
+
+private:
+  // MMIO counters of a plugin device
+  struct device_t {
+    std::string name;
+    reg_t base;
+    uint64_t loads;
+    uint64_t stores;
+  };
+
+  enum type_t { COUNTER, GAUGE };
+
+  // one published value
+  struct series_t {
+    std::string name;
+    std::string labels;
+    type_t type;
+    std::string help;
+    // zero-valued series are left out of the exposition
+    bool sparse;
+  };
+
+  struct hart_t {
+    processor_t *proc;
+    traps_t traps;
+    uint64_t satp_writes;
+    uint64_t last_instret;
+  };
+
+private:
+  void add(const std::string &name, const std::string &labels, type_t type,
+           const std::string &help, bool sparse = false);
+  std::vector<uint64_t> read() const;
+  void accept();
+  // waits for `events` on connection `fd` until `deadline_ns`. false on
+  // timeout, or once `close()` was called.
+  bool wait(int fd, short events, uint64_t deadline_ns) const;
+
+private:
+  sim_t *sim;
+  std::atomic<uint64_t> interval;
+  uint64_t ticks;
+  std::vector<std::unique_ptr<device_factory_t>> factories;
+  std::vector<std::unique_ptr<device_t>> counters;
+  std::vector<abstract_device_t *> devices;
+  std::vector<hart_t> harts;
+  std::vector<std::pair<reg_t, mapped_mem_t *>> mems;
+  uint64_t last_publication_ns;
+  // layout of the published values, fixed once bound
+  std::vector<series_t> series;
+  std::vector<uint64_t> scratch;
+  // seqlock
+  std::atomic<uint64_t> sequence;
+  std::unique_ptr<std::atomic<uint64_t>[]> values;
+  mutable std::atomic<bool> wanted;
+  // unix socket server
+  std::string socket_path;
+  int listen_fd;
+  int wake_fd[2];
+  std::thread server;
+};
+
+#endif // _RISCV_METRICS_H_
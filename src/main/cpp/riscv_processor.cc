@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 #include <iostream>
+#include <unordered_map>
+#include <utility>
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
@@ -23,7 +25,9 @@
 
 namespace py = pybind11;
 
-py_commit_log_reg_t::py_commit_log_reg_t(commit_log_reg_t &ref) : ref(ref) {
+py_commit_log_reg_t::py_commit_log_reg_t(commit_log_reg_t &ref,
+                                         py::object owner)
+    : ref(ref), owner(std::move(owner)) {
   // NOP
 }
 
@@ -64,7 +68,9 @@ py::str py_commit_log_reg_t::repr() const {
   return oss.str();
 }
 
-py_commit_log_mem_t::py_commit_log_mem_t(commit_log_mem_t &ref) : ref(ref) {
+py_commit_log_mem_t::py_commit_log_mem_t(commit_log_mem_t &ref,
+                                         py::object owner)
+    : ref(ref), owner(std::move(owner)) {
   // NOP
 }
 
@@ -92,6 +98,37 @@ py::str py_commit_log_mem_t::repr() const {
   return oss.str();
 }
 
+std::unordered_map<const state_t *, const py_hart_pin_t *>
+    py_hart_pin_t::pinned;
+
+py_hart_pin_t::py_hart_pin_t(processor_t *proc) : key(nullptr) {
+  state_t *st = proc->get_state();
+  if (pinned.count(st) != 0) {
+    return;
+  }
+  key = st;
+  this->proc = py::cast(proc, py::return_value_policy::reference);
+  state = py::cast(st, py::return_value_policy::reference_internal,
+                   this->proc);
+  XPR = py::cast(&st->XPR, py::return_value_policy::reference_internal, state);
+  FPR = py::cast(&st->FPR, py::return_value_policy::reference_internal, state);
+  log_reg_write = py::cast(py_commit_log_reg_t(st->log_reg_write, state));
+  log_mem_read = py::cast(py_commit_log_mem_t(st->log_mem_read, state));
+  log_mem_write = py::cast(py_commit_log_mem_t(st->log_mem_write, state));
+  pinned.emplace(key, this);
+}
+
+py_hart_pin_t::~py_hart_pin_t() {
+  if (key != nullptr) {
+    pinned.erase(key);
+  }
+}
+
+const py_hart_pin_t *py_hart_pin_t::lookup(const state_t *state) {
+  auto it = pinned.find(state);
+  return it == pinned.end() ? nullptr : it->second;
+}
+
 insn_desc_t *
 py_insn_desc_t_create(insn_bits_t match, insn_bits_t mask,
                       py::function fast_rv32i, py::function fast_rv64i,
@@ -99,16 +136,26 @@ py_insn_desc_t_create(insn_bits_t match, insn_bits_t mask,
                       py::function logged_rv32i, py::function logged_rv64i,
                       py::function logged_rv32e, py::function logged_rv64e) {
   auto &bridge = PythonBridge::getInstance();
+  // the same callable is often given for several variants
+  std::unordered_map<PyObject *, insn_func_t> funcs;
+  auto track = [&](const py::function &py_func) {
+    auto it = funcs.find(py_func.ptr());
+    if (it == funcs.end()) {
+      it = funcs.emplace(py_func.ptr(), bridge.track<insn_func_t>(py_func))
+               .first;
+    }
+    return it->second;
+  };
   return new insn_desc_t{
     match,
     mask,
-    bridge.track<insn_func_t>(fast_rv32i),
-    bridge.track<insn_func_t>(fast_rv64i),
-    bridge.track<insn_func_t>(fast_rv32e),
-    bridge.track<insn_func_t>(fast_rv64e),
-    bridge.track<insn_func_t>(logged_rv32i),
-    bridge.track<insn_func_t>(logged_rv64i),
-    bridge.track<insn_func_t>(logged_rv32e),
-    bridge.track<insn_func_t>(logged_rv64e)
+    track(fast_rv32i),
+    track(fast_rv64i),
+    track(fast_rv32e),
+    track(fast_rv64e),
+    track(logged_rv32i),
+    track(logged_rv64i),
+    track(logged_rv32e),
+    track(logged_rv64e)
   };
 }
@@ -17,6 +17,7 @@
 #define _RISCV_PROCESSOR_H_
 
 #include <functional>
+#include <unordered_map>
 
 #include <pybind11/functional.h>
 #include <pybind11/pybind11.h>
@@ -28,7 +29,9 @@
 // proxy to state_t::log_reg_write
 class py_commit_log_reg_t {
 public:
-  py_commit_log_reg_t(commit_log_reg_t &ref);
+  // `owner`, if any, is kept alive by the proxy
+  py_commit_log_reg_t(commit_log_reg_t &ref,
+                      pybind11::object owner = pybind11::object());
 
 public:
   size_t len() const;
@@ -42,12 +45,14 @@ public:
 
 private:
   commit_log_reg_t &ref;
+  pybind11::object owner;
 };
 
 // proxy to state_t::log_mem_{read,write}
 class py_commit_log_mem_t {
 public:
-  py_commit_log_mem_t(commit_log_mem_t &ref);
+  py_commit_log_mem_t(commit_log_mem_t &ref,
+                      pybind11::object owner = pybind11::object());
 
 public:
   size_t len() const;
@@ -58,6 +63,41 @@ public:
 
 private:
   commit_log_mem_t &ref;
+  pybind11::object owner;
+};
+
+// python wrappers of a hart, pinned while its sim runs or while it steps
+//
+// python instruction handlers then get the same processor_t, state_t, register
+// file and commit log wrappers on every call, instead of allocating (and
+// freeing) new ones. pinning a hart that is pinned already is a no-op.
+class py_hart_pin_t {
+public:
+  py_hart_pin_t(processor_t *proc);
+  ~py_hart_pin_t();
+
+private:
+  py_hart_pin_t(const py_hart_pin_t &) = delete;
+  py_hart_pin_t &operator=(const py_hart_pin_t &) = delete;
+
+public:
+  // the pin of the hart of `state`, null if it is not pinned
+  static const py_hart_pin_t *lookup(const state_t *state);
+
+public:
+  pybind11::object proc;
+  pybind11::object state;
+  pybind11::object XPR;
+  pybind11::object FPR;
+  pybind11::object log_reg_write;
+  pybind11::object log_mem_read;
+  pybind11::object log_mem_write;
+
+private:
+  const state_t *key;
+
+private:
+  static std::unordered_map<const state_t *, const py_hart_pin_t *> pinned;
 };
 
 // py signature : insn_desc_t_create(
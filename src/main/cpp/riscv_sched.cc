@@ -0,0 +1,259 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <riscv/devices.h>
+#include <riscv/encoding.h>
+#include <riscv/platform.h>
+#include <riscv/processor.h>
+
+#include "riscv_sched.h"
+
+// CLINT register offsets, as in spike's clint_t
+static const reg_t CLINT_MTIMECMP = 0x4000;
+static const reg_t CLINT_MTIME = 0xbff8;
+
+// PLIC register offsets, as in spike's plic_t
+static const reg_t PLIC_PENDING = 0x1000;
+static const reg_t PLIC_ENABLE = 0x2000;
+static const reg_t PLIC_ENABLE_PER_CONTEXT = 0x80;
+static const size_t PLIC_WORDS = 32;
+
+namespace {
+
+// spike keeps the devices of a sim private. explicit instantiations are
+// exempt from access checks, which lets `sim_devices` name the member.
+typedef std::vector<std::shared_ptr<abstract_device_t>> devices_t;
+
+devices_t sim_t::*sim_devices();
+
+template <devices_t sim_t::*member> struct sim_devices_t {
+  friend devices_t sim_t::*sim_devices() { return member; }
+};
+
+template struct sim_devices_t<&sim_t::devices>;
+
+} // namespace
+
+scheduler_t::scheduler_t(sim_t *sim)
+    : sim(sim), idle_skip(false), next_id(1), events(), skips(0), skipped(0) {
+  // NOP
+}
+
+bool scheduler_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  return false;
+}
+
+bool scheduler_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  return false;
+}
+
+reg_t scheduler_t::size() {
+  return 0;
+}
+
+void scheduler_t::tick(reg_t rtc_ticks) {
+  std::optional<reg_t> now = get_mtime();
+  if (!now.has_value()) {
+    return;
+  }
+  fire(now.value());
+  if (!idle_skip || !all_idle()) {
+    return;
+  }
+  std::optional<reg_t> target = next_event();
+  if (!target.has_value() || target.value() <= now.value()) {
+    return;
+  }
+  reg_t mtime = target.value();
+  if (!sim->mmio_store(CLINT_BASE + CLINT_MTIME, sizeof(mtime),
+                       reinterpret_cast<const uint8_t *>(&mtime))) {
+    return;
+  }
+  skips++;
+  skipped += mtime - now.value();
+  advance(mtime - now.value());
+  fire(mtime);
+}
+
+uint64_t scheduler_t::schedule(reg_t when, callback_t callback) {
+  uint64_t id = next_id++;
+  events.emplace(when, event_t{id, callback});
+  return id;
+}
+
+bool scheduler_t::cancel(uint64_t id) {
+  for (auto it = events.begin(); it != events.end(); it++) {
+    if (it->second.id == id) {
+      events.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t scheduler_t::pending() const {
+  return events.size();
+}
+
+std::optional<reg_t> scheduler_t::get_mtime() const {
+  reg_t mtime = 0;
+  if (!sim->mmio_load(CLINT_BASE + CLINT_MTIME, sizeof(mtime),
+                      reinterpret_cast<uint8_t *>(&mtime))) {
+    return std::nullopt;
+  }
+  return mtime;
+}
+
+bool scheduler_t::get_idle_skip() const {
+  return idle_skip;
+}
+
+void scheduler_t::set_idle_skip(bool enabled) {
+  idle_skip = enabled;
+}
+
+uint64_t scheduler_t::get_skips() const {
+  return skips;
+}
+
+uint64_t scheduler_t::get_skipped() const {
+  return skipped;
+}
+
+bool scheduler_t::all_idle() const {
+  for (size_t i = 0; i < sim->nprocs(); i++) {
+    processor_t *proc = sim->get_core(i);
+    state_t *state = proc->get_state();
+    reg_t mie = state->mie->read();
+    if (!proc->is_waiting_for_interrupt() || (state->mip->read() & mie) != 0) {
+      return false;
+    }
+  }
+  return sim->nprocs() > 0 && !external_pending();
+}
+
+bool scheduler_t::external_pending() const {
+  auto *plic = dynamic_cast<abstract_device_t *>(sim->get_intctrl());
+  if (plic == nullptr) {
+    return false;
+  }
+  uint32_t pending[PLIC_WORDS] = {};
+  bool any = false;
+  for (size_t i = 0; i < PLIC_WORDS; i++) {
+    plic->load(PLIC_PENDING + 4 * i, sizeof(pending[i]),
+               reinterpret_cast<uint8_t *>(&pending[i]));
+    any |= pending[i] != 0;
+  }
+  if (!any) {
+    return false;
+  }
+  // loads past the last context fail
+  for (reg_t context = 0;; context++) {
+    for (size_t i = 0; i < PLIC_WORDS; i++) {
+      uint32_t enabled = 0;
+      if (!plic->load(PLIC_ENABLE + context * PLIC_ENABLE_PER_CONTEXT + 4 * i,
+                      sizeof(enabled), reinterpret_cast<uint8_t *>(&enabled))) {
+        return false;
+      }
+      if (pending[i] & enabled) {
+        return true;
+      }
+    }
+  }
+}
+
+std::optional<reg_t> scheduler_t::next_event() const {
+  std::optional<reg_t> next;
+  if (!events.empty()) {
+    next = events.begin()->first;
+  }
+  for (size_t i = 0; i < sim->nprocs(); i++) {
+    processor_t *proc = sim->get_core(i);
+    state_t *state = proc->get_state();
+    reg_t mie = state->mie->read();
+    reg_t mtimecmp = 0;
+    // an all-ones compare value never fires
+    if ((mie & MIP_MTIP) &&
+        sim->mmio_load(CLINT_BASE + CLINT_MTIMECMP + 8 * proc->get_id(),
+                       sizeof(mtimecmp),
+                       reinterpret_cast<uint8_t *>(&mtimecmp)) &&
+        mtimecmp != ~reg_t(0)) {
+      next = std::min(next.value_or(mtimecmp), mtimecmp);
+    }
+    // with Sstc, STIP follows `time >= stimecmp` (the CSR itself has no read
+    // side effects, unlike its RV32 halves in the csrmap)
+    if ((mie & MIP_STIP) && proc->extension_enabled(EXT_SSTC) &&
+        state->stimecmp && (state->menvcfg->read() & MENVCFG_STCE)) {
+      reg_t stimecmp = state->stimecmp->read();
+      if (stimecmp != ~reg_t(0)) {
+        next = std::min(next.value_or(stimecmp), stimecmp);
+      }
+    }
+  }
+  return next;
+}
+
+void scheduler_t::fire(reg_t now) {
+  while (!events.empty() && events.begin()->first <= now) {
+    // callbacks may schedule or cancel events
+    callback_t callback = std::move(events.begin()->second.callback);
+    events.erase(events.begin());
+    try {
+      callback();
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+}
+
+void scheduler_t::advance(reg_t rtc_ticks) {
+  for (auto &dev : sim->*sim_devices()) {
+    if (dev.get() != this && dynamic_cast<clint_t *>(dev.get()) == nullptr) {
+      dev->tick(rtc_ticks);
+    }
+  }
+}
+
+scheduler_factory_t::scheduler_factory_t(bool idle_skip)
+    : idle_skip(idle_skip), instance(nullptr) {
+  // NOP
+}
+
+abstract_device_t *scheduler_factory_t::parse_from_fdt(
+    const void *fdt, const sim_t *sim, reg_t *base,
+    const std::vector<std::string> &sargs) const {
+  if (base != nullptr) {
+    *base = scheduler_t::BASE;
+  }
+  instance = new scheduler_t(const_cast<sim_t *>(sim));
+  instance->set_idle_skip(idle_skip);
+  return instance;
+}
+
+std::string
+scheduler_factory_t::generate_dts(const sim_t *sim,
+                                  const std::vector<std::string> &sargs) const {
+  return "";
+}
+
+scheduler_t *scheduler_factory_t::get_instance() const {
+  return instance;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_SCHED_H_
+#define _RISCV_SCHED_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/sim.h>
+
+// timed events and idle fast-forward of one sim
+//
+// the scheduler is a device without registers, ticked along with all others.
+// event times are in CLINT `mtime` units, and events fire on the first tick
+// at or after their time.
+//
+// with `idle_skip` set, a tick on which every hart waits in WFI with no
+// enabled interrupt pending, and no PLIC source is both pending and enabled,
+// moves `mtime` straight to the next event: the earliest `mtimecmp` of the
+// harts with MTIE set, the earliest `stimecmp` of the harts with STIE set and
+// Sstc enabled (`menvcfg.STCE`), or the earliest scheduled event (devices
+// schedule theirs here). all-ones compare values never fire, and nothing is
+// skipped while there is no such event. the other devices are then ticked
+// once for the skipped time, so that their time keeps up with `mtime`, and
+// an external interrupt they raise wakes the harts right after the skip.
+class scheduler_t : public abstract_device_t {
+public:
+  typedef std::function<void()> callback_t;
+
+public:
+  scheduler_t(sim_t *sim);
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual reg_t size() override;
+  virtual void tick(reg_t rtc_ticks) override;
+
+public:
+  // returns an id for `cancel`
+  uint64_t schedule(reg_t when, callback_t callback);
+  bool cancel(uint64_t id);
+  size_t pending() const;
+
+  std::optional<reg_t> get_mtime() const;
+  bool get_idle_skip() const;
+  void set_idle_skip(bool enabled);
+  uint64_t get_skips() const;
+  uint64_t get_skipped() const;
+
+public:
+  // address of the (empty) device on the bus
+  static const reg_t BASE = ~reg_t(0) << 12;
+
+private:
+  bool all_idle() const;
+  // whether any PLIC source is pending and enabled in some context
+  bool external_pending() const;
+  std::optional<reg_t> next_event() const;
+  void fire(reg_t now);
+  // tick all other devices but the CLINT for `rtc_ticks`
+  void advance(reg_t rtc_ticks);
+
+private:
+  struct event_t {
+    uint64_t id;
+    callback_t callback;
+  };
+
+private:
+  sim_t *sim;
+  bool idle_skip;
+  uint64_t next_id;
+  std::multimap<reg_t, event_t> events;
+  uint64_t skips;
+  uint64_t skipped;
+};
+
+// device factory of a sim's `scheduler_t`, with sargs `()`
+class scheduler_factory_t : public device_factory_t {
+public:
+  scheduler_factory_t(bool idle_skip);
+
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override;
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override;
+
+public:
+  // the instance created by `parse_from_fdt`, owned by the sim
+  scheduler_t *get_instance() const;
+
+private:
+  bool idle_skip;
+  mutable scheduler_t *instance;
+};
+
+#endif // _RISCV_SCHED_H_
@@ -13,20 +13,181 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <optional>
+#include <stdexcept>
 #include <vector>
 
 #include <pybind11/functional.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include "riscv_cache.h"
+#include "riscv_processor.h"
 #include "riscv_sim.h"
 
+// set by spike's SIGINT handler, the sim enters its interactive prompt
+extern volatile bool ctrlc_pressed;
+
+namespace {
+
+// spike keeps the dtb it compiled and its debug flag private. explicit
+// instantiations are exempt from access checks, which lets `sim_dtb` and
+// `sim_debug` name the members.
+std::string sim_t::*sim_dtb();
+bool sim_t::*sim_debug();
+
+template <std::string sim_t::*member> struct sim_dtb_t {
+  friend std::string sim_t::*sim_dtb() { return member; }
+};
+
+template <bool sim_t::*member> struct sim_debug_t {
+  friend bool sim_t::*sim_debug() { return member; }
+};
+
+template struct sim_dtb_t<&sim_t::dtb>;
+template struct sim_debug_t<&sim_t::debug>;
+
+} // namespace
+
+py_sim_t::~py_sim_t() {
+  if (metrics) {
+    metrics->unbind();
+  }
+  if (trace) {
+    trace->unbind();
+  }
+}
+
 void py_sim_t::proc_reset(unsigned id) {
+  // a reset replaces the CSRs of the hart
+  if (metrics) {
+    for (size_t i = 0; i < nprocs(); i++) {
+      if (get_core(i)->get_id() == id) {
+        metrics->attach(get_core(i));
+      }
+    }
+  }
   PYBIND11_OVERRIDE(void, sim_t, proc_reset, id);
 }
 
+int py_sim_t::run() {
+  PythonBridge::scope_guard_t scope(get_id());
+  mmio_trace_t::run_scope_t trace_scope(trace.get());
+  std::vector<std::unique_ptr<py_hart_pin_t>> pins;
+  for (size_t i = 0; i < nprocs(); i++) {
+    pins.push_back(std::make_unique<py_hart_pin_t>(get_core(i)));
+  }
+  if (shared_mem_factories.empty()) {
+    int exit_code = sim_t::run();
+    if (metrics) {
+      metrics->publish();
+    }
+    return exit_code;
+  }
+  pybind11::gil_scoped_release release;
+  // a debug sim starts at its interactive prompt
+  shared_mem_turns->start(this->*sim_debug() || parked());
+  int exit_code;
+  try {
+    exit_code = sim_t::run();
+  } catch (...) {
+    shared_mem_turns->stop();
+    throw;
+  }
+  shared_mem_turns->stop();
+  if (metrics) {
+    metrics->publish();
+  }
+  return exit_code;
+}
+
+bool py_sim_t::parked() {
+  if (ctrlc_pressed) {
+    return true;
+  }
+  for (size_t i = 0; i < nprocs(); i++) {
+    if (!get_core(i)->halted()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+scheduler_t &py_sim_t::get_scheduler() {
+  return *scheduler_factory->get_instance();
+}
+
+std::shared_ptr<mmio_trace_t> py_sim_t::get_trace() {
+  return trace;
+}
+
+std::shared_ptr<sim_metrics_t> py_sim_t::get_metrics() {
+  return metrics;
+}
+
+size_t py_sim_t::get_tracked_objects() const {
+  return PythonBridge::getInstance().live(get_id());
+}
+
+std::map<std::string, uint64_t>
+py_sim_t::load_payload(const std::string &payload, reg_t *entry,
+                       reg_t load_offset) {
+  // payloads not found as-is are left to the regular loader, which also
+  // searches them under the install prefix
+  if (image_cache && access(payload.c_str(), R_OK) == 0) {
+    auto image = elf_image_cache_t::getInstance().get(
+        payload, get_cfg().mem_layout, load_offset, this);
+    if (image.has_value()) {
+      preload_image(image.value());
+    }
+  }
+  // the regular loader still parses the ELF (for entry and symbols), but skips
+  // writing the ranges reported by is_address_preloaded()
+  return htif_t::load_payload(payload, entry, load_offset);
+}
+
+bool py_sim_t::is_address_preloaded(addr_t taddr, size_t len) {
+  for (const auto &[first, second] : preloaded) {
+    if (taddr >= first && taddr + len <= second) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void py_sim_t::preload_image(const elf_image_t &image) {
+  int fd = open(image.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  for (const auto &extent : image.extents) {
+    for (const auto &[base, mem] : mapped_mems) {
+      reg_t lo = std::max<reg_t>(extent.paddr, base);
+      reg_t hi = std::min<reg_t>(extent.paddr + extent.size, base + mem->size());
+      if (lo >= hi) {
+        continue;
+      }
+      // pages already written to are left to the regular loader, as mapping
+      // whole pages would clobber the bytes that the ELF does not cover
+      if (mem->touched(lo - base, hi - lo)) {
+        continue;
+      }
+      if (mem->map_private(lo - base, fd, extent.offset + (lo - extent.paddr),
+                           hi - lo)) {
+        preloaded.push_back(std::make_pair(lo, hi));
+      }
+    }
+  }
+  // the mappings keep the image file referenced
+  close(fd);
+}
+
 py_sim_t *py_sim_t::create(
     const managed_cfg_t &cfg, bool halted,
     const std::vector<std::pair<std::string, std::vector<std::string>>>
@@ -39,28 +200,131 @@ py_sim_t *py_sim_t::create(
     const std::optional<std::string>& dtb_file,
     bool socket_enabled,
     const std::optional<FILE *>& cmd_file,
-    std::optional<unsigned long long> instruction_limit) {
+    std::optional<unsigned long long> instruction_limit,
+    bool dtb_cache,
+    bool image_cache,
+    bool idle_skip,
+    const std::optional<std::string>& record,
+    const std::optional<std::string>& replay,
+    bool metrics) {
+  if (record.has_value() && replay.has_value()) {
+    throw std::invalid_argument("cannot both record and replay");
+  }
+  std::shared_ptr<mmio_trace_t> trace;
+  if (record.has_value()) {
+    trace =
+        std::make_shared<mmio_trace_t>(record.value(), mmio_trace_t::RECORD);
+  } else if (replay.has_value()) {
+    trace =
+        std::make_shared<mmio_trace_t>(replay.value(), mmio_trace_t::REPLAY);
+  }
+  std::shared_ptr<sim_metrics_t> sim_metrics;
+  if (metrics) {
+    sim_metrics = std::make_shared<sim_metrics_t>(sim_metrics_t::INTERVAL);
+  }
   // allocate mem based on mem_layout
   std::vector<std::pair<reg_t, abstract_mem_t *>> mems;
+  std::vector<std::pair<reg_t, mapped_mem_t *>> mapped_mems;
   mems.reserve(cfg.mem_layout.size());
-  for (const auto &cfg : cfg.mem_layout) {
-    mems.push_back(std::make_pair(cfg.get_base(), new mem_t(cfg.get_size())));
+  mapped_mems.reserve(cfg.mem_layout.size());
+  std::vector<std::unique_ptr<device_factory_t>> shared_mem_factories;
+  std::vector<device_factory_sargs_t> shared_mem_sargs;
+  auto shared_mem_turns = std::make_shared<shared_mem_turns_t>();
+  for (size_t i = 0; i < cfg.mem_layout.size(); i++) {
+    const mem_cfg_t &mem_cfg = cfg.mem_layout[i];
+    mem_backing_t backing = cfg.get_mem_backing(i);
+    if (backing.region) {
+      // one view for the memory map, another one to be ticked
+      mems.push_back(std::make_pair(
+          mem_cfg.get_base(),
+          new shared_mem_view_t(backing.region, mem_cfg.get_size())));
+      shared_mem_factories.push_back(std::make_unique<shared_mem_factory_t>(
+          backing.region, mem_cfg.get_size(), shared_mem_turns));
+      shared_mem_sargs.push_back(std::make_pair(
+          shared_mem_factories.back().get(),
+          std::vector<std::string>{std::to_string(mem_cfg.get_base())}));
+      shared_mem_turns->add(backing.region);
+      continue;
+    }
+    // spike's own memory, unless images are mapped into the region, its
+    // residency is reported, or it has a backing other than zero pages
+    if (!image_cache && !metrics && backing.kind == "anonymous" &&
+        !backing.shared) {
+      mems.push_back(
+          std::make_pair(mem_cfg.get_base(), new mem_t(mem_cfg.get_size())));
+      continue;
+    }
+    mapped_mem_t *mem = new mapped_mem_t(mem_cfg.get_size(), backing);
+    mems.push_back(std::make_pair(mem_cfg.get_base(), mem));
+    mapped_mems.push_back(std::make_pair(mem_cfg.get_base(), mem));
   }
   // lookup device factories
   const mmio_device_map_t &registry = mmio_device_map();
   std::vector<device_factory_sargs_t> factories;
   for (const auto &[k, v] : plugin_device_factories) {
-    const device_factory_t *factory = registry.at(k);
+    // replayed devices are neither instantiated, nor need be registered
+    const device_factory_t *factory = nullptr;
+    if (!trace || trace->get_mode() != mmio_trace_t::REPLAY) {
+      factory = registry.at(k);
+    }
+    if (trace) {
+      factory = trace->wrap(factory);
+    }
+    if (sim_metrics) {
+      factory = sim_metrics->wrap(k, factory);
+    }
     const std::vector<std::string> &sargs = v;
     factories.push_back(std::make_pair(factory, sargs));
   }
+  factories.insert(factories.end(), shared_mem_sargs.begin(),
+                   shared_mem_sargs.end());
+  auto scheduler_factory = std::make_unique<scheduler_factory_t>(idle_skip);
+  factories.push_back(
+      std::make_pair(scheduler_factory.get(), std::vector<std::string>()));
+  if (sim_metrics) {
+    factories.push_back(
+        std::make_pair(sim_metrics->ticker(), std::vector<std::string>()));
+  }
+  // lookup compiled dtb from cache (unless an explicit dtb_file is given)
+  std::optional<std::string> dtb_key;
+  std::optional<std::string> cached_dtb_file;
+  if (dtb_cache && dtb_enabled && !dtb_file.has_value()) {
+    dtb_key = dtb_cache_t::getInstance().key(cfg, plugin_device_factories);
+    if (dtb_key.has_value()) {
+      cached_dtb_file = dtb_cache_t::getInstance().lookup(dtb_key.value());
+    }
+  }
   // adapt py_sim_t ctor arguments
   const char * _log_path = log_path.has_value() ? log_path.value().c_str() : nullptr;
   const char * _dtb_file = dtb_file.has_value() ? dtb_file.value().c_str() : nullptr;
+  if (cached_dtb_file.has_value()) {
+    _dtb_file = cached_dtb_file.value().c_str();
+  }
   FILE * _cmd_file = cmd_file.value_or(nullptr);
   // allocate py_sim_t instance
-  return new py_sim_t(
+  py_sim_t *sim = new py_sim_t(
     &cfg, halted, mems, factories, dtb_discovery, args, dm_config,
     _log_path, dtb_enabled, _dtb_file, socket_enabled,
     _cmd_file, instruction_limit);
+  // the sim's scope was entered by its constructor
+  sim->leave();
+  sim->mapped_mems = mapped_mems;
+  sim->image_cache = image_cache;
+  sim->shared_mem_factories = std::move(shared_mem_factories);
+  sim->shared_mem_turns = shared_mem_turns;
+  shared_mem_turns->parked = [sim]() { return sim->parked(); };
+  sim->scheduler_factory = std::move(scheduler_factory);
+  sim->trace = trace;
+  if (trace) {
+    trace->bind(sim);
+  }
+  sim->metrics = sim_metrics;
+  if (sim_metrics) {
+    sim_metrics->bind(sim, mapped_mems);
+  }
+  // populate dtb cache on miss, with the dtb the sim compiled
+  if (dtb_key.has_value() && !cached_dtb_file.has_value()) {
+    dtb_cache_t::getInstance().store(dtb_key.value(), sim->*sim_dtb());
+  }
+  return sim;
 }
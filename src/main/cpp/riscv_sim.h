@@ -17,22 +17,68 @@
 #define _RISCV_SIM_H_
 
 #include <map>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <riscv/devices.h>
 #include <riscv/processor.h>
 #include <riscv/sim.h>
 
+#include "py_bridge.h"
+#include "riscv_cache.h"
 #include "riscv_cfg.h"
+#include "riscv_mem.h"
+#include "riscv_metrics.h"
+#include "riscv_sched.h"
+#include "riscv_trace.h"
 
 // trampoline helper class for extending sim_t
-class py_sim_t : public sim_t, pybind11::trampoline_self_life_support {
+//
+// a sim is the ownership scope of the python objects tracked while it is
+// constructed or run (devices, extensions, CSRs, instructions, ...), which
+// are released once `sim_t` is destroyed.
+class py_sim_t : public PythonBridge::scope_t,
+                 public sim_t,
+                 pybind11::trampoline_self_life_support {
 public:
   using sim_t::sim_t;
+  ~py_sim_t();
 
 public:
   virtual void proc_reset(unsigned id) override;
 
+  // runs `sim_t::run`. with shared memory attached, the GIL is released so
+  // that sims on other threads can proceed (every python callback reacquires
+  // it), and synchronized regions are accessed in turns (see `shared_mem_t`),
+  // which a halted sim, or one at its interactive prompt, hands over.
+  int run();
+
+  // timed events and idle fast-forward
+  scheduler_t &get_scheduler();
+
+  // record / replay of the plugin devices, if any
+  std::shared_ptr<mmio_trace_t> get_trace();
+
+  // live telemetry, if enabled
+  std::shared_ptr<sim_metrics_t> get_metrics();
+
+  // number of python objects kept alive for the sim
+  size_t get_tracked_objects() const;
+
+protected:
+  virtual std::map<std::string, uint64_t>
+  load_payload(const std::string &payload, reg_t *entry,
+               reg_t load_offset) override;
+  virtual bool is_address_preloaded(addr_t taddr, size_t len) override;
+
+private:
+  // map the pages of a cached program image into guest memory
+  void preload_image(const elf_image_t &image);
+  // whether the sim stopped running guest code (see `shared_mem_turns_t`)
+  bool parked();
+
 public:
   static py_sim_t *
   create(const managed_cfg_t &cfg, bool halted,
@@ -46,7 +92,31 @@ public:
          const std::optional<std::string>& dtb_file,
          bool socket_enabled,
          const std::optional<FILE *>& cmd_file,
-         std::optional<unsigned long long> instruction_limit);
+         std::optional<unsigned long long> instruction_limit,
+         bool dtb_cache,
+         bool image_cache,
+         bool idle_skip,
+         const std::optional<std::string>& record,
+         const std::optional<std::string>& replay,
+         bool metrics);
+
+private:
+  // guest memory regions, owned by sim_t
+  std::vector<std::pair<reg_t, mapped_mem_t *>> mapped_mems;
+  // guest address ranges [first, second) populated by preload_image()
+  std::vector<std::pair<reg_t, reg_t>> preloaded;
+  bool image_cache = false;
+  // factories of the ticked shared memory views, used during construction
+  std::vector<std::unique_ptr<device_factory_t>> shared_mem_factories;
+  // turns on the synchronized regions attached
+  std::shared_ptr<shared_mem_turns_t> shared_mem_turns;
+  // factory of the sim's scheduler, used during construction
+  std::unique_ptr<scheduler_factory_t> scheduler_factory;
+  // owns the factories standing in for the plugin device factories
+  std::shared_ptr<mmio_trace_t> trace;
+  // owns the factories standing in for the plugin device factories, and the
+  // one of the ticking device
+  std::shared_ptr<sim_metrics_t> metrics;
 };
 
 #endif // _RISCV_SIM_H_
@@ -0,0 +1,286 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "riscv_stats.h"
+
+namespace py = pybind11;
+
+namespace {
+
+uint64_t steady_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// reference points for `cycles_per_ns`
+const uint64_t startup_cycles = callback_stats_t::now();
+const uint64_t startup_ns = steady_ns();
+
+// instrumented stand-ins for python insn_func_t, one per slot
+const size_t THUNKS = 1024;
+
+struct thunk_slot_t {
+  insn_func_t func;
+  callback_site_t *site;
+};
+
+thunk_slot_t thunk_slots[THUNKS];
+std::vector<size_t> free_thunks;
+std::mutex thunk_lock;
+bool thunks_initialized = false;
+// whether running out of stand-ins was warned of, since one was last released
+bool thunks_warned = false;
+
+template <size_t N> reg_t thunk(processor_t *p, insn_t insn, reg_t pc) {
+  const thunk_slot_t &slot = thunk_slots[N];
+  if (!callback_stats_t::is_enabled()) {
+    return slot.func(p, insn, pc);
+  }
+  uint64_t start = callback_stats_t::now();
+  reg_t next_pc = slot.func(p, insn, pc);
+  slot.site->record(callback_stats_t::now() - start);
+  return next_pc;
+}
+
+template <size_t... N>
+std::array<insn_func_t, sizeof...(N)> make_thunks(std::index_sequence<N...>) {
+  return {&thunk<N>...};
+}
+
+const std::array<insn_func_t, THUNKS> thunks =
+    make_thunks(std::make_index_sequence<THUNKS>());
+
+void release_thunk(void *ptr) {
+  std::lock_guard<std::mutex> guard(thunk_lock);
+  free_thunks.push_back(reinterpret_cast<size_t>(ptr) - 1);
+  thunks_warned = false;
+}
+
+} // namespace
+
+callback_site_t::callback_site_t(const std::string &kind,
+                                 const std::string &name)
+    : kind(kind), name(name), calls(0), cycles(0), max(0), histogram() {
+  // NOP
+}
+
+void callback_site_t::record(uint64_t elapsed) {
+  calls.fetch_add(1, std::memory_order_relaxed);
+  cycles.fetch_add(elapsed, std::memory_order_relaxed);
+  uint64_t prev = max.load(std::memory_order_relaxed);
+  while (elapsed > prev &&
+         !max.compare_exchange_weak(prev, elapsed, std::memory_order_relaxed)) {
+    // NOP
+  }
+  size_t bucket = elapsed == 0 ? 0 : 64 - __builtin_clzll(elapsed);
+  if (bucket >= BUCKETS) {
+    bucket = BUCKETS - 1;
+  }
+  histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void callback_site_t::reset() {
+  calls = 0;
+  cycles = 0;
+  max = 0;
+  for (auto &count : histogram) {
+    count = 0;
+  }
+}
+
+const std::string &callback_site_t::get_kind() const {
+  return kind;
+}
+
+const std::string &callback_site_t::get_name() const {
+  return name;
+}
+
+uint64_t callback_site_t::get_calls() const {
+  return calls.load(std::memory_order_relaxed);
+}
+
+uint64_t callback_site_t::get_cycles() const {
+  return cycles.load(std::memory_order_relaxed);
+}
+
+uint64_t callback_site_t::get_max() const {
+  return max.load(std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> callback_site_t::get_histogram() const {
+  std::vector<uint64_t> result;
+  result.reserve(BUCKETS);
+  for (const auto &count : histogram) {
+    result.push_back(count.load(std::memory_order_relaxed));
+  }
+  return result;
+}
+
+uint64_t callback_site_t::get_quantile(double q) const {
+  uint64_t total = get_calls();
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; i++) {
+    seen += histogram[i].load(std::memory_order_relaxed);
+    if (seen >= q * total) {
+      return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+    }
+  }
+  return get_max();
+}
+
+std::atomic<bool> callback_stats_t::enabled(false);
+std::mutex callback_stats_t::lock;
+std::map<std::pair<std::string, std::string>, std::unique_ptr<callback_site_t>>
+    callback_stats_t::registry;
+
+bool callback_stats_t::is_enabled() {
+  return enabled.load(std::memory_order_relaxed);
+}
+
+void callback_stats_t::set_enabled(bool enabled) {
+  callback_stats_t::enabled = enabled;
+}
+
+callback_site_t *callback_stats_t::site(const std::string &kind,
+                                        const std::string &name) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto &site = registry[std::make_pair(kind, name)];
+  if (!site) {
+    site = std::make_unique<callback_site_t>(kind, name);
+  }
+  return site.get();
+}
+
+std::vector<const callback_site_t *> callback_stats_t::sites() {
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<const callback_site_t *> result;
+  for (const auto &entry : registry) {
+    result.push_back(entry.second.get());
+  }
+  return result;
+}
+
+void callback_stats_t::reset() {
+  std::lock_guard<std::mutex> guard(lock);
+  for (auto &entry : registry) {
+    entry.second->reset();
+  }
+}
+
+std::string callback_stats_t::report() {
+  auto all = sites();
+  all.erase(std::remove_if(all.begin(), all.end(),
+                           [](const callback_site_t *site) {
+                             return site->get_calls() == 0;
+                           }),
+            all.end());
+  std::sort(all.begin(), all.end(),
+            [](const callback_site_t *a, const callback_site_t *b) {
+              return a->get_cycles() > b->get_cycles();
+            });
+  double scale = 1.0 / cycles_per_ns();
+  std::ostringstream oss;
+  oss << std::left << std::setw(10) << "kind" << std::setw(40) << "name"
+      << std::right << std::setw(12) << "calls" << std::setw(12) << "total_ms"
+      << std::setw(10) << "mean_ns" << std::setw(10) << "p50_ns"
+      << std::setw(10) << "p99_ns" << std::setw(12) << "max_ns" << "\n";
+  oss << std::fixed << std::setprecision(1);
+  for (const auto *site : all) {
+    uint64_t calls = site->get_calls();
+    oss << std::left << std::setw(10) << site->get_kind() << std::setw(40)
+        << site->get_name() << std::right << std::setw(12) << calls
+        << std::setw(12) << site->get_cycles() * scale / 1e6 << std::setw(10)
+        << site->get_cycles() * scale / calls << std::setw(10)
+        << site->get_quantile(0.5) * scale << std::setw(10)
+        << site->get_quantile(0.99) * scale << std::setw(12)
+        << site->get_max() * scale << "\n";
+  }
+  return oss.str();
+}
+
+uint64_t callback_stats_t::now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return steady_ns();
+#endif
+}
+
+double callback_stats_t::cycles_per_ns() {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t ns = steady_ns() - startup_ns;
+  if (ns == 0) {
+    return 1.0;
+  }
+  return static_cast<double>(now() - startup_cycles) / ns;
+#else
+  return 1.0;
+#endif
+}
+
+insn_func_t callback_stats_t::wrap_insn(insn_func_t func,
+                                        const std::string &name,
+                                        py::object &owner) {
+  if (!is_enabled()) {
+    return func;
+  }
+  callback_site_t *insn_site = site("insn", name);
+  size_t index;
+  {
+    std::unique_lock<std::mutex> guard(thunk_lock);
+    if (!thunks_initialized) {
+      for (size_t i = THUNKS; i > 0; i--) {
+        free_thunks.push_back(i - 1);
+      }
+      thunks_initialized = true;
+    }
+    if (free_thunks.empty()) {
+      bool warned = std::exchange(thunks_warned, true);
+      guard.unlock();
+      if (!warned) {
+        // stand-ins of global scope (e.g. shared tables) are never released
+        py::module_::import("warnings")
+            .attr("warn")("all " + std::to_string(THUNKS) +
+                              " insn stand-ins are taken, " + name +
+                              " and later insn functions are not timed",
+                          py::module_::import("builtins")
+                              .attr("RuntimeWarning"));
+      }
+      return func;
+    }
+    index = free_thunks.back();
+    free_thunks.pop_back();
+  }
+  thunk_slots[index] = {func, insn_site};
+  owner = py::capsule(reinterpret_cast<void *>(index + 1), &release_thunk);
+  return thunks[index];
+}
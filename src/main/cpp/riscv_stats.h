@@ -0,0 +1,151 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_STATS_H_
+#define _RISCV_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <riscv/decode.h>
+#include <riscv/processor.h>
+
+#include <pybind11/pybind11.h>
+
+// counters and latency histogram of one python-crossing site, e.g. the loads
+// of one device class
+//
+// latencies are in TSC cycles (nanoseconds where there is no TSC), in
+// power-of-two buckets: bucket 0 counts 0 cycles, bucket i counts
+// [2^(i-1), 2^i) cycles.
+class callback_site_t {
+public:
+  callback_site_t(const std::string &kind, const std::string &name);
+
+public:
+  void record(uint64_t cycles);
+  void reset();
+
+public:
+  const std::string &get_kind() const;
+  const std::string &get_name() const;
+  uint64_t get_calls() const;
+  uint64_t get_cycles() const;
+  uint64_t get_max() const;
+  std::vector<uint64_t> get_histogram() const;
+  // upper bound of the `q` quantile of the latencies, in cycles
+  uint64_t get_quantile(double q) const;
+
+public:
+  static const size_t BUCKETS = 48;
+
+private:
+  std::string kind;
+  std::string name;
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> cycles;
+  std::atomic<uint64_t> max;
+  std::atomic<uint64_t> histogram[BUCKETS];
+};
+
+// registry of the python-crossing sites (`riscv.stats`)
+//
+// sites are keyed by kind ("insn", "device", "csr", "rocc" or "disasm_arg")
+// and name (the python class or function, and the method), and live as long
+// as the process. nothing is measured, and the TSC is not read, unless
+// enabled.
+class callback_stats_t {
+public:
+  static bool is_enabled();
+  static void set_enabled(bool enabled);
+
+  // the site of `(kind, name)`, created on first use
+  static callback_site_t *site(const std::string &kind,
+                               const std::string &name);
+  static std::vector<const callback_site_t *> sites();
+  // zeroes the counters of all sites
+  static void reset();
+  // table of the sites called, by total time
+  static std::string report();
+
+public:
+  // TSC, or nanoseconds where there is no TSC
+  static uint64_t now();
+  // TSC cycles per nanosecond, as measured since startup
+  static double cycles_per_ns();
+
+  // name of the python class of `self`
+  template <typename T> static std::string type_name(const T *self) {
+    pybind11::gil_scoped_acquire gil;
+    auto py_self =
+        pybind11::cast(self, pybind11::return_value_policy::reference);
+    return pybind11::str(pybind11::type::handle_of(py_self).attr("__name__"));
+  }
+
+  // an instrumented stand-in for `func`, reserved until `owner` (set on
+  // success) is released. `func` itself if stats are disabled (insn functions
+  // taken before `enable()` are not timed), or if all stand-ins are taken,
+  // which warns once.
+  static insn_func_t wrap_insn(insn_func_t func, const std::string &name,
+                               pybind11::object &owner);
+
+private:
+  static std::atomic<bool> enabled;
+  static std::mutex lock;
+  static std::map<std::pair<std::string, std::string>,
+                  std::unique_ptr<callback_site_t>>
+      registry;
+};
+
+// times a python call in its scope, if stats are enabled
+//
+// `cache` is the site of the caller, looked up by `lookup` on first use.
+class callback_probe_t {
+public:
+  template <typename F>
+  callback_probe_t(callback_site_t *&cache, F &&lookup)
+      : site(nullptr), start(0) {
+    if (!callback_stats_t::is_enabled()) {
+      return;
+    }
+    if (cache == nullptr) {
+      cache = lookup();
+    }
+    site = cache;
+    start = callback_stats_t::now();
+  }
+
+  ~callback_probe_t() {
+    if (site != nullptr) {
+      site->record(callback_stats_t::now() - start);
+    }
+  }
+
+private:
+  callback_probe_t(const callback_probe_t &) = delete;
+  callback_probe_t &operator=(const callback_probe_t &) = delete;
+
+private:
+  callback_site_t *site;
+  uint64_t start;
+};
+
+#endif // _RISCV_STATS_H_
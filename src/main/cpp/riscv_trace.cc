@@ -0,0 +1,467 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <riscv/processor.h>
+
+#include "riscv_trace.h"
+
+// plugin device of a recording sim
+class recording_device_t : public abstract_device_t {
+public:
+  recording_device_t(std::shared_ptr<mmio_trace_t> trace, size_t index,
+                     abstract_device_t *dev)
+      : trace(trace), index(index), dev(dev) {
+    // NOP
+  }
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override {
+    mmio_trace_t::scope_t scope(trace.get());
+    bool ok = dev->load(addr, len, bytes);
+    trace->record_load(index, addr, len, bytes, ok);
+    return ok;
+  }
+
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override {
+    mmio_trace_t::scope_t scope(trace.get());
+    return dev->store(addr, len, bytes);
+  }
+
+  virtual reg_t size() override {
+    return dev->size();
+  }
+
+  virtual void tick(reg_t rtc_ticks) override {
+    mmio_trace_t::scope_t scope(trace.get());
+    dev->tick(rtc_ticks);
+  }
+
+private:
+  std::shared_ptr<mmio_trace_t> trace;
+  size_t index;
+  std::unique_ptr<abstract_device_t> dev;
+};
+
+// stand-in for a plugin device of a replaying sim
+class replay_device_t : public abstract_device_t {
+public:
+  replay_device_t(std::shared_ptr<mmio_trace_t> trace, size_t index,
+                  reg_t size)
+      : trace(trace), index(index), sz(size) {
+    // NOP
+  }
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override {
+    return trace->replay_load(index, addr, len, bytes);
+  }
+
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override {
+    trace->replay_events();
+    return true;
+  }
+
+  virtual reg_t size() override {
+    return sz;
+  }
+
+  virtual void tick(reg_t rtc_ticks) override {
+    trace->replay_events();
+  }
+
+private:
+  std::shared_ptr<mmio_trace_t> trace;
+  size_t index;
+  reg_t sz;
+};
+
+class recording_factory_t : public device_factory_t {
+public:
+  recording_factory_t(mmio_trace_t *trace, size_t index,
+                      const device_factory_t *inner)
+      : trace(trace), index(index), inner(inner) {
+    // NOP
+  }
+
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override {
+    trace->bind(sim);
+    abstract_device_t *dev = inner->parse_from_fdt(fdt, sim, base, sargs);
+    if (dev == nullptr) {
+      return nullptr;
+    }
+    return trace->add_device(index, base != nullptr ? *base : 0, dev, dts);
+  }
+
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override {
+    dts = inner->generate_dts(sim, sargs);
+    return dts;
+  }
+
+private:
+  mmio_trace_t *trace;
+  size_t index;
+  const device_factory_t *inner;
+  mutable std::string dts;
+};
+
+class replay_factory_t : public device_factory_t {
+public:
+  replay_factory_t(mmio_trace_t *trace, size_t index)
+      : trace(trace), index(index) {
+    // NOP
+  }
+
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override {
+    trace->bind(sim);
+    return trace->replay_device(index, base);
+  }
+
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override {
+    return trace->replay_dts(index);
+  }
+
+private:
+  mmio_trace_t *trace;
+  size_t index;
+};
+
+const char mmio_trace_t::MAGIC[8] = {'P', 'Y', 'S', 'P', 'T', 'R', 'C', 1};
+
+thread_local mmio_trace_t *mmio_trace_t::current = nullptr;
+thread_local mmio_trace_t *mmio_trace_t::running = nullptr;
+
+mmio_trace_t::mmio_trace_t(const std::string &path, mode_t mode)
+    : path(path), mode(mode), file(nullptr), sim(nullptr), last_stamp(0),
+      records(0), factories(), devices(), logged(), head(), console(),
+      divergence() {
+  file = fopen(path.c_str(), mode == RECORD ? "wb" : "rb");
+  if (file == nullptr) {
+    throw std::runtime_error("cannot open trace " + path + ": " +
+                             strerror(errno));
+  }
+  if (mode == RECORD) {
+    fwrite(MAGIC, 1, sizeof(MAGIC), file);
+    return;
+  }
+  char magic[sizeof(MAGIC)];
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+      memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+    fclose(file);
+    throw std::runtime_error(path + " is not a trace");
+  }
+  // the devices come first, as they are all created along with the sim
+  while (read_record() && head->kind == DEVICE) {
+    logged[head->index] = {head->addr, head->len, head->data};
+  }
+}
+
+mmio_trace_t::~mmio_trace_t() {
+  fclose(file);
+}
+
+const device_factory_t *mmio_trace_t::wrap(const device_factory_t *inner) {
+  size_t index = factories.size();
+  if (mode == RECORD) {
+    factories.push_back(
+        std::make_unique<recording_factory_t>(this, index, inner));
+  } else {
+    factories.push_back(std::make_unique<replay_factory_t>(this, index));
+  }
+  return factories.back().get();
+}
+
+void mmio_trace_t::bind(const sim_t *sim) {
+  this->sim = sim;
+}
+
+void mmio_trace_t::unbind() {
+  sim = nullptr;
+  devices.clear();
+}
+
+void mmio_trace_t::flush() {
+  if (mode == RECORD) {
+    fflush(file);
+  }
+}
+
+const std::string &mmio_trace_t::get_path() const {
+  return path;
+}
+
+mmio_trace_t::mode_t mmio_trace_t::get_mode() const {
+  return mode;
+}
+
+uint64_t mmio_trace_t::get_records() const {
+  return records;
+}
+
+const std::vector<abstract_device_t *> &mmio_trace_t::get_devices() const {
+  return devices;
+}
+
+const std::optional<std::string> &mmio_trace_t::get_divergence() const {
+  return divergence;
+}
+
+abstract_device_t *mmio_trace_t::add_device(size_t index, reg_t base,
+                                            abstract_device_t *dev,
+                                            const std::string &dts) {
+  put(DEVICE);
+  put(index);
+  put(base);
+  put(dev->size());
+  put(dts.size());
+  fwrite(dts.data(), 1, dts.size(), file);
+  records++;
+  devices.push_back(new recording_device_t(shared_from_this(), index, dev));
+  return devices.back();
+}
+
+abstract_device_t *mmio_trace_t::replay_device(size_t index, reg_t *base) {
+  auto it = logged.find(index);
+  if (it == logged.end()) {
+    return nullptr;
+  }
+  if (base != nullptr) {
+    *base = it->second.base;
+  }
+  devices.push_back(
+      new replay_device_t(shared_from_this(), index, it->second.size));
+  return devices.back();
+}
+
+std::string mmio_trace_t::replay_dts(size_t index) {
+  auto it = logged.find(index);
+  return it != logged.end() ? it->second.dts : "";
+}
+
+void mmio_trace_t::record_load(size_t index, reg_t addr, size_t len,
+                               const uint8_t *bytes, bool ok) {
+  put(ok ? LOAD : LOAD_FAIL);
+  put_stamp();
+  put(index);
+  put(addr);
+  put(len);
+  if (ok) {
+    fwrite(bytes, 1, len, file);
+  }
+  records++;
+}
+
+bool mmio_trace_t::replay_load(size_t index, reg_t addr, size_t len,
+                               uint8_t *bytes) {
+  // whatever was logged before the load is due by now
+  replay_events();
+  if (divergence.has_value()) {
+    return false;
+  }
+  if (!head.has_value()) {
+    diverged("end of trace");
+    return false;
+  }
+  if (head->index != index || head->addr != addr || head->len != len ||
+      head->stamp != stamp() || head->kind == IRQ_LOW ||
+      head->kind == IRQ_HIGH || head->kind == CONSOLE) {
+    std::ostringstream oss;
+    oss << "device " << index << " load at 0x" << std::hex << addr << std::dec
+        << " of " << len << " bytes, logged device " << head->index
+        << " load at 0x" << std::hex << head->addr << std::dec << " of "
+        << head->len << " bytes at instret " << head->stamp;
+    diverged(oss.str());
+    return false;
+  }
+  bool ok = head->kind == LOAD;
+  if (ok) {
+    memcpy(bytes, head->data.data(), len);
+  }
+  read_record();
+  return ok;
+}
+
+void mmio_trace_t::replay_events() {
+  if (sim == nullptr || divergence.has_value()) {
+    return;
+  }
+  uint64_t now = stamp();
+  while (head.has_value() && head->kind != LOAD && head->kind != LOAD_FAIL &&
+         head->stamp <= now) {
+    if (head->kind == CONSOLE) {
+      console.append(head->data);
+    } else {
+      const_cast<sim_t *>(sim)->get_intctrl()->set_interrupt_level(
+          head->index, head->kind == IRQ_HIGH ? 1 : 0);
+    }
+    read_record();
+  }
+}
+
+void mmio_trace_t::record_irq(unsigned irq, bool level) {
+  if (current == nullptr) {
+    return;
+  }
+  current->put(level ? IRQ_HIGH : IRQ_LOW);
+  current->put_stamp();
+  current->put(irq);
+  current->records++;
+}
+
+void mmio_trace_t::record_console(const std::string &data) {
+  if (current == nullptr || data.empty()) {
+    return;
+  }
+  current->put(CONSOLE);
+  current->put_stamp();
+  current->put(data.size());
+  fwrite(data.data(), 1, data.size(), current->file);
+  current->records++;
+}
+
+std::optional<std::string> mmio_trace_t::replay_console() {
+  if (running == nullptr || running->mode != REPLAY) {
+    return std::nullopt;
+  }
+  std::string data;
+  data.swap(running->console);
+  return data;
+}
+
+mmio_trace_t::scope_t::scope_t(mmio_trace_t *trace) : prev(current) {
+  current = trace;
+}
+
+mmio_trace_t::scope_t::~scope_t() {
+  current = prev;
+}
+
+mmio_trace_t::run_scope_t::run_scope_t(mmio_trace_t *trace) : prev(running) {
+  running = trace;
+}
+
+mmio_trace_t::run_scope_t::~run_scope_t() {
+  running = prev;
+}
+
+uint64_t mmio_trace_t::stamp() const {
+  if (sim == nullptr) {
+    return 0;
+  }
+  sim_t *s = const_cast<sim_t *>(sim);
+  uint64_t instret = 0;
+  for (size_t i = 0; i < s->nprocs(); i++) {
+    instret += s->get_core(i)->get_state()->minstret->read();
+  }
+  return instret;
+}
+
+void mmio_trace_t::put(uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    putc_unlocked(byte | (value != 0 ? 0x80 : 0), file);
+  } while (value != 0);
+}
+
+void mmio_trace_t::put_stamp() {
+  // zigzag-coded, should instret ever go backwards
+  uint64_t now = stamp();
+  int64_t delta = static_cast<int64_t>(now - last_stamp);
+  put((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+  last_stamp = now;
+}
+
+bool mmio_trace_t::get(uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    int c = getc_unlocked(file);
+    if (c == EOF) {
+      return false;
+    }
+    value |= static_cast<uint64_t>(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool mmio_trace_t::read_record() {
+  head.reset();
+  int c = getc_unlocked(file);
+  if (c == EOF) {
+    return false;
+  }
+  record_t r = {static_cast<kind_t>(c), last_stamp, 0, 0, 0, ""};
+  uint64_t zigzag = 0;
+  uint64_t data_len = 0;
+  bool ok;
+  switch (r.kind) {
+  case DEVICE:
+    // (index, base, size, dts)
+    ok = get(r.index) && get(r.addr) && get(r.len) && get(data_len);
+    break;
+  case LOAD:
+    ok = get(zigzag) && get(r.index) && get(r.addr) && get(r.len);
+    data_len = r.len;
+    break;
+  case LOAD_FAIL:
+    ok = get(zigzag) && get(r.index) && get(r.addr) && get(r.len);
+    break;
+  case IRQ_LOW:
+  case IRQ_HIGH:
+    ok = get(zigzag) && get(r.index);
+    break;
+  case CONSOLE:
+    ok = get(zigzag) && get(data_len);
+    break;
+  default:
+    ok = false;
+  }
+  r.data.resize(data_len);
+  if (!ok || fread(r.data.data(), 1, data_len, file) != data_len) {
+    // a truncated trace, e.g. of a run that was killed, ends here
+    return false;
+  }
+  r.stamp += (zigzag >> 1) ^ -(zigzag & 1);
+  last_stamp = r.stamp;
+  head = std::move(r);
+  records++;
+  return true;
+}
+
+void mmio_trace_t::diverged(const std::string &what) {
+  // no exception may unwind through spike's run loop
+  std::ostringstream oss;
+  oss << "replay of " << path << " diverged at instret " << stamp() << ": "
+      << what;
+  divergence = oss.str();
+  std::cerr << divergence.value() << std::endl;
+}
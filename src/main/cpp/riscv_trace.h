@@ -0,0 +1,179 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_TRACE_H_
+#define _RISCV_TRACE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/sim.h>
+
+// deterministic record and replay of the inputs of a sim's plugin devices
+//
+// a recording sim logs, in the order they happen, and stamped with the number
+// of instructions retired by all of its harts:
+//
+// - the results of loads from its plugin devices
+// - changes of interrupt levels made while a plugin device is accessed or
+//   ticked (through `interrupt_line_t`, or `set_interrupt_level` from python)
+// - console input read through `fesvr.term` at such times
+//
+// a replaying sim instantiates none of the original devices, which need not
+// even be registered. each one is replaced by a stub with the recorded base,
+// size and dts, whose loads return the logged results. logged interrupt
+// levels are set, and logged console input is handed to the `fesvr.term`
+// readers of the sim while it runs, once the replay reaches them. stores are
+// dropped.
+//
+// the replay is exact as long as the rest of the sim is deterministic: the
+// same cfg, program and plugin device list, instret counting never inhibited
+// or written to, and no plugin device writing guest memory (e.g. by DMA). the
+// first load that does not match the log is reported on stderr and kept as
+// the divergence, and the replay stops there: that load and all later ones
+// fail (so the guest takes access faults), and no more events are applied.
+//
+// the log is a header followed by records of a kind byte and LEB128 fields,
+// with stamps delta-coded, so that a load costs a few bytes besides its data.
+class mmio_trace_t : public std::enable_shared_from_this<mmio_trace_t> {
+public:
+  enum mode_t { RECORD, REPLAY };
+
+public:
+  mmio_trace_t(const std::string &path, mode_t mode);
+  ~mmio_trace_t();
+
+private:
+  mmio_trace_t(const mmio_trace_t &) = delete;
+  mmio_trace_t &operator=(const mmio_trace_t &) = delete;
+
+public:
+  // the factory standing in for plugin device factory `inner` (which is
+  // ignored, and may be null, when replaying). owned by the trace.
+  const device_factory_t *wrap(const device_factory_t *inner);
+  void bind(const sim_t *sim);
+  // forget the sim and its devices, as they are destroyed
+  void unbind();
+  void flush();
+
+public:
+  const std::string &get_path() const;
+  mode_t get_mode() const;
+  uint64_t get_records() const;
+  const std::vector<abstract_device_t *> &get_devices() const;
+  const std::optional<std::string> &get_divergence() const;
+
+public:
+  // called by the devices of the trace
+  abstract_device_t *add_device(size_t index, reg_t base,
+                                abstract_device_t *dev, const std::string &dts);
+  abstract_device_t *replay_device(size_t index, reg_t *base);
+  std::string replay_dts(size_t index);
+  void record_load(size_t index, reg_t addr, size_t len, const uint8_t *bytes,
+                   bool ok);
+  bool replay_load(size_t index, reg_t addr, size_t len, uint8_t *bytes);
+  // applies the logged interrupt levels and console input up to now
+  void replay_events();
+
+public:
+  // hooks for interrupt controllers and terminals, no-ops unless called from
+  // a device of a recording sim / on the thread running a replaying sim
+  static void record_irq(unsigned irq, bool level);
+  static void record_console(const std::string &data);
+  static std::optional<std::string> replay_console();
+
+  // the recording trace of the device being accessed or ticked on this thread
+  class scope_t {
+  public:
+    scope_t(mmio_trace_t *trace);
+    ~scope_t();
+
+  private:
+    mmio_trace_t *prev;
+  };
+
+  // the trace (if any) of the sim running on this thread
+  class run_scope_t {
+  public:
+    run_scope_t(mmio_trace_t *trace);
+    ~run_scope_t();
+
+  private:
+    mmio_trace_t *prev;
+  };
+
+public:
+  static const char MAGIC[8];
+
+private:
+  enum kind_t : uint8_t {
+    DEVICE = 1,
+    LOAD = 2,
+    LOAD_FAIL = 3,
+    IRQ_LOW = 4,
+    IRQ_HIGH = 5,
+    CONSOLE = 6,
+  };
+
+  struct record_t {
+    kind_t kind;
+    uint64_t stamp;
+    uint64_t index; // device or irq
+    reg_t addr;
+    uint64_t len;
+    std::string data;
+  };
+
+  struct device_t {
+    reg_t base;
+    reg_t size;
+    std::string dts;
+  };
+
+private:
+  uint64_t stamp() const;
+  void put(uint64_t value);
+  void put_stamp();
+  bool get(uint64_t &value);
+  bool read_record();
+  void diverged(const std::string &what);
+
+private:
+  std::string path;
+  mode_t mode;
+  FILE *file;
+  const sim_t *sim;
+  uint64_t last_stamp;
+  uint64_t records;
+  std::vector<std::unique_ptr<device_factory_t>> factories;
+  std::vector<abstract_device_t *> devices;
+  // replaying: the devices logged up front, and the next record
+  std::map<size_t, device_t> logged;
+  std::optional<record_t> head;
+  std::string console;
+  std::optional<std::string> divergence;
+
+private:
+  static thread_local mmio_trace_t *current;
+  static thread_local mmio_trace_t *running;
+};
+
+#endif // _RISCV_TRACE_H_
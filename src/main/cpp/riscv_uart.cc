@@ -0,0 +1,327 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <riscv/devices.h>
+
+#include "riscv_uart.h"
+
+byte_fifo_t::byte_fifo_t(size_t capacity)
+    : storage(capacity), head(0), count(0) {
+  if (capacity == 0) {
+    throw std::runtime_error("fifo capacity must be positive");
+  }
+}
+
+size_t byte_fifo_t::size() const {
+  return count;
+}
+
+size_t byte_fifo_t::capacity() const {
+  return storage.size();
+}
+
+bool byte_fifo_t::empty() const {
+  return count == 0;
+}
+
+bool byte_fifo_t::full() const {
+  return count == storage.size();
+}
+
+size_t byte_fifo_t::push(const uint8_t *data, size_t len) {
+  len = std::min(len, storage.size() - count);
+  for (size_t i = 0; i < len; i++) {
+    storage[(head + count + i) % storage.size()] = data[i];
+  }
+  count += len;
+  return len;
+}
+
+size_t byte_fifo_t::pop(uint8_t *data, size_t len) {
+  len = std::min(len, count);
+  for (size_t i = 0; i < len; i++) {
+    data[i] = storage[(head + i) % storage.size()];
+  }
+  head = (head + len) % storage.size();
+  count -= len;
+  return len;
+}
+
+void byte_fifo_t::clear() {
+  head = 0;
+  count = 0;
+}
+
+uint8_t *byte_fifo_t::linearize() {
+  std::rotate(storage.begin(), storage.begin() + head, storage.end());
+  head = 0;
+  return storage.data();
+}
+
+ssize_t byte_fifo_t::fill_from(int fd) {
+  if (fd < 0 || full()) {
+    return 0;
+  }
+  struct pollfd pfd = {fd, POLLIN, 0};
+  if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) {
+    return 0;
+  }
+  // the free space, in (up to) two contiguous pieces
+  size_t tail = (head + count) % storage.size();
+  size_t free = storage.size() - count;
+  size_t first = std::min(free, storage.size() - tail);
+  struct iovec iov[2] = {
+      {storage.data() + tail, first},
+      {storage.data(), free - first},
+  };
+  ssize_t n = readv(fd, iov, free > first ? 2 : 1);
+  if (n > 0) {
+    count += n;
+  }
+  return n;
+}
+
+ssize_t byte_fifo_t::drain_to(int fd) {
+  if (fd < 0 || empty()) {
+    return 0;
+  }
+  struct pollfd pfd = {fd, POLLOUT, 0};
+  if (poll(&pfd, 1, 0) <= 0) {
+    return 0;
+  }
+  if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    // the reader is gone, drop the output like a closed terminal would
+    clear();
+    return 0;
+  }
+  // `POLLOUT` on a pipe or a tty only guarantees room for `PIPE_BUF` bytes,
+  // and a larger write to a blocking fd would wait for the reader
+  size_t len = std::min<size_t>(count, PIPE_BUF);
+  size_t first = std::min(len, storage.size() - head);
+  struct iovec iov[2] = {
+      {storage.data() + head, first},
+      {storage.data(), len - first},
+  };
+  ssize_t n = writev(fd, iov, len > first ? 2 : 1);
+  if (n > 0) {
+    head = (head + n) % storage.size();
+    count -= n;
+  }
+  return n;
+}
+
+uartlite_t::uartlite_t(const sim_t *sim, int in_fd, int out_fd, bool owns_in,
+                       bool owns_out, unsigned irq, size_t fifo_depth)
+    : sim(sim), in_fd(in_fd), out_fd(out_fd), owns_in(owns_in),
+      owns_out(owns_out), irq(sim, irq), ctrl(0), overrun(false),
+      rx_fifo(fifo_depth), tx_fifo(fifo_depth) {
+  // NOP
+}
+
+uartlite_t::~uartlite_t() {
+  while (tx_fifo.drain_to(out_fd) > 0) {
+    // flush what the guest has written
+  }
+  if (owns_in) {
+    close(in_fd);
+  }
+  if (owns_out && out_fd != in_fd) {
+    close(out_fd);
+  }
+}
+
+bool uartlite_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > SIZE) {
+    return false;
+  }
+  uint32_t value = 0;
+  switch (addr & ~reg_t(3)) {
+  case RX_FIFO: {
+    uint8_t ch = 0;
+    if (rx_fifo.pop(&ch, 1) == 1) {
+      value = ch;
+    }
+    update_interrupt();
+    break;
+  }
+  case STAT_REG:
+    value = (rx_fifo.empty() ? 0 : RX_FIFO_VALID_DATA) |
+            (rx_fifo.full() ? RX_FIFO_FULL : 0) |
+            (tx_fifo.empty() ? TX_FIFO_EMPTY : 0) |
+            (tx_fifo.full() ? TX_FIFO_FULL : 0) |
+            ((ctrl & ENABLE_INTR) ? INTR_ENABLED : 0) |
+            (overrun ? OVERRUN_ERROR : 0);
+    // cleared on read
+    overrun = false;
+    break;
+  default:
+    break;
+  }
+  std::memset(bytes, 0, len);
+  std::memcpy(bytes, reinterpret_cast<const uint8_t *>(&value) + addr % 4,
+              std::min<size_t>(len, sizeof(value) - addr % 4));
+  return true;
+}
+
+bool uartlite_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (addr + len < addr || addr + len > SIZE) {
+    return false;
+  }
+  switch (addr & ~reg_t(3)) {
+  case TX_FIFO:
+    if (tx_fifo.full()) {
+      // flush early if the host takes it, or drop the byte as hardware does
+      tx_fifo.drain_to(out_fd);
+    }
+    tx_fifo.push(bytes, 1);
+    break;
+  case CTRL_REG:
+    ctrl = bytes[0];
+    if (ctrl & RST_TX_FIFO) {
+      tx_fifo.clear();
+    }
+    if (ctrl & RST_RX_FIFO) {
+      rx_fifo.clear();
+    }
+    update_interrupt();
+    break;
+  default:
+    break;
+  }
+  return true;
+}
+
+reg_t uartlite_t::size() {
+  return SIZE;
+}
+
+void uartlite_t::tick(reg_t rtc_ticks) {
+  irq.tick(rtc_ticks);
+  tx_fifo.drain_to(out_fd);
+  if (rx_fifo.full()) {
+    struct pollfd pfd = {in_fd, POLLIN, 0};
+    overrun = in_fd >= 0 && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+  } else {
+    rx_fifo.fill_from(in_fd);
+  }
+  update_interrupt();
+}
+
+byte_fifo_t &uartlite_t::get_rx_fifo() {
+  return rx_fifo;
+}
+
+byte_fifo_t &uartlite_t::get_tx_fifo() {
+  return tx_fifo;
+}
+
+interrupt_line_t &uartlite_t::get_irq() {
+  return irq;
+}
+
+void uartlite_t::update_interrupt() {
+  bool level = (ctrl & ENABLE_INTR) && !rx_fifo.empty();
+  irq.set_level(level);
+}
+
+// opens a host endpoint given as `stdin`, `stdout`, `fd:N` or a path
+static int uartlite_open(const std::string &spec, int flags, bool *owned) {
+  *owned = false;
+  if (spec == "stdin") {
+    return 0;
+  }
+  if (spec == "stdout") {
+    return 1;
+  }
+  if (spec.rfind("fd:", 0) == 0) {
+    return std::stoi(spec.substr(3));
+  }
+  int fd = open(spec.c_str(), flags | O_CLOEXEC | O_NOCTTY, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("amba_uartlite:native cannot open " + spec +
+                             ": " + strerror(errno));
+  }
+  *owned = true;
+  return fd;
+}
+
+// sargs: `(base, *options)`, see `uartlite_t`
+class uartlite_factory_t : public device_factory_t {
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override {
+    if (sargs.empty()) {
+      throw std::runtime_error("amba_uartlite:native requires (base, ...)");
+    }
+    if (base != nullptr) {
+      *base = std::stoull(sargs[0], nullptr, 16);
+    }
+    std::string in = "stdin", out = "stdout", io;
+    unsigned irq = 1;
+    size_t depth = 16;
+    for (size_t i = 1; i < sargs.size(); i++) {
+      size_t eq = sargs[i].find('=');
+      std::string key = sargs[i].substr(0, eq);
+      std::string value = eq == std::string::npos ? "" : sargs[i].substr(eq + 1);
+      if (key == "irq") {
+        irq = std::stoul(value, nullptr, 0);
+      } else if (key == "in") {
+        in = value;
+      } else if (key == "out") {
+        out = value;
+      } else if (key == "io") {
+        io = value;
+      } else if (key == "fifo") {
+        depth = std::stoul(value, nullptr, 0);
+      } else {
+        throw std::runtime_error("amba_uartlite:native unknown option " + key);
+      }
+    }
+    bool owns_in, owns_out;
+    int in_fd, out_fd;
+    if (!io.empty()) {
+      in_fd = out_fd = uartlite_open(io, O_RDWR, &owns_in);
+      owns_out = owns_in;
+    } else {
+      in_fd = uartlite_open(in, O_RDONLY, &owns_in);
+      out_fd = uartlite_open(out, O_WRONLY | O_CREAT | O_TRUNC, &owns_out);
+    }
+    return new uartlite_t(sim, in_fd, out_fd, owns_in, owns_out, irq, depth);
+  }
+
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override {
+    // same as the python mockup
+    return "";
+  }
+};
+
+static bool uartlite_registered = [] {
+  mmio_device_map()["amba_uartlite:native"] = new uartlite_factory_t();
+  return true;
+}();
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_UART_H_
+#define _RISCV_UART_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/sim.h>
+
+#include "riscv_irq.h"
+
+// fixed-capacity ring buffer of bytes
+class byte_fifo_t {
+public:
+  byte_fifo_t(size_t capacity);
+
+public:
+  size_t size() const;
+  size_t capacity() const;
+  bool empty() const;
+  bool full() const;
+
+  // appends up to `len` bytes, returns the number of bytes appended
+  size_t push(const uint8_t *data, size_t len);
+  // removes up to `len` bytes into `data`, returns the number removed
+  size_t pop(uint8_t *data, size_t len);
+  void clear();
+
+  // rotates the contents to the start of the storage, and returns them as
+  // one contiguous range of `size()` bytes
+  uint8_t *linearize();
+
+  // host fd I/O, both with a single transfer, and never blocking
+  ssize_t fill_from(int fd);
+  ssize_t drain_to(int fd);
+
+private:
+  std::vector<uint8_t> storage;
+  size_t head;
+  size_t count;
+};
+
+// native Xilinx AMBA UART Lite
+//
+// registered as "amba_uartlite:native" in `mmio_device_map`, with sargs
+// `(base, *options)`, where options are any of:
+//
+// - `irq=N`: PLIC interrupt source (default 1, 0 for none)
+// - `in=PATH`, `out=PATH`, `io=PATH`: host input, output or both (e.g. a pty),
+//   where PATH may also be `stdin`, `stdout` or `fd:N` (default stdin/stdout)
+// - `fifo=N`: depth of both FIFOs (default 16)
+//
+// the interrupt is raised while enabled (`ENABLE_INTR` in CTRL_REG) and the
+// RX FIFO holds data. host input is read once per tick, and TX output is
+// written once per tick (or as soon as the TX FIFO fills up), as far as the
+// host takes it without blocking. while the host stalls, the TX FIFO stays
+// full and further bytes are dropped, as on hardware.
+class uartlite_t : public abstract_device_t {
+public:
+  uartlite_t(const sim_t *sim, int in_fd, int out_fd, bool owns_in,
+             bool owns_out, unsigned irq, size_t fifo_depth);
+  ~uartlite_t();
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual reg_t size() override;
+  virtual void tick(reg_t rtc_ticks) override;
+
+public:
+  byte_fifo_t &get_rx_fifo();
+  byte_fifo_t &get_tx_fifo();
+
+public:
+  interrupt_line_t &get_irq();
+
+public:
+  static const reg_t RX_FIFO = 0x00;
+  static const reg_t TX_FIFO = 0x04;
+  static const reg_t STAT_REG = 0x08;
+  static const reg_t CTRL_REG = 0x0c;
+  static const reg_t SIZE = 0x10;
+
+  static const uint32_t RST_TX_FIFO = 0x01;
+  static const uint32_t RST_RX_FIFO = 0x02;
+  static const uint32_t ENABLE_INTR = 0x10;
+
+  static const uint32_t RX_FIFO_VALID_DATA = 0x01;
+  static const uint32_t RX_FIFO_FULL = 0x02;
+  static const uint32_t TX_FIFO_EMPTY = 0x04;
+  static const uint32_t TX_FIFO_FULL = 0x08;
+  static const uint32_t INTR_ENABLED = 0x10;
+  static const uint32_t OVERRUN_ERROR = 0x20;
+
+private:
+  void update_interrupt();
+
+private:
+  const sim_t *sim;
+  int in_fd;
+  int out_fd;
+  bool owns_in;
+  bool owns_out;
+  interrupt_line_t irq;
+  uint32_t ctrl;
+  bool overrun;
+  byte_fifo_t rx_fifo;
+  byte_fifo_t tx_fifo;
+};
+
+#endif // _RISCV_UART_H_
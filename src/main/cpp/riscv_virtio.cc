@@ -0,0 +1,520 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <riscv/devices.h>
+#include <riscv/mmu.h>
+
+#include <pybind11/stl.h>
+
+#include "riscv_virtio.h"
+
+namespace py = pybind11;
+
+virtio_request_t::virtio_request_t(std::weak_ptr<virtio_mmio_t> dev,
+                                   const sim_t *sim, unsigned queue,
+                                   uint16_t head)
+    : readable(), writable(), dev(dev), sim(sim), queue(queue), head(head),
+      completed(false) {
+  // NOP
+}
+
+void virtio_request_t::complete(uint32_t written) {
+  if (completed) {
+    throw std::runtime_error("virtio request already completed");
+  }
+  completed = true;
+  if (auto device = dev.lock()) {
+    device->complete(queue, head, written);
+  }
+}
+
+unsigned virtio_request_t::get_queue() const {
+  return queue;
+}
+
+uint16_t virtio_request_t::get_head() const {
+  return head;
+}
+
+bool virtio_request_t::is_completed() const {
+  return completed;
+}
+
+const sim_t *virtio_request_t::get_sim() const {
+  return sim;
+}
+
+uint64_t virtio_backend_t::device_features() {
+  return 0;
+}
+
+unsigned virtio_backend_t::num_queues() {
+  return 1;
+}
+
+std::string virtio_backend_t::config() {
+  return "";
+}
+
+void virtio_backend_t::reset() {
+  // NOP
+}
+
+void virtio_backend_t::attach(const std::string &name,
+                              std::shared_ptr<virtio_backend_t> backend) {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  registry[name] = backend;
+}
+
+void virtio_backend_t::detach(const std::string &name) {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  registry.erase(name);
+}
+
+std::shared_ptr<virtio_backend_t>
+virtio_backend_t::lookup(const std::string &name) {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  auto it = registry.find(name);
+  if (it == registry.end()) {
+    throw std::runtime_error("unknown virtio backend: " + name);
+  }
+  return it->second;
+}
+
+std::vector<std::string> virtio_backend_t::names() {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  std::vector<std::string> result;
+  for (const auto &[name, backend] : registry) {
+    result.push_back(name);
+  }
+  return result;
+}
+
+std::mutex virtio_backend_t::registry_lock;
+std::map<std::string, std::shared_ptr<virtio_backend_t>>
+    virtio_backend_t::registry;
+
+uint32_t py_virtio_backend_t::device_id() {
+  PYBIND11_OVERRIDE_PURE(uint32_t, virtio_backend_t, device_id);
+}
+
+uint64_t py_virtio_backend_t::device_features() {
+  PYBIND11_OVERRIDE(uint64_t, virtio_backend_t, device_features);
+}
+
+unsigned py_virtio_backend_t::num_queues() {
+  PYBIND11_OVERRIDE(unsigned, virtio_backend_t, num_queues);
+}
+
+std::string py_virtio_backend_t::config() {
+  py::gil_scoped_acquire gil;
+  if (py::function py_method = py::get_override(this, "config")) {
+    return py::bytes(py_method()).cast<std::string>();
+  }
+  return virtio_backend_t::config();
+}
+
+void py_virtio_backend_t::reset() {
+  PYBIND11_OVERRIDE(void, virtio_backend_t, reset);
+}
+
+void py_virtio_backend_t::handle(unsigned queue,
+                                 const virtio_batch_t &requests) {
+  // the sim may run without the GIL (see `py_sim_t::run`)
+  py::gil_scoped_acquire gil;
+  try {
+    py::function py_method = py::get_override(this, "handle");
+    py_method(queue, requests);
+  } catch (py::error_already_set &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+virtio_mmio_t::virtio_mmio_t(const sim_t *sim,
+                             std::shared_ptr<virtio_backend_t> backend,
+                             unsigned irq, uint16_t queue_size)
+    : sim(sim), port(const_cast<sim_t *>(sim)), backend(backend),
+      irq(sim, irq), queue_size(queue_size), device_id(backend->device_id()),
+      device_features(backend->device_features() | F_VERSION_1 |
+                      F_INDIRECT_DESC),
+      config(backend->config()), config_generation(0), device_features_sel(0),
+      driver_features_sel(0), driver_features(0), queue_sel(0),
+      interrupt_status(0), status(0), queues(backend->num_queues(), queue_t{}),
+      requests(0), batches(0), self(this, [](virtio_mmio_t *) {}) {
+  // NOP
+}
+
+bool virtio_mmio_t::load(reg_t addr, size_t len, uint8_t *bytes) {
+  if (addr + len < addr || addr + len > SIZE) {
+    return false;
+  }
+  std::memset(bytes, 0, len);
+  if (addr >= CONFIG) {
+    reg_t offset = addr - CONFIG;
+    if (offset < config.size()) {
+      std::memcpy(bytes, config.data() + offset,
+                  std::min<reg_t>(len, config.size() - offset));
+    }
+    return true;
+  }
+  uint32_t value = read_reg(addr & ~reg_t(3));
+  std::memcpy(bytes, reinterpret_cast<const uint8_t *>(&value) + addr % 4,
+              std::min<size_t>(len, sizeof(value) - addr % 4));
+  return true;
+}
+
+bool virtio_mmio_t::store(reg_t addr, size_t len, const uint8_t *bytes) {
+  if (addr + len < addr || addr + len > SIZE) {
+    return false;
+  }
+  if (addr >= CONFIG) {
+    // the configuration space is read-only to the driver
+    return true;
+  }
+  uint32_t value = 0;
+  std::memcpy(&value, bytes, std::min<size_t>(len, sizeof(value)));
+  write_reg(addr & ~reg_t(3), value);
+  return true;
+}
+
+reg_t virtio_mmio_t::size() {
+  return SIZE;
+}
+
+void virtio_mmio_t::tick(reg_t rtc_ticks) {
+  irq.tick(rtc_ticks);
+  update_interrupt();
+}
+
+void virtio_mmio_t::complete(unsigned queue, uint16_t head, uint32_t written) {
+  if (queue >= queues.size() || !queues[queue].ready) {
+    // the queue has been reset since
+    return;
+  }
+  queue_t &q = queues[queue];
+  uint16_t used_idx = 0, avail_flags = 0;
+  port.read(q.used + 2, sizeof(used_idx),
+            reinterpret_cast<uint8_t *>(&used_idx));
+  uint32_t elem[2] = {head, written};
+  port.write(q.used + 4 + 8 * (used_idx % q.num), sizeof(elem),
+             reinterpret_cast<const uint8_t *>(elem));
+  used_idx++;
+  port.write(q.used + 2, sizeof(used_idx),
+             reinterpret_cast<const uint8_t *>(&used_idx));
+  // VIRTQ_AVAIL_F_NO_INTERRUPT
+  port.read(q.avail, sizeof(avail_flags),
+            reinterpret_cast<uint8_t *>(&avail_flags));
+  if (!(avail_flags & 0x1)) {
+    interrupt_status |= INT_USED_BUFFER;
+  }
+}
+
+void virtio_mmio_t::set_config(const std::string &data) {
+  config = data;
+  config_generation++;
+  interrupt_status |= INT_CONFIG_CHANGE;
+  update_interrupt();
+}
+
+const std::string &virtio_mmio_t::get_config() const {
+  return config;
+}
+
+uint32_t virtio_mmio_t::get_status() const {
+  return status;
+}
+
+uint64_t virtio_mmio_t::get_driver_features() const {
+  return driver_features;
+}
+
+uint64_t virtio_mmio_t::get_requests() const {
+  return requests;
+}
+
+uint64_t virtio_mmio_t::get_batches() const {
+  return batches;
+}
+
+uint32_t virtio_mmio_t::read_reg(reg_t addr) {
+  queue_t *q = queue_sel < queues.size() ? &queues[queue_sel] : nullptr;
+  switch (addr) {
+  case MAGIC_VALUE:
+    return MAGIC;
+  case VERSION:
+    return 2;
+  case DEVICE_ID:
+    return device_id;
+  case VENDOR_ID:
+    return VENDOR;
+  case DEVICE_FEATURES:
+    return device_features_sel == 0   ? uint32_t(device_features)
+           : device_features_sel == 1 ? uint32_t(device_features >> 32)
+                                      : 0;
+  case QUEUE_NUM_MAX:
+    return q != nullptr ? queue_size : 0;
+  case QUEUE_READY:
+    return q != nullptr && q->ready;
+  case INTERRUPT_STATUS:
+    return interrupt_status;
+  case STATUS:
+    return status;
+  case CONFIG_GENERATION:
+    return config_generation;
+  default:
+    return 0;
+  }
+}
+
+void virtio_mmio_t::write_reg(reg_t addr, uint32_t value) {
+  queue_t *q = queue_sel < queues.size() ? &queues[queue_sel] : nullptr;
+  auto set_low = [](reg_t &reg, uint32_t value) {
+    reg = (reg & ~reg_t(0xffffffff)) | value;
+  };
+  auto set_high = [](reg_t &reg, uint32_t value) {
+    reg = (reg & 0xffffffff) | (reg_t(value) << 32);
+  };
+  switch (addr) {
+  case DEVICE_FEATURES_SEL:
+    device_features_sel = value;
+    break;
+  case DRIVER_FEATURES:
+    if (driver_features_sel == 0) {
+      driver_features = (driver_features & ~0xffffffffull) | value;
+    } else if (driver_features_sel == 1) {
+      driver_features = (driver_features & 0xffffffffull) |
+                        (uint64_t(value) << 32);
+    }
+    break;
+  case DRIVER_FEATURES_SEL:
+    driver_features_sel = value;
+    break;
+  case QUEUE_SEL:
+    queue_sel = value;
+    break;
+  case QUEUE_NUM:
+    if (q != nullptr) {
+      q->num = std::min<uint32_t>(value, queue_size);
+    }
+    break;
+  case QUEUE_READY:
+    if (q != nullptr) {
+      q->ready = value & 1;
+      q->last_avail = 0;
+    }
+    break;
+  case QUEUE_NOTIFY:
+    notify(value & 0xffff);
+    break;
+  case INTERRUPT_ACK:
+    interrupt_status &= ~value;
+    update_interrupt();
+    break;
+  case STATUS:
+    if (value == 0) {
+      reset();
+    } else {
+      status = value;
+    }
+    break;
+  case QUEUE_DESC_LOW:
+  case QUEUE_DESC_HIGH:
+  case QUEUE_DRIVER_LOW:
+  case QUEUE_DRIVER_HIGH:
+  case QUEUE_DEVICE_LOW:
+  case QUEUE_DEVICE_HIGH:
+    if (q != nullptr) {
+      reg_t &reg = addr < QUEUE_DRIVER_LOW   ? q->desc
+                   : addr < QUEUE_DEVICE_LOW ? q->avail
+                                             : q->used;
+      if (addr % 8 == 0) {
+        set_low(reg, value);
+      } else {
+        set_high(reg, value);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void virtio_mmio_t::reset() {
+  device_features_sel = 0;
+  driver_features_sel = 0;
+  driver_features = 0;
+  queue_sel = 0;
+  interrupt_status = 0;
+  status = 0;
+  std::fill(queues.begin(), queues.end(), queue_t{});
+  backend->reset();
+  update_interrupt();
+}
+
+void virtio_mmio_t::notify(unsigned queue) {
+  if (queue >= queues.size() || (status & STATUS_NEEDS_RESET)) {
+    return;
+  }
+  queue_t &q = queues[queue];
+  if (!q.ready || q.num == 0) {
+    return;
+  }
+  uint16_t avail_idx = 0;
+  port.read(q.avail + 2, sizeof(avail_idx),
+            reinterpret_cast<uint8_t *>(&avail_idx));
+  virtio_batch_t batch;
+  while (q.last_avail != avail_idx) {
+    uint16_t head = 0;
+    port.read(q.avail + 4 + 2 * (q.last_avail % q.num), sizeof(head),
+              reinterpret_cast<uint8_t *>(&head));
+    q.last_avail++;
+    auto req = std::make_shared<virtio_request_t>(self, sim, queue, head);
+    if (!walk(q, head, *req)) {
+      status |= STATUS_NEEDS_RESET;
+      interrupt_status |= INT_CONFIG_CHANGE;
+      break;
+    }
+    batch.push_back(req);
+  }
+  if (!batch.empty()) {
+    requests += batch.size();
+    batches++;
+    backend->handle(queue, batch);
+  }
+  update_interrupt();
+}
+
+bool virtio_mmio_t::walk(queue_t &q, uint16_t head, virtio_request_t &req) {
+  struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+  } desc;
+  static_assert(sizeof(desc) == 16, "virtq_desc is 16 bytes");
+  reg_t table = q.desc;
+  uint32_t table_num = q.num;
+  uint32_t budget = table_num;
+  bool indirect = false;
+  for (uint32_t index = head;;) {
+    if (index >= table_num || budget-- == 0) {
+      return false;
+    }
+    if (!port.read(table + 16 * index, sizeof(desc),
+                   reinterpret_cast<uint8_t *>(&desc))) {
+      return false;
+    }
+    if (desc.flags & DESC_F_INDIRECT) {
+      // an indirect table is one level deep, and holds the rest of the chain
+      if (indirect || desc.len == 0 || desc.len % 16 != 0) {
+        return false;
+      }
+      indirect = true;
+      table = desc.addr;
+      table_num = budget = desc.len / 16;
+      index = 0;
+      continue;
+    }
+    auto &segments = (desc.flags & DESC_F_WRITE) ? req.writable : req.readable;
+    // one segment per run of pages contiguous in host memory, as spike's own
+    // memory allocates each page apart
+    size_t first = segments.size();
+    for (uint32_t done = 0; done < desc.len;) {
+      reg_t addr = desc.addr + done;
+      uint32_t len =
+          std::min<reg_t>(desc.len - done, PGSIZE - addr % PGSIZE);
+      char *host = port.contents(addr, len);
+      if (host == nullptr) {
+        return false;
+      }
+      if (segments.size() > first &&
+          segments.back().host + segments.back().len == host) {
+        segments.back().len += len;
+      } else {
+        segments.push_back({host, len});
+      }
+      done += len;
+    }
+    if (!(desc.flags & DESC_F_NEXT)) {
+      return true;
+    }
+    index = desc.next;
+  }
+}
+
+interrupt_line_t &virtio_mmio_t::get_irq() {
+  return irq;
+}
+
+void virtio_mmio_t::update_interrupt() {
+  bool level = interrupt_status != 0;
+  irq.set_level(level);
+}
+
+// sargs: `(base, backend, irq = 0, queue_size = 256)`
+class virtio_mmio_factory_t : public device_factory_t {
+public:
+  virtual abstract_device_t *
+  parse_from_fdt(const void *fdt, const sim_t *sim, reg_t *base,
+                 const std::vector<std::string> &sargs) const override {
+    if (sargs.size() < 2) {
+      throw std::runtime_error(
+          "virtio_mmio requires (base, backend[, irq[, queue_size]])");
+    }
+    if (base != nullptr) {
+      *base = std::stoull(sargs[0], nullptr, 16);
+    }
+    unsigned irq = sargs.size() > 2 ? std::stoul(sargs[2], nullptr, 0) : 0;
+    unsigned queue_size =
+        sargs.size() > 3 ? std::stoul(sargs[3], nullptr, 0) : 256;
+    if (queue_size == 0 || queue_size > 0x8000) {
+      throw std::runtime_error("virtio_mmio queue_size out of range");
+    }
+    return new virtio_mmio_t(sim, virtio_backend_t::lookup(sargs[1]), irq,
+                             queue_size);
+  }
+
+  virtual std::string
+  generate_dts(const sim_t *sim,
+               const std::vector<std::string> &sargs) const override {
+    if (sargs.empty()) {
+      return "";
+    }
+    reg_t base = std::stoull(sargs[0], nullptr, 16);
+    unsigned irq = sargs.size() > 2 ? std::stoul(sargs[2], nullptr, 0) : 0;
+    std::ostringstream s;
+    s << std::hex << "    virtio_mmio@" << base << " {\n"
+      << "      compatible = \"virtio,mmio\";\n";
+    if (irq != 0) {
+      s << "      interrupt-parent = <&PLIC>;\n"
+        << "      interrupts = <" << std::dec << irq << std::hex << ">;\n";
+    }
+    s << "      reg = <0x" << (base >> 32) << " 0x" << (base & 0xffffffff)
+      << " 0x0 0x" << virtio_mmio_t::SIZE << ">;\n"
+      << "    };\n";
+    return s.str();
+  }
+};
+
+static bool virtio_mmio_registered = [] {
+  mmio_device_map()["virtio_mmio"] = new virtio_mmio_factory_t();
+  return true;
+}();
@@ -0,0 +1,254 @@
+/*
+ * Copyright 2024 WuXi EsionTech Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _RISCV_VIRTIO_H_
+#define _RISCV_VIRTIO_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <riscv/abstract_device.h>
+#include <riscv/sim.h>
+
+#include <pybind11/pybind11.h>
+
+#include "riscv_dma.h"
+#include "riscv_irq.h"
+
+class virtio_mmio_t;
+
+// one guest buffer of a descriptor chain, in host memory. a buffer spanning
+// pages apart in host memory takes several segments.
+struct virtio_segment_t {
+  char *host;
+  uint32_t len;
+};
+
+// one descriptor chain popped from an available ring
+//
+// the segments point into guest memory, and stay valid as long as the sim
+// does, so backends may keep a request and complete it later. the python
+// views of the segments keep the sim alive.
+class virtio_request_t {
+public:
+  virtio_request_t(std::weak_ptr<virtio_mmio_t> dev, const sim_t *sim,
+                   unsigned queue, uint16_t head);
+
+public:
+  // puts the chain on the used ring, with `written` bytes written to the
+  // device-writable segments. a request completes once only, and to no
+  // effect once the device is gone.
+  void complete(uint32_t written);
+
+public:
+  unsigned get_queue() const;
+  uint16_t get_head() const;
+  bool is_completed() const;
+  const sim_t *get_sim() const;
+
+public:
+  std::vector<virtio_segment_t> readable;
+  std::vector<virtio_segment_t> writable;
+
+private:
+  std::weak_ptr<virtio_mmio_t> dev;
+  const sim_t *sim;
+  unsigned queue;
+  uint16_t head;
+  bool completed;
+};
+
+typedef std::vector<std::shared_ptr<virtio_request_t>> virtio_batch_t;
+
+// device-specific half of a virtio device
+//
+// backends are registered by name, and looked up when virtio_mmio devices
+// are instantiated.
+class virtio_backend_t {
+public:
+  virtual ~virtio_backend_t() = default;
+
+public:
+  // virtio device id, e.g. 2 for block and 3 for console
+  virtual uint32_t device_id() = 0;
+  // device feature bits, besides those of the transport
+  virtual uint64_t device_features();
+  virtual unsigned num_queues();
+  // device configuration space
+  virtual std::string config();
+  // called when the driver resets the device
+  virtual void reset();
+  // handles all requests made available on `queue` since the last notify
+  virtual void handle(unsigned queue, const virtio_batch_t &requests) = 0;
+
+public:
+  // registry of backends by name
+  static void attach(const std::string &name,
+                     std::shared_ptr<virtio_backend_t> backend);
+  static void detach(const std::string &name);
+  static std::shared_ptr<virtio_backend_t> lookup(const std::string &name);
+  static std::vector<std::string> names();
+
+private:
+  static std::mutex registry_lock;
+  static std::map<std::string, std::shared_ptr<virtio_backend_t>> registry;
+};
+
+// trampoline helper class for extending virtio_backend_t
+class py_virtio_backend_t : public virtio_backend_t,
+                            public pybind11::trampoline_self_life_support {
+public:
+  using virtio_backend_t::virtio_backend_t;
+
+public:
+  // py signature: `() -> int`
+  virtual uint32_t device_id() override;
+  // py signature: `() -> int`
+  virtual uint64_t device_features() override;
+  // py signature: `() -> int`
+  virtual unsigned num_queues() override;
+  // py signature: `() -> bytes`
+  virtual std::string config() override;
+  // py signature: `() -> None`
+  virtual void reset() override;
+  // py signature: `(queue: int, requests: list[virtio_request_t]) -> None`
+  virtual void handle(unsigned queue, const virtio_batch_t &requests) override;
+};
+
+// virtio-mmio transport (version 2) with split virtqueues
+//
+// registered as "virtio_mmio" in `mmio_device_map`, with sargs
+// `(base, backend, irq = 0, queue_size = 256)`.
+//
+// a write to QueueNotify walks the available ring of that queue in C++ (direct
+// and indirect descriptors alike), and hands the whole batch of chains to the
+// backend in a single call. completed chains are put on the used ring, and the
+// interrupt is updated once per notify and on every tick, so requests
+// completed outside of `handle` are signalled on the next tick.
+class virtio_mmio_t : public abstract_device_t {
+public:
+  virtio_mmio_t(const sim_t *sim, std::shared_ptr<virtio_backend_t> backend,
+                unsigned irq, uint16_t queue_size);
+
+public:
+  virtual bool load(reg_t addr, size_t len, uint8_t *bytes) override;
+  virtual bool store(reg_t addr, size_t len, const uint8_t *bytes) override;
+  virtual reg_t size() override;
+  virtual void tick(reg_t rtc_ticks) override;
+
+public:
+  void complete(unsigned queue, uint16_t head, uint32_t written);
+  // replaces the configuration space, and notifies the driver
+  void set_config(const std::string &data);
+
+public:
+  const std::string &get_config() const;
+  uint32_t get_status() const;
+  uint64_t get_driver_features() const;
+  uint64_t get_requests() const;
+  uint64_t get_batches() const;
+
+public:
+  interrupt_line_t &get_irq();
+
+public:
+  static const reg_t MAGIC_VALUE = 0x000;
+  static const reg_t VERSION = 0x004;
+  static const reg_t DEVICE_ID = 0x008;
+  static const reg_t VENDOR_ID = 0x00c;
+  static const reg_t DEVICE_FEATURES = 0x010;
+  static const reg_t DEVICE_FEATURES_SEL = 0x014;
+  static const reg_t DRIVER_FEATURES = 0x020;
+  static const reg_t DRIVER_FEATURES_SEL = 0x024;
+  static const reg_t QUEUE_SEL = 0x030;
+  static const reg_t QUEUE_NUM_MAX = 0x034;
+  static const reg_t QUEUE_NUM = 0x038;
+  static const reg_t QUEUE_READY = 0x044;
+  static const reg_t QUEUE_NOTIFY = 0x050;
+  static const reg_t INTERRUPT_STATUS = 0x060;
+  static const reg_t INTERRUPT_ACK = 0x064;
+  static const reg_t STATUS = 0x070;
+  static const reg_t QUEUE_DESC_LOW = 0x080;
+  static const reg_t QUEUE_DESC_HIGH = 0x084;
+  static const reg_t QUEUE_DRIVER_LOW = 0x090;
+  static const reg_t QUEUE_DRIVER_HIGH = 0x094;
+  static const reg_t QUEUE_DEVICE_LOW = 0x0a0;
+  static const reg_t QUEUE_DEVICE_HIGH = 0x0a4;
+  static const reg_t CONFIG_GENERATION = 0x0fc;
+  static const reg_t CONFIG = 0x100;
+  static const reg_t SIZE = 0x1000;
+
+  static const uint32_t MAGIC = 0x74726976; // "virt"
+  static const uint32_t VENDOR = 0x554d4551; // "QEMU", as most guests expect
+
+  static const uint64_t F_INDIRECT_DESC = 1ull << 28;
+  static const uint64_t F_VERSION_1 = 1ull << 32;
+
+  static const uint32_t INT_USED_BUFFER = 0x1;
+  static const uint32_t INT_CONFIG_CHANGE = 0x2;
+  static const uint32_t STATUS_NEEDS_RESET = 0x40;
+
+  static const uint16_t DESC_F_NEXT = 0x1;
+  static const uint16_t DESC_F_WRITE = 0x2;
+  static const uint16_t DESC_F_INDIRECT = 0x4;
+
+private:
+  struct queue_t {
+    uint16_t num;
+    bool ready;
+    reg_t desc;
+    reg_t avail;
+    reg_t used;
+    uint16_t last_avail;
+  };
+
+private:
+  uint32_t read_reg(reg_t addr);
+  void write_reg(reg_t addr, uint32_t value);
+  void reset();
+  void notify(unsigned queue);
+  // walks the chain at `head`, false if it is malformed
+  bool walk(queue_t &q, uint16_t head, virtio_request_t &req);
+  void update_interrupt();
+
+private:
+  const sim_t *sim;
+  dma_port_t port;
+  std::shared_ptr<virtio_backend_t> backend;
+  interrupt_line_t irq;
+  uint16_t queue_size;
+  uint32_t device_id;
+  uint64_t device_features;
+  std::string config;
+  uint32_t config_generation;
+  uint32_t device_features_sel;
+  uint32_t driver_features_sel;
+  uint64_t driver_features;
+  uint32_t queue_sel;
+  uint32_t interrupt_status;
+  uint32_t status;
+  std::vector<queue_t> queues;
+  uint64_t requests;
+  uint64_t batches;
+  // non-owning handle, whose weak references held by requests expire along
+  // with the device (owned by the sim)
+  std::shared_ptr<virtio_mmio_t> self;
+};
+
+#endif // _RISCV_VIRTIO_H_
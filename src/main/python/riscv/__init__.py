@@ -14,6 +14,7 @@
 # limitations under the License.
 #
 import importlib
+import os
 import sys
 import types
 import warnings
@@ -25,12 +26,17 @@ try:
 except ImportError:
     warnings.warn("Missing `riscv._version`, run `python -m setuptools_scm --force-write-version-files` to generate.")
 
-__all__ = ["ENV_PYSPIKE_LIBS", "ENV_PYSPIKE_EXTS"]
+__all__ = ["ENV_PYSPIKE_LIBS", "ENV_PYSPIKE_EXTS", "ENV_PYSPIKE_CACHE", "ENV_PYSPIKE_STATS"]
 
 ENV_PYSPIKE_LIBS = "PYSPIKE_LIBS"
 
 ENV_PYSPIKE_EXTS = "PYSPIKE_EXTS"
 
+ENV_PYSPIKE_CACHE = "PYSPIKE_CACHE"
+
+# "text" or "json": time python callbacks, and report at exit (to stderr)
+ENV_PYSPIKE_STATS = "PYSPIKE_STATS"
+
 # load spike runtime library (libriscv.so, libcustomext.so)
 try:
     load_spike_library("riscv")
@@ -49,5 +55,12 @@ else:
                 setattr(self, name, _attr)
         # bootstrap spike-in-python
         getattr(_riscv, "bootstrap")()
+        # per-callback latency stats
+        _stats_format = os.environ.get(ENV_PYSPIKE_STATS)
+        if _stats_format in ("text", "json"):
+            _riscv.stats.enable()
+            _riscv.stats.report_at_exit(_stats_format)
+        elif _stats_format:
+            warnings.warn(f"Unknown `{ENV_PYSPIKE_STATS}={_stats_format}`, expected \"text\" or \"json\".")
     except (ImportError, AttributeError) as exc:
         warnings.warn("Missing `riscv._riscv`, run `python setup.py build_ext --inplace` to build it.")
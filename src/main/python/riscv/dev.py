@@ -13,9 +13,9 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 #
-from typing import Optional, Tuple, Type
+from typing import Iterable, Optional, Tuple, Type
 
-from riscv.devices import abstract_device_t, device_factory_t, mmio_device_map
+from riscv.devices import abstract_device_t, device_factory_t, dma_port_t, interrupt_line_t, mmio_device_map
 from riscv.sim import sim_t
 
 
@@ -31,16 +31,69 @@ class MMIO(abstract_device_t):
         super().__init__()
         self.sim: sim_t = sim
         self.args: Optional[str] = args
+        self._dma: Optional[dma_port_t] = None
+        # see `register`, may be changed at any time, e.g. to tick only while
+        # there is work to do
+        self.tick_divisor = getattr(type(self), "_mmio_tick_divisor", 1)
 
     def tick(self, rtc_ticks: int) -> None:
         pass
 
-
-def register(name: str, *, size: Optional[int] = None, replace: bool = False):
+    def interrupt_line(self, irq: int) -> interrupt_line_t:
+        """
+        Interrupt line to the PLIC, ticked natively on every tick of the
+        device, whatever its tick divisor
+        """
+        line = interrupt_line_t(self.sim, irq)
+        self.attach_line(line)
+        return line
+
+    @property
+    def dma(self) -> dma_port_t:
+        """
+        Bus master port to guest physical memory
+        """
+        if self._dma is None:
+            self._dma = dma_port_t(self.sim)
+        return self._dma
+
+    def dma_read(self, addr: int, size: int) -> memoryview:
+        """
+        Read `size` bytes at `addr`, in place if they lie within one memory region
+        """
+        return self.dma.read(addr, size)
+
+    def dma_write(self, addr: int, data) -> None:
+        """
+        Write a bytes-like object at `addr`
+        """
+        self.dma.write(addr, data)
+
+    def dma_gather(self, segments: Iterable[Tuple[int, int]]) -> memoryview:
+        """
+        Read and concatenate `(addr, size)` segments
+        """
+        return self.dma.gather(list(segments))
+
+    def dma_scatter(self, segments: Iterable[Tuple[int, int]], data) -> None:
+        """
+        Split a bytes-like object over `(addr, size)` segments
+        """
+        self.dma.scatter(list(segments), data)
+
+
+def register(name: str, *, size: Optional[int] = None, replace: bool = False, tick: Optional[int] = 1):
     """
     Decorator for registering MMIO device
+
+    The device's `tick` is called once every `tick` spike ticks, with the sum
+    of their `rtc_ticks`, or never if `tick` is None. Skipped ticks do not
+    enter python, while interrupt lines still tick on every one of them.
     """
 
+    if tick is not None and tick < 1:
+        raise ValueError(f"Invalid tick divisor {tick}")
+
     if name in mmio_device_map and not replace:
         raise KeyError(f"Device factory '{name}' already registered")
 
@@ -48,6 +101,8 @@ def register(name: str, *, size: Optional[int] = None, replace: bool = False):
 
         class MMIODevice(mmio_cls):
 
+            _mmio_tick_divisor = 0 if tick is None else tick
+
             def size(self) -> int:
                 if size is not None:
                     return size
@@ -58,6 +113,10 @@ def register(name: str, *, size: Optional[int] = None, replace: bool = False):
 
         class MMIOFactory(device_factory_t):
 
+            # `generate_dts` yields the same (empty) dts regardless of `sim`
+            dts_deterministic = True
+            dts_version = ""
+
             # pylint: disable=unused-argument
             def parse_from_fdt(self, fdt, sim: sim_t, *sargs: str) -> Tuple[Optional[abstract_device_t], int]:
                 return MMIODevice(sim, ",".join(sargs[1:])), int(sargs[0], 16)
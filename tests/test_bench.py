@@ -0,0 +1,42 @@
+#
+# Copyright 2024 WuXi EsionTech Co., Ltd.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+import pytest
+
+# pylint: disable=import-error,no-name-in-module
+from riscv.devices import abstract_device_t
+from riscv.test import _bench_mmio_load, _bench_mmio_store
+
+
+class BenchDevice(abstract_device_t):
+
+    # pylint: disable=unused-argument
+    def load(self, addr: int, size: int) -> bytes:
+        return bytes(size)
+
+    # pylint: disable=unused-argument
+    def store(self, addr: int, data: bytes) -> None:
+        pass
+
+
+def test_bench_mmio_size():
+    """
+    the mmio loops refuse accesses wider than 8 bytes, instead of timing others
+    """
+    dev = BenchDevice()
+    with pytest.raises(RuntimeError):
+        _bench_mmio_load(dev, 0, 16, 1)
+    with pytest.raises(RuntimeError):
+        _bench_mmio_store(dev, 0, 16, 1)
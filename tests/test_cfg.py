@@ -14,6 +14,8 @@
 # limitations under the License.
 #
 # pylint: disable=import-error,no-name-in-module
+import pytest
+
 from riscv.cfg import mem_cfg_t, cfg_t
 from riscv.debug_module import debug_module_config_t
 
@@ -22,6 +24,20 @@ def test_mem_cfg_t():
     mc = mem_cfg_t(0x8000_0000, 0x4000)
     assert mc.base == 0x8000_0000
     assert mc.size == 0x4000
+    assert mc.backing == "anonymous"
+    assert not mc.shared
+
+
+def test_mem_cfg_t_backing(tmp_path):
+    mc = mem_cfg_t(0x8000_0000, 0x4000, backing="file", path=(tmp_path / "ram.bin").as_posix(), shared=True)
+    assert mc.backing == "file"
+    assert mc.path == (tmp_path / "ram.bin").as_posix()
+    assert mc.shared
+    assert mem_cfg_t(0x8000_0000, 0x4000, backing="shm", path="/pyspike").shared
+    with pytest.raises(RuntimeError):
+        mem_cfg_t(0x8000_0000, 0x4000, backing="tape")
+    with pytest.raises(RuntimeError):
+        mem_cfg_t(0x8000_0000, 0x4000, backing="file")
 
 
 def test_cfg_t():
@@ -13,8 +13,10 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 #
+import pytest
+
 # pylint: disable=import-error,no-name-in-module
-from riscv.csrs import csr_t
+from riscv.csrs import csr_t, native_csr_t, cached_csr_t
 from riscv.decode import insn_t
 from riscv.processor import processor_t
 
@@ -45,3 +47,160 @@ def test_csr_t(mock_sim):
     assert p.get_csr(csr.address) == 0x1234
     p.put_csr(csr.address, 0x1235)
     assert p.get_csr(csr.address) == 0x1235
+
+
+def test_native_csr_t(mock_sim):
+    p: processor_t = mock_sim.get_core(0)
+    writes = []
+    # bits [7:4] are read-only, and field [1:0] is WARL with 2 reserved
+    csr = native_csr_t(p, 0x7c1, 0x51, write_mask=0xffff_ff0f, warl={0x3: [0, 1, 3]},
+                       on_write=lambda old, new: writes.append((old, new)))
+    p.state.add_csr(csr.address, csr)
+    assert p.get_csr(csr.address) == 0x51
+    p.put_csr(csr.address, 0xf03)
+    assert p.get_csr(csr.address) == 0xf53
+    # illegal WARL values keep the field as is
+    p.put_csr(csr.address, 0xf02)
+    assert p.get_csr(csr.address) == 0xf53
+    assert writes == [(0x51, 0xf53)]
+    assert csr.legalize(0xf0) == 0x50
+    csr.value = 0x7
+    assert p.get_csr(csr.address) == 0x7
+    csr.reset()
+    assert (csr.value, csr.reset_value) == (0x51, 0x51)
+    assert len(writes) == 1
+
+
+def test_cached_csr_t(mock_sim):
+    p: processor_t = mock_sim.get_core(0)
+    source = [7]
+    ctrl = native_csr_t(p, 0x7c2, 0)
+    csr = cached_csr_t(p, 0x7c3, lambda: source[0])
+    csr.depend_on(ctrl)
+    p.state.add_csr(ctrl.address, ctrl)
+    p.state.add_csr(csr.address, csr)
+    assert not csr.valid
+    assert p.get_csr(csr.address) == 7
+    source[0] = 8
+    # served from the cache
+    assert p.get_csr(csr.address) == 7
+    assert (csr.refreshes, csr.hits) == (1, 1)
+    csr.invalidate()
+    assert p.get_csr(csr.address) == 8
+    # by a change of the dependency, but not by a redundant write to it
+    source[0] = 9
+    p.put_csr(ctrl.address, 0)
+    assert p.get_csr(csr.address) == 8
+    p.put_csr(ctrl.address, 1)
+    assert p.get_csr(csr.address) == 9
+    assert csr.refreshes == 3
+
+
+def test_cached_csr_t_depend_on(mock_sim):
+    p: processor_t = mock_sim.get_core(0)
+    source = [1]
+    csr = cached_csr_t(p, 0x7c6, lambda: source[0])
+    p.state.add_csr(csr.address, csr)
+    # a spike CSR (mscratch, by address) and a python one, wrapped in the csrmap
+    py_csr = MyCSR(p, 0x7c7)
+    p.state.add_csr(py_csr.address, py_csr)
+    csr.depend_on(0x340)
+    csr.depend_on(py_csr)
+    assert p.get_csr(csr.address) == 1
+    source[0] = 2
+    p.put_csr(0x340, 0x55)
+    assert p.get_csr(0x340) == 0x55
+    assert p.get_csr(csr.address) == 2
+    source[0] = 3
+    p.put_csr(py_csr.address, 0x1235)
+    assert py_csr.v == 0x1235
+    assert p.get_csr(csr.address) == 3
+    # CSRs that are not on the hart
+    with pytest.raises(RuntimeError):
+        csr.depend_on(MyCSR(p, 0x7c8))
+    with pytest.raises(RuntimeError):
+        csr.depend_on(0x7c8)
+
+
+def test_cached_csr_t_raises(mock_sim):
+    p: processor_t = mock_sim.get_core(0)
+
+    def compute() -> int:
+        raise OverflowError("not a CSR value")
+
+    csr = cached_csr_t(p, 0x7c9, compute)
+    p.state.add_csr(csr.address, csr)
+    # the stale value is served
+    assert p.get_csr(csr.address) == 0
+    assert csr.refreshes == 1
+
+
+def test_cached_csr_t_ttl(mock_sim):
+    p: processor_t = mock_sim.get_core(0)
+    csr = cached_csr_t(p, 0x7c4, lambda: 1, ttl=10)
+    p.state.add_csr(csr.address, csr)
+    assert p.get_csr(csr.address) == 1
+    assert p.get_csr(csr.address) == 1
+    assert csr.refreshes == 1
+    # minstret
+    p.put_csr(0xb02, 100)
+    assert p.get_csr(csr.address) == 1
+    assert csr.refreshes == 2
+
+
+def test_csr_snapshot(mock_sim):
+    p: processor_t = mock_sim.get_core(0)
+    csr = native_csr_t(p, 0x7c5, 0x55)
+    p.state.add_csr(csr.address, csr)
+    snapshot = p.csr_snapshot()
+    assert len(snapshot) > 1
+    rows = memoryview(snapshot)
+    assert rows.shape == (len(snapshot), 2)
+    addrs = [snapshot[i][0] for i in range(len(snapshot))]
+    assert addrs == sorted(addrs)
+    assert snapshot.get(csr.address) == 0x55
+    assert snapshot.as_dict()[0x300] == p.get_csr(0x300)  # mstatus
+    # filters
+    custom = p.csr_snapshot(custom=True).as_dict()
+    assert csr.address in custom and 0x300 not in custom
+    assert all(((addr >> 8) & 0x3) <= 1 for addr in p.csr_snapshot(priv=1).as_dict())
+    # restore
+    mscratch = snapshot.get(0x340)
+    p.put_csr(0x340, 0x1234)
+    csr.value = 0
+    assert p.csr_restore(snapshot) > 1
+    assert p.get_csr(0x340) == mscratch
+    assert csr.value == 0x55
+
+
+def test_csr_snapshot_side_effects(mock_sim):
+    p: processor_t = mock_sim.get_core(0)
+    py_csr = MyCSR(p, 0x7ca)
+    p.state.add_csr(py_csr.address, py_csr)
+    cached = cached_csr_t(p, 0x7cb, lambda: 5)
+    p.state.add_csr(cached.address, cached)
+    # python CSRs are read, but caches are not refreshed
+    snapshot = p.csr_snapshot(custom=True)
+    assert snapshot.get(py_csr.address) == 0x1234
+    assert snapshot.get(cached.address) is None
+    assert (cached.refreshes, cached.hits) == (0, 0)
+    # unless asked to
+    assert p.csr_snapshot(custom=True, side_effects=True).get(cached.address) == 5
+    assert (cached.refreshes, cached.hits) == (1, 0)
+    # valid cached values are taken as they are
+    assert p.csr_snapshot(custom=True).get(cached.address) == 5
+    assert (cached.refreshes, cached.hits) == (1, 0)
+
+
+def test_csr_snapshot_aliases(mock_sim):
+    p: processor_t = mock_sim.get_core(0)
+    snapshot = p.csr_snapshot()
+    # fcsr is in the snapshot, but only fflags and frm are written back
+    assert snapshot.get(0x003) is not None
+    mstatus = p.get_csr(0x300)
+    frm = p.get_csr(0x002)
+    p.put_csr(0x300, mstatus ^ 0x8)  # MIE
+    p.put_csr(0x002, frm ^ 0x1)
+    p.csr_restore(snapshot)
+    assert p.get_csr(0x300) == mstatus
+    assert p.get_csr(0x002) == frm
@@ -13,13 +13,19 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 #
+import gc
+import struct
+import sys
+import weakref
 from typing import Optional, Tuple
 import pytest
 
 # pylint: disable=import-error,no-name-in-module
-from riscv.devices import abstract_device_t, device_factory_t, plic_t, mmio_device_map
+from riscv.cfg import cfg_t, mem_cfg_t
+from riscv.devices import (abstract_device_t, device_factory_t, plic_t, mmio_device_map, channel_t, dma_port_t,
+                           virtio_backend_t, buffer_device_t, rom_device_t, rom_image_t, interrupt_line_t)
 from riscv.sim import sim_t
-from riscv.test import _test_mmio_load, _test_mmio_store, _test_mmio_parse_from_fdt
+from riscv.test import _test_mmio_load, _test_mmio_store, _test_mmio_tick, _test_mmio_parse_from_fdt
 
 
 class MyDevice(abstract_device_t):
@@ -159,3 +165,468 @@ def test_mmio_device_map_builtin(name):
 def test_device_factory_t_generate_dts(mock_sim, name, sargs, dts):
     assert name in mmio_device_map
     assert mmio_device_map[name].generate_dts(mock_sim, *sargs) == dts
+
+
+def test_channel_t():
+    ch = channel_t("test_channel_t", slots=2, mtu=16)
+    assert (ch.slots, ch.mtu, ch.shm) == (2, 16, False)
+    # endpoint 0 sends to endpoint 1, and vice versa
+    assert ch.send(0, b"ping")
+    assert ch.send(0, b"pong")
+    assert not ch.send(0, b"full")
+    assert not ch.send(1, b"x" * 17)
+    assert ch.pending(1) == 2
+    assert ch.recv(0) is None
+    assert ch.recv(1) == b"ping"
+    assert ch.recv(1) == b"pong"
+    assert ch.recv(1) is None
+    ch.close()
+
+
+def test_mailbox_t(mock_sim):
+    ch = channel_t("test_mailbox_t", slots=4, mtu=64)
+    fact = mmio_device_map["mailbox"]
+    mbox, base = _test_mmio_parse_from_fdt(fact, None, mock_sim, "30000000", "test_mailbox_t", "0", "3")
+    assert base == 0x3000_0000
+    # tx: fill TX_BUF, then write TX_LEN
+    _test_mmio_store(mbox, 0x1000, b"hello")
+    _test_mmio_store(mbox, 0x08, (5).to_bytes(4, "little"))
+    assert ch.recv(1) == b"hello"
+    assert mbox.tx_packets == 1
+    # rx: STATUS, RX_LEN, RX_BUF, then RX_POP
+    assert ch.send(1, b"world!")
+    assert int.from_bytes(_test_mmio_load(mbox, 0x00, 4), "little") & 1
+    assert int.from_bytes(_test_mmio_load(mbox, 0x0C, 4), "little") == 6
+    assert _test_mmio_load(mbox, 0x2000, 6) == b"world!"
+    _test_mmio_store(mbox, 0x10, bytes(4))
+    assert int.from_bytes(_test_mmio_load(mbox, 0x0C, 4), "little") == 0
+    assert mbox.rx_packets == 1
+    # accesses straddling TX_BUF and RX_BUF are rejected
+    with pytest.raises(RuntimeError):
+        _test_mmio_load(mbox, 0x1FFC, 8)
+    with pytest.raises(RuntimeError):
+        _test_mmio_store(mbox, 0x1FFC, bytes(8))
+    assert _test_mmio_load(mbox, 0x1FFC, 4) == bytes(4)
+    ch.close()
+
+
+def test_dma_port_t(mock_sim):
+    dma = dma_port_t(mock_sim)
+    dma.write(0x9000_1000, b"hello, world")
+    view = dma.read(0x9000_1000, 12)
+    assert bytes(view) == b"hello, world"
+    # reads within one memory region are views of guest memory
+    dma.write(0x9000_1000, b"j")
+    assert bytes(view[:5]) == b"jello"
+    dma.copy(0x9000_2000, 0x9000_1000, 12)
+    assert bytes(dma.read(0x9000_2000, 12)) == b"jello, world"
+    assert bytes(dma.gather([(0x9000_2007, 5), (0x9000_1005, 2)])) == b"world, "
+    dma.scatter([(0x9000_3000, 2), (0x9000_3010, 3)], b"abcde")
+    assert bytes(dma.read(0x9000_3000, 2)) + bytes(dma.read(0x9000_3010, 3)) == b"abcde"
+    with pytest.raises(IndexError):
+        dma.read(0x1000, 4)
+    # views keep the port, and thus the sim, alive
+    port = weakref.ref(dma)
+    del dma
+    gc.collect()
+    assert port() is not None
+    assert bytes(view[:5]) == b"jello"
+    del view
+    gc.collect()
+    assert port() is None
+
+
+def test_dma_engine_t(mock_sim):
+    dma = dma_port_t(mock_sim)
+    dma.write(0x9000_1000, bytes(range(64)))
+    fact = mmio_device_map["dma_engine"]
+    eng, base = _test_mmio_parse_from_fdt(fact, None, mock_sim, "30010000", "0", "16")
+    assert base == 0x3001_0000
+    assert "interrupts" not in fact.generate_dts(mock_sim, "30010000", "0", "16")
+    dts = fact.generate_dts(mock_sim, "30010000", "5")
+    assert "dma@30010000 {" in dts
+    assert "interrupts = <5>;" in dts
+    assert "reg = <0x0 0x30010000 0x0 0x28>;" in dts
+    # SRC, DST, LEN, then CTRL.START
+    _test_mmio_store(eng, 0x00, (0x9000_1000).to_bytes(8, "little"))
+    _test_mmio_store(eng, 0x08, (0x9000_2000).to_bytes(8, "little"))
+    _test_mmio_store(eng, 0x10, (64).to_bytes(8, "little"))
+    _test_mmio_store(eng, 0x18, (1).to_bytes(8, "little"))
+    # transfers from python share the queue
+    eng.submit(0x9000_1000, 0x9000_3000, 8)
+    assert eng.pending == 2
+    # 16 bytes per tick
+    for _ in range(4):
+        assert int.from_bytes(_test_mmio_load(eng, 0x20, 8), "little") & 0x1
+        _test_mmio_tick(eng, 1)
+    assert eng.pending == 1
+    _test_mmio_tick(eng, 1)
+    assert (eng.pending, eng.transfers, eng.bytes) == (0, 2, 72)
+    assert int.from_bytes(_test_mmio_load(eng, 0x20, 8), "little") == 0x2
+    assert bytes(dma.read(0x9000_2000, 64)) == bytes(range(64))
+    assert bytes(dma.read(0x9000_3000, 8)) == bytes(range(8))
+    # stores spanning CTRL and STATUS would bypass write-1-to-clear
+    with pytest.raises(RuntimeError):
+        _test_mmio_store(eng, 0x1C, bytes(8))
+    assert int.from_bytes(_test_mmio_load(eng, 0x20, 8), "little") == 0x2
+    _test_mmio_store(eng, 0x20, (0x2).to_bytes(8, "little"))
+    assert int.from_bytes(_test_mmio_load(eng, 0x20, 8), "little") == 0
+
+
+def test_virtio_mmio_t(mock_sim):
+
+    class EchoBackend(virtio_backend_t):
+
+        def __init__(self):
+            super().__init__()
+            self.batches = []
+            self.deferred = []
+
+        def device_id(self) -> int:
+            return 3
+
+        def config(self) -> bytes:
+            return b"\x50\x00\x19\x00"
+
+        def handle(self, queue, requests) -> None:
+            self.batches.append(len(requests))
+            for req in requests:
+                data = b"".join(bytes(view) for view in req.readable)
+                req.writable[0][:len(data)] = data[::-1]
+                if req.head == 0:
+                    req.complete(len(data))
+                else:
+                    self.deferred.append(req)
+
+    backend = EchoBackend()
+    backend.attach("test_virtio_mmio_t")
+    fact = mmio_device_map["virtio_mmio"]
+    dev, base = _test_mmio_parse_from_fdt(fact, None, mock_sim, "30020000", "test_virtio_mmio_t", "0", "8")
+    assert base == 0x3002_0000
+
+    def reg_load(addr):
+        return int.from_bytes(_test_mmio_load(dev, addr, 4), "little")
+
+    def reg_store(addr, value):
+        _test_mmio_store(dev, addr, value.to_bytes(4, "little"))
+
+    assert (reg_load(0x000), reg_load(0x004), reg_load(0x008)) == (0x74726976, 2, 3)
+    assert _test_mmio_load(dev, 0x100, 4) == b"\x50\x00\x19\x00"
+    # a direct chain at 0, and an indirect one at 2
+    dma = dma_port_t(mock_sim)
+    dma.write(0x9000_8000, b"ping")
+    dma.write(0x9000_8100, b"abc")
+    dma.write(0x9000_4000, struct.pack("<QIHH", 0x9000_8000, 4, 0x1, 1) +
+              struct.pack("<QIHH", 0x9000_9000, 16, 0x2, 0) +
+              struct.pack("<QIHH", 0x9000_7000, 32, 0x4, 0))
+    dma.write(0x9000_7000, struct.pack("<QIHH", 0x9000_8100, 3, 0x1, 1) +
+              struct.pack("<QIHH", 0x9000_9100, 8, 0x2, 0))
+    dma.write(0x9000_5000, struct.pack("<HHHH", 0, 2, 0, 2))
+    # QueueSel, QueueNum, QueueDesc, QueueDriver, QueueDevice, QueueReady
+    reg_store(0x030, 0)
+    assert reg_load(0x034) == 8
+    reg_store(0x038, 8)
+    reg_store(0x080, 0x9000_4000)
+    reg_store(0x090, 0x9000_5000)
+    reg_store(0x0A0, 0x9000_6000)
+    reg_store(0x044, 1)
+    reg_store(0x070, 0xF)
+    # QueueNotify: both chains, in one batch
+    reg_store(0x050, 0)
+    assert backend.batches == [2]
+    assert (dev.requests, dev.batches) == (2, 1)
+    assert bytes(dma.read(0x9000_9000, 4)) == b"gnip"
+    assert struct.unpack("<HHII", bytes(dma.read(0x9000_6000, 12))) == (0, 1, 0, 4)
+    assert reg_load(0x060) == 0x1
+    reg_store(0x064, 0x1)
+    # deferred completion
+    req, = backend.deferred
+    assert bytes(dma.read(0x9000_9100, 3)) == b"cba"
+    # views of guest memory keep the sim alive
+    refs = sys.getrefcount(mock_sim)
+    readable, writable = req.readable, req.writable
+    assert sys.getrefcount(mock_sim) == refs + len(readable) + len(writable)
+    assert readable[0].readonly and not writable[0].readonly
+    del readable, writable
+    assert sys.getrefcount(mock_sim) == refs
+    req.complete(3)
+    assert req.completed
+    assert struct.unpack("<HHIIII", bytes(dma.read(0x9000_6000, 20)))[1:] == (2, 0, 4, 2, 3)
+    _test_mmio_tick(dev, 1)
+    assert reg_load(0x060) == 0x1
+    with pytest.raises(RuntimeError):
+        req.complete(3)
+    # config change
+    dev.config = b"\x78\x00\x28\x00"
+    assert reg_load(0x0FC) == 1
+    assert _test_mmio_load(dev, 0x100, 4) == b"\x78\x00\x28\x00"
+    # reset
+    reg_store(0x070, 0)
+    assert (reg_load(0x070), reg_load(0x044), reg_load(0x060)) == (0, 0, 0)
+    virtio_backend_t.detach("test_virtio_mmio_t")
+
+
+def test_virtio_request_t_device_gone():
+
+    class DeferringBackend(virtio_backend_t):
+
+        def __init__(self):
+            super().__init__()
+            self.requests = []
+
+        def device_id(self) -> int:
+            return 3
+
+        # pylint: disable=unused-argument
+        def handle(self, queue, requests) -> None:
+            self.requests.extend(requests)
+
+    backend = DeferringBackend()
+    backend.attach("test_virtio_request_t")
+    try:
+        s = sim_t(
+            cfg=cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+            halted=True,
+            plugin_device_factories=[("virtio_mmio", ("30020000", "test_virtio_request_t"))],
+            args=["pk"],
+        )
+        # one chain, made available through the device registers
+        dma = dma_port_t(s)
+        dma.write(0x8000_4000, struct.pack("<QIHH", 0x8000_9000, 16, 0x2, 0))
+        dma.write(0x8000_5000, struct.pack("<HHH", 0, 1, 0))
+        for addr, value in [(0x030, 0), (0x038, 8), (0x080, 0x8000_4000), (0x090, 0x8000_5000),
+                            (0x0A0, 0x8000_6000), (0x044, 1), (0x070, 0xF), (0x050, 0)]:
+            dma.write(0x3002_0000 + addr, value.to_bytes(4, "little"))
+        req, = backend.requests
+        del dma, s
+        gc.collect()
+        # the sim and its devices are gone
+        req.complete(0)
+        assert req.completed
+    finally:
+        virtio_backend_t.detach("test_virtio_request_t")
+
+
+def test_buffer_device_t():
+    buf = bytearray(0x100)
+    calls = []
+    dev = buffer_device_t(buf, doorbell=0x80, threshold=3, callback=lambda *args: calls.append(args))
+    assert dev.size() == 0x100
+    # guest stores land in the buffer, and host writes are seen by the guest
+    _test_mmio_store(dev, 0x10, b"ab")
+    assert buf[0x10:0x12] == b"ab"
+    buf[0x20:0x24] = b"wxyz"
+    assert _test_mmio_load(dev, 0x20, 4) == b"wxyz"
+    # doorbell
+    _test_mmio_store(dev, 0x80, (1).to_bytes(4, "little"))
+    assert calls == [(0x80, 2)]
+    # write-count threshold
+    for i in range(3):
+        _test_mmio_store(dev, 4 * i, b"\xff")
+    assert calls == [(0x80, 2), (0x8, 3)]
+    assert (dev.writes, dev.notifications) == (5, 2)
+    with pytest.raises(BufferError):
+        buf.extend(b"x")
+    with pytest.raises(BufferError):
+        buffer_device_t(b"read-only")
+
+
+def test_rom_device_t():
+    data = bytearray(b"\x13\x00\x00\x00" * 4)
+    rom = rom_device_t(data)
+    assert type(rom) is rom_device_t  # pylint: disable=unidiomatic-typecheck
+    assert rom.size() == 16
+    assert _test_mmio_load(rom, 4, 4) == b"\x13\x00\x00\x00"
+    # the buffer is referenced, not copied
+    data[4] = 0x73
+    assert _test_mmio_load(rom, 4, 1) == b"\x73"
+    with pytest.raises(RuntimeError):
+        _test_mmio_store(rom, 0, b"\x00")
+    with pytest.raises(RuntimeError):
+        _test_mmio_load(rom, 16, 1)
+
+
+def test_rom_device_t_mapped(tmp_path):
+    path = tmp_path / "boot.rom"
+    path.write_bytes(b"\x6f\x00\x00\x00")
+    rom0, rom1 = rom_device_t(path), rom_device_t(str(path))
+    # one image, shared by both devices
+    assert rom0.image is rom1.image
+    assert len(rom0.image) == 4
+    image = rom_image_t(path)
+    assert bytes(image) == b"\x6f\x00\x00\x00"
+    assert _test_mmio_load(rom_device_t(image), 0, 4) == b"\x6f\x00\x00\x00"
+    # small files are copied, truncating them does not fault
+    assert not image.mapped
+    path.write_bytes(b"")
+    assert _test_mmio_load(rom0, 0, 4) == b"\x6f\x00\x00\x00"
+    assert len(rom_image_t(path)) == 0
+    # larger ones are mapped
+    path.write_bytes(bytes(range(256)) * 1024)
+    image = rom_image_t(path)
+    assert image.mapped and len(image) == 256 * 1024
+    assert rom_image_t(path) is image
+
+
+def test_interrupt_line_t(mock_sim):
+    line = interrupt_line_t(mock_sim, 1)
+    assert (line.irq, line.level) == (1, False)
+    # redundant updates are dropped
+    line.level = True
+    line.level = True
+    assert (line.assertions, line.updates, line.redundant) == (1, 1, 1)
+    line.tick()
+    line.tick()
+    line.set_level(False)
+    assert line.histogram[2] == 1
+    # pulses deassert on their own, and coalesce while asserted
+    line.pulse(3)
+    line.pulse(1)
+    assert line.coalesced == 1
+    line.tick()
+    line.tick()
+    assert line.level
+    line.tick()
+    assert not line.level
+    # pulses expiring unclaimed are not serviced
+    assert (line.assertions, sum(line.histogram)) == (2, 1)
+    line.reset_stats()
+    assert (line.assertions, line.updates, sum(line.histogram)) == (0, 0, 0)
+    # the latency runs until the guest claims the interrupt, in rtc ticks
+    plic = mock_sim.plic
+    _test_mmio_store(plic, 0x4, (1).to_bytes(4, "little"))  # priority of irq 1
+    _test_mmio_store(plic, 0x2000, (0x2).to_bytes(4, "little"))  # enabled for context 0
+    line.level = True
+    line.tick(1)
+    line.tick(1)
+    assert _test_mmio_load(plic, 0x20_0004, 4) == (1).to_bytes(4, "little")
+    line.tick(4)
+    assert line.level
+    assert line.histogram[3] == 1
+    line.level = False
+    assert sum(line.histogram) == 1
+    # irq 0 is no line at all
+    none = interrupt_line_t(mock_sim, 0)
+    none.pulse(1)
+    assert (none.level, none.assertions) == (False, 0)
+
+
+def test_mmio_interrupt_line(mock_sim):
+    from riscv.dev import MMIO, register
+
+    @register("test_mmio_interrupt_line")
+    class PulseDevice(MMIO):
+
+        def __init__(self, sim, args=None):
+            super().__init__(sim, args)
+            self.irq = self.interrupt_line(2)
+
+        def tick(self, rtc_ticks: int) -> None:
+            self.irq.pulse(2)
+
+    try:
+        pulser = PulseDevice(mock_sim)
+        _test_mmio_tick(pulser, 1)
+        _test_mmio_tick(pulser, 1)
+        assert pulser.irq.level
+        assert (pulser.irq.assertions, pulser.irq.coalesced) == (1, 1)
+    finally:
+        del mmio_device_map["test_mmio_interrupt_line"]
+
+
+def test_mmio_interrupt_line_untick(mock_sim):
+    from riscv.dev import MMIO, register
+
+    @register("test_mmio_interrupt_line_untick", tick=None)
+    class IdlePulser(MMIO):
+
+        def __init__(self, sim, args=None):
+            super().__init__(sim, args)
+            self.irq = self.interrupt_line(2)
+
+        # pylint: disable=unused-argument
+        def store(self, addr: int, data: bytes) -> None:
+            self.irq.pulse(2)
+
+    try:
+        pulser = IdlePulser(mock_sim)
+        pulser.store(0, b"\x01")
+        assert pulser.irq.level
+        # the line ticks natively, though python `tick` never runs
+        _test_mmio_tick(pulser, 1)
+        assert pulser.irq.level
+        _test_mmio_tick(pulser, 1)
+        assert not pulser.irq.level
+        # nor do divisors stretch pulses
+        pulser.tick_divisor = 4
+        pulser.store(0, b"\x01")
+        _test_mmio_tick(pulser, 1)
+        _test_mmio_tick(pulser, 1)
+        assert not pulser.irq.level
+    finally:
+        del mmio_device_map["test_mmio_interrupt_line_untick"]
+
+
+class TickCounter(abstract_device_t):
+
+    def __init__(self):
+        super().__init__()
+        self.ticks = []
+
+    def tick(self, rtc_ticks: int) -> None:
+        self.ticks.append(rtc_ticks)
+
+
+def test_tick_divisor():
+    dev = TickCounter()
+    assert dev.tick_divisor == 1
+    dev.tick_divisor = 3
+    for _ in range(7):
+        _test_mmio_tick(dev, 2)
+    # skipped ticks accumulate
+    assert dev.ticks == [6, 6]
+    dev.tick_divisor = 0
+    for _ in range(7):
+        _test_mmio_tick(dev, 2)
+    assert dev.ticks == [6, 6]
+    dev.tick_divisor = 1
+    _test_mmio_tick(dev, 2)
+    assert dev.ticks == [6, 6, 2]
+    # native devices tick on every tick
+    with pytest.raises(TypeError):
+        rom_device_t(b"\0" * 8).tick_divisor = 2
+
+
+def test_tick_divisor_factory(mock_sim):
+
+    class SlowFactory(MyFactory):
+        tick_divisor = 4
+
+    dev, _ = _test_mmio_parse_from_fdt(SlowFactory(), None, mock_sim)
+    assert dev.tick_divisor == 4
+
+
+def test_mmio_tick_divisor(mock_sim):
+    from riscv.dev import MMIO, register
+
+    @register("test_mmio_tick_divisor", tick=None)
+    class IdleDevice(MMIO):
+
+        def __init__(self, sim, args=None):
+            super().__init__(sim, args)
+            self.ticks = 0
+
+        def tick(self, rtc_ticks: int) -> None:
+            self.ticks += rtc_ticks
+
+    try:
+        dev = IdleDevice(mock_sim)
+        assert dev.tick_divisor == 0
+        _test_mmio_tick(dev, 1)
+        assert dev.ticks == 0
+        # e.g. while there is work to do
+        dev.tick_divisor = 1
+        _test_mmio_tick(dev, 1)
+        assert dev.ticks == 1
+    finally:
+        del mmio_device_map["test_mmio_tick_divisor"]
@@ -24,6 +24,7 @@ from riscv.csrs import csr_t
 from riscv.disasm import disasm_insn_t
 from riscv.extension import extension_t, register_extension, find_extension
 from riscv.processor import insn_desc_t, processor_t
+from riscv.test import _test_extension_get_instructions, _test_extension_get_disasms
 
 
 # pylint: disable=unused-argument
@@ -115,3 +116,68 @@ def test_register_extension(mock_sim, name, cls, n_insn, n_disasm):
         assert isinstance(disasm, disasm_insn_t)
     # reset
     ext.reset(p)
+
+
+class MyCounting(isa.ISA):
+
+    calls = 0
+
+    @property
+    def name(self) -> str:
+        return "my_counting"
+
+    def get_instructions(self, proc: processor_t) -> List[insn_desc_t]:
+        type(self).calls += 1
+        return []
+
+    def get_disasms(self, proc: processor_t) -> List[disasm_insn_t]:
+        type(self).calls += 1
+        return []
+
+
+class MyCountingPerHart(MyCounting):
+
+    hart_specific = True
+    calls = 0
+
+
+@pytest.mark.parametrize("cls,calls", [
+    pytest.param(MyCounting, 2, id="shared"),
+    pytest.param(MyCountingPerHart, 8, id="hart_specific"),
+])
+def test_extension_tables(mock_sim, cls, calls):
+    p: processor_t = mock_sim.get_core(0)
+    extension_t.clear_tables()
+    # one instance per hart, as spike makes them
+    for ext in (cls(), cls(), cls(), cls()):
+        assert _test_extension_get_instructions(ext, p) == 0
+        assert _test_extension_get_disasms(ext, p) == 0
+    assert cls.calls == calls
+
+
+class MySharedDisasm(isa.ISA):
+
+    @property
+    def name(self) -> str:
+        return "my_shared_disasm"
+
+    def get_instructions(self, proc: processor_t) -> List[insn_desc_t]:
+        return []
+
+    def get_disasms(self, proc: processor_t) -> List[disasm_insn_t]:
+        return [disasm_insn_t("my.nop", 0x0000000b, 0x0000007f)]
+
+
+def test_extension_clear_tables(mock_sim):
+    # pylint: disable=import-outside-toplevel
+    from riscv.sim import tracked_objects
+
+    p: processor_t = mock_sim.get_core(0)
+    extension_t.clear_tables()
+    before = tracked_objects()
+    # every hart gets (and deletes) its own copies of the shared entries
+    for ext in (MySharedDisasm(), MySharedDisasm()):
+        assert _test_extension_get_disasms(ext, p) == 1
+    assert tracked_objects() == before + 1
+    extension_t.clear_tables()
+    assert tracked_objects() == before
@@ -17,7 +17,8 @@
 import os
 import tempfile
 import pytest
-from riscv.test import _test_mmio_load, _test_mmio_store, _test_mmio_tick
+from riscv.devices import mmio_device_map
+from riscv.test import _test_mmio_load, _test_mmio_store, _test_mmio_tick, _test_mmio_parse_from_fdt
 
 
 @pytest.mark.parametrize("message", [
@@ -53,3 +54,78 @@ def test_amba_uart_lite(import_from_data_dir, mock_sim, message):
             _test_mmio_tick(uart, 1)
         finally:
             os.dup2(orig_stdin_fd, 0)
+
+
+def test_amba_uart_lite_native(mock_sim, tmp_path):
+    rx_path, tx_path = tmp_path / "rx", tmp_path / "tx"
+    rx_path.write_bytes(b"hello world!\n")
+    fact = mmio_device_map["amba_uartlite:native"]
+    uart, base = _test_mmio_parse_from_fdt(
+        fact, None, mock_sim, "20000000", f"in={rx_path}", f"out={tx_path}", "irq=0", "fifo=8")
+    assert base == 0x2000_0000
+    assert uart.rx_fifo.capacity == 8
+    # tick fills RX_FIFO with a single read of the host input
+    _test_mmio_tick(uart, 1)
+    assert bytes(memoryview(uart.rx_fifo)) == b"hello wo"
+    stat = int.from_bytes(_test_mmio_load(uart, 0x08, 4), "little")
+    assert stat & 0x03 == 0x03  # RX_FIFO_VALID_DATA | RX_FIFO_FULL
+    for ch in b"hello wo":
+        assert int.from_bytes(_test_mmio_load(uart, 0x00, 4), "little") == ch
+    _test_mmio_tick(uart, 1)
+    assert len(uart.rx_fifo) == 5
+    # stores to TX_FIFO are written out on tick
+    for ch in b"echo":
+        _test_mmio_store(uart, 0x04, ch.to_bytes(4, "little"))
+    assert bytes(memoryview(uart.tx_fifo)) == b"echo"
+    _test_mmio_tick(uart, 1)
+    assert len(uart.tx_fifo) == 0
+    assert tx_path.read_bytes() == b"echo"
+
+
+def test_amba_uart_lite_native_interrupt(mock_sim, tmp_path):
+    rx_path = tmp_path / "rx"
+    rx_path.write_bytes(b"hi")
+    fact = mmio_device_map["amba_uartlite:native"]
+    uart, _ = _test_mmio_parse_from_fdt(
+        fact, None, mock_sim, "20000000", f"in={rx_path}", "out=fd:-1", "irq=1")
+    # the RX FIFO holds data, but interrupts are disabled
+    _test_mmio_tick(uart, 1)
+    assert len(uart.rx_fifo) == 2
+    assert not uart.irq.level
+    stat = int.from_bytes(_test_mmio_load(uart, 0x08, 4), "little")
+    assert not stat & 0x10  # INTR_ENABLED
+    # CTRL_REG.ENABLE_INTR
+    _test_mmio_store(uart, 0x0c, (0x10).to_bytes(4, "little"))
+    assert uart.irq.level
+    _test_mmio_store(uart, 0x0c, (0x00).to_bytes(4, "little"))
+    assert not uart.irq.level
+    _test_mmio_tick(uart, 1)
+    assert not uart.irq.level
+
+
+@pytest.mark.timeout(3)
+def test_amba_uart_lite_native_stalled(mock_sim):
+    rfd, wfd = os.pipe()
+    try:
+        # a blocking pipe nobody reads from
+        os.set_blocking(wfd, False)
+        try:
+            while True:
+                os.write(wfd, bytes(4096))
+        except BlockingIOError:
+            pass
+        os.set_blocking(wfd, True)
+        fact = mmio_device_map["amba_uartlite:native"]
+        uart, _ = _test_mmio_parse_from_fdt(
+            fact, None, mock_sim, "20000000", "in=fd:-1", f"out=fd:{wfd}", "irq=0", "fifo=4")
+        # neither stores nor ticks wait for the reader, excess bytes are dropped
+        for ch in b"stalled":
+            _test_mmio_store(uart, 0x04, ch.to_bytes(4, "little"))
+        _test_mmio_tick(uart, 1)
+        assert bytes(memoryview(uart.tx_fifo)) == b"stal"
+        stat = int.from_bytes(_test_mmio_load(uart, 0x08, 4), "little")
+        assert stat & 0x08  # TX_FIFO_FULL
+        del uart
+    finally:
+        os.close(rfd)
+        os.close(wfd)
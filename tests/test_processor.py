@@ -81,3 +81,88 @@ def test_register_custom_insn(import_from_data_dir, mock_sim):
     f32i = d.func(32, False, False)
     assert f32i(p, i, 4) == 8
     assert p.state.XPR[i.rd] == 64
+
+
+def test_insn_func_wrappers(mock_sim):
+    # pylint: disable=import-outside-toplevel
+    from riscv.test import _test_insn_func
+
+    p: processor_t = mock_sim.get_core(0)
+    p.reset()
+
+    # keep every object a handler gets, so that each allocation has its own id
+    seen = {"proc": [], "state": [], "XPR": [], "log_reg_write": [], "log_mem_read": []}
+    # ... but the insn, which is updated in place (see `insn_t.copy`)
+    insn_ids = []
+
+    def do_addi(p: processor_t, i: insn_t, pc: int) -> int:
+        seen["proc"].append(p)
+        insn_ids.append(id(i))
+        seen["state"].append(p.state)
+        seen["XPR"].append(p.state.XPR)
+        seen["log_reg_write"].append(p.state.log_reg_write)
+        seen["log_mem_read"].append(p.state.log_mem_read)
+        p.state.XPR.write(i.rd, p.state.XPR[i.rs1] + i.i_imm)
+        return pc + len(i)
+
+    d = insn_desc_t(0x13, 0x707f, *(do_addi, ) * 8)
+    p.state.XPR.write(5, 0)
+    # addi x5, x5, 1
+    assert _test_insn_func(p, d, 0x00128293, 0x9000_0000, 100) == 0x9000_0000 + 400
+    assert p.state.XPR[5] == 100
+    for name, objs in seen.items():
+        assert len(objs) == 100
+        assert len(set(map(id, objs))) == 1, name
+    assert len(set(insn_ids)) == 1
+    # unpinned, the commit logs are proxied on each access
+    log = p.state.log_reg_write
+    assert log is not p.state.log_reg_write
+
+
+def test_insn_func_kept_insn(mock_sim):
+    # pylint: disable=import-outside-toplevel
+    from riscv.test import _test_insn_func
+
+    p: processor_t = mock_sim.get_core(0)
+    p.reset()
+    kept = []
+
+    def do_addi(p: processor_t, i: insn_t, pc: int) -> int:
+        kept.append((i, i.copy()))
+        return pc + len(i)
+
+    d = insn_desc_t(0x13, 0x707f, *(do_addi, ) * 8)
+    # addi x5, x5, 1 then addi x6, x6, 2
+    _test_insn_func(p, d, 0x00128293, 0x9000_0000, 1)
+    _test_insn_func(p, d, 0x00230313, 0x9000_0000, 1)
+    # the insn handed over is updated in place, its copies never are
+    assert kept[0][0] is kept[1][0]
+    assert kept[1][0] == 0x00230313
+    assert (kept[0][1], kept[1][1]) == (0x00128293, 0x00230313)
+
+
+def test_insn_func_allocations(mock_sim):
+    # pylint: disable=import-outside-toplevel
+    from riscv.test import _bench_allocations, _test_insn_func
+
+    p: processor_t = mock_sim.get_core(0)
+    p.reset()
+    calls = [0]
+
+    def do_addi(p: processor_t, i: insn_t, pc: int) -> int:
+        calls[0] += 1
+        p.state.XPR.write(i.rd, p.state.XPR[i.rs1] + i.i_imm)
+        assert p.state.log_reg_write is not None
+        assert p.state.log_mem_read is not None
+        return pc + len(i)
+
+    d = insn_desc_t(0x13, 0x707f, *(do_addi, ) * 8)
+    n = 1000
+    # the first calls may fill caches, e.g. of pybind11 type lookups
+    _test_insn_func(p, d, 0x00128293, 0x9000_0000, n)
+    before = _bench_allocations()
+    _test_insn_func(p, d, 0x00128293, 0x9000_0000, n)
+    after = _bench_allocations()
+    assert calls[0] == 2 * n
+    # in steady state, no call allocates on the C++ side
+    assert after - before == 0
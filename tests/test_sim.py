@@ -16,6 +16,7 @@
 import os
 import pathlib
 import signal
+import threading
 
 import pexpect
 import pexpect.fdpexpect
@@ -24,10 +25,13 @@ import pytest
 # pylint: disable=import-error,no-name-in-module
 from riscv.cfg import cfg_t, mem_cfg_t
 from riscv.debug_module import debug_module_config_t
-from riscv.sim import sim_t
+from riscv.devices import shared_mem_t
+from riscv.sim import sim_t, dtb_cache, image_cache, tracked_objects
 
 DATA_DIR = pathlib.Path(__file__).parent / "data"
 
+IDLE_SKIP = r"idle skip: (\d+) skips, (0x[0-9a-f]+) of (0x[0-9a-f]+) ticks skipped"
+
 
 @pytest.mark.timeout(3)
 @pytest.mark.parametrize("kwargs,req_resp,ret_code", [
@@ -52,10 +56,42 @@ DATA_DIR = pathlib.Path(__file__).parent / "data"
         (None, "warning: tohost and fromhost symbols not in ELF; can't communicate with target\r\n"),
         ("hello world!\r\n", "1:hello world!\r\n"),
         ("hello again!\r\n", "1:hello again!\r\n"),
-    ], 0, id="plic")
+    ], 0, id="plic"),
+    pytest.param({
+        "cfg": cfg_t(
+            isa="rv32imc_zicsr_zifencei_zba_zbb_zbs",
+            priv="m",
+            mem_layout=[
+                mem_cfg_t(0x9000_0000, 0x4_0000)
+            ],
+            start_pc=0x9000_0000,
+        ),
+        "halted": False,
+        "plugin_device_factories": [
+            ("amba_uartlite:plic", ("0x20000000", )),
+        ],
+        "args": [
+            DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()
+        ],
+        "dm_config": debug_module_config_t(),
+        "idle_skip": True,
+    }, [
+        (None, "warning: tohost and fromhost symbols not in ELF; can't communicate with target\r\n"),
+        (None, IDLE_SKIP),
+        ("hello world!\r\n", "1:hello world!\r\n"),
+    ], 0, id="plic-idle_skip"),
 ])
 def test_sim_run(kwargs, req_resp, ret_code):
     s = sim_t(**kwargs)
+    if s.scheduler.idle_skip:
+        # the guest waits for the UART with its external interrupt enabled,
+        # and skips to the event
+        def report():
+            sched = s.scheduler
+            print(f"idle skip: {sched.skips} skips, {sched.skipped:#x} of {sched.mtime:#x} ticks skipped",
+                  flush=True)
+
+        s.scheduler.schedule_at(0x10_0000, report)
     pid, fd = os.forkpty()
     if pid == 0:
         s.run()
@@ -65,6 +101,11 @@ def test_sim_run(kwargs, req_resp, ret_code):
         if inp is not None:
             proc.sendline(inp)
         assert proc.expect(out) == 0
+        if out == IDLE_SKIP:
+            skips, skipped, mtime = (int(g, 0) for g in proc.match.groups())
+            assert skips > 0
+            # most of the time passed without the host stepping the harts
+            assert skipped > mtime // 2
     # enter the interactive mode then quit
     os.kill(pid, signal.SIGINT)
     assert proc.expect("(spike)") == 0
@@ -73,3 +114,971 @@ def test_sim_run(kwargs, req_resp, ret_code):
     assert os.WIFEXITED(status)
     assert os.WEXITSTATUS(status) == ret_code
     proc.close()  # closes fd internally
+
+
+def test_sim_dtb_cache(tmp_path):
+    directory = dtb_cache.directory
+    dtb_cache.directory = tmp_path.as_posix()
+    try:
+        dtb_cache.clear()
+        kwargs = {
+            "cfg": cfg_t(
+                isa="rv32gc",
+                priv="m",
+                mem_layout=[
+                    mem_cfg_t(0x9000_0000, 0x4_0000)
+                ],
+                start_pc=0x9000_0000
+            ),
+            "halted": True,
+            "plugin_device_factories": [],
+            "args": ["pk"],
+            "dtb_cache": True,
+        }
+        # miss: generate, compile and store the dtb
+        s1 = sim_t(**kwargs)
+        assert "riscv,isa" in s1.get_dts()
+        assert dtb_cache.misses == 1
+        assert dtb_cache.hits == 0
+        assert len(dtb_cache) == 1
+        assert len(list(tmp_path.glob("*.dtb"))) == 1
+        # hit: reuse the compiled dtb
+        s2 = sim_t(**kwargs)
+        assert s2.nprocs == s1.nprocs
+        assert dtb_cache.misses == 1
+        assert dtb_cache.hits == 1
+        # clear
+        dtb_cache.clear()
+        assert len(dtb_cache) == 0
+        assert not list(tmp_path.glob("*.dtb"))
+    finally:
+        dtb_cache.directory = directory
+
+
+def test_sim_mem_backing(tmp_path):
+    ram = tmp_path / "ram.bin"
+    ram.write_bytes(b"\x13\x00\x00\x00")
+    s = sim_t(
+        cfg=cfg_t(
+            isa="rv32gc",
+            priv="m",
+            mem_layout=[
+                mem_cfg_t(0x9000_0000, 0x4_0000, backing="file", path=ram.as_posix(), shared=True),
+                mem_cfg_t(0xa000_0000, 0x40_0000, backing="hugepage"),
+            ],
+            start_pc=0x9000_0000
+        ),
+        halted=True,
+        plugin_device_factories=[],
+        args=["pk"],
+    )
+    assert s.nprocs == 1
+    # shared file backings are grown to the region size, keeping the contents
+    assert ram.stat().st_size == 0x4_0000
+    assert ram.read_bytes()[:4] == b"\x13\x00\x00\x00"
+
+
+def test_sim_shared_mem():
+    dram = shared_mem_t(0x10_0000)
+    assert dram.sync
+    sims = [
+        sim_t(
+            cfg=cfg_t(
+                isa="rv64gc",
+                priv="msu",
+                mem_layout=[
+                    mem_cfg_t(0x8000_0000, 0x4_0000),
+                    mem_cfg_t(base, 0x10_0000, region=dram),
+                ],
+                start_pc=0x8000_0000
+            ),
+            halted=True,
+            plugin_device_factories=[],
+            args=["pk"],
+        )
+        for base in (0x1_0000_0000, 0x2_0000_0000)
+    ]
+    assert "memory@100000000" in sims[0].get_dts()
+    assert "memory@200000000" in sims[1].get_dts()
+    dram.write(0x100, b"\xde\xad\xbe\xef")
+    assert dram.read(0x100, 4) == b"\xde\xad\xbe\xef"
+    with pytest.raises(IndexError):
+        dram.read(0x10_0000, 1)
+    with pytest.raises(RuntimeError):
+        mem_cfg_t(0x1_0000_0000, 0x20_0000, region=dram)
+
+
+@pytest.mark.timeout(3)
+def test_sim_shared_mem_run():
+    # pylint: disable=import-outside-toplevel
+    from riscv.dev import MMIO, register
+    from riscv.devices import mmio_device_map
+
+    dram = shared_mem_t(0x1_0000)
+    # the guest copies loads from the device into shared memory, forever
+    dram.write(0, b"".join(insn.to_bytes(4, "little") for insn in [
+        0x300002b7,  # lui  t0, 0x30000
+        0xa0000337,  # lui  t1, 0xa0000
+        0x0002a383,  # lw   t2, 0(t0)
+        0x10732023,  # sw   t2, 0x100(t1)
+        0xff9ff06f,  # j    -8
+    ]))
+
+    @register("test_sim_shared_mem_run", size=0x1000)
+    class Counter(MMIO):
+
+        def __init__(self, sim, args=None):
+            super().__init__(sim, args)
+            self.count = 0
+            self.seen = False
+
+        # pylint: disable=unused-argument
+        def load(self, addr: int, size: int) -> bytes:
+            self.count += 1
+            return self.count.to_bytes(size, "little")
+
+        # python callbacks are entered while the sim runs without the GIL
+        def tick(self, rtc_ticks: int) -> None:
+            if not self.seen and int.from_bytes(dram.read(0x100, 4), "little") > 0:
+                self.seen = True
+                print("shared memory written", flush=True)
+
+    try:
+        s = sim_t(
+            cfg=cfg_t(
+                isa="rv32imc_zicsr_zifencei",
+                priv="m",
+                mem_layout=[
+                    mem_cfg_t(0x9000_0000, 0x4_0000),
+                    mem_cfg_t(0xa000_0000, 0x1_0000, region=dram),
+                ],
+                start_pc=0xa000_0000,
+            ),
+            halted=False,
+            plugin_device_factories=[("test_sim_shared_mem_run", ("0x30000000", ))],
+            args=[DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()],
+        )
+        pid, fd = os.forkpty()
+        if pid == 0:
+            s.run()
+    finally:
+        del mmio_device_map["test_sim_shared_mem_run"]
+    proc = pexpect.fdpexpect.fdspawn(fd)
+    assert proc.expect("shared memory written") == 0
+    os.kill(pid, signal.SIGINT)
+    assert proc.expect("(spike)") == 0
+    proc.sendline("q")
+    _, status = os.waitpid(pid, 0)
+    assert os.WIFEXITED(status)
+    proc.close()  # closes fd internally
+
+
+@pytest.mark.timeout(6)
+def test_sim_shared_mem_reservation():
+    dram = shared_mem_t(0x1_0000)
+    # sim a reserves a word, waits for longer than a quantum, then records
+    # whether its store conditional succeeded (0) and that it is done
+    dram.write(0, b"".join(insn.to_bytes(4, "little") for insn in [
+        0xa0000337,  # lui  t1, 0xa0000
+        0x10030e13,  # addi t3, t1, 0x100
+        0x100e23af,  # lr.w t2, (t3)
+        0x00005eb7,  # lui  t4, 0x5
+        0xfffe8e93,  # addi t4, t4, -1
+        0xfe0e9ee3,  # bnez t4, -4
+        0x187e2f2f,  # sc.w t5, t2, (t3)
+        0x11e32223,  # sw   t5, 0x104(t1)
+        0x00100f93,  # li   t6, 1
+        0x11f32423,  # sw   t6, 0x108(t1)
+        0x0000006f,  # j    0
+    ]))
+    # sim b stores to the reserved word, forever
+    dram.write(0x80, b"".join(insn.to_bytes(4, "little") for insn in [
+        0xa0000337,  # lui  t1, 0xa0000
+        0x00128293,  # addi t0, t0, 1
+        0x10532023,  # sw   t0, 0x100(t1)
+        0xff9ff06f,  # j    -8
+    ]))
+    sims = [
+        sim_t(
+            cfg=cfg_t(
+                isa="rv32imac_zicsr_zifencei",
+                priv="m",
+                mem_layout=[
+                    mem_cfg_t(0x9000_0000, 0x4_0000),
+                    mem_cfg_t(0xa000_0000, 0x1_0000, region=dram),
+                ],
+                start_pc=start_pc,
+            ),
+            halted=False,
+            plugin_device_factories=[],
+            args=[DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()],
+            instruction_limit=200_000,
+        )
+        for start_pc in (0xa000_0000, 0xa000_0080)
+    ]
+    # both run concurrently, in turns
+    threads = [threading.Thread(target=s.run) for s in sims]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    assert int.from_bytes(dram.read(0x108, 4), "little") == 1
+    assert int.from_bytes(dram.read(0x100, 4), "little") > 0
+    # sim b stored to the word while sim a waited, the reservation is broken
+    assert int.from_bytes(dram.read(0x104, 4), "little") != 0
+
+
+@pytest.mark.timeout(6)
+def test_sim_image_cache(tmp_path):
+    # pylint: disable=import-outside-toplevel
+    from riscv.dev import MMIO, register
+    from riscv.devices import mmio_device_map
+
+    @register("test_sim_image_cache", size=0x1000)
+    class Reporter(MMIO):
+
+        def __init__(self, sim, args=None):
+            super().__init__(sim, args)
+            self.reported = False
+
+        # pylint: disable=unused-argument
+        def tick(self, rtc_ticks: int) -> None:
+            if not self.reported:
+                self.reported = True
+                print(f"image_cache: hits={image_cache.hits} misses={image_cache.misses}", flush=True)
+
+    directory = image_cache.directory
+    image_cache.directory = tmp_path.as_posix()
+    try:
+        image_cache.clear()
+        kwargs = {
+            "cfg": cfg_t(
+                isa="rv32imc_zicsr_zifencei_zba_zbb_zbs",
+                priv="m",
+                mem_layout=[
+                    mem_cfg_t(0x9000_0000, 0x4_0000)
+                ],
+                start_pc=0x9000_0000,
+            ),
+            "halted": False,
+            "plugin_device_factories": [
+                ("amba_uartlite:plic", ("0x20000000", )),
+                ("test_sim_image_cache", ("0x30000000", )),
+            ],
+            "args": [
+                DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()
+            ],
+            "image_cache": True,
+        }
+        # 1st run lays out the image, 2nd run maps it from the cache on disk.
+        # images are loaded by the forked children, which report the counters
+        # on the first tick of a device.
+        for hits, misses in [(0, 1), (1, 0)]:
+            s = sim_t(**kwargs)
+            pid, fd = os.forkpty()
+            if pid == 0:
+                s.run()
+            proc = pexpect.fdpexpect.fdspawn(fd)
+            assert proc.expect(f"image_cache: hits={hits} misses={misses}") == 0
+            proc.sendline("hello world!\r\n")
+            assert proc.expect("1:hello world!\r\n") == 0
+            os.kill(pid, signal.SIGINT)
+            assert proc.expect("(spike)") == 0
+            proc.sendline("q")
+            _, status = os.waitpid(pid, 0)
+            assert os.WIFEXITED(status)
+            proc.close()
+            assert len(list(tmp_path.glob("*.img"))) == 1
+            assert len(list(tmp_path.glob("*.idx"))) == 1
+        # clear
+        image_cache.clear()
+        assert len(image_cache) == 0
+        assert not list(tmp_path.glob("*.img"))
+    finally:
+        image_cache.directory = directory
+        del mmio_device_map["test_sim_image_cache"]
+
+
+def test_sim_shared_rom(tmp_path):
+    # pylint: disable=import-outside-toplevel
+    from riscv.devices import device_factory_t, dma_port_t, mmio_device_map, rom_device_t
+
+    path = tmp_path / "boot.rom"
+    path.write_bytes(bytes(range(256)) * 1024)
+    roms = []
+
+    class RomFactory(device_factory_t):
+
+        # pylint: disable=unused-argument
+        def parse_from_fdt(self, fdt, sim, *sargs):
+            roms.append(rom_device_t(path))
+            return roms[-1], int(sargs[0], 16)
+
+        # pylint: disable=unused-argument
+        def generate_dts(self, sim, *sargs):
+            return ""
+
+    mmio_device_map["test_sim_shared_rom"] = RomFactory()
+    try:
+        sims = [
+            sim_t(
+                cfg=cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+                halted=True,
+                plugin_device_factories=[("test_sim_shared_rom", ("0x20000000", ))],
+                args=["pk"],
+            )
+            for _ in range(2)
+        ]
+    finally:
+        del mmio_device_map["test_sim_shared_rom"]
+    # both sims read the one mapping of the file
+    assert len(roms) == 2
+    assert roms[0].image is roms[1].image
+    assert roms[0].image.mapped
+    for s in sims:
+        assert bytes(dma_port_t(s).read(0x2000_0100, 4)) == bytes(range(4))
+
+
+def test_sim_buffer_device():
+    # pylint: disable=import-outside-toplevel
+    from riscv.devices import buffer_factory_t, dma_port_t, mmio_device_map
+
+    buf = bytearray(0x100)
+    calls = []
+    mmio_device_map["test_sim_buffer_device"] = buffer_factory_t(
+        buf, doorbell=0x80, callback=lambda *args: calls.append(args))
+    try:
+        s = sim_t(
+            cfg=cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+            halted=True,
+            plugin_device_factories=[("test_sim_buffer_device", ("0x10000000", ))],
+            args=["pk"],
+        )
+    finally:
+        del mmio_device_map["test_sim_buffer_device"]
+    assert "buffer@10000000 {" in s.get_dts()
+    assert "reg = <0x0 0x10000000 0x0 0x100>;" in s.get_dts()
+    # bus accesses of the sim land in the buffer, and the other way round
+    dma = dma_port_t(s)
+    dma.write(0x1000_0010, b"abcd")
+    assert buf[0x10:0x14] == b"abcd"
+    buf[0x20:0x24] = b"wxyz"
+    assert bytes(dma.read(0x1000_0020, 4)) == b"wxyz"
+    dma.write(0x1000_0080, (1).to_bytes(4, "little"))
+    assert calls == [(0x80, 2)]
+
+
+def test_sim_scheduler():
+    s = sim_t(
+        cfg=cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+        halted=True,
+        plugin_device_factories=[],
+        args=["pk"],
+        idle_skip=True,
+    )
+    sched = s.scheduler
+    assert sched.idle_skip
+    assert sched.mtime == 0
+    fired = []
+    sched.schedule(0, lambda: fired.append("now"))
+    sched.schedule_at(100, lambda: fired.append("later"))
+    cancelled = sched.schedule(50, lambda: fired.append("never"))
+    assert sched.pending == 3
+    assert sched.cancel(cancelled)
+    assert not sched.cancel(cancelled)
+    sched.tick(1)
+    assert fired == ["now"]
+    assert sched.pending == 1
+    # a halted hart is not idle, so nothing is skipped
+    assert (sched.mtime, sched.skips, sched.skipped) == (0, 0, 0)
+    sched.idle_skip = False
+    assert not sched.idle_skip
+
+
+def test_sim_scheduler_wfi():
+    # pylint: disable=import-outside-toplevel
+    from riscv.dev import MMIO, register
+    from riscv.devices import mmio_device_map
+
+    dram = shared_mem_t(0x1_0000)
+    # the guest arms the timer 0x100000 ticks ahead, waits for it, then reports
+    # the time it woke up at to the device
+    dram.write(0, b"".join(insn.to_bytes(4, "little") for insn in [
+        0x0200c2b7,  # lui  t0, 0x200c
+        0xff82a303,  # lw   t1, -8(t0)      (mtime)
+        0x001003b7,  # lui  t2, 0x100
+        0x00730333,  # add  t1, t1, t2
+        0x02004e37,  # lui  t3, 0x2004
+        0x006e2023,  # sw   t1, 0(t3)       (mtimecmp)
+        0x08000e93,  # li   t4, 0x80
+        0x304ea073,  # csrs mie, t4         (MTIE)
+        0x10500073,  # wfi
+        0xff82af03,  # lw   t5, -8(t0)      (mtime)
+        0x30000fb7,  # lui  t6, 0x30000
+        0x01efa023,  # sw   t5, 0(t6)
+        0x0000006f,  # j    .
+    ]))
+
+    @register("test_sim_scheduler_wfi", size=0x1000)
+    class Waker(MMIO):
+
+        # pylint: disable=unused-argument
+        def store(self, addr: int, data: bytes) -> None:
+            mtime = int.from_bytes(data, "little")
+            print(f"woke at {mtime:#x}, skips {self.sim.scheduler.skips}", flush=True)
+
+    try:
+        s = sim_t(
+            cfg=cfg_t(
+                isa="rv32imc_zicsr_zifencei",
+                priv="m",
+                mem_layout=[
+                    mem_cfg_t(0x9000_0000, 0x4_0000),
+                    mem_cfg_t(0xa000_0000, 0x1_0000, region=dram),
+                ],
+                start_pc=0xa000_0000,
+            ),
+            halted=False,
+            plugin_device_factories=[("test_sim_scheduler_wfi", ("0x30000000", ))],
+            args=[DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()],
+            idle_skip=True,
+        )
+        pid, fd = os.forkpty()
+        if pid == 0:
+            s.run()
+    finally:
+        del mmio_device_map["test_sim_scheduler_wfi"]
+    proc = pexpect.fdpexpect.fdspawn(fd)
+    assert proc.expect(r"woke at (0x[0-9a-f]+), skips (\d+)") == 0
+    mtime, skips = (int(g, 0) for g in proc.match.groups())
+    # skipped straight to the timer, then woke up within a quantum
+    assert skips > 0
+    assert 0x10_0000 <= mtime < 0x10_1000
+    os.kill(pid, signal.SIGINT)
+    assert proc.expect("(spike)") == 0
+    proc.sendline("q")
+    _, status = os.waitpid(pid, 0)
+    assert os.WIFEXITED(status)
+    proc.close()  # closes fd internally
+
+
+def test_sim_trace(tmp_path):
+    # pylint: disable=import-outside-toplevel
+    from riscv.dev import MMIO, register
+    from riscv.devices import mmio_device_map
+    from riscv.test import _test_mmio_load, _test_mmio_tick
+
+    @register("test_sim_trace", size=0x1000)
+    class Counter(MMIO):
+
+        def __init__(self, sim, args=None):
+            super().__init__(sim, args)
+            self.count = 0
+            self.irq = self.interrupt_line(1)
+
+        # pylint: disable=unused-argument
+        def load(self, addr: int, size: int) -> bytes:
+            self.count += 1
+            return self.count.to_bytes(size, "little")
+
+        def tick(self, rtc_ticks: int) -> None:
+            self.irq.set_level(self.count % 2 == 1)
+
+    kwargs = {
+        "cfg": cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+        "halted": True,
+        "plugin_device_factories": [("test_sim_trace", ("0x10000000", ))],
+        "args": ["pk"],
+    }
+    path = (tmp_path / "trace.bin").as_posix()
+    try:
+        s = sim_t(**kwargs, record=path)
+        assert s.trace.recording
+        dev = s.trace.devices[0]
+        loads = [_test_mmio_load(dev, 0, 4) for _ in range(3)]
+        _test_mmio_tick(dev, 1)
+        # the device, three loads and one irq level
+        assert s.trace.records == 5
+        del dev, s
+    finally:
+        del mmio_device_map["test_sim_trace"]
+    # the device is neither registered nor instantiated
+    s = sim_t(**kwargs, replay=path)
+    assert not s.trace.recording
+    dev = s.trace.devices[0]
+    assert [_test_mmio_load(dev, 0, 4) for _ in range(3)] == loads
+    _test_mmio_tick(dev, 1)
+    assert s.trace.records == 5
+    assert s.trace.divergence is None
+    # past the end of the log, loads fail rather than throw through spike
+    with pytest.raises(RuntimeError, match="load failed"):
+        _test_mmio_load(dev, 0, 4)
+    assert "diverged" in s.trace.divergence
+    # the trace outlives the sim, but not its devices
+    trace = s.trace
+    del dev, s
+    assert not trace.devices
+    with pytest.raises(ValueError):
+        sim_t(**kwargs, record=path, replay=path)
+
+
+def test_sim_trace_run(tmp_path):
+    # pylint: disable=import-outside-toplevel
+    from riscv.dev import MMIO, register
+    from riscv.devices import dma_port_t, mmio_device_map
+
+    @register("test_sim_trace_run", size=0x1000)
+    class Counter(MMIO):
+
+        def __init__(self, sim, args=None):
+            super().__init__(sim, args)
+            self.count = 0
+
+        # pylint: disable=unused-argument
+        def load(self, addr: int, size: int) -> bytes:
+            self.count += 1
+            return self.count.to_bytes(size, "little")
+
+    def run(**kwargs) -> int:
+        s = sim_t(
+            cfg=cfg_t(
+                isa="rv32imc_zicsr_zifencei",
+                priv="m",
+                mem_layout=[
+                    mem_cfg_t(0x9000_0000, 0x4_0000),
+                    mem_cfg_t(0xa000_0000, 0x1_0000),
+                ],
+                start_pc=0xa000_0000,
+            ),
+            halted=False,
+            plugin_device_factories=[("test_sim_trace_run", ("0x30000000", ))],
+            args=[DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()],
+            **kwargs,
+        )
+        dma = dma_port_t(s)
+        # the guest copies loads from the device into memory, forever
+        dma.write(0xa000_0000, b"".join(insn.to_bytes(4, "little") for insn in [
+            0x300002b7,  # lui  t0, 0x30000
+            0xa0000337,  # lui  t1, 0xa0000
+            0x0002a383,  # lw   t2, 0(t0)
+            0x10732023,  # sw   t2, 0x100(t1)
+            0xff9ff06f,  # j    -8
+        ]))
+
+        def report():
+            value = int.from_bytes(dma.read(0xa000_0100, 4), "little")
+            print(f"guest saw {value}", flush=True)
+            s.trace.flush()
+
+        s.scheduler.schedule_at(0x100, report)
+        pid, fd = os.forkpty()
+        if pid == 0:
+            s.run()
+        proc = pexpect.fdpexpect.fdspawn(fd)
+        assert proc.expect(r"guest saw (\d+)") == 0
+        value = int(proc.match.group(1))
+        os.kill(pid, signal.SIGINT)
+        assert proc.expect("(spike)") == 0
+        proc.sendline("q")
+        _, status = os.waitpid(pid, 0)
+        assert os.WIFEXITED(status)
+        proc.close()  # closes fd internally
+        return value
+
+    path = (tmp_path / "trace.bin").as_posix()
+    try:
+        recorded = run(record=path)
+    finally:
+        del mmio_device_map["test_sim_trace_run"]
+    assert recorded > 0
+    # the device is gone, and the guest sees the same loads at the same time
+    assert run(replay=path) == recorded
+
+
+def test_sim_trace_console(tmp_path):
+    # pylint: disable=import-outside-toplevel
+    from riscv.dev import MMIO, register
+    from riscv.devices import dma_port_t, mmio_device_map
+    from riscv.fesvr.term import buffered_terminal_t
+
+    rfd, wfd = os.pipe()
+    os.write(wfd, b"hello\n")
+    term = buffered_terminal_t(in_fd=rfd, out_fd=None)
+    read = []
+
+    @register("test_sim_trace_console", size=0x1000)
+    class Console(MMIO):
+
+        # console input is recorded while a plugin device is ticked
+        def tick(self, rtc_ticks: int) -> None:
+            read.append(term.read())
+
+    def run(reader, **kwargs) -> bytes:
+        s = sim_t(
+            cfg=cfg_t(
+                isa="rv32imc_zicsr_zifencei",
+                priv="m",
+                mem_layout=[
+                    mem_cfg_t(0x9000_0000, 0x4_0000),
+                    mem_cfg_t(0xa000_0000, 0x1_0000),
+                ],
+                start_pc=0xa000_0000,
+            ),
+            halted=False,
+            plugin_device_factories=[("test_sim_trace_console", ("0x30000000", ))],
+            args=[DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()],
+            **kwargs,
+        )
+        dma_port_t(s).write(0xa000_0000, (0x0000006f).to_bytes(4, "little"))  # j 0
+
+        def poll():
+            data = reader()
+            if data:
+                s.trace.flush()
+                print(f"console read {data.hex()}", flush=True)
+            else:
+                s.scheduler.schedule(0x10, poll)
+
+        s.scheduler.schedule(0x10, poll)
+        pid, fd = os.forkpty()
+        if pid == 0:
+            s.run()
+        proc = pexpect.fdpexpect.fdspawn(fd)
+        assert proc.expect(r"console read ([0-9a-f]+)") == 0
+        data = bytes.fromhex(proc.match.group(1).decode())
+        os.kill(pid, signal.SIGINT)
+        assert proc.expect("(spike)") == 0
+        proc.sendline("q")
+        _, status = os.waitpid(pid, 0)
+        assert os.WIFEXITED(status)
+        proc.close()  # closes fd internally
+        return data
+
+    path = (tmp_path / "trace.bin").as_posix()
+    try:
+        assert run(lambda: b"".join(read), record=path) == b"hello\n"
+    finally:
+        del mmio_device_map["test_sim_trace_console"]
+        os.close(rfd)
+        os.close(wfd)
+    # the device is gone, any reader of the replaying sim gets the input
+    replayed = buffered_terminal_t(in_fd=-1, out_fd=None)
+    assert run(replayed.read, replay=path) == b"hello\n"
+
+
+def test_sim_tracked_objects():
+    # pylint: disable=import-outside-toplevel
+    import gc
+
+    from riscv.dev import MMIO, register
+    from riscv.devices import mmio_device_map
+
+    @register("test_sim_tracked_objects", size=0x1000)
+    class Dummy(MMIO):
+
+        # pylint: disable=unused-argument
+        def load(self, addr: int, size: int) -> bytes:
+            return bytes(size)
+
+    kwargs = {
+        "cfg": cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+        "halted": True,
+        "plugin_device_factories": [("test_sim_tracked_objects", ("0x10000000", ))],
+        "args": ["pk"],
+    }
+    try:
+        # the factory is tracked globally, on registration
+        baseline = tracked_objects()
+        for _ in range(8):
+            s = sim_t(**kwargs)
+            # the device is tracked for the sim
+            assert s.tracked_objects >= 1
+            assert tracked_objects() == baseline + s.tracked_objects
+            proc = s.get_core(0)
+            for _ in range(16):
+                assert len(proc.state.log_reg_write) == 0
+            del proc, s
+            gc.collect()
+            assert tracked_objects() == baseline
+    finally:
+        del mmio_device_map["test_sim_tracked_objects"]
+
+
+def test_sim_teardown():
+    # pylint: disable=import-outside-toplevel
+    import gc
+    import weakref
+    from typing import List
+
+    from riscv import isa
+    from riscv.dev import MMIO, register
+    from riscv.devices import mmio_device_map
+    from riscv.disasm import disasm_insn_t
+    from riscv.processor import insn_desc_t, processor_t
+
+    alive = []
+
+    @register("test_sim_teardown", size=0x1000)
+    class Counter(MMIO):
+
+        def __init__(self, sim, args=None):
+            super().__init__(sim, args)
+            alive.append(weakref.ref(self))
+            self.count = 0
+
+        # pylint: disable=unused-argument
+        def load(self, addr: int, size: int) -> bytes:
+            self.count += 1
+            return self.count.to_bytes(size, "little")
+
+    # pylint: disable=unused-variable,unused-argument
+    @isa.register("teardown")
+    class TeardownISA(isa.ISA):
+
+        def get_instructions(self, proc: processor_t) -> List[insn_desc_t]:
+            return []
+
+        def get_disasms(self, proc: processor_t) -> List[disasm_insn_t]:
+            return [disasm_insn_t("teardown.nop", 0x0000000b, 0x0000007f)]
+
+    try:
+        s = sim_t(
+            cfg=cfg_t(
+                isa="rv32imc_zicsr_zifencei_xteardown",
+                priv="m",
+                mem_layout=[
+                    mem_cfg_t(0x9000_0000, 0x4_0000),
+                ],
+                start_pc=0x9000_0000,
+            ),
+            halted=False,
+            plugin_device_factories=[("test_sim_teardown", ("0x30000000", ))],
+            args=[DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()],
+            instruction_limit=100_000,
+        )
+    finally:
+        del mmio_device_map["test_sim_teardown"]
+    pid, fd = os.forkpty()
+    if pid == 0:
+        # pylint: disable=protected-access
+        s.run()
+        # spike deletes the device and the disasm entries, python must not
+        del s
+        gc.collect()
+        print(f"torn down, device alive: {alive[0]() is not None}", flush=True)
+        os._exit(0)
+    proc = pexpect.fdpexpect.fdspawn(fd)
+    assert proc.expect("torn down, device alive: False") == 0
+    _, status = os.waitpid(pid, 0)
+    assert os.WIFEXITED(status)
+    assert os.WEXITSTATUS(status) == 0
+    proc.close()  # closes fd internally
+
+
+def test_sim_metrics(tmp_path):
+    # pylint: disable=import-outside-toplevel
+    import socket
+
+    from riscv.dev import MMIO, register
+    from riscv.devices import mmio_device_map
+    from riscv.test import _test_mmio_load, _test_mmio_store
+
+    @register("test_sim_metrics", size=0x1000)
+    class Dummy(MMIO):
+
+        # pylint: disable=unused-argument
+        def load(self, addr: int, size: int) -> bytes:
+            return bytes(size)
+
+        # pylint: disable=unused-argument
+        def store(self, addr: int, data: bytes) -> None:
+            pass
+
+    kwargs = {
+        "cfg": cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+        "halted": True,
+        "plugin_device_factories": [("test_sim_metrics", ("0x10000000", ))],
+        "args": ["pk"],
+    }
+    try:
+        assert sim_t(**kwargs).metrics is None
+        s = sim_t(**kwargs, metrics=True)
+    finally:
+        del mmio_device_map["test_sim_metrics"]
+    metrics = s.metrics
+    dev = metrics.devices[0]
+    for _ in range(3):
+        _test_mmio_load(dev, 0, 4)
+    _test_mmio_store(dev, 0, b"\0" * 4)
+    # nothing is visible before a publication
+    device = 'device="test_sim_metrics",base="0x10000000"'
+    assert metrics.snapshot()[f"pyspike_mmio_loads_total{{{device}}}"] == 0
+    metrics.publish()
+    assert metrics.publications == 1
+    snapshot = metrics.snapshot()
+    assert snapshot[f"pyspike_mmio_loads_total{{{device}}}"] == 3
+    assert snapshot[f"pyspike_mmio_stores_total{{{device}}}"] == 1
+    assert snapshot['pyspike_instret_total{hart="0"}'] == 0
+    assert snapshot['pyspike_memory_pages{base="0x80000000"}'] == 0x100
+    # zero trap counts are left out of the exposition
+    text = metrics.prometheus()
+    assert "# TYPE pyspike_mmio_loads_total counter\n" in text
+    assert f"pyspike_mmio_loads_total{{{device}}} 3\n" in text
+    assert "pyspike_traps_total{" not in text
+    path = tmp_path / "pyspike.prom"
+    metrics.write(path.as_posix())
+    assert path.read_text() == text
+    # served over HTTP on a unix socket
+    sock_path = (tmp_path / "metrics.sock").as_posix()
+    metrics.serve(sock_path)
+    assert metrics.socket == sock_path
+    try:
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as conn:
+            conn.connect(sock_path)
+            conn.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+            response = b""
+            while chunk := conn.recv(4096):
+                response += chunk
+        head, body = response.decode().split("\r\n\r\n", 1)
+        assert head.startswith("HTTP/1.0 200 OK")
+        assert body == text
+    finally:
+        metrics.close()
+    assert metrics.socket is None
+    assert not os.path.exists(sock_path)
+    # on reads only, by default
+    assert metrics.interval == 0
+    # readers on other threads never see a partial publication
+    loads = f"pyspike_mmio_loads_total{{{device}}}"
+    stores = f"pyspike_mmio_stores_total{{{device}}}"
+    stop = threading.Event()
+    torn = []
+
+    def reader():
+        while not stop.is_set():
+            snapshot = metrics.snapshot()
+            if snapshot[loads] - snapshot[stores] != 2:
+                torn.append(snapshot)
+
+    thread = threading.Thread(target=reader)
+    thread.start()
+    try:
+        for _ in range(1000):
+            _test_mmio_load(dev, 0, 4)
+            _test_mmio_store(dev, 0, b"\0" * 4)
+            metrics.publish()
+    finally:
+        stop.set()
+        thread.join()
+    assert not torn
+    assert metrics.snapshot()[loads] == 1003
+
+
+def metrics_sim(**kwargs) -> sim_t:
+    # pylint: disable=import-outside-toplevel
+    from riscv.devices import dma_port_t
+
+    s = sim_t(
+        cfg=cfg_t(
+            isa="rv32imc_zicsr_zifencei",
+            priv="m",
+            mem_layout=[
+                mem_cfg_t(0x9000_0000, 0x4_0000),
+                mem_cfg_t(0xa000_0000, 0x1_0000),
+            ],
+            start_pc=0xa000_0000,
+        ),
+        halted=False,
+        plugin_device_factories=[],
+        args=[DATA_DIR.joinpath("plic-uart_echo.elf").as_posix()],
+        metrics=True,
+        **kwargs,
+    )
+    dma = dma_port_t(s)
+    # the guest takes an ecall, forever
+    dma.write(0xa000_0000, b"".join(insn.to_bytes(4, "little") for insn in [
+        0xa00002b7,  # lui   t0, 0xa0000
+        0x02028293,  # addi  t0, t0, 0x20
+        0x30529073,  # csrw  mtvec, t0
+        0x00000073,  # ecall
+        0xffdff06f,  # j     -4
+        0x00000013,  # nop
+        0x00000013,  # nop
+        0x00000013,  # nop
+        # trap handler at 0xa0000020, returns past the ecall
+        0x34102373,  # csrr  t1, mepc
+        0x00430313,  # addi  t1, t1, 4
+        0x34131073,  # csrw  mepc, t1
+        0x30200073,  # mret
+    ]))
+    return s
+
+
+def test_sim_metrics_run():
+    s = metrics_sim(instruction_limit=100_000)
+    metrics = s.metrics
+    # published at every tick
+    metrics.interval = 1
+    pid, fd = os.forkpty()
+    if pid == 0:
+        # a reset replaces the trap CSRs, which are wrapped again
+        s.get_core(0).reset()
+        s.run()
+        snapshot = metrics.snapshot()
+        instret = snapshot['pyspike_instret_total{hart="0"}']
+        traps = snapshot['pyspike_traps_total{hart="0",cause="11",interrupt="0"}']
+        print(f"instret {instret} traps {traps} publications {metrics.publications}", flush=True)
+        # pylint: disable=protected-access
+        os._exit(0)
+    proc = pexpect.fdpexpect.fdspawn(fd)
+    assert proc.expect(r"instret (\d+) traps (\d+) publications (\d+)") == 0
+    instret, traps, publications = map(int, proc.match.groups())
+    _, status = os.waitpid(pid, 0)
+    assert os.WIFEXITED(status)
+    proc.close()  # closes fd internally
+    # the boot rom and the setup, then 5 instructions retired per ecall
+    assert traps > 10_000
+    assert 5 * traps <= instret <= 5 * traps + 20
+    # 20 quanta of 5000 steps, and the end of the run
+    assert publications > 10
+
+
+def test_sim_metrics_served(tmp_path):
+    # pylint: disable=import-outside-toplevel
+    import socket
+    import time
+
+    def scrape(path: str) -> int:
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as conn:
+            conn.connect(path)
+            conn.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+            response = b""
+            while chunk := conn.recv(4096):
+                response += chunk
+        for line in response.decode().splitlines():
+            if line.startswith('pyspike_instret_total{hart="0"} '):
+                return int(line.split()[-1])
+        raise AssertionError("no instret in " + response.decode())
+
+    s = metrics_sim()
+    sock_path = (tmp_path / "metrics.sock").as_posix()
+    pid, fd = os.forkpty()
+    if pid == 0:
+        s.metrics.serve(sock_path)
+        print("serving", flush=True)
+        s.run()
+    proc = pexpect.fdpexpect.fdspawn(fd)
+    assert proc.expect("serving") == 0
+    # read while the sim runs, from the server thread, each read publishing
+    # on the next tick
+    values = []
+    for _ in range(3):
+        values.append(scrape(sock_path))
+        time.sleep(0.2)
+    os.kill(pid, signal.SIGINT)
+    assert proc.expect("(spike)") == 0
+    proc.sendline("q")
+    _, status = os.waitpid(pid, 0)
+    assert os.WIFEXITED(status)
+    proc.close()  # closes fd internally
+    assert 0 < values[1] < values[2]
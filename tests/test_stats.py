@@ -0,0 +1,274 @@
+#
+# Copyright 2024 WuXi EsionTech Co., Ltd.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+import json
+import os
+import subprocess
+import sys
+
+# pylint: disable=import-error,no-name-in-module
+from riscv import ENV_PYSPIKE_STATS, isa, stats
+from riscv.cfg import cfg_t, mem_cfg_t
+from riscv.csrs import csr_t
+from riscv.decode import insn_t
+from riscv.devices import abstract_device_t, device_factory_t, dma_port_t, mmio_device_map
+from riscv.processor import insn_desc_t, processor_t
+from riscv.sim import sim_t
+from riscv.test import _bench_csr_read, _bench_csr_write, _bench_mmio_load, _test_insn_func, _test_rocc_custom
+
+
+class StatsDevice(abstract_device_t):
+
+    # pylint: disable=unused-argument
+    def load(self, addr: int, size: int) -> bytes:
+        return bytes(size)
+
+    def size(self) -> int:
+        return 0x1000
+
+
+class StatsDeviceFactory(device_factory_t):
+
+    # pylint: disable=unused-argument
+    def parse_from_fdt(self, fdt, sim, *sargs):
+        return StatsDevice(), int(sargs[0], 16)
+
+    # pylint: disable=unused-argument
+    def generate_dts(self, sim, *sargs):
+        return ""
+
+
+class StatsCSR(csr_t):
+
+    def __init__(self, proc: processor_t, addr: int):
+        super().__init__(proc, addr)
+        self.v = 0
+
+    # pylint: disable=unused-argument
+    def verify_permissions(self, insn: insn_t, write: bool) -> None:
+        pass
+
+    def read(self) -> int:
+        return self.v
+
+    def unlogged_write(self, val: int) -> None:
+        self.v = val
+
+
+class StatsROCC(isa.ROCC):
+
+    @property
+    def name(self) -> str:
+        return "stats_rocc"
+
+    # pylint: disable=unused-argument
+    def custom0(self, proc: processor_t, insn, xs1: int, xs2: int) -> int:
+        return xs1 + xs2
+
+
+def stats_addi(p: processor_t, i: insn_t, pc: int) -> int:
+    return pc + len(i)
+
+
+def run_python(script: str, stats_format: str) -> subprocess.CompletedProcess:
+    env = dict(os.environ)
+    env[ENV_PYSPIKE_STATS] = stats_format
+    return subprocess.run([sys.executable, "-W", "ignore", "-c", script],
+                          env=env,
+                          check=True,
+                          capture_output=True,
+                          text=True)
+
+
+def find_site(kind: str, name: str):
+    for site in stats.sites():
+        if site.kind == kind and site.name == name:
+            return site
+    return None
+
+
+def test_stats_disabled():
+    """
+    callbacks are not timed unless stats are enabled
+    """
+    stats.disable()
+    stats.reset()
+    dev = StatsDevice()
+    _bench_mmio_load(dev, 0, 4, 10)
+    site = find_site("device", "StatsDevice.load")
+    assert site is None or site.calls == 0
+
+
+def test_stats_device_load():
+    """
+    time the loads of a python device, then reset and report them
+    """
+    stats.enable()
+    try:
+        stats.reset()
+        dev = StatsDevice()
+        _bench_mmio_load(dev, 0, 4, 100)
+        site = find_site("device", "StatsDevice.load")
+        assert site is not None
+        assert site.calls == 100
+        assert sum(site.histogram) == 100
+        assert site.ns > 0
+        assert site.max_ns <= site.ns
+        assert site.quantile_ns(0.5) <= site.quantile_ns(0.99)
+        # reports list the sites called
+        assert "StatsDevice.load" in stats.report()
+        entries = json.loads(stats.report("json"))
+        assert any(e["name"] == "StatsDevice.load" and e["calls"] == 100 for e in entries)
+        # reset zeroes the counters, but keeps the sites
+        stats.reset()
+        assert find_site("device", "StatsDevice.load").calls == 0
+        assert "StatsDevice.load" not in stats.report()
+    finally:
+        stats.disable()
+
+
+def test_stats_device_sites():
+    """
+    devices of one class placed by a factory have a site per base address
+    """
+    mmio_device_map["test_stats_device_sites"] = StatsDeviceFactory()
+    try:
+        s = sim_t(
+            cfg=cfg_t(isa="rv64gc", priv="m", mem_layout=[mem_cfg_t(0x8000_0000, 0x10_0000)]),
+            halted=True,
+            plugin_device_factories=[("test_stats_device_sites", ("0x20000000", )),
+                                     ("test_stats_device_sites", ("0x20001000", ))],
+            args=["pk"],
+        )
+    finally:
+        del mmio_device_map["test_stats_device_sites"]
+    stats.enable()
+    try:
+        stats.reset()
+        port = dma_port_t(s)
+        port.read(0x2000_0000, 4)
+        port.read(0x2000_1000, 4)
+        port.read(0x2000_1000, 4)
+        assert find_site("device", "StatsDevice@0x20000000.load").calls == 1
+        assert find_site("device", "StatsDevice@0x20001000.load").calls == 2
+    finally:
+        stats.disable()
+
+
+def test_stats_insn(mock_sim):
+    """
+    time the insn functions taken while stats are enabled
+    """
+    p: processor_t = mock_sim.get_core(0)
+    p.reset()
+    stats.disable()
+    untimed = insn_desc_t(0x13, 0x707f, *(stats_addi, ) * 8)
+    stats.enable()
+    try:
+        stats.reset()
+        desc = insn_desc_t(0x13, 0x707f, *(stats_addi, ) * 8)
+        # addi x5, x5, 1
+        _test_insn_func(p, desc, 0x00128293, 0x9000_0000, 10)
+        site = find_site("insn", "stats_addi")
+        assert site is not None
+        assert site.calls == 10
+        # functions taken before are called as they are
+        _test_insn_func(p, untimed, 0x00128293, 0x9000_0000, 10)
+        assert site.calls == 10
+    finally:
+        stats.disable()
+
+
+def test_stats_csr(mock_sim):
+    """
+    time the reads and writes of a python CSR
+    """
+    stats.enable()
+    try:
+        stats.reset()
+        csr = StatsCSR(mock_sim.get_core(0), 0x7c0)
+        _bench_csr_write(csr, 0x1234, 10)
+        _bench_csr_read(csr, 20)
+        assert csr.v == 0x1234
+        assert find_site("csr", "StatsCSR@0x7c0.unlogged_write").calls == 10
+        assert find_site("csr", "StatsCSR@0x7c0.read").calls == 20
+    finally:
+        stats.disable()
+
+
+def test_stats_rocc(mock_sim):
+    """
+    time the custom ops of a python RoCC
+    """
+    stats.enable()
+    try:
+        stats.reset()
+        rocc = StatsROCC()
+        for _ in range(10):
+            # custom0
+            assert _test_rocc_custom(rocc, mock_sim.get_core(0), 0x0000000b, 1, 2) == 3
+        site = find_site("rocc", "StatsROCC.custom0")
+        assert site is not None
+        assert site.calls == 10
+    finally:
+        stats.disable()
+
+
+STATS_SCRIPT = """
+from riscv.devices import abstract_device_t
+from riscv.test import _bench_mmio_load
+
+class StatsDevice(abstract_device_t):
+    def load(self, addr, size):
+        return bytes(size)
+
+_bench_mmio_load(StatsDevice(), 0, 4, 10)
+"""
+
+
+def test_stats_report_at_exit():
+    """
+    PYSPIKE_STATS reports at exit, and is ignored with a warning if unknown
+    """
+    entries = json.loads(run_python(STATS_SCRIPT, "json").stderr)
+    assert [(e["name"], e["calls"]) for e in entries] == [("StatsDevice.load", 10)]
+    assert "StatsDevice.load" in run_python(STATS_SCRIPT, "text").stderr
+    result = subprocess.run([sys.executable, "-c", "import riscv"],
+                            env={
+                                **os.environ, ENV_PYSPIKE_STATS: "yaml"
+                            },
+                            check=True,
+                            capture_output=True,
+                            text=True)
+    assert ENV_PYSPIKE_STATS in result.stderr
+
+
+THUNKS_SCRIPT = """
+import warnings
+from riscv.processor import insn_desc_t
+
+with warnings.catch_warnings(record=True) as caught:
+    warnings.simplefilter("always")
+    # one function each, so that each takes a stand-in of its own
+    descs = [insn_desc_t(0x13, 0x707f, *(lambda p, i, pc: pc + 4, ) * 8) for _ in range(1100)]
+print(sum(issubclass(w.category, RuntimeWarning) for w in caught))
+"""
+
+
+def test_stats_insn_thunks():
+    """
+    running out of insn stand-ins warns once
+    """
+    assert run_python(THUNKS_SCRIPT, "text").stdout.strip() == "1"
@@ -0,0 +1,71 @@
+#
+# Copyright 2024 WuXi EsionTech Co., Ltd.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+import os
+
+import pytest
+
+# pylint: disable=import-error,no-name-in-module
+from riscv.fesvr.term import buffered_terminal_t
+
+
+def test_buffered_terminal_t_sink():
+    t = buffered_terminal_t(in_fd=-1, out_fd=None)
+    t.write(b"hello ")
+    t.write(b"world!\n")
+    assert t.getvalue() == b"hello world!\n"
+    assert t.read() == b""
+    t.clear()
+    assert t.getvalue() == b""
+    assert t.syscalls == 0
+
+
+def test_buffered_terminal_t_fd():
+    rfd, wfd = os.pipe()
+    try:
+        t = buffered_terminal_t(in_fd=rfd, out_fd=wfd, flush_bytes=8, flush_interval=60)
+        # small writes are held back until `flush_bytes` are pending
+        for ch in b"hello":
+            t.write(bytes([ch]))
+        assert t.pending == 5
+        t.write(b" world!\n")
+        assert t.pending == 0
+        # everything available is read at once
+        assert t.read() == b"hello world!\n"
+        assert t.read() == b""
+        t.write(b"bye")
+        t.flush()
+        assert os.read(rfd, 16) == b"bye"
+    finally:
+        os.close(rfd)
+        os.close(wfd)
+
+
+@pytest.mark.timeout(3)
+def test_buffered_terminal_t_stalled():
+    rfd, wfd = os.pipe()
+    try:
+        t = buffered_terminal_t(in_fd=-1, out_fd=wfd, flush_bytes=1, max_pending=1024)
+        # more than the pipe holds, with nobody reading: nothing blocks, what
+        # the pipe does not take stays queued, and the excess is dropped
+        for _ in range(128):
+            t.write(bytes(1024))
+        t.flush()
+        assert t.pending == 1024
+        assert t.dropped > 0
+        assert len(os.read(rfd, 1 << 20)) + t.pending + t.dropped == 128 * 1024
+    finally:
+        os.close(rfd)
+        os.close(wfd)